@@ -48,11 +48,33 @@ pub fn run() -> Result<()> {
         env::set_var("FINDORAD_KEEP_HIST", "1");
     }
 
-    let app = server::ABCISubmissionServer::new(
+    let state_sync_dir = || CFG.state_sync_dir.as_deref().c(d!("no state-sync dir"));
+    if let Some(app_hash) = CFG.state_sync_import.as_deref() {
+        let height =
+            server::snapshot::import(&CFG.ledger_dir, state_sync_dir()?, app_hash)
+                .c(d!())?;
+        println!("Restored the ledger from the snapshot at height {}", height);
+    }
+
+    let mut app = server::ABCISubmissionServer::new(
         basedir,
         format!("{}:{}", config.tendermint_host, config.tendermint_port),
     )?;
 
+    if let Some(app_hash) = CFG.state_sync_import.as_deref() {
+        server::snapshot::verify(&mut app, app_hash).c(d!())?;
+    }
+    if CFG.state_sync_export {
+        let snapshot =
+            server::snapshot::export(&mut app, &CFG.ledger_dir, state_sync_dir()?)
+                .c(d!())?;
+        println!(
+            "Exported the snapshot at height {}, {} chunks",
+            snapshot.height, snapshot.chunks
+        );
+        return Ok(());
+    }
+
     let submission_service_hdr = Arc::clone(&app.la);
 
     if CFG.enable_query_service {
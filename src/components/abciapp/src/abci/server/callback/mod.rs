@@ -2,6 +2,7 @@
 //! # Impl function of tendermint ABCI
 //!
 
+mod replay;
 mod utils;
 
 use {
@@ -9,7 +10,7 @@ use {
         abci::{server::ABCISubmissionServer, staking, IN_SAFE_ITV, POOL},
         api::{
             query_server::BLOCK_CREATED,
-            submission_server::{convert_tx, try_tx_catalog, TxCatalog},
+            submission_server::{convert_tx, try_tx_catalog, TxCatalog, TxnHandle},
         },
     },
     abci::{
@@ -23,16 +24,16 @@ use {
     lazy_static::lazy_static,
     ledger::{
         converter::is_convert_account,
+        data_model::{Transaction, TxnEffect},
         staking::KEEP_HIST,
-        store::{
-            api_cache,
-            fbnc::{new_mapx, Mapx},
-        },
+        store::api_cache,
     },
     parking_lot::{Mutex, RwLock},
     protobuf::RepeatedField,
+    replay::ReplayFilter,
     ruc::*,
     std::{
+        collections::HashMap,
         fs,
         ops::Deref,
         sync::{
@@ -49,8 +50,32 @@ lazy_static! {
     static ref REQ_BEGIN_BLOCK: Arc<Mutex<RequestBeginBlock>> =
         Arc::new(Mutex::new(RequestBeginBlock::new()));
     // avoid on-chain-existing transactions to be stored again
-    static ref TX_HISTORY: Arc<RwLock<Mapx<Vec<u8>, bool>>> =
-        Arc::new(RwLock::new(new_mapx!("tx_history")));
+    static ref TX_HISTORY: ReplayFilter = ReplayFilter::new();
+    // transactions decoded and verified by `check_tx`, reused in `deliver_tx`,
+    // <sha256 of the raw tx bytes> => <cached results>
+    static ref TX_CACHE: Arc<RwLock<HashMap<[u8; 32], CachedTx>>> =
+        Arc::new(RwLock::new(HashMap::new()));
+}
+
+// max number of entries in `TX_CACHE`
+const TX_CACHE_CAP: usize = 1_0000;
+
+// entries of `TX_CACHE` older than this number of blocks will be dropped
+const TX_CACHE_TTL: i64 = 128;
+
+/// A FindoraTx that has been processed in `check_tx`
+///
+/// NOTE:
+/// `TxnEffect::compute_effect` depends on nothing but the tx itself,
+/// all the state-dependent checks are done again in `deliver_tx`,
+/// so an entry will never be out of date before its TTL.
+struct CachedTx {
+    // `Transaction::hash_tm_rawbytes`
+    txhash: Vec<u8>,
+    // the decoded tx is `effect.txn`
+    effect: TxnEffect,
+    // tendermint height at which this entry is created
+    height: i64,
 }
 
 // #[cfg(feature = "debug_env")]
@@ -68,7 +93,7 @@ lazy_static! {
 pub fn info(s: &mut ABCISubmissionServer, req: &RequestInfo) -> ResponseInfo {
     let mut resp = ResponseInfo::new();
 
-    let mut la = s.la.write();
+    let mut la = s.la_write();
     let state = la.get_committed_state().write();
 
     let commitment = state.get_state_commitment();
@@ -78,14 +103,8 @@ pub fn info(s: &mut ABCISubmissionServer, req: &RequestInfo) -> ResponseInfo {
     TENDERMINT_BLOCK_HEIGHT.swap(h, Ordering::Relaxed);
     resp.set_last_block_height(h);
     if 0 < h {
-        if CFG.checkpoint.disable_evm_block_height < h
-            && h < CFG.checkpoint.enable_frc20_height
-        {
-            resp.set_last_block_app_hash(la_hash);
-        } else {
-            let cs_hash = s.account_base_app.write().info(req).last_block_app_hash;
-            resp.set_last_block_app_hash(app_hash("info", h, la_hash, cs_hash));
-        }
+        let cs_hash = s.account_base_app_write().info(req).last_block_app_hash;
+        resp.set_last_block_app_hash(app_hash_at("info", h, la_hash, cs_hash));
     }
 
     drop(state);
@@ -104,14 +123,14 @@ pub fn info(s: &mut ABCISubmissionServer, req: &RequestInfo) -> ResponseInfo {
 }
 
 pub fn query(s: &mut ABCISubmissionServer, req: &RequestQuery) -> ResponseQuery {
-    s.account_base_app.write().query(req)
+    s.account_base_app.read().handle_query(req)
 }
 
 pub fn init_chain(
     s: &mut ABCISubmissionServer,
     req: &RequestInitChain,
 ) -> ResponseInitChain {
-    s.account_base_app.write().init_chain(req)
+    s.account_base_app_write().init_chain(req)
 }
 
 /// any new tx will trigger this callback before it can enter the mem-pool of tendermint
@@ -125,13 +144,22 @@ pub fn check_tx(s: &mut ABCISubmissionServer, req: &RequestCheckTx) -> ResponseC
     match tx_catalog {
         TxCatalog::FindoraTx => {
             if matches!(req.field_type, CheckTxType::New) {
-                if let Ok(tx) = convert_tx(req.get_tx()) {
+                // the tx will be included in the next block at least
+                if let Ok(tx) = convert_tx(req.get_tx(), td_height as u64 + 1) {
+                    let txhash = tx.hash_tm_rawbytes();
                     if !tx.valid_in_abci() {
                         resp.log = "Should not appear in ABCI".to_owned();
                         resp.code = 1;
-                    } else if TX_HISTORY.read().contains_key(&tx.hash_tm_rawbytes()) {
+                    } else if TX_HISTORY.contains(&txhash) {
                         resp.log = "Historical transaction".to_owned();
                         resp.code = 1;
+                    } else {
+                        // verify signatures and proofs in the background,
+                        // the result will be used by `deliver_tx`
+                        let rawhash = Sha256::hash(req.get_tx());
+                        POOL.spawn_ok(async move {
+                            cache_in_background(rawhash, tx, txhash, td_height);
+                        });
                     }
                 } else {
                     resp.log = "Invalid format".to_owned();
@@ -147,7 +175,7 @@ pub fn check_tx(s: &mut ABCISubmissionServer, req: &RequestCheckTx) -> ResponseC
                 resp.log = "EVM is disabled".to_owned();
                 resp
             } else {
-                s.account_base_app.write().check_tx(req)
+                s.account_base_app_write().check_tx(req)
             }
         }
         TxCatalog::Unknown => {
@@ -189,7 +217,7 @@ pub fn begin_block(
 
     *REQ_BEGIN_BLOCK.lock() = req.clone();
 
-    let mut la = s.la.write();
+    let mut la = s.la_write();
 
     // set height first
     la.get_committed_state()
@@ -209,7 +237,7 @@ pub fn begin_block(
     {
         ResponseBeginBlock::default()
     } else {
-        s.account_base_app.write().begin_block(req)
+        s.account_base_app_write().begin_block(req)
     }
 }
 
@@ -225,11 +253,9 @@ pub fn deliver_tx(
 
     match tx_catalog {
         TxCatalog::FindoraTx => {
-            if let Ok(tx) = convert_tx(req.get_tx()) {
-                let txhash = tx.hash_tm_rawbytes();
-                POOL.spawn_ok(async move {
-                    TX_HISTORY.write().set_value(txhash, Default::default());
-                });
+            if let Some((tx, txhash, effect)) = decode_tx(req.get_tx(), td_height as u64)
+            {
+                TX_HISTORY.insert(txhash);
 
                 if tx.valid_in_abci() {
                     // Log print for monitor purpose
@@ -254,13 +280,13 @@ pub fn deliver_tx(
                             resp.code = 2;
                             resp.log = "EVM is disabled".to_owned();
                             return resp;
-                        } else if let Err(e) = s.la.write().cache_transaction(tx) {
+                        } else if let Err(e) = cache_transaction(s, tx, effect) {
                             resp.code = 1;
                             resp.log = e.to_string();
                         }
                     } else if is_convert_account(&tx) {
                         if let Err(err) =
-                            s.account_base_app.write().deliver_findora_tx(&tx)
+                            s.account_base_app_write().deliver_findora_tx(&tx)
                         {
                             log::info!(target: "abciapp", "deliver convert account tx failed: {:?}", err);
 
@@ -270,7 +296,7 @@ pub fn deliver_tx(
                             return resp;
                         }
 
-                        if s.la.write().cache_transaction(tx).is_ok() {
+                        if cache_transaction(s, tx, effect).is_ok() {
                             s.account_base_app
                                 .read()
                                 .deliver_state
@@ -298,7 +324,7 @@ pub fn deliver_tx(
                             .db
                             .write()
                             .discard_session();
-                    } else if let Err(e) = s.la.write().cache_transaction(tx) {
+                    } else if let Err(e) = cache_transaction(s, tx, effect) {
                         resp.code = 1;
                         resp.log = e.to_string();
                     }
@@ -328,7 +354,7 @@ pub fn deliver_tx(
                         td_height, req
                     );
                 }
-                return s.account_base_app.write().deliver_tx(req);
+                return s.account_base_app_write().deliver_tx(req);
             }
         }
         TxCatalog::Unknown => {
@@ -352,13 +378,13 @@ pub fn end_block(
     let td_height = TENDERMINT_BLOCK_HEIGHT.load(Ordering::Relaxed);
 
     IN_SAFE_ITV.swap(false, Ordering::Relaxed);
-    let mut la = s.la.write();
+    let mut la = s.la_write();
 
     // mint coinbase, cache system transactions to ledger
     {
         let laa = la.get_committed_state().read();
         if let Some(tx) =
-            staking::system_mint_pay(&*laa, &mut *s.account_base_app.write())
+            staking::system_mint_pay(&*laa, &mut *s.account_base_app_write())
         {
             drop(laa);
             // this unwrap should be safe
@@ -387,14 +413,14 @@ pub fn end_block(
     if td_height <= CFG.checkpoint.disable_evm_block_height
         || td_height >= CFG.checkpoint.enable_frc20_height
     {
-        let _ = s.account_base_app.write().end_block(req);
+        let _ = s.account_base_app_write().end_block(req);
     }
 
     resp
 }
 
 pub fn commit(s: &mut ABCISubmissionServer, req: &RequestCommit) -> ResponseCommit {
-    let la = s.la.write();
+    let la = s.la_write();
     let mut state = la.get_committed_state().write();
 
     // will change `struct LedgerStatus`
@@ -410,19 +436,102 @@ pub fn commit(s: &mut ABCISubmissionServer, req: &RequestCommit) -> ResponseComm
         .c(d!())
         .and_then(|s| fs::write(&path, s).c(d!(path))));
 
+    TX_CACHE
+        .write()
+        .retain(|_, c| c.height + TX_CACHE_TTL > td_height);
+    TX_HISTORY.commit(state.get_block_commit_count());
+
     let mut r = ResponseCommit::new();
     let la_hash = state.get_state_commitment().0.as_ref().to_vec();
-    let cs_hash = s.account_base_app.write().commit(req).data;
+    let cs_hash = s.account_base_app_write().commit(req).data;
 
-    if CFG.checkpoint.disable_evm_block_height < td_height
-        && td_height < CFG.checkpoint.enable_frc20_height
-    {
-        r.set_data(la_hash);
+    r.set_data(app_hash_at("commit", td_height, la_hash, cs_hash));
+
+    r
+}
+
+/// Run the heavy and stateless checks of a FindoraTx out of the ABCI thread,
+/// these tasks run in parallel on the workers of `POOL`
+fn cache_in_background(
+    rawhash: [u8; 32],
+    tx: Transaction,
+    txhash: Vec<u8>,
+    td_height: i64,
+) {
+    if TX_CACHE.read().len() >= TX_CACHE_CAP {
+        return;
+    }
+
+    // failed ones are not cached, `deliver_tx` will
+    // run the full serial path to get the deterministic error
+    if TxnEffect::verify_stateless(&tx).is_err() {
+        return;
+    }
+    if let Ok(effect) = TxnEffect::compute_effect_preverified(tx) {
+        TX_CACHE.write().insert(
+            rawhash,
+            CachedTx {
+                txhash,
+                effect,
+                height: td_height,
+            },
+        );
+    }
+}
+
+/// Decode a FindoraTx, reuse the results of `check_tx` if possible
+///
+/// Returns the tx, its `hash_tm_rawbytes` and its `TxnEffect` if already computed
+fn decode_tx(
+    raw: &[u8],
+    height: u64,
+) -> Option<(Transaction, Vec<u8>, Option<TxnEffect>)> {
+    // the cache of `check_tx` must not bypass the activation height
+    if height < CFG.checkpoint.tx_wire_v1_height && Transaction::is_wire_bytes(raw) {
+        return None;
+    }
+
+    if let Some(c) = TX_CACHE.write().remove(&Sha256::hash(raw)) {
+        return Some((c.effect.txn.clone(), c.txhash, Some(c.effect)));
+    }
+
+    convert_tx(raw, height).ok().map(|tx| {
+        let txhash = tx.hash_tm_rawbytes();
+        (tx, txhash, None)
+    })
+}
+
+/// Apply a FindoraTx to the current block,
+/// skip `TxnEffect::compute_effect` if it has been done in `check_tx`.
+#[inline(always)]
+fn cache_transaction(
+    s: &mut ABCISubmissionServer,
+    tx: Transaction,
+    effect: Option<TxnEffect>,
+) -> Result<TxnHandle> {
+    let mut la = s.la_write();
+    if let Some(effect) = effect {
+        la.cache_txn_effect(effect)
     } else {
-        r.set_data(app_hash("commit", td_height, la_hash, cs_hash));
+        la.cache_transaction(tx)
     }
+}
 
-    r
+/// The app hash after `height`, the EVM chain state hash
+/// is not a part of it between the two checkpoints.
+pub(super) fn app_hash_at(
+    when: &str,
+    height: i64,
+    la_hash: Vec<u8>,
+    cs_hash: Vec<u8>,
+) -> Vec<u8> {
+    if CFG.checkpoint.disable_evm_block_height < height
+        && height < CFG.checkpoint.enable_frc20_height
+    {
+        la_hash
+    } else {
+        app_hash(when, height, la_hash, cs_hash)
+    }
 }
 
 /// Combines ledger state hash and EVM chain state hash
@@ -0,0 +1,288 @@
+//!
+//! # Replay filter of FindoraTx
+//!
+//! `check_tx` rejects the transactions which are already on chain,
+//! but only the recent ones need to be remembered: the ledger rejects
+//! a transaction once `seq_id + TRANSACTION_WINDOW_WIDTH < block_commit_count`,
+//! where `seq_id` is from its no-replay token and can not be ahead of the
+//! commit count at which it has been delivered.
+//!
+//! So the hashes are kept by the commit count after their blocks,
+//! and are forgotten once the count is beyond the one of their block by
+//! more than `TRANSACTION_WINDOW_WIDTH`, the ledger rejects them from then on.
+//!
+//! Lookups go through an in-memory blocked Bloom filter first, which is read
+//! without locks, only its positives touch the persistent set.
+//!
+//! The unbounded `tx_history` set used before is emptied at the first start,
+//! its hashes have no commit counts to be bucketed with.
+//!
+
+use {
+    ledger::store::{
+        fbnc::{new_mapx, new_mapxnk, Mapx, Mapxnk},
+        TRANSACTION_WINDOW_WIDTH,
+    },
+    parking_lot::{Mutex, RwLock},
+    std::{
+        collections::{hash_map::DefaultHasher, BTreeSet},
+        hash::Hasher,
+        sync::atomic::{AtomicU64, AtomicUsize, Ordering},
+    },
+};
+
+// 512 bits, one cache line
+const BLOCK_WORDS: usize = 8;
+
+// 256 KiB per generation, about 200k hashes
+// with a false positive rate around 1%
+const BLOCKS: usize = 1 << 12;
+
+// bits set in the block of a hash
+const BITS_PER_HASH: u64 = 7;
+
+/// A Bloom filter whose bits of a hash are all in one cache line,
+/// built on atomics to be shared by all threads without locks.
+pub struct BlockedBloom {
+    words: Vec<AtomicU64>,
+}
+
+impl BlockedBloom {
+    #[inline(always)]
+    pub fn new() -> Self {
+        BlockedBloom {
+            words: (0..BLOCKS * BLOCK_WORDS)
+                .map(|_| AtomicU64::new(0))
+                .collect(),
+        }
+    }
+
+    // (<index of the first word of the block>, <hash for the bits>)
+    #[inline(always)]
+    fn locate(key: &[u8]) -> (usize, u64) {
+        let mut hasher = DefaultHasher::new();
+        hasher.write(key);
+        let h = hasher.finish();
+        let block = (h.wrapping_mul(0x9e37_79b9_7f4a_7c15) >> 52) as usize;
+        (block % BLOCKS * BLOCK_WORDS, h)
+    }
+
+    // positions of the bits in a block, by double hashing
+    #[inline(always)]
+    fn bits(h: u64) -> impl Iterator<Item = (usize, u64)> {
+        let (a, b) = (h & 0xffff_ffff, (h >> 32) | 1);
+        (0..BITS_PER_HASH).map(move |i| {
+            let bit = a.wrapping_add(i.wrapping_mul(b)) % (BLOCK_WORDS as u64 * 64);
+            ((bit / 64) as usize, 1 << (bit % 64))
+        })
+    }
+
+    #[inline(always)]
+    pub fn insert(&self, key: &[u8]) {
+        let (base, h) = Self::locate(key);
+        for (w, mask) in Self::bits(h) {
+            self.words[base + w].fetch_or(mask, Ordering::Relaxed);
+        }
+    }
+
+    /// `false` if `key` has never been inserted since the last `clear`.
+    #[inline(always)]
+    pub fn may_contain(&self, key: &[u8]) -> bool {
+        let (base, h) = Self::locate(key);
+        Self::bits(h)
+            .all(|(w, mask)| 0 != self.words[base + w].load(Ordering::Relaxed) & mask)
+    }
+
+    pub fn clear(&self) {
+        self.words
+            .iter()
+            .for_each(|w| w.store(0, Ordering::Relaxed));
+    }
+}
+
+impl Default for BlockedBloom {
+    #[inline(always)]
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+// The Bloom filter can not drop single hashes, so there are two generations,
+// each one covers `TRANSACTION_WINDOW_WIDTH + 1` commit counts, called an epoch.
+// When an epoch begins, the older generation is cleared and takes the new hashes,
+// the hashes in it were delivered two epochs ago, all of them have expired.
+#[inline(always)]
+fn epoch_of(count: u64) -> u64 {
+    count / (TRANSACTION_WINDOW_WIDTH + 1)
+}
+
+/// Hashes of the FindoraTxs delivered within the no-replay window.
+pub struct ReplayFilter {
+    blooms: [BlockedBloom; 2],
+    // index of the generation taking new hashes
+    current: AtomicUsize,
+    epoch: AtomicU64,
+    // delivered in the current block, not committed yet
+    pending: Mutex<Vec<Vec<u8>>>,
+    // commit counts of the persisted buckets
+    counts: Mutex<BTreeSet<u64>>,
+    // <hash> => <commit count>
+    hashes: RwLock<Mapx<Vec<u8>, u64>>,
+    // <commit count> => <hashes>
+    buckets: Mutex<Mapxnk<u64, Vec<Vec<u8>>>>,
+}
+
+// Hashes removed from the legacy set in one batch.
+const LEGACY_BATCH: usize = 4096;
+
+// Empty the legacy `<hash> => true` set of all the delivered FindoraTxs,
+// this is a no-op once it has been done.
+fn drop_legacy_history() {
+    let mut legacy: Mapx<Vec<u8>, bool> = new_mapx!("tx_history");
+    let mut removed = 0;
+    loop {
+        let batch = legacy
+            .iter()
+            .take(LEGACY_BATCH)
+            .map(|(h, _)| h)
+            .collect::<Vec<_>>();
+        if batch.is_empty() {
+            break;
+        }
+        removed += batch.len();
+        batch.iter().for_each(|h| {
+            legacy.remove(h);
+        });
+    }
+    if 0 < removed {
+        log::info!(target: "abciapp", "Dropped {} legacy tx history entries", removed);
+    }
+}
+
+impl ReplayFilter {
+    /// Open the persistent set, the Bloom filter is rebuilt from it.
+    pub fn new() -> Self {
+        drop_legacy_history();
+
+        let hashes = new_mapx!("replay_filter/hashes");
+        let buckets: Mapxnk<u64, Vec<Vec<u8>>> = new_mapxnk!("replay_filter/buckets");
+
+        let blooms = [BlockedBloom::new(), BlockedBloom::new()];
+        let mut counts = BTreeSet::new();
+        for (count, bucket) in buckets.iter() {
+            bucket.iter().for_each(|h| blooms[0].insert(h));
+            counts.insert(count);
+        }
+        let epoch = counts.iter().next_back().copied().map_or(0, epoch_of);
+
+        ReplayFilter {
+            blooms,
+            current: AtomicUsize::new(0),
+            epoch: AtomicU64::new(epoch),
+            pending: Mutex::new(vec![]),
+            counts: Mutex::new(counts),
+            hashes: RwLock::new(hashes),
+            buckets: Mutex::new(buckets),
+        }
+    }
+
+    /// Whether a FindoraTx with this `hash_tm_rawbytes` has been delivered
+    /// within the window, most of the new ones return without any lock.
+    pub fn contains(&self, txhash: &[u8]) -> bool {
+        if !self.blooms.iter().any(|b| b.may_contain(txhash)) {
+            return false;
+        }
+        self.hashes.read().contains_key(&txhash.to_vec())
+            || self.pending.lock().iter().any(|h| h == txhash)
+    }
+
+    /// Record a FindoraTx delivered in the current block.
+    pub fn insert(&self, txhash: Vec<u8>) {
+        self.blooms[self.current.load(Ordering::Relaxed)].insert(&txhash);
+        self.pending.lock().push(txhash);
+    }
+
+    /// Persist the hashes of the committed block with the commit count
+    /// of the ledger after it, and forget the expired ones.
+    pub fn commit(&self, count: u64) {
+        let epoch = epoch_of(count);
+        let last_epoch = self.epoch.swap(epoch, Ordering::Relaxed);
+        if epoch > last_epoch {
+            let older = 1 - self.current.load(Ordering::Relaxed);
+            self.blooms[older].clear();
+            // nothing in the last one is alive either
+            if epoch > last_epoch + 1 {
+                self.blooms[1 - older].clear();
+            }
+            self.current.store(older, Ordering::Relaxed);
+        }
+
+        let mut counts = self.counts.lock();
+        let mut buckets = self.buckets.lock();
+        let mut hashes = self.hashes.write();
+        // taken under the lock of `hashes`, not to be missed by `contains`
+        let new = std::mem::take(&mut *self.pending.lock());
+
+        if !new.is_empty() {
+            for h in new.iter() {
+                // it's in the current generation already,
+                // unless the generation has just been cleared
+                self.blooms[self.current.load(Ordering::Relaxed)].insert(h);
+                hashes.insert(h.clone(), count);
+            }
+            // the ledger does not count the blocks without transactions,
+            // so a bucket may take the hashes of several blocks
+            let mut bucket = buckets.get(&count).unwrap_or_default();
+            bucket.extend(new);
+            buckets.insert(count, bucket);
+            counts.insert(count);
+        }
+
+        while let Some(oldest) = counts.iter().next().copied() {
+            if oldest + TRANSACTION_WINDOW_WIDTH >= count {
+                break;
+            }
+            counts.remove(&oldest);
+            for h in buckets.remove(&oldest).unwrap_or_default() {
+                // a hash may be delivered again after a failed attempt
+                if hashes.get(&h) == Some(oldest) {
+                    hashes.remove(&h);
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn blocked_bloom() {
+        let bloom = BlockedBloom::new();
+        let keys = (0..10_0000u64)
+            .map(|i| i.to_be_bytes().to_vec())
+            .collect::<Vec<_>>();
+        keys.iter().for_each(|k| bloom.insert(k));
+        assert!(keys.iter().all(|k| bloom.may_contain(k)));
+
+        let fp = (10_0000..20_0000u64)
+            .filter(|i| bloom.may_contain(&i.to_be_bytes()))
+            .count();
+        assert!(fp < 1000, "false positives: {}", fp);
+
+        bloom.clear();
+        assert!(keys.iter().all(|k| !bloom.may_contain(k)));
+    }
+
+    #[test]
+    fn replay_window() {
+        // a hash kept at the earliest count of an epoch,
+        // is alive until the last count of the next epoch
+        let w = TRANSACTION_WINDOW_WIDTH;
+        assert_eq!(epoch_of(0), epoch_of(w));
+        assert_eq!(epoch_of(0) + 1, epoch_of(w + 1));
+        assert_eq!(epoch_of(0) + 1, epoch_of(2 * w + 1));
+        assert_eq!(epoch_of(0) + 2, epoch_of(2 * w + 2));
+    }
+}
@@ -0,0 +1,94 @@
+//!
+//! # Metrics of the ABCI callbacks, and of the forwarding of transactions
+//!
+//! Exported by the `/metrics` route of the query server.
+//!
+
+use globutils::metrics::{Counter, Gauge, Histogram};
+
+const PHASE_HELP: &str = "Time spent in the ABCI callbacks";
+const FAILURE_HELP: &str = "Transactions rejected by the ABCI callbacks";
+const LOCK_HELP: &str = "Time waiting for the locks of the ABCI server";
+const FORWARD_HELP: &str = "Transactions forwarded to tendermint";
+
+/// `begin_block`
+pub static BEGIN_BLOCK: Histogram =
+    Histogram::new("findora_abci_seconds", "phase=\"begin_block\"", PHASE_HELP);
+/// `check_tx`
+pub static CHECK_TX: Histogram =
+    Histogram::new("findora_abci_seconds", "phase=\"check_tx\"", PHASE_HELP);
+/// `deliver_tx`
+pub static DELIVER_TX: Histogram =
+    Histogram::new("findora_abci_seconds", "phase=\"deliver_tx\"", PHASE_HELP);
+/// `end_block`
+pub static END_BLOCK: Histogram =
+    Histogram::new("findora_abci_seconds", "phase=\"end_block\"", PHASE_HELP);
+/// `commit`
+pub static COMMIT: Histogram =
+    Histogram::new("findora_abci_seconds", "phase=\"commit\"", PHASE_HELP);
+
+/// Non-zero codes of `check_tx`
+pub static CHECK_TX_FAILURES: Counter = Counter::new(
+    "findora_abci_failed_txs_total",
+    "phase=\"check_tx\"",
+    FAILURE_HELP,
+);
+/// Non-zero codes of `deliver_tx`
+pub static DELIVER_TX_FAILURES: Counter = Counter::new(
+    "findora_abci_failed_txs_total",
+    "phase=\"deliver_tx\"",
+    FAILURE_HELP,
+);
+
+/// Waiting for `ABCISubmissionServer::la`
+pub static LA_WAIT: Histogram =
+    Histogram::new("findora_abci_lock_wait_seconds", "lock=\"la\"", LOCK_HELP);
+/// Waiting for `ABCISubmissionServer::account_base_app`
+pub static ACCOUNT_BASE_APP_WAIT: Histogram = Histogram::new(
+    "findora_abci_lock_wait_seconds",
+    "lock=\"account_base_app\"",
+    LOCK_HELP,
+);
+
+/// Transactions waiting in the queue of `tx_sender`
+pub static TX_QUEUE_DEPTH: Gauge = Gauge::new(
+    "findora_tx_sender_queue_depth",
+    "",
+    "Transactions waiting to be forwarded to tendermint",
+);
+/// Transactions delivered to tendermint
+pub static TX_FORWARDED: Counter = Counter::new(
+    "findora_tx_sender_txs_total",
+    "result=\"forwarded\"",
+    FORWARD_HELP,
+);
+/// Transactions refused because the queue is full
+pub static TX_QUEUE_FULL: Counter = Counter::new(
+    "findora_tx_sender_txs_total",
+    "result=\"queue_full\"",
+    FORWARD_HELP,
+);
+/// Transactions tendermint already has in its mempool
+pub static TX_DUPLICATE: Counter = Counter::new(
+    "findora_tx_sender_txs_total",
+    "result=\"duplicate\"",
+    FORWARD_HELP,
+);
+/// Transactions refused by tendermint, or lost to an error of the connection
+pub static TX_DROPPED: Counter = Counter::new(
+    "findora_tx_sender_txs_total",
+    "result=\"dropped\"",
+    FORWARD_HELP,
+);
+/// JSON-RPC batches sent to tendermint
+pub static TX_BATCHES: Counter = Counter::new(
+    "findora_tx_sender_batches_total",
+    "",
+    "JSON-RPC batches sent to tendermint",
+);
+/// Round trip of a batch
+pub static TX_BATCH_RTT: Histogram = Histogram::new(
+    "findora_tx_sender_batch_seconds",
+    "",
+    "Round trip of a JSON-RPC batch to tendermint",
+);
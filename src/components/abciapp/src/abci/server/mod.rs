@@ -16,7 +16,7 @@ use {
     baseapp::BaseApp as AccountBaseAPP,
     config::abci::global_cfg::CFG,
     ledger::store::LedgerState,
-    parking_lot::RwLock,
+    parking_lot::{RwLock, RwLockWriteGuard},
     rand_chacha::ChaChaRng,
     rand_core::SeedableRng,
     ruc::*,
@@ -30,6 +30,8 @@ use {
 pub use tx_sender::forward_txn_with_mode;
 
 pub mod callback;
+pub mod metrics;
+pub mod snapshot;
 pub mod tx_sender;
 
 /// findora impl of tendermint abci
@@ -79,6 +81,20 @@ impl ABCISubmissionServer {
             account_base_app: Arc::new(RwLock::new(account_base_app)),
         })
     }
+
+    /// Lock `la` for writing, the time waiting for it is recorded
+    #[inline(always)]
+    pub fn la_write(
+        &self,
+    ) -> RwLockWriteGuard<'_, SubmissionServer<ChaChaRng, TendermintForward>> {
+        metrics::LA_WAIT.time(|| self.la.write())
+    }
+
+    /// Lock `account_base_app` for writing, the time waiting for it is recorded
+    #[inline(always)]
+    pub fn account_base_app_write(&self) -> RwLockWriteGuard<'_, AccountBaseAPP> {
+        metrics::ACCOUNT_BASE_APP_WAIT.time(|| self.account_base_app.write())
+    }
 }
 
 impl abci::Application for ABCISubmissionServer {
@@ -94,7 +110,11 @@ impl abci::Application for ABCISubmissionServer {
 
     #[inline(always)]
     fn check_tx(&mut self, req: &RequestCheckTx) -> ResponseCheckTx {
-        callback::check_tx(self, req)
+        let resp = metrics::CHECK_TX.time(|| callback::check_tx(self, req));
+        if 0 != resp.code {
+            metrics::CHECK_TX_FAILURES.inc();
+        }
+        resp
     }
 
     #[inline(always)]
@@ -104,21 +124,25 @@ impl abci::Application for ABCISubmissionServer {
 
     #[inline(always)]
     fn begin_block(&mut self, req: &RequestBeginBlock) -> ResponseBeginBlock {
-        callback::begin_block(self, req)
+        metrics::BEGIN_BLOCK.time(|| callback::begin_block(self, req))
     }
 
     #[inline(always)]
     fn deliver_tx(&mut self, req: &RequestDeliverTx) -> ResponseDeliverTx {
-        callback::deliver_tx(self, req)
+        let resp = metrics::DELIVER_TX.time(|| callback::deliver_tx(self, req));
+        if 0 != resp.code {
+            metrics::DELIVER_TX_FAILURES.inc();
+        }
+        resp
     }
 
     #[inline(always)]
     fn end_block(&mut self, req: &RequestEndBlock) -> ResponseEndBlock {
-        callback::end_block(self, req)
+        metrics::END_BLOCK.time(|| callback::end_block(self, req))
     }
 
     #[inline(always)]
     fn commit(&mut self, req: &RequestCommit) -> ResponseCommit {
-        callback::commit(self, req)
+        metrics::COMMIT.time(|| callback::commit(self, req))
     }
 }
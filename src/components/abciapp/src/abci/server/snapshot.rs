@@ -0,0 +1,505 @@
+//!
+//! # State-sync snapshots
+//!
+//! A snapshot is a copy of the ledger dir after a committed height, which
+//! holds all the states of a node: the `LedgerStatus` with its entries and
+//! `Staking`, the merkle trees, the utxo map, and the chain states of `BaseApp`.
+//!
+//! The files are packed into chunks of about `CHUNK_SIZE` bytes, which are
+//! listed with their sha256 in a manifest, the hash of the manifest is the
+//! hash of the snapshot. An empty ledger dir is restored from the chunks in
+//! parallel and in any order, each chunk is checked against the manifest
+//! before it's written. The restored ledger is then checked against its last
+//! `StateCommitmentData`, and the app hash recomputed from the restored states
+//! against a trusted one.
+//!
+//! The functions are named after the snapshot callbacks of ABCI, but the
+//! ABCI version used here has no state-sync connection, so the snapshots are
+//! exported to and imported from a directory, which can be shared by any
+//! means, see `--state-sync-dir`, `--state-sync-export` and `--state-sync-import`.
+//!
+
+use {
+    super::{callback::app_hash_at, ABCISubmissionServer},
+    abci::{Application, RequestInfo},
+    fp_storage::hash::{Sha256, StorageHasher},
+    parking_lot::Mutex,
+    ruc::*,
+    serde::{Deserialize, Serialize},
+    std::{
+        fs::{self, File, OpenOptions},
+        io::Read,
+        os::unix::fs::FileExt,
+        path::{Component, Path, PathBuf},
+        sync::atomic::{AtomicUsize, Ordering},
+        thread,
+    },
+};
+
+/// Version of the layout of snapshots.
+pub const FORMAT: u32 = 1;
+
+// bytes of the files in a chunk
+const CHUNK_SIZE: usize = 8 * 1024 * 1024;
+
+const MANIFEST: &str = "manifest.json";
+
+/// Same with the `Snapshot` of ABCI.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Snapshot {
+    pub height: u64,
+    pub format: u32,
+    pub chunks: u32,
+    /// sha256 of `metadata`
+    pub hash: Vec<u8>,
+    /// the serialized `Manifest`
+    pub metadata: Vec<u8>,
+}
+
+/// Contents of a snapshot.
+#[derive(Clone, Debug, Serialize, Deserialize)]
+pub struct Manifest {
+    pub height: u64,
+    pub format: u32,
+    /// the app hash after `height`, in upper-hex format
+    pub app_hash: String,
+    /// (<path relative to the ledger dir>, <size>)
+    pub files: Vec<(String, u64)>,
+    /// sha256 of the chunks, in hex format
+    pub chunks: Vec<String>,
+}
+
+// A range of a file in a chunk.
+#[derive(Serialize, Deserialize)]
+struct Piece {
+    file: u32,
+    offset: u64,
+    data: Vec<u8>,
+}
+
+#[inline(always)]
+fn chunk_path(root: &Path, chunk: u32) -> PathBuf {
+    root.join(format!("{}.chunk", chunk))
+}
+
+// All regular files under `dir`, relative to it and sorted.
+fn list_files(dir: &Path) -> Result<Vec<String>> {
+    let mut res = vec![];
+    let mut dirs = vec![dir.to_path_buf()];
+    while let Some(d) = dirs.pop() {
+        for entry in fs::read_dir(&d).c(d!())? {
+            let path = entry.c(d!())?.path();
+            if path.is_dir() {
+                dirs.push(path);
+            } else if path.is_file() {
+                let rel = path.strip_prefix(dir).c(d!())?;
+                res.push(rel.to_str().c(d!())?.to_owned());
+            }
+        }
+    }
+    res.sort();
+    Ok(res)
+}
+
+struct ChunkWriter {
+    root: PathBuf,
+    pieces: Vec<Piece>,
+    size: usize,
+    hashes: Vec<String>,
+}
+
+impl ChunkWriter {
+    fn flush(&mut self) -> Result<()> {
+        if self.pieces.is_empty() {
+            return Ok(());
+        }
+        let bytes = bincode::serialize(&self.pieces).c(d!())?;
+        let path = chunk_path(&self.root, self.hashes.len() as u32);
+        fs::write(&path, &bytes).c(d!())?;
+        self.hashes.push(hex::encode(Sha256::hash(&bytes)));
+        self.pieces.clear();
+        self.size = 0;
+        Ok(())
+    }
+}
+
+/// Export a snapshot of the state loaded by `app` to `dir`,
+/// nothing should be committed during the export.
+pub fn export(
+    app: &mut ABCISubmissionServer,
+    ledger_dir: &str,
+    dir: &str,
+) -> Result<Snapshot> {
+    let info = app.info(&RequestInfo::new());
+    let height = info.last_block_height as u64;
+    let app_hash = hex::encode_upper(&info.last_block_app_hash);
+    ledger::store::flush_data();
+
+    let ledger_dir = fs::canonicalize(ledger_dir).c(d!())?;
+    fs::create_dir_all(dir).c(d!())?;
+    let dir = fs::canonicalize(dir).c(d!())?;
+    if dir.starts_with(&ledger_dir) {
+        return Err(eg!("The state-sync dir can not be in the ledger dir"));
+    }
+
+    let root = dir.join(height.to_string());
+    if root.exists() {
+        fs::remove_dir_all(&root).c(d!())?;
+    }
+    fs::create_dir_all(&root).c(d!())?;
+
+    let mut writer = ChunkWriter {
+        root: root.clone(),
+        pieces: vec![],
+        size: 0,
+        hashes: vec![],
+    };
+    let mut files = vec![];
+    for (idx, rel) in list_files(&ledger_dir).c(d!())?.into_iter().enumerate() {
+        let mut f = File::open(ledger_dir.join(&rel)).c(d!(rel))?;
+        let mut offset = 0;
+        loop {
+            let mut data = vec![0; CHUNK_SIZE - writer.size];
+            let n = f.read(&mut data).c(d!(rel))?;
+            if 0 == n {
+                break;
+            }
+            data.truncate(n);
+            writer.pieces.push(Piece {
+                file: idx as u32,
+                offset,
+                data,
+            });
+            writer.size += n;
+            offset += n as u64;
+            if writer.size >= CHUNK_SIZE {
+                writer.flush().c(d!())?;
+            }
+        }
+        files.push((rel, offset));
+    }
+    writer.flush().c(d!())?;
+
+    let manifest = Manifest {
+        height,
+        format: FORMAT,
+        app_hash,
+        files,
+        chunks: writer.hashes,
+    };
+    let metadata = serde_json::to_vec(&manifest).c(d!())?;
+    fs::write(root.join(MANIFEST), &metadata).c(d!())?;
+
+    Ok(Snapshot {
+        height,
+        format: FORMAT,
+        chunks: manifest.chunks.len() as u32,
+        hash: Sha256::hash(&metadata).to_vec(),
+        metadata,
+    })
+}
+
+/// The snapshots in `dir`, the latest one first.
+pub fn list_snapshots(dir: &str) -> Result<Vec<Snapshot>> {
+    let mut res = vec![];
+    for entry in fs::read_dir(dir).c(d!())? {
+        let path = entry.c(d!())?.path().join(MANIFEST);
+        if !path.is_file() {
+            continue;
+        }
+        let metadata = fs::read(&path).c(d!())?;
+        let manifest = serde_json::from_slice::<Manifest>(&metadata).c(d!())?;
+        res.push(Snapshot {
+            height: manifest.height,
+            format: manifest.format,
+            chunks: manifest.chunks.len() as u32,
+            hash: Sha256::hash(&metadata).to_vec(),
+            metadata,
+        });
+    }
+    res.sort_by(|a, b| b.height.cmp(&a.height));
+    Ok(res)
+}
+
+/// A chunk of the snapshot at `height` in `dir`.
+pub fn load_snapshot_chunk(
+    dir: &str,
+    height: u64,
+    format: u32,
+    chunk: u32,
+) -> Result<Vec<u8>> {
+    if FORMAT != format {
+        return Err(eg!(format!("Unknown snapshot format: {}", format)));
+    }
+    fs::read(chunk_path(&Path::new(dir).join(height.to_string()), chunk)).c(d!())
+}
+
+/// Restores a ledger dir from the chunks of a snapshot.
+pub struct Restorer {
+    ledger_dir: PathBuf,
+    manifest: Manifest,
+    applied: Mutex<Vec<bool>>,
+}
+
+impl Restorer {
+    /// Accept a snapshot with the trusted app hash,
+    /// the ledger dir should be empty, the files are created here.
+    pub fn offer_snapshot(
+        ledger_dir: &str,
+        snapshot: &Snapshot,
+        trusted_app_hash: &str,
+    ) -> Result<Self> {
+        if FORMAT != snapshot.format {
+            return Err(eg!(format!("Unknown snapshot format: {}", snapshot.format)));
+        }
+        if Sha256::hash(&snapshot.metadata).to_vec() != snapshot.hash {
+            return Err(eg!("The snapshot does not match its hash"));
+        }
+        let manifest = serde_json::from_slice::<Manifest>(&snapshot.metadata).c(d!())?;
+        if !manifest.app_hash.eq_ignore_ascii_case(trusted_app_hash) {
+            return Err(eg!("The snapshot is not of the trusted app hash"));
+        }
+
+        let ledger_dir = PathBuf::from(ledger_dir);
+        if ledger_dir.exists() && 0 < fs::read_dir(&ledger_dir).c(d!())?.count() {
+            return Err(eg!("The ledger dir to restore should be empty"));
+        }
+        for (rel, size) in manifest.files.iter() {
+            let rel = Path::new(rel);
+            if !rel.components().all(|c| matches!(c, Component::Normal(_))) {
+                return Err(eg!(format!("Invalid path in the snapshot: {:?}", rel)));
+            }
+            let path = ledger_dir.join(rel);
+            fs::create_dir_all(path.parent().c(d!())?).c(d!())?;
+            File::create(&path).and_then(|f| f.set_len(*size)).c(d!())?;
+        }
+
+        Ok(Restorer {
+            ledger_dir,
+            applied: Mutex::new(vec![false; manifest.chunks.len()]),
+            manifest,
+        })
+    }
+
+    /// Check a chunk against the manifest and write its contents,
+    /// chunks can be applied on multiple threads.
+    pub fn apply_snapshot_chunk(&self, index: u32, chunk: &[u8]) -> Result<()> {
+        let hash = self.manifest.chunks.get(index as usize).c(d!())?;
+        if hex::encode(Sha256::hash(chunk)) != *hash {
+            return Err(eg!(format!("Chunk {} does not match the manifest", index)));
+        }
+
+        for piece in bincode::deserialize::<Vec<Piece>>(chunk).c(d!())? {
+            let (rel, size) = self.manifest.files.get(piece.file as usize).c(d!())?;
+            if piece.offset + piece.data.len() as u64 > *size {
+                return Err(eg!(format!(
+                    "Chunk {} is out of the range of {}",
+                    index, rel
+                )));
+            }
+            OpenOptions::new()
+                .write(true)
+                .open(self.ledger_dir.join(rel))
+                .and_then(|f| f.write_all_at(&piece.data, piece.offset))
+                .c(d!(rel))?;
+        }
+
+        self.applied.lock()[index as usize] = true;
+        Ok(())
+    }
+
+    /// All the chunks have been applied.
+    pub fn is_done(&self) -> bool {
+        self.applied.lock().iter().all(|done| *done)
+    }
+}
+
+/// Restore `ledger_dir` from the latest snapshot in `dir` with the trusted
+/// app hash, `verify` should be called on the app loaded from it.
+pub fn import(ledger_dir: &str, dir: &str, trusted_app_hash: &str) -> Result<u64> {
+    let snapshot = list_snapshots(dir)
+        .c(d!())?
+        .into_iter()
+        .find(|s| {
+            serde_json::from_slice::<Manifest>(&s.metadata)
+                .map_or(false, |m| m.app_hash.eq_ignore_ascii_case(trusted_app_hash))
+        })
+        .c(d!("No snapshot of the trusted app hash"))?;
+    let restorer =
+        Restorer::offer_snapshot(ledger_dir, &snapshot, trusted_app_hash).c(d!())?;
+
+    let next = AtomicUsize::new(0);
+    let threads = thread::available_parallelism().map_or(1, |n| n.get());
+    thread::scope(|s| {
+        let workers = (0..threads)
+            .map(|_| {
+                s.spawn(|| -> Result<()> {
+                    loop {
+                        let index = next.fetch_add(1, Ordering::Relaxed) as u32;
+                        if index >= snapshot.chunks {
+                            return Ok(());
+                        }
+                        let chunk = load_snapshot_chunk(
+                            dir,
+                            snapshot.height,
+                            snapshot.format,
+                            index,
+                        )
+                        .c(d!())?;
+                        restorer.apply_snapshot_chunk(index, &chunk).c(d!())?;
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        workers
+            .into_iter()
+            .try_for_each(|w| w.join().ok().c(d!()).and_then(|r| r))
+    })
+    .c(d!())?;
+
+    if !restorer.is_done() {
+        return Err(eg!("Some chunks have not been applied"));
+    }
+    Ok(snapshot.height)
+}
+
+/// Check the state restored from a snapshot, the app hash is recomputed
+/// from the restored ledger and EVM chain state, and must be the trusted one.
+pub fn verify(app: &mut ABCISubmissionServer, trusted_app_hash: &str) -> Result<()> {
+    let (height, la_hash) = {
+        let la = app.la.read();
+        let mut state = la.get_committed_state().write();
+        let la_hash = state.verify_state_commitment().c(d!())?;
+        (
+            state.get_tendermint_height() as i64,
+            la_hash.as_ref().to_vec(),
+        )
+    };
+    let cs_hash = app.account_base_app.read().chain_state.read().root_hash();
+
+    check_app_hash(height, la_hash, cs_hash, trusted_app_hash).c(d!())
+}
+
+// The hashes of the states, rather than anything saved with them,
+// are checked against the trusted app hash.
+fn check_app_hash(
+    height: i64,
+    la_hash: Vec<u8>,
+    cs_hash: Vec<u8>,
+    trusted_app_hash: &str,
+) -> Result<()> {
+    let app_hash = app_hash_at("restore", height, la_hash, cs_hash);
+    if !hex::encode_upper(&app_hash).eq_ignore_ascii_case(trusted_app_hash) {
+        return Err(eg!(
+            "The restored state does not match the trusted app hash"
+        ));
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod test {
+    use {
+        super::super::AccountBaseAPP,
+        super::*,
+        config::abci::global_cfg::CFG,
+        fp_storage::{generate_storage, BorrowMut},
+    };
+
+    #[test]
+    fn restore_chunks() {
+        let src = globutils::fresh_tmp_dir();
+        let dst = globutils::fresh_tmp_dir().join("restored");
+        let dir = globutils::fresh_tmp_dir();
+
+        pnk!(fs::create_dir_all(src.join("sub")));
+        pnk!(fs::write(src.join("a"), vec![1u8; CHUNK_SIZE + 7]));
+        pnk!(fs::write(src.join("sub/b"), b"b"));
+        pnk!(fs::write(src.join("empty"), b""));
+
+        // same layout as `export`, without an app
+        let files = pnk!(list_files(&src));
+        let mut writer = ChunkWriter {
+            root: dir.clone(),
+            pieces: vec![],
+            size: 0,
+            hashes: vec![],
+        };
+        let mut sizes = vec![];
+        for (idx, rel) in files.iter().enumerate() {
+            let data = pnk!(fs::read(src.join(rel)));
+            for (i, part) in data.chunks(CHUNK_SIZE).enumerate() {
+                writer.pieces.push(Piece {
+                    file: idx as u32,
+                    offset: (i * CHUNK_SIZE) as u64,
+                    data: part.to_vec(),
+                });
+                pnk!(writer.flush());
+            }
+            sizes.push((rel.clone(), data.len() as u64));
+        }
+        let metadata = pnk!(serde_json::to_vec(&Manifest {
+            height: 1,
+            format: FORMAT,
+            app_hash: "AB".to_owned(),
+            files: sizes,
+            chunks: writer.hashes.clone(),
+        }));
+        let snapshot = Snapshot {
+            height: 1,
+            format: FORMAT,
+            chunks: writer.hashes.len() as u32,
+            hash: Sha256::hash(&metadata).to_vec(),
+            metadata,
+        };
+
+        let dst_str = dst.to_str().unwrap();
+        assert!(Restorer::offer_snapshot(dst_str, &snapshot, "cd").is_err());
+        let restorer = pnk!(Restorer::offer_snapshot(dst_str, &snapshot, "ab"));
+
+        // a chunk is rejected if it's not the one in the manifest
+        let c1 = pnk!(fs::read(chunk_path(&dir, 1)));
+        assert!(restorer.apply_snapshot_chunk(0, &c1).is_err());
+
+        // in any order
+        for i in (0..snapshot.chunks).rev() {
+            assert!(!restorer.is_done());
+            let c = pnk!(fs::read(chunk_path(&dir, i)));
+            pnk!(restorer.apply_snapshot_chunk(i, &c));
+        }
+        assert!(restorer.is_done());
+
+        assert_eq!(pnk!(list_files(&dst)), files);
+        for rel in files.iter() {
+            assert_eq!(pnk!(fs::read(src.join(rel))), pnk!(fs::read(dst.join(rel))));
+        }
+    }
+
+    #[test]
+    fn reject_tampered_states() {
+        generate_storage!(Snapshot, Number => Value<u32>);
+
+        let app = pnk!(AccountBaseAPP::new(&globutils::fresh_tmp_dir(), false));
+        let commit = |n: u32, h: u64| {
+            let mut state = app.deliver_state.state.write();
+            pnk!(Number::put(state.borrow_mut(), &n));
+            pnk!(state.commit(h));
+        };
+        let cs_hash = || app.chain_state.read().root_hash();
+
+        // the EVM chain state is a part of the app hash at this height
+        let height = CFG.checkpoint.enable_frc20_height;
+        let la_hash = vec![1; 32];
+        commit(1, 1);
+        let trusted =
+            hex::encode_upper(app_hash_at("test", height, la_hash.clone(), cs_hash()));
+        pnk!(check_app_hash(height, la_hash.clone(), cs_hash(), &trusted));
+
+        // the ledger state has been changed
+        assert!(check_app_hash(height, vec![2; 32], cs_hash(), &trusted).is_err());
+
+        // the EVM chain state has been changed
+        commit(2, 2);
+        assert!(check_app_hash(height, la_hash, cs_hash(), &trusted).is_err());
+    }
+}
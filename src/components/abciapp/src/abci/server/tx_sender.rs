@@ -1,15 +1,70 @@
 //!
 //! # send the transaction to tendermint
 //!
+//! Transactions are pushed into a bounded queue, a full queue is reported
+//! to the caller instead of dropping the transaction.
+//!
+//! A few workers drain the queue, each one coalesces the transactions
+//! arrived within `BATCH_ITV` into one JSON-RPC batch request,
+//! so one connection is made to tendermint per batch instead of per transaction.
+//!
 
 use {
-    crate::{abci::POOL, api::submission_server::TxnForward},
+    super::{callback::TENDERMINT_BLOCK_HEIGHT, metrics},
+    crate::api::submission_server::TxnForward,
+    config::abci::global_cfg::CFG,
+    lazy_static::lazy_static,
     ledger::data_model::Transaction,
+    parking_lot::Mutex,
     ruc::*,
-    std::sync::atomic::{AtomicU16, Ordering},
+    serde_json::Value,
+    std::{
+        collections::HashMap,
+        io::{self, Read},
+        sync::{
+            atomic::Ordering,
+            mpsc::{self, Receiver, SyncSender, TrySendError},
+            Arc,
+        },
+        thread,
+        time::{Duration, Instant},
+    },
 };
 
-static TX_PENDING_CNT: AtomicU16 = AtomicU16::new(0);
+// capacity of the queue of a tendermint endpoint
+const QUEUE_CAP: usize = 8192;
+
+// workers, also the number of batches in flight, of a tendermint endpoint
+const WORKERS: usize = 4;
+
+// transactions in one JSON-RPC batch
+const MAX_BATCH: usize = 256;
+
+// how long a worker waits for more transactions to fill a batch
+const BATCH_ITV: Duration = Duration::from_millis(5);
+
+const IO_TIMEOUT: Duration = Duration::from_secs(10);
+
+// the result of a transaction is far smaller than this
+const MAX_RESP_SIZE: usize = MAX_BATCH * 16 * 1024;
+
+// the error data of tendermint for a transaction already in its mempool
+const DUPLICATE_TX: &str = "tx already exists in cache";
+
+const SYNC_API: &str = "broadcast_tx_sync";
+const ASYNC_API: &str = "broadcast_tx_async";
+
+lazy_static! {
+    // tendermint endpoint -> its queue
+    static ref QUEUES: Mutex<HashMap<String, SyncSender<Pending>>> =
+        Mutex::new(HashMap::new());
+}
+
+struct Pending {
+    // base64 of the wire bytes
+    txn_b64: String,
+    async_mode: bool,
+}
 
 pub struct TendermintForward {
     pub tendermint_reply: String,
@@ -27,43 +82,292 @@ impl TxnForward for TendermintForward {
     }
 }
 
+/// Queue a transaction for `url` (`host:port`),
+/// an error means it has not been accepted and the caller should retry later.
 pub fn forward_txn_with_mode(
     url: &str,
     txn: Transaction,
     async_mode: bool,
 ) -> Result<()> {
-    const SYNC_API: &str = "broadcast_tx_sync";
-    const ASYNC_API: &str = "broadcast_tx_async";
-
-    let txn_json = serde_json::to_string(&txn).c(d!())?;
-    let txn_b64 = base64::encode_config(&txn_json.as_str(), base64::URL_SAFE);
-
-    let json_rpc = if async_mode {
-        format!(
-                "{{\"jsonrpc\":\"2.0\",\"id\":\"anything\",\"method\":\"{}\",\"params\": {{\"tx\": \"{}\"}}}}",
-                ASYNC_API, &txn_b64
-            )
+    // the binary format can not be included in a block before the checkpoint
+    let next_height = TENDERMINT_BLOCK_HEIGHT.load(Ordering::Relaxed) as u64 + 1;
+    let txn_bytes = if next_height < CFG.checkpoint.tx_wire_v1_height {
+        serde_json::to_vec(&txn).c(d!())?
     } else {
-        format!(
-                "{{\"jsonrpc\":\"2.0\",\"id\":\"anything\",\"method\":\"{}\",\"params\": {{\"tx\": \"{}\"}}}}",
-                SYNC_API, &txn_b64
-            )
+        txn.to_wire_bytes().c(d!())?
+    };
+    let pending = Pending {
+        txn_b64: base64::encode_config(&txn_bytes, base64::URL_SAFE),
+        async_mode,
     };
 
-    let tendermint_reply = format!("http://{}", url);
-    if 2000 > TX_PENDING_CNT.fetch_add(1, Ordering::Relaxed) {
-        POOL.spawn_ok(async move {
-            ruc::info_omit!(attohttpc::post(&tendermint_reply)
+    // count before sending, a worker may take it at once
+    metrics::TX_QUEUE_DEPTH.add(1);
+    match queue_of(url).c(d!())?.try_send(pending) {
+        Ok(()) => Ok(()),
+        Err(e) => {
+            metrics::TX_QUEUE_DEPTH.add(-1);
+            if let TrySendError::Full(_) = e {
+                metrics::TX_QUEUE_FULL.inc();
+                Err(eg!("Too many pending transactions, retry later"))
+            } else {
+                Err(eg!("The transaction sender has exited"))
+            }
+        }
+    }
+}
+
+// Get the queue of a tendermint endpoint, start its workers on first use.
+fn queue_of(url: &str) -> Result<SyncSender<Pending>> {
+    let mut queues = QUEUES.lock();
+    if let Some(q) = queues.get(url) {
+        return Ok(q.clone());
+    }
+
+    let (tx, rx) = mpsc::sync_channel(QUEUE_CAP);
+    let rx = Arc::new(Mutex::new(rx));
+    for i in 0..WORKERS {
+        let client = Client::new(url);
+        let rx = Arc::clone(&rx);
+        thread::Builder::new()
+            .name(format!("tx_sender_{}", i))
+            .spawn(move || {
+                while let Some(batch) = recv_batch(&rx) {
+                    send_batch(&client, &batch);
+                }
+            })
+            .c(d!())?;
+    }
+    queues.insert(url.to_owned(), tx.clone());
+    Ok(tx)
+}
+
+// Block for the first transaction, then take what arrives within `BATCH_ITV`.
+// Only one worker collects at a time, the others are sending.
+fn recv_batch(rx: &Mutex<Receiver<Pending>>) -> Option<Vec<Pending>> {
+    let rx = rx.lock();
+    let mut batch = vec![rx.recv().ok()?];
+    let deadline = Instant::now() + BATCH_ITV;
+    while batch.len() < MAX_BATCH {
+        let itv = deadline.saturating_duration_since(Instant::now());
+        match rx.recv_timeout(itv) {
+            Ok(p) => batch.push(p),
+            Err(_) => break,
+        }
+    }
+    metrics::TX_QUEUE_DEPTH.add(-(batch.len() as i64));
+    Some(batch)
+}
+
+fn send_batch(client: &Client, batch: &[Pending]) {
+    let body = batch_body(batch);
+
+    let start = Instant::now();
+    let resp = client.post(body.into_bytes());
+    metrics::TX_BATCH_RTT.observe_since(start);
+    metrics::TX_BATCHES.inc();
+
+    match resp.and_then(|r| serde_json::from_slice::<Vec<Value>>(&r).c(d!())) {
+        Ok(results) => {
+            let (mut failed, mut duplicated) = (0, 0);
+            for e in results.iter().filter_map(|r| r.get("error")) {
+                if is_duplicate(e) {
+                    duplicated += 1;
+                } else {
+                    failed += 1;
+                    ruc::info_omit!(Err::<(), _>(eg!(e.to_string())));
+                }
+            }
+            metrics::TX_FORWARDED
+                .inc_by(batch.len().saturating_sub(failed + duplicated) as u64);
+            metrics::TX_DUPLICATE.inc_by(duplicated as u64);
+            metrics::TX_DROPPED.inc_by(failed as u64);
+        }
+        Err(e) => {
+            metrics::TX_DROPPED.inc_by(batch.len() as u64);
+            ruc::info_omit!(Err::<(), _>(e));
+        }
+    }
+}
+
+// The transaction is already in the mempool (cache) of tendermint,
+// it is not lost, e.g. it has been resent by the client.
+fn is_duplicate(err: &Value) -> bool {
+    err.get("data")
+        .and_then(Value::as_str)
+        .map_or(false, |d| d.contains(DUPLICATE_TX))
+}
+
+// `[{"jsonrpc":"2.0","id":0,"method":"broadcast_tx_sync","params":{"tx":"..."}},...]`
+fn batch_body(batch: &[Pending]) -> String {
+    let size = batch.iter().map(|p| p.txn_b64.len() + 96).sum();
+    let mut body = String::with_capacity(size);
+    body.push('[');
+    for (id, p) in batch.iter().enumerate() {
+        if 0 < id {
+            body.push(',');
+        }
+        body.push_str("{\"jsonrpc\":\"2.0\",\"id\":");
+        body.push_str(&id.to_string());
+        body.push_str(",\"method\":\"");
+        body.push_str(if p.async_mode { ASYNC_API } else { SYNC_API });
+        body.push_str("\",\"params\":{\"tx\":\"");
+        body.push_str(&p.txn_b64);
+        body.push_str("\"}}");
+    }
+    body.push(']');
+    body
+}
+
+/// A JSON-RPC client of tendermint.
+struct Client {
+    url: String,
+}
+
+impl Client {
+    fn new(addr: &str) -> Self {
+        Client {
+            url: format!("http://{}", addr),
+        }
+    }
+
+    // A batch is sent again only when the first attempt can not have
+    // reached tendermint, that is, the connection was refused.
+    // Any later error, e.g. a timeout waiting for the response, is final.
+    fn post(&self, body: Vec<u8>) -> Result<Vec<u8>> {
+        let send = || {
+            attohttpc::post(&self.url)
                 .header(attohttpc::header::CONTENT_TYPE, "application/json")
-                .text(json_rpc)
+                .connect_timeout(IO_TIMEOUT)
+                .read_timeout(IO_TIMEOUT)
+                .bytes(body.clone())
                 .send()
-                .c(d!()));
-            TX_PENDING_CNT.fetch_sub(1, Ordering::Relaxed);
-        });
-    } else {
-        TX_PENDING_CNT.fetch_sub(1, Ordering::Relaxed);
-        return Err(eg!("Too many pending tasks"));
+        };
+        let resp = match send() {
+            Err(e) if is_refused(&e) => send(),
+            resp => resp,
+        }
+        .c(d!())?;
+
+        let (status, _, reader) = resp.split();
+        let mut body = vec![];
+        reader
+            .take(MAX_RESP_SIZE as u64 + 1)
+            .read_to_end(&mut body)
+            .c(d!())?;
+        if MAX_RESP_SIZE < body.len() {
+            return Err(eg!(format!("response larger than {} bytes", MAX_RESP_SIZE)));
+        }
+        if !status.is_success() {
+            return Err(eg!(format!(
+                "HTTP {}: {}",
+                status,
+                String::from_utf8_lossy(&body)
+            )));
+        }
+        Ok(body)
+    }
+}
+
+// Nothing has been written before the connection is established.
+fn is_refused(e: &attohttpc::Error) -> bool {
+    matches!(
+        e.kind(),
+        attohttpc::ErrorKind::Io(e) if io::ErrorKind::ConnectionRefused == e.kind()
+    )
+}
+
+#[cfg(test)]
+mod test {
+    use {
+        super::*,
+        std::{
+            io::{BufRead, BufReader, Write},
+            net::TcpListener,
+        },
+    };
+
+    // Serve one request per connection, return the request bodies.
+    fn serve(listener: TcpListener, resps: Vec<String>) -> Vec<String> {
+        let mut bodies = vec![];
+        for resp in resps {
+            let (stream, _) = pnk!(listener.accept());
+            let mut stream = BufReader::new(stream);
+            let mut len = 0;
+            let mut line = String::new();
+            loop {
+                line.clear();
+                pnk!(stream.read_line(&mut line));
+                if let Some((k, v)) = line.split_once(':') {
+                    if k.eq_ignore_ascii_case("content-length") {
+                        len = pnk!(v.trim().parse::<usize>());
+                    }
+                }
+                if "\r\n" == line {
+                    break;
+                }
+            }
+            let mut body = vec![0; len];
+            pnk!(stream.read_exact(&mut body));
+            bodies.push(pnk!(String::from_utf8(body)));
+            pnk!(stream.get_mut().write_all(resp.as_bytes()));
+        }
+        bodies
+    }
+
+    fn resp_of(body: &str) -> String {
+        format!(
+            "HTTP/1.1 200 OK\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+            body.len(),
+            body
+        )
     }
 
-    Ok(())
+    #[test]
+    fn batch_post() {
+        let listener = pnk!(TcpListener::bind("127.0.0.1:0"));
+        let addr = pnk!(listener.local_addr()).to_string();
+
+        let big = "x".repeat(MAX_RESP_SIZE + 1);
+        let server =
+            thread::spawn(move || serve(listener, vec![resp_of("[]"), resp_of(&big)]));
+
+        let batch = (0..2)
+            .map(|i| Pending {
+                txn_b64: format!("tx{}", i),
+                async_mode: 1 == i,
+            })
+            .collect::<Vec<_>>();
+        let client = Client::new(&addr);
+        assert_eq!(
+            b"[]",
+            pnk!(client.post(batch_body(&batch).into_bytes())).as_slice()
+        );
+        // an oversized response is refused
+        assert!(client.post(b"[]".to_vec()).is_err());
+
+        let bodies = pnk!(server.join());
+        let sent = pnk!(serde_json::from_str::<Vec<Value>>(&bodies[0]));
+        assert_eq!(2, sent.len());
+        assert_eq!(SYNC_API, sent[0]["method"]);
+        assert_eq!(ASYNC_API, sent[1]["method"]);
+        assert_eq!("tx1", sent[1]["params"]["tx"]);
+        assert_eq!("[]", bodies[1]);
+    }
+
+    #[test]
+    fn duplicate_tx() {
+        let dup = serde_json::json!({
+            "code": -32603,
+            "message": "Internal error",
+            "data": DUPLICATE_TX,
+        });
+        let err = serde_json::json!({
+            "code": -32603,
+            "message": "Internal error",
+            "data": "mempool is full",
+        });
+        assert!(is_duplicate(&dup));
+        assert!(!is_duplicate(&err));
+    }
 }
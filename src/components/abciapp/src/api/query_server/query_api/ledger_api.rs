@@ -170,6 +170,68 @@ pub async fn query_txn(
     }
 }
 
+/// query a batch of txs according to a list of `TxnSID`s,
+/// all the proofs are merged into a compact multi-proof
+pub async fn query_txns(
+    data: web::Data<Arc<RwLock<QueryServer>>>,
+    info: web::Path<String>,
+) -> actix_web::Result<String> {
+    let sid_list = info
+        .as_ref()
+        .split(',')
+        .map(|i| {
+            i.parse::<usize>()
+                .map(TxnSID)
+                .map_err(actix_web::error::ErrorBadRequest)
+        })
+        .collect::<actix_web::Result<Vec<_>, actix_web::error::Error>>()?;
+
+    if sid_list.len() > 256 || sid_list.is_empty() {
+        return Err(actix_web::error::ErrorBadRequest("Invalid Query List"));
+    }
+
+    let qs = data.read();
+    let ledger = &qs.ledger_cloned;
+    if let Ok(mut txns) = ruc::info!(ledger.get_transactions(&sid_list)) {
+        txns.finalized_txns
+            .iter_mut()
+            .for_each(|tx| tx.set_txo_id());
+        Ok(serde_json::to_string(&txns)?)
+    } else {
+        Err(actix_web::error::ErrorNotFound(
+            "Specified transactions do not exist.",
+        ))
+    }
+}
+
+#[allow(missing_docs)]
+#[derive(Deserialize, Debug)]
+pub struct TxnProofQueryParams {
+    version: Option<u64>,
+}
+
+/// query the inclusion proof of a tx according to `TxnSID`,
+/// at an older version of the transaction merkle tree if specified
+pub async fn query_txn_proof(
+    data: web::Data<Arc<RwLock<QueryServer>>>,
+    info: web::Path<String>,
+    web::Query(params): web::Query<TxnProofQueryParams>,
+) -> actix_web::Result<String> {
+    let txn_sid = info
+        .parse::<usize>()
+        .map_err(|_| error::ErrorBadRequest("Invalid txn sid encoding."))?;
+
+    let qs = data.read();
+    let ledger = &qs.ledger_cloned;
+    let proof = ruc::info!(
+        ledger.get_transaction_proof(TxnSID(txn_sid), params.version.unwrap_or(0))
+    )
+    .map_err(|_| {
+        error::ErrorNotFound("Specified transaction or version does not exist.")
+    })?;
+    Ok(serde_json::to_string(&proof)?)
+}
+
 /// query tx according to `TxnSID`, lighter and faster version
 pub async fn query_txn_light(
     data: web::Data<Arc<RwLock<QueryServer>>>,
@@ -701,6 +763,8 @@ pub enum ApiRoutes {
     GlobalState,
     TxnSid,
     TxnSidLight,
+    TxnSidList,
+    TxnSidProof,
     GlobalStateVersion,
     OwnedUtxos,
     ValidatorList,
@@ -720,6 +784,8 @@ impl NetworkRoute for ApiRoutes {
             ApiRoutes::GlobalState => "global_state",
             ApiRoutes::TxnSid => "txn_sid",
             ApiRoutes::TxnSidLight => "txn_sid_light",
+            ApiRoutes::TxnSidList => "txn_sid_list",
+            ApiRoutes::TxnSidProof => "txn_sid_proof",
             ApiRoutes::GlobalStateVersion => "global_state_version",
             ApiRoutes::OwnedUtxos => "owned_utxos",
             ApiRoutes::ValidatorList => "validator_list",
@@ -10,7 +10,7 @@ pub mod service;
 
 use {
     actix_cors::Cors,
-    actix_web::{error, middleware, web, App, HttpServer},
+    actix_web::{error, middleware, web, App, HttpResponse, HttpServer},
     finutils::api::NetworkRoute,
     globutils::wallet,
     ledger::{
@@ -48,6 +48,13 @@ pub async fn version() -> actix_web::Result<String> {
     ))
 }
 
+/// Timings and counters of the node in the text format of Prometheus
+pub async fn metrics() -> HttpResponse {
+    HttpResponse::Ok()
+        .content_type("text/plain; version=0.0.4")
+        .body(globutils::metrics::render())
+}
+
 /// Queries the status of a transaction by its handle. Returns either a not committed message or a
 /// serialized TxnStatus.
 pub async fn get_address(
@@ -123,6 +130,7 @@ pub enum QueryServerRoutes {
     GetTransactionHash,
     GetTransactionSid,
     GetCommits,
+    GetIndexedCommits,
 }
 
 impl NetworkRoute for QueryServerRoutes {
@@ -141,6 +149,7 @@ impl NetworkRoute for QueryServerRoutes {
             QueryServerRoutes::GetTransactionHash => "get_transaction_hash",
             QueryServerRoutes::GetTransactionSid => "get_transaction_sid",
             QueryServerRoutes::GetCommits => "get_commits",
+            QueryServerRoutes::GetIndexedCommits => "get_indexed_commits",
         };
         "/".to_owned() + endpoint
     }
@@ -254,6 +263,15 @@ pub async fn get_commits(
     Ok(web::Json(server.get_commits()))
 }
 
+/// Returns the number of blocks indexed by the api cache,
+/// results of the cache-based APIs cover these blocks only
+pub async fn get_indexed_commits(
+    data: web::Data<Arc<RwLock<QueryServer>>>,
+) -> actix_web::Result<web::Json<u64>> {
+    let server = data.read();
+    Ok(web::Json(server.get_indexed_commits()))
+}
+
 #[allow(missing_docs)]
 #[derive(Debug, Deserialize)]
 pub struct WalletQueryParams {
@@ -491,6 +509,7 @@ impl QueryApi {
                 .data(Arc::clone(&server))
                 .route("/ping", web::get().to(ping))
                 .route("/version", web::get().to(version))
+                .route("/metrics", web::get().to(metrics))
                 .service(
                     web::resource("get_total_supply")
                         .route(web::get().to(get_total_supply)),
@@ -561,6 +580,10 @@ impl QueryApi {
                     &QueryServerRoutes::GetCommits.route(),
                     web::get().to(get_commits),
                 )
+                .route(
+                    &QueryServerRoutes::GetIndexedCommits.route(),
+                    web::get().to(get_indexed_commits),
+                )
                 .route(
                     &ApiRoutes::UtxoSid.with_arg_template("sid"),
                     web::get().to(query_utxo),
@@ -593,6 +616,14 @@ impl QueryApi {
                     &ApiRoutes::TxnSidLight.with_arg_template("sid"),
                     web::get().to(query_txn_light),
                 )
+                .route(
+                    &ApiRoutes::TxnSidList.with_arg_template("sid_list"),
+                    web::get().to(query_txns),
+                )
+                .route(
+                    &ApiRoutes::TxnSidProof.with_arg_template("sid"),
+                    web::get().to(query_txn_proof),
+                )
                 .route(
                     &ApiRoutes::GlobalStateVersion.with_arg_template("version"),
                     web::get().to(query_global_state_version),
@@ -289,6 +289,17 @@ impl QueryServer {
         self.ledger_cloned.get_block_commit_count()
     }
 
+    /// Returns the number of blocks that have been written into the api cache,
+    /// data of later blocks may be incomplete.
+    #[inline(always)]
+    pub fn get_indexed_commits(&self) -> u64 {
+        self.ledger_cloned
+            .api_cache
+            .as_ref()
+            .and_then(|c| c.indexed_blocks())
+            .unwrap_or(0)
+    }
+
     /// Returns the owner memo required to decrypt the asset record stored at given index, if it exists.
     #[inline(always)]
     pub fn get_owner_memo(&self, txo_sid: TxoSID) -> Option<OwnerMemo> {
@@ -5,6 +5,7 @@
 pub mod submission_api;
 
 use {
+    config::abci::global_cfg::CFG,
     fp_utils::tx::EVM_TX_TAG,
     ledger::{
         data_model::{BlockEffect, Transaction, TxnEffect, TxnSID, TxnTempSID, TxoSID},
@@ -205,7 +206,29 @@ where
 
     /// The transaction will be applied to the effect_block after a series of judgments,
     /// and will be classified as pending or rejected depending on the result of the processing.
+    #[inline(always)]
     pub fn cache_transaction(&mut self, txn: Transaction) -> Result<TxnHandle> {
+        let handle = TxnHandle::new(&txn);
+        let txn_effect =
+            TxnEffect::compute_effect(txn.clone()).c(d!("Failed to compute txn effect"));
+        self.do_cache_transaction(handle, txn, txn_effect)
+    }
+
+    /// Same as `cache_transaction`,
+    /// but the `TxnEffect` has been computed in advance.
+    #[inline(always)]
+    pub fn cache_txn_effect(&mut self, txn_effect: TxnEffect) -> Result<TxnHandle> {
+        let txn = txn_effect.txn.clone();
+        let handle = TxnHandle::new(&txn);
+        self.do_cache_transaction(handle, txn, Ok(txn_effect))
+    }
+
+    fn do_cache_transaction(
+        &mut self,
+        handle: TxnHandle,
+        txn: Transaction,
+        txn_effect: Result<TxnEffect>,
+    ) -> Result<TxnHandle> {
         // Begin a block if the previous one has been commited
         if self.all_commited() {
             self.begin_block();
@@ -214,14 +237,11 @@ where
         // The if statement above guarantees that we have a block.
         let mut block = self.block.as_mut().unwrap();
         let ledger = self.committed_state.read();
-        let handle = TxnHandle::new(&txn);
-        let temp_sid = TxnEffect::compute_effect(txn.clone())
-            .c(d!("Failed to compute txn effect"))
-            .and_then(|txn_effect| {
-                ledger
-                    .apply_transaction(&mut block, txn_effect)
-                    .c(d!("Failed to apply transaction"))
-            });
+        let temp_sid = txn_effect.and_then(|txn_effect| {
+            ledger
+                .apply_transaction(&mut block, txn_effect)
+                .c(d!("Failed to apply transaction"))
+        });
         match temp_sid {
             Ok(temp_sid) => {
                 self.pending_txns.push((temp_sid, handle.clone(), txn));
@@ -249,10 +269,18 @@ where
     }
 }
 
-/// Convert incoming tx data to the proper Transaction format
+/// Convert incoming tx data to the proper Transaction format,
+/// the binary wire format is accepted since `tx_wire_v1_height`,
+/// the legacy JSON format is always accepted
 #[inline(always)]
-pub fn convert_tx(tx: &[u8]) -> Result<Transaction> {
-    serde_json::from_slice(tx).c(d!())
+pub fn convert_tx(tx: &[u8], height: u64) -> Result<Transaction> {
+    if height < CFG.checkpoint.tx_wire_v1_height && Transaction::is_wire_bytes(tx) {
+        return Err(eg!(format!(
+            "binary transactions are not accepted before height {}",
+            CFG.checkpoint.tx_wire_v1_height
+        )));
+    }
+    Transaction::from_wire_bytes(tx).c(d!())
 }
 
 /// Tx Catalog
@@ -26,10 +26,32 @@ pub struct CheckPointConfig {
     pub apy_v7_upgrade_height: u64,
     pub ff_addr_extra_fix_height: u64,
     pub nonconfidential_balance_fix_height: u64,
+    // hash the staking data incrementally since this height,
+    // disabled by default for the compatibility of existing nodes
+    #[serde(default = "CheckPointConfig::disabled_height")]
+    pub staking_commitment_v2_height: u64,
+    // report the real original values of storage slots to the EVM,
+    // the SSTORE gas will be changed since this height
+    #[serde(default = "CheckPointConfig::disabled_height")]
+    pub evm_original_storage_height: u64,
+    // execute the EVM transactions speculatively in parallel since this height,
+    // the results are always the same as the serial execution
+    #[serde(default = "CheckPointConfig::disabled_height")]
+    pub parallel_evm_height: u64,
+    // accept the binary wire format of transactions since this height,
+    // only the legacy JSON format is emitted and accepted before it
+    #[serde(default = "CheckPointConfig::disabled_height")]
+    pub tx_wire_v1_height: u64,
     pub unbond_block_cnt: u64,
 }
 
 impl CheckPointConfig {
+    // `toml` can not represent integers bigger than `i64::MAX`
+    #[inline(always)]
+    fn disabled_height() -> u64 {
+        i64::MAX as u64
+    }
+
     /// load configuration of checkpoints from file.
     pub fn from_file(file_path: &str) -> Option<CheckPointConfig> {
         let mut f = match File::open(file_path) {
@@ -51,6 +73,10 @@ impl CheckPointConfig {
                                 apy_v7_upgrade_height: 0,
                                 ff_addr_extra_fix_height: 0,
                                 nonconfidential_balance_fix_height: 0,
+                                staking_commitment_v2_height: 0,
+                                evm_original_storage_height: 0,
+                                parallel_evm_height: 0,
+                                tx_wire_v1_height: 0,
                                 unbond_block_cnt: 3600 * 24 * 21 / 16,
                             };
                             #[cfg(not(feature = "debug_env"))]
@@ -66,6 +92,12 @@ impl CheckPointConfig {
                                 apy_v7_upgrade_height: 1429000,
                                 ff_addr_extra_fix_height: 1200000,
                                 nonconfidential_balance_fix_height: 1210000,
+                                staking_commitment_v2_height:
+                                    CheckPointConfig::disabled_height(),
+                                evm_original_storage_height:
+                                    CheckPointConfig::disabled_height(),
+                                parallel_evm_height: CheckPointConfig::disabled_height(),
+                                tx_wire_v1_height: CheckPointConfig::disabled_height(),
                                 unbond_block_cnt: 3600 * 24 * 21 / 16,
                             };
                             let content = toml::to_string(&config).unwrap();
@@ -213,6 +245,9 @@ pub mod global_cfg {
         pub tendermint_node_self_addr: Option<String>,
         pub tendermint_node_key_config_path: Option<String>,
         pub ledger_dir: String,
+        pub state_sync_dir: Option<String>,
+        pub state_sync_export: bool,
+        pub state_sync_import: Option<String>,
         #[cfg(target_os = "linux")]
         pub btmcfg: BtmCfg,
         pub checkpoint: CheckPointConfig,
@@ -247,6 +282,9 @@ pub mod global_cfg {
             .arg_from_usage("--tendermint-node-key-config-path=[Path] 'such as: ${HOME}/.tendermint/config/priv_validator_key.json'")
             .arg_from_usage("-d, --ledger-dir=[Path]")
             .arg_from_usage("--checkpoint-file=[Path]")
+            .arg_from_usage("--state-sync-dir=[Path] 'where the state-sync snapshots are kept, out of the ledger dir'")
+            .arg_from_usage("--state-sync-export 'export a state-sync snapshot of the last committed height, then exit'")
+            .arg_from_usage("--state-sync-import=[AppHash] 'restore an empty ledger dir from the state-sync snapshot with this trusted app hash, in upper-hex format'")
             .arg_from_usage("--enable-snapshot 'global switch for enabling snapshot functions'")
             .arg_from_usage("--snapshot-list 'list all available snapshots in the form of block height'")
             .arg_from_usage("--snapshot-target=[TargetPath] 'a data volume containing both ledger data and tendermint data'")
@@ -339,6 +377,16 @@ pub mod global_cfg {
             .unwrap_or_else(|| "8546".to_owned())
             .parse::<u16>()
             .c(d!())?;
+        let ssd = m
+            .value_of("state-sync-dir")
+            .map(|v| v.to_owned())
+            .or_else(|| env::var("STATE_SYNC_DIR").ok());
+        let sse =
+            m.is_present("state-sync-export") || env::var("STATE_SYNC_EXPORT").is_ok();
+        let ssi = m
+            .value_of("state-sync-import")
+            .map(|v| v.to_owned())
+            .or_else(|| env::var("STATE_SYNC_IMPORT").ok());
         let checkpoint_path = m
             .value_of("checkpoint-file")
             .map(|v| v.to_owned())
@@ -359,6 +407,9 @@ pub mod global_cfg {
             tendermint_node_self_addr: tnsa,
             tendermint_node_key_config_path: tnkcp,
             ledger_dir: ld,
+            state_sync_dir: ssd,
+            state_sync_export: sse,
+            state_sync_import: ssi,
             #[cfg(target_os = "linux")]
             btmcfg: parse_btmcfg(&m).c(d!())?,
             checkpoint: CheckPointConfig::from_file(&checkpoint_path).unwrap(),
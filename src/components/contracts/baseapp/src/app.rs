@@ -2,12 +2,22 @@ use crate::extensions::SignedExtra;
 use abci::*;
 use fp_core::context::RunTxMode;
 use fp_evm::BlockId;
-use fp_types::assemble::convert_unchecked_transaction;
+use fp_types::{
+    actions::{ethereum::Action as EthereumAction, Action},
+    assemble::convert_unchecked_transaction,
+};
 use fp_utils::tx::EvmRawTxWrapper;
+use globutils::metrics::Histogram;
 use log::{debug, error, info};
 use primitive_types::U256;
 use ruc::*;
 
+static EVM_DELIVER_TX: Histogram = Histogram::new(
+    "findora_evm_seconds",
+    "phase=\"deliver_tx\"",
+    "Time spent in executing the EVM transactions",
+);
+
 impl abci::Application for crate::BaseApp {
     /// info implements the ABCI interface.
     /// - Returns chain info (las height and hash where the node left off)
@@ -28,36 +38,7 @@ impl abci::Application for crate::BaseApp {
 
     /// query implements the ABCI interface.
     fn query(&mut self, req: &RequestQuery) -> ResponseQuery {
-        let err_resp = |err: String| -> ResponseQuery {
-            let mut resp: ResponseQuery = Default::default();
-            resp.code = 1;
-            resp.log = err;
-            resp
-        };
-
-        if req.height < 0 {
-            return err_resp(
-                "cannot query with height < 0; please provide a valid height"
-                    .to_string(),
-            );
-        }
-
-        // example: "module/evm/code"
-        let mut path: Vec<_> = req.path.split('/').collect();
-        if path.is_empty() {
-            return err_resp("Empty query path!".to_string());
-        }
-
-        let ctx = self.create_query_context(Some(req.height as u64), req.prove);
-        if let Err(e) = ctx {
-            return err_resp(format!("Cannot create query context with err: {}!", e));
-        }
-
-        match path.remove(0) {
-            // "store" => self.store.query(path, req),
-            "module" => self.modules.query(ctx.unwrap(), path, req),
-            _ => err_resp("Invalid query path!".to_string()),
-        }
+        self.handle_query(req)
     }
 
     /// check_tx implements the ABCI interface and executes a tx in Check/ReCheck mode.
@@ -75,6 +56,12 @@ impl abci::Application for crate::BaseApp {
         }
 
         if let Ok(tx) = convert_unchecked_transaction::<SignedExtra>(raw_tx) {
+            // kept for the sender recovery and the speculative execution of the next blocks
+            let ethereum_tx = match &tx.function {
+                Action::Ethereum(EthereumAction::Transact(t)) => Some(t.clone()),
+                _ => None,
+            };
+
             let check_fn = |mode: RunTxMode| {
                 let ctx = self.retrieve_context(mode).clone();
                 let result = self.modules.process_tx::<SignedExtra>(ctx, tx);
@@ -97,6 +84,12 @@ impl abci::Application for crate::BaseApp {
                 CheckTxType::New => check_fn(RunTxMode::Check),
                 CheckTxType::Recheck => check_fn(RunTxMode::ReCheck),
             }
+
+            if 0 != resp.code {
+                self.parallel.remove(req.get_tx());
+            } else if let Some(t) = ethereum_tx {
+                self.parallel.on_checked(req.get_tx(), t);
+            }
         } else {
             info!(target: "baseapp", "Could not unpack transaction");
         }
@@ -131,11 +124,15 @@ impl abci::Application for crate::BaseApp {
 
         self.modules.begin_block(&mut self.deliver_state, req);
 
+        // run the EVM transactions ahead on the state after `begin_block`
+        self.parallel.begin_block(&self.deliver_state);
+
         ResponseBeginBlock::default()
     }
 
     fn deliver_tx(&mut self, req: &RequestDeliverTx) -> ResponseDeliverTx {
         let mut resp = ResponseDeliverTx::new();
+        self.parallel.remove(req.get_tx());
 
         let raw_tx;
         if let Ok(tx) = EvmRawTxWrapper::unwrap(req.get_tx()) {
@@ -150,7 +147,8 @@ impl abci::Application for crate::BaseApp {
         if let Ok(tx) = convert_unchecked_transaction::<SignedExtra>(raw_tx) {
             let ctx = self.retrieve_context(RunTxMode::Deliver).clone();
 
-            let ret = self.modules.process_tx::<SignedExtra>(ctx, tx);
+            let ret =
+                EVM_DELIVER_TX.time(|| self.modules.process_tx::<SignedExtra>(ctx, tx));
             match ret {
                 Ok(ar) => {
                     if ar.code != 0 {
@@ -191,6 +189,9 @@ impl abci::Application for crate::BaseApp {
     }
 
     fn commit(&mut self, _req: &RequestCommit) -> ResponseCommit {
+        // Speculations are based on the uncommitted state
+        self.parallel.on_commit();
+
         // Reset the Check state to the latest committed.
         self.check_state = self.deliver_state.copy_with_new_state();
 
@@ -216,9 +217,18 @@ impl abci::Application for crate::BaseApp {
                 panic!("Failed to commit chain state at height: {}", block_height)
             });
 
+        // New query contexts run on top of this block
+        self.query_pool.on_commit(
+            self.check_state.header.clone(),
+            self.check_state.header_hash(),
+        );
+
         // Reset the deliver state
         Self::update_state(&mut self.deliver_state, Default::default(), vec![]);
 
+        // The created and removed contracts are committed now
+        module_evm::runtime::code_cache::on_commit();
+
         pnk!(self
             .event_notify
             .notify(BlockId::Number(U256::from(block_height))));
@@ -229,3 +239,40 @@ impl abci::Application for crate::BaseApp {
         res
     }
 }
+
+impl crate::BaseApp {
+    /// Handle an ABCI query, it only reads the committed state,
+    /// so it can be served under a read lock.
+    pub fn handle_query(&self, req: &RequestQuery) -> ResponseQuery {
+        let err_resp = |err: String| -> ResponseQuery {
+            let mut resp: ResponseQuery = Default::default();
+            resp.code = 1;
+            resp.log = err;
+            resp
+        };
+
+        if req.height < 0 {
+            return err_resp(
+                "cannot query with height < 0; please provide a valid height"
+                    .to_string(),
+            );
+        }
+
+        // example: "module/evm/code"
+        let mut path: Vec<_> = req.path.split('/').collect();
+        if path.is_empty() {
+            return err_resp("Empty query path!".to_string());
+        }
+
+        let ctx = self.create_query_context(Some(req.height as u64), req.prove);
+        if let Err(e) = ctx {
+            return err_resp(format!("Cannot create query context with err: {}!", e));
+        }
+
+        match path.remove(0) {
+            // "store" => self.store.query(path, req),
+            "module" => self.modules.query(ctx.unwrap(), path, req),
+            _ => err_resp("Invalid query path!".to_string()),
+        }
+    }
+}
@@ -9,6 +9,8 @@ mod app;
 pub mod extensions;
 mod modules;
 mod notify;
+mod parallel;
+mod query;
 
 use crate::modules::ModuleManager;
 use abci::Header;
@@ -29,8 +31,10 @@ use fp_types::{actions::xhub::NonConfidentialOutput, actions::Action, crypto::Ad
 use lazy_static::lazy_static;
 use ledger::data_model::Transaction as FindoraTransaction;
 use notify::*;
+pub use parallel::ParallelExecutor;
 use parking_lot::RwLock;
 use primitive_types::{H160, H256, U256};
+pub use query::{PooledContext, QueryContextPool};
 use ruc::{eg, Result};
 use std::borrow::BorrowMut;
 use std::path::Path;
@@ -73,6 +77,10 @@ pub struct BaseApp {
     pub modules: ModuleManager,
     /// New Block event notify
     pub event_notify: Arc<Notifications<BlockId>>,
+    /// Read-only contexts on the latest committed state
+    pub query_pool: Arc<QueryContextPool>,
+    /// Speculative executions of the EVM transactions
+    pub parallel: Arc<ParallelExecutor>,
 }
 
 impl module_template::Config for BaseApp {}
@@ -159,12 +167,14 @@ impl BaseApp {
             chain_state: chain_state.clone(),
             chain_db: chain_db.clone(),
             check_state: Context::new(chain_state.clone(), chain_db.clone()),
-            deliver_state: Context::new(chain_state, chain_db),
+            deliver_state: Context::new(chain_state.clone(), chain_db.clone()),
             modules: ModuleManager {
                 ethereum_module: module_ethereum::App::<Self>::new(empty_block),
                 ..Default::default()
             },
             event_notify: Arc::new(Notifications::new()),
+            query_pool: Arc::new(QueryContextPool::new(chain_state, chain_db)),
+            parallel: Arc::new(ParallelExecutor::default()),
         })
     }
 
@@ -182,6 +192,8 @@ impl BaseApp {
             deliver_state: Context::new(chain_state, chain_db),
             modules: ModuleManager::default(),
             event_notify: self.event_notify.clone(),
+            query_pool: self.query_pool.clone(),
+            parallel: self.parallel.clone(),
         }
     }
 
@@ -314,64 +326,34 @@ impl BaseProvider for BaseApp {
     }
 
     fn current_block(&self, id: Option<BlockId>) -> Option<Block> {
-        if let Ok(ctx) = self.create_query_context(Some(0), false) {
-            self.modules.ethereum_module.current_block(&ctx, id)
-        } else {
-            None
-        }
+        self.query_pool.current_block(id)
     }
 
     fn current_block_number(&self) -> Option<U256> {
-        if let Ok(ctx) = self.create_query_context(Some(0), false) {
-            module_ethereum::App::<Self>::current_block_number(&ctx)
-        } else {
-            None
-        }
+        self.query_pool.current_block_number()
     }
 
     fn current_transaction_statuses(
         &self,
         id: Option<BlockId>,
     ) -> Option<Vec<fp_evm::TransactionStatus>> {
-        if let Ok(ctx) = self.create_query_context(Some(0), false) {
-            self.modules
-                .ethereum_module
-                .current_transaction_statuses(&ctx, id)
-        } else {
-            None
-        }
+        self.query_pool.current_transaction_statuses(id)
     }
 
     fn current_receipts(&self, id: Option<BlockId>) -> Option<Vec<ethereum::Receipt>> {
-        if let Ok(ctx) = self.create_query_context(Some(0), false) {
-            self.modules.ethereum_module.current_receipts(&ctx, id)
-        } else {
-            None
-        }
+        self.query_pool.current_receipts(id)
     }
 
     fn block_hash(&self, id: Option<BlockId>) -> Option<H256> {
-        if let Ok(ctx) = self.create_query_context(Some(0), false) {
-            module_ethereum::App::<Self>::block_hash(&ctx, id)
-        } else {
-            None
-        }
+        self.query_pool.block_hash(id)
     }
 
     fn transaction_index(&self, hash: H256) -> Option<(U256, u32)> {
-        if let Ok(ctx) = self.create_query_context(Some(0), false) {
-            module_ethereum::App::<Self>::transaction_index(&ctx, hash)
-        } else {
-            None
-        }
+        self.query_pool.transaction_index(hash)
     }
 
     fn account_code_at(&self, address: H160, height: Option<u64>) -> Option<Vec<u8>> {
-        if let Ok(ctx) = self.create_query_context(Some(0), false) {
-            module_evm::App::<Self>::account_codes(&ctx, &address.into(), height)
-        } else {
-            None
-        }
+        self.query_pool.account_code_at(address, height)
     }
 
     fn account_storage_at(
@@ -0,0 +1,217 @@
+//!
+//! # Parallel EVM execution
+//!
+//! Tendermint delivers the transactions of a block one by one, so the EVM
+//! transactions to run ahead are the ones which have passed `check_tx`,
+//! most of the next block comes from them.
+//!
+//! At the beginning of a block they are executed speculatively on the
+//! workers of `POOL_SPECULATION`, against the state after `begin_block`.
+//! `deliver_tx` replays the results which do not conflict with the
+//! transactions delivered before, and executes the others in order,
+//! see `module_ethereum::speculation`.
+//!
+//! Enabled since `CFG.checkpoint.parallel_evm_height`.
+//!
+//! Regardless of that, the senders of the kept transactions have been recovered
+//! into `sender_cache` by `check_tx`, the ones evicted since are recovered again
+//! on multiple threads before a block is delivered.
+//!
+
+use crate::BaseApp;
+use config::abci::global_cfg::CFG;
+use ethereum::TransactionV0 as Transaction;
+use fp_core::context::Context;
+use fp_storage::access;
+use futures::executor::ThreadPool;
+use lazy_static::lazy_static;
+use module_ethereum::{
+    sender_cache,
+    speculation::{self, Speculated},
+};
+use parking_lot::Mutex;
+use primitive_types::H256;
+use std::{
+    collections::{hash_map::DefaultHasher, BTreeMap, HashMap},
+    hash::Hasher,
+    panic::{self, AssertUnwindSafe},
+};
+
+/// Max number of the checked transactions kept for the next blocks.
+const PENDING_TXS_CAP: usize = 8192;
+
+/// Max number of speculations in a block.
+const MAX_SPECULATIONS: usize = 2048;
+
+lazy_static! {
+    static ref POOL_SPECULATION: ThreadPool =
+        ThreadPool::new().expect("Failed to create speculation thread pool executor");
+}
+
+#[derive(Default)]
+struct PendingTxs {
+    next_seq: u64,
+    // <seq> => (<hash of the raw bytes>, <hash>, <transaction>),
+    // in the checking order
+    txs: BTreeMap<u64, (u64, H256, Transaction)>,
+    // <hash of the raw bytes> => <seq>
+    index: HashMap<u64, u64>,
+}
+
+/// Runs the EVM transactions of a block ahead on multiple threads.
+#[derive(Default)]
+pub struct ParallelExecutor {
+    pending: Mutex<PendingTxs>,
+}
+
+impl ParallelExecutor {
+    #[inline(always)]
+    pub fn is_enabled(height: i64) -> bool {
+        height >= 0 && height as u64 >= CFG.checkpoint.parallel_evm_height
+    }
+
+    /// Keep an EVM transaction which has passed `check_tx`.
+    pub fn on_checked(&self, raw_tx: &[u8], tx: Transaction) {
+        let mut pending = self.pending.lock();
+        let key = raw_key(raw_tx);
+        if pending.index.contains_key(&key) {
+            return;
+        }
+
+        if pending.txs.len() >= PENDING_TXS_CAP {
+            if let Some(oldest) = pending.txs.keys().next().copied() {
+                if let Some((oldest_key, _, _)) = pending.txs.remove(&oldest) {
+                    pending.index.remove(&oldest_key);
+                }
+            }
+        }
+
+        let seq = pending.next_seq;
+        pending.next_seq += 1;
+        let hash = module_ethereum::App::<BaseApp>::transaction_hash(&tx);
+        pending.txs.insert(seq, (key, hash, tx));
+        pending.index.insert(key, seq);
+    }
+
+    /// Forget a transaction which has been delivered or failed to be rechecked.
+    pub fn remove(&self, raw_tx: &[u8]) {
+        let mut pending = self.pending.lock();
+        if let Some(seq) = pending.index.remove(&raw_key(raw_tx)) {
+            pending.txs.remove(&seq);
+        }
+    }
+
+    /// Start the speculations on `deliver_state` after `begin_block`.
+    pub fn begin_block(&self, deliver_state: &Context) {
+        self.recover_evicted_senders();
+
+        let height = deliver_state.header.height;
+        if !Self::is_enabled(height) {
+            return;
+        }
+
+        let txs = self
+            .pending
+            .lock()
+            .txs
+            .values()
+            .take(MAX_SPECULATIONS)
+            .map(|(_, hash, tx)| (*hash, tx.clone()))
+            .collect::<Vec<_>>();
+        if txs.is_empty() {
+            return;
+        }
+
+        // The snapshot is shared by all speculations, it's never written.
+        let base = deliver_state.copy_with_state();
+        access::watch(&[
+            access::store_id(&*deliver_state.state.read()),
+            access::store_id(&*deliver_state.db.read()),
+        ]);
+        speculation::begin_block(height, txs.iter().map(|(hash, _)| *hash));
+
+        for (hash, tx) in txs {
+            let base = base.clone();
+            POOL_SPECULATION.spawn_ok(async move {
+                if !speculation::start(height, &hash) {
+                    return;
+                }
+                // a panic is taken as a failure, `deliver_tx` must not wait for it
+                let speculated = panic::catch_unwind(AssertUnwindSafe(|| {
+                    speculate(&base, &hash, &tx)
+                }))
+                .ok()
+                .flatten();
+                speculation::finish(height, &hash, speculated);
+            });
+        }
+    }
+
+    /// Drop the speculations after the block is committed,
+    /// the transactions left are rechecked next.
+    pub fn on_commit(&self) {
+        access::unwatch();
+        speculation::clear();
+    }
+
+    // Recover the senders evicted from `sender_cache` since `check_tx`,
+    // in parallel and without holding the lock of `pending`.
+    fn recover_evicted_senders(&self) {
+        let txs = self
+            .pending
+            .lock()
+            .txs
+            .values()
+            .filter(|(_, hash, _)| !sender_cache::contains(hash))
+            .map(|(_, hash, tx)| (*hash, tx.clone()))
+            .collect::<Vec<_>>();
+        sender_cache::warm(txs.iter().map(|(hash, tx)| (hash, tx)));
+    }
+}
+
+// Execute a transaction on a copy of the snapshot and record its accesses.
+fn speculate(base: &Context, hash: &H256, tx: &Transaction) -> Option<Speculated> {
+    let source = module_ethereum::App::<BaseApp>::recover_signer_with_hash(tx, hash)?;
+    let ctx = base.copy_with_state();
+
+    let (ret, mut accesses) = access::record(|| {
+        module_ethereum::App::<BaseApp>::execute_transaction(
+            &ctx,
+            source,
+            tx.input.clone(),
+            tx.value,
+            tx.gas_limit,
+            Some(tx.gas_price),
+            Some(tx.nonce),
+            tx.action,
+        )
+    });
+    // failed ones are executed again to get the same errors
+    let result = ret.ok()?;
+
+    let state = accesses.take(&*ctx.state.read());
+    let db = accesses.take(&*ctx.db.read());
+    if !accesses.is_empty() {
+        return None;
+    }
+
+    let state_changes = state
+        .changes(&*ctx.state.read(), &*base.state.read())
+        .ok()?;
+    let db_changes = db.changes(&*ctx.db.read(), &*base.db.read()).ok()?;
+
+    Some(Speculated {
+        result,
+        state,
+        db,
+        state_changes,
+        db_changes,
+    })
+}
+
+#[inline(always)]
+fn raw_key(raw_tx: &[u8]) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    hasher.write(raw_tx);
+    hasher.finish()
+}
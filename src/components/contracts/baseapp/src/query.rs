@@ -0,0 +1,219 @@
+//!
+//! # Read-only query contexts
+//!
+//! RPC services read the committed state a lot, going through the lock of
+//! `BaseApp` makes them wait for the block processing, and vice versa.
+//!
+//! A `QueryContextPool` is shared by `BaseApp` and the services, it hands out
+//! contexts on the latest committed version of the chain states, which can
+//! be used by any number of threads in parallel, while the next block is being
+//! delivered in the `deliver_state`. Each context is pinned to that version,
+//! the blocks committed while it's in use are not seen by it.
+//!
+//! Released contexts are reset and kept for the following queries.
+//!
+
+use crate::BaseApp;
+use abci::Header;
+use ethereum::{BlockV0 as Block, Receipt};
+use fp_core::context::{Context, RunTxMode};
+use fp_evm::{BlockId, TransactionStatus};
+use parking_lot::{Mutex, RwLock};
+use primitive_types::{H160, H256, U256};
+use std::{ops::Deref, sync::Arc};
+use storage::{
+    db::{FinDB, RocksDB},
+    state::{ChainState, State},
+};
+
+/// Max number of idle contexts kept in the pool.
+const QUERY_CONTEXT_POOL_SIZE: usize = 64;
+
+pub struct QueryContextPool {
+    chain_state: Arc<RwLock<ChainState<FinDB>>>,
+    chain_db: Arc<RwLock<ChainState<RocksDB>>>,
+    // (<header>, <header hash>) of the latest committed block
+    header: RwLock<(Header, Vec<u8>)>,
+    idle: Mutex<Vec<Context>>,
+    ethereum_module: module_ethereum::App<BaseApp>,
+}
+
+impl QueryContextPool {
+    pub fn new(
+        chain_state: Arc<RwLock<ChainState<FinDB>>>,
+        chain_db: Arc<RwLock<ChainState<RocksDB>>>,
+    ) -> Self {
+        QueryContextPool {
+            chain_state,
+            chain_db,
+            header: RwLock::new((Default::default(), vec![])),
+            idle: Mutex::new(Vec::with_capacity(QUERY_CONTEXT_POOL_SIZE)),
+            ethereum_module: Default::default(),
+        }
+    }
+
+    /// Called after a block is committed,
+    /// new contexts will run on top of this block.
+    pub fn on_commit(&self, header: Header, header_hash: Vec<u8>) {
+        *self.header.write() = (header, header_hash);
+    }
+
+    /// Get a context on the latest committed state,
+    /// it's returned to the pool when dropped.
+    pub fn get(&self) -> PooledContext {
+        let mut ctx = self.idle.lock().pop().unwrap_or_else(|| {
+            Context::new(self.chain_state.clone(), self.chain_db.clone())
+        });
+
+        // pinned to the committed version of the header,
+        // so a commit in the middle of a query is not seen by it
+        let header = self.header.read();
+        ctx.header = header.0.clone();
+        ctx.header_hash = header.1.clone();
+        if 0 < ctx.header.height {
+            ctx.pin_version(ctx.header.height as u64);
+        }
+        drop(header);
+
+        PooledContext {
+            ctx: Some(ctx),
+            pool: self,
+        }
+    }
+
+    fn put(&self, mut ctx: Context) {
+        // Skip contexts whose states are still shared by its copies.
+        if 1 != Arc::strong_count(&ctx.state) || 1 != Arc::strong_count(&ctx.db) {
+            return;
+        }
+
+        ctx.unpin_version();
+        let mut idle = self.idle.lock();
+        if idle.len() < QUERY_CONTEXT_POOL_SIZE {
+            *ctx.state.write() = State::new(self.chain_state.clone(), true);
+            *ctx.db.write() = State::new(self.chain_db.clone(), false);
+            ctx.run_mode = RunTxMode::None;
+            idle.push(ctx);
+        }
+    }
+
+    /// The chain state with merkle root hash, eg. for the height and versions.
+    pub fn chain_state(&self) -> &Arc<RwLock<ChainState<FinDB>>> {
+        &self.chain_state
+    }
+
+    pub fn current_block(&self, id: Option<BlockId>) -> Option<Block> {
+        self.ethereum_module.current_block(&self.get(), id)
+    }
+
+    pub fn current_block_number(&self) -> Option<U256> {
+        module_ethereum::App::<BaseApp>::current_block_number(&self.get())
+    }
+
+    pub fn current_transaction_statuses(
+        &self,
+        id: Option<BlockId>,
+    ) -> Option<Vec<TransactionStatus>> {
+        self.ethereum_module
+            .current_transaction_statuses(&self.get(), id)
+    }
+
+    pub fn current_receipts(&self, id: Option<BlockId>) -> Option<Vec<Receipt>> {
+        self.ethereum_module.current_receipts(&self.get(), id)
+    }
+
+    pub fn block_hash(&self, id: Option<BlockId>) -> Option<H256> {
+        module_ethereum::App::<BaseApp>::block_hash(&self.get(), id)
+    }
+
+    pub fn transaction_index(&self, hash: H256) -> Option<(U256, u32)> {
+        module_ethereum::App::<BaseApp>::transaction_index(&self.get(), hash)
+    }
+
+    pub fn account_code_at(
+        &self,
+        address: H160,
+        height: Option<u64>,
+    ) -> Option<Vec<u8>> {
+        module_evm::App::<BaseApp>::account_codes(&self.get(), &address.into(), height)
+    }
+}
+
+/// A context borrowed from the `QueryContextPool`.
+pub struct PooledContext<'a> {
+    ctx: Option<Context>,
+    pool: &'a QueryContextPool,
+}
+
+impl Deref for PooledContext<'_> {
+    type Target = Context;
+
+    fn deref(&self) -> &Self::Target {
+        self.ctx.as_ref().unwrap()
+    }
+}
+
+impl Drop for PooledContext<'_> {
+    fn drop(&mut self) {
+        if let Some(ctx) = self.ctx.take() {
+            self.pool.put(ctx);
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use fp_storage::{generate_storage, Borrow, BorrowMut};
+
+    generate_storage!(Query, Number => Value<u32>);
+
+    #[test]
+    fn pinned_query_context() {
+        let dir = globutils::fresh_tmp_dir();
+        let chain_state = Arc::new(RwLock::new(ChainState::new(
+            FinDB::open(dir.join("state.db")).unwrap(),
+            "test_db".to_owned(),
+            100,
+        )));
+        let chain_db = Arc::new(RwLock::new(ChainState::new(
+            RocksDB::open(dir.join("history.db")).unwrap(),
+            "test_rocks_db".to_owned(),
+            0,
+        )));
+        let pool = QueryContextPool::new(chain_state.clone(), chain_db.clone());
+
+        let deliver = Context::new(chain_state, chain_db);
+        let commit = |n: u32, height: i64| {
+            Number::put(deliver.state.write().borrow_mut(), &n).unwrap();
+            deliver.state.write().commit(height as u64).unwrap();
+            let mut header = Header::new();
+            header.height = height;
+            pool.on_commit(header, vec![]);
+        };
+        let get = |ctx: &Context| Number::get(ctx.state.read().borrow());
+
+        commit(1, 1);
+        let query = pool.get();
+        assert_eq!(Some(1), query.pinned_version());
+        assert_eq!(Some(1), get(&query));
+
+        // a block is committed in the middle of the query
+        commit(2, 2);
+        assert_eq!(Some(1), get(&query));
+
+        // the copies are pinned too, their own writes are seen
+        let copied = query.copy_with_state();
+        assert_eq!(Some(1), get(&copied));
+        Number::put(copied.state.write().borrow_mut(), &5).unwrap();
+        assert_eq!(Some(5), get(&copied));
+        assert_eq!(Some(1), get(&query));
+        drop(copied);
+        drop(query);
+
+        // new queries see the new block
+        let query = pool.get();
+        assert_eq!(Some(2), query.pinned_version());
+        assert_eq!(Some(2), get(&query));
+    }
+}
@@ -84,10 +84,9 @@ impl<C: Config> AccountAsset<Address> for App<C> {
 
         AccountStore::insert(ctx.state.write().borrow_mut(), target, &target_account)?;
 
-        let issuance = Self::total_issuance(ctx)
-            .checked_add(balance)
-            .c(d!("issuance overflow"))?;
-        TotalIssuance::put(ctx.state.write().borrow_mut(), &issuance)
+        // update it as a counter, it does not conflict with other transactions
+        TotalIssuance::checked_add(ctx.state.write().borrow_mut(), balance)
+            .c(d!("issuance overflow"))
     }
 
     fn burn(ctx: &Context, target: &Address, balance: U256) -> Result<()> {
@@ -104,10 +103,8 @@ impl<C: Config> AccountAsset<Address> for App<C> {
 
         AccountStore::insert(ctx.state.write().borrow_mut(), target, &target_account)?;
 
-        let issuance = Self::total_issuance(ctx)
-            .checked_sub(balance)
-            .c(d!("insufficient issuance"))?;
-        TotalIssuance::put(ctx.state.write().borrow_mut(), &issuance)
+        TotalIssuance::checked_sub(ctx.state.write().borrow_mut(), balance)
+            .c(d!("insufficient issuance"))
     }
 
     fn withdraw(ctx: &Context, who: &Address, value: U256) -> Result<()> {
@@ -1,39 +1,60 @@
 use crate::storage::*;
-use crate::{App, Config, ContractLog, TransactionExecuted};
+use crate::{sender_cache, speculation};
+use crate::{App, Config, ContractLog, PendingBlock, TransactionExecuted};
 use config::abci::global_cfg::CFG;
-use ethereum::{
-    BlockV0 as Block, LegacyTransactionMessage, Receipt, TransactionV0 as Transaction,
-};
+use ethereum::{BlockV0 as Block, Receipt, TransactionV0 as Transaction};
 use ethereum_types::{Bloom, BloomInput, H160, H256, H64, U256};
 use evm::{ExitFatal, ExitReason};
 use fp_core::{
-    context::Context, macros::Get, module::AppModuleBasic, transaction::ActionResult,
+    context::{Context, RunTxMode},
+    macros::Get,
+    module::AppModuleBasic,
+    transaction::ActionResult,
 };
 use fp_events::Event;
 use fp_evm::{BlockId, CallOrCreateInfo, Runner, TransactionStatus};
 use fp_storage::{Borrow, BorrowMut};
+use fp_types::actions::evm as EvmAction;
 use fp_types::crypto::HA256;
-use fp_types::{actions::evm as EvmAction, crypto::secp256k1_ecdsa_recover};
 use fp_utils::{proposer_converter, timestamp_converter};
 use log::{debug, info};
 use ruc::*;
 use sha3::{Digest, Keccak256};
+use std::collections::BTreeSet;
+
+/// Number of continuous blocks under one first key of `LogIndex`.
+const LOG_INDEX_BUCKET_SIZE: u64 = 1024;
+
+/// First key of `LogIndex`, a missing part means any value.
+fn log_index_key(address: Option<&H160>, topic0: Option<&H256>, bucket: u64) -> HA256 {
+    let mut hasher = Keccak256::new();
+    hasher.input(bucket.to_be_bytes());
+    if let Some(address) = address {
+        hasher.input(b"address");
+        hasher.input(address.as_bytes());
+    }
+    if let Some(topic0) = topic0 {
+        hasher.input(b"topic0");
+        hasher.input(topic0.as_bytes());
+    }
+    HA256::new(H256::from_slice(hasher.result().as_slice()))
+}
 
 impl<C: Config> App<C> {
     pub fn recover_signer(transaction: &Transaction) -> Option<H160> {
-        let mut sig = [0u8; 65];
-        let mut msg = [0u8; 32];
-        sig[0..32].copy_from_slice(&transaction.signature.r()[..]);
-        sig[32..64].copy_from_slice(&transaction.signature.s()[..]);
-        sig[64] = transaction.signature.standard_v();
-        msg.copy_from_slice(
-            &LegacyTransactionMessage::from(transaction.clone()).hash()[..],
-        );
-
-        let pubkey = secp256k1_ecdsa_recover(&sig, &msg).ok()?;
-        Some(H160::from(H256::from_slice(
-            Keccak256::digest(&pubkey).as_slice(),
-        )))
+        Self::recover_signer_with_hash(transaction, &Self::transaction_hash(transaction))
+    }
+
+    /// Same as `recover_signer`, for a known `transaction_hash`.
+    pub fn recover_signer_with_hash(
+        transaction: &Transaction,
+        transaction_hash: &H256,
+    ) -> Option<H160> {
+        sender_cache::recover(transaction, transaction_hash).map(|s| s.address)
+    }
+
+    pub fn transaction_hash(transaction: &Transaction) -> H256 {
+        H256::from_slice(Keccak256::digest(&rlp::encode(transaction)).as_slice())
     }
 
     pub fn store_block(&mut self, ctx: &mut Context, block_number: U256) -> Result<()> {
@@ -43,23 +64,28 @@ impl<C: Config> App<C> {
         // #[cfg(not(feature = "debug_env"))]
         // const EVM_FIRST_BLOCK_HEIGHT: U256 = U256::zero();
 
-        let mut transactions: Vec<Transaction> = Vec::new();
-        let mut statuses: Vec<TransactionStatus> = Vec::new();
-        let mut receipts: Vec<Receipt> = Vec::new();
-        let mut logs_bloom = Bloom::default();
         let mut is_store_block = true;
 
-        let pending_txs: Vec<(Transaction, TransactionStatus, Receipt)> =
-            PendingTransactions::take(ctx.db.write().borrow_mut()).unwrap_or_default();
+        let pending =
+            CurrentPendingBlock::take(ctx.db.write().borrow_mut()).unwrap_or_default();
 
         if block_number < U256::from(CFG.checkpoint.evm_first_block_height)
-            || (pending_txs.is_empty() && self.disable_eth_empty_blocks)
+            || (0 == pending.transactions && self.disable_eth_empty_blocks)
         {
             is_store_block = false;
         }
 
-        for (transaction, status, receipt) in pending_txs {
-            Self::logs_bloom(receipt.logs.clone(), &mut logs_bloom);
+        let n = pending.transactions as usize;
+        let mut transactions: Vec<Transaction> = Vec::with_capacity(n);
+        let mut statuses: Vec<TransactionStatus> = Vec::with_capacity(n);
+        let mut receipts: Vec<Receipt> = Vec::with_capacity(n);
+
+        for i in 0..pending.transactions {
+            let mut db = ctx.db.write();
+            let (transaction, status, receipt) = PendingTransactions::get(&*db, &i)
+                .c(d!(format!("missing pending transaction {}", i)))?;
+            PendingTransactions::remove(db.borrow_mut(), &i);
+
             transactions.push(transaction);
             statuses.push(status);
             receipts.push(receipt);
@@ -86,14 +112,11 @@ impl<C: Config> App<C> {
                 .unwrap_or_default(),
             state_root,
             receipts_root,
-            logs_bloom,
+            logs_bloom: pending.logs_bloom,
             difficulty: U256::zero(),
             number: block_number,
             gas_limit: C::BlockGasLimit::get(),
-            gas_used: receipts
-                .clone()
-                .into_iter()
-                .fold(U256::zero(), |acc, r| acc + r.used_gas),
+            gas_used: pending.gas_used,
             timestamp: timestamp_converter(block_timestamp),
             extra_data: Vec::new(),
             mix_hash: H256::default(),
@@ -116,6 +139,7 @@ impl<C: Config> App<C> {
                 &block_hash,
                 &statuses,
             )?;
+            Self::index_logs(ctx, block_number.low_u64(), &receipts)?;
         }
 
         debug!(target: "ethereum", "store new ethereum block: {}", block_number);
@@ -127,28 +151,36 @@ impl<C: Config> App<C> {
 
         let mut events = vec![];
 
-        let source = Self::recover_signer(&transaction)
-            .ok_or_else(|| eg!("ExecuteTransaction: InvalidSignature"))?;
+        let transaction_hash = Self::transaction_hash(&transaction);
 
-        let transaction_hash =
-            H256::from_slice(Keccak256::digest(&rlp::encode(&transaction)).as_slice());
+        let source = Self::recover_signer_with_hash(&transaction, &transaction_hash)
+            .ok_or_else(|| eg!("ExecuteTransaction: InvalidSignature"))?;
 
-        let mut pending_txs: Vec<_> =
-            PendingTransactions::get(ctx.db.read().borrow()).unwrap_or_default();
-        let transaction_index = pending_txs.len() as u32;
+        let transaction_index = CurrentPendingBlock::get(ctx.db.read().borrow())
+            .map(|p| p.transactions)
+            .unwrap_or_default();
 
         let gas_limit = transaction.gas_limit;
 
-        let execute_ret = Self::execute_transaction(
-            ctx,
-            source,
-            transaction.input.clone(),
-            transaction.value,
-            transaction.gas_limit,
-            Some(transaction.gas_price),
-            Some(transaction.nonce),
-            transaction.action,
-        );
+        let replayed = if RunTxMode::Deliver == ctx.run_mode {
+            speculation::replay(ctx, &transaction_hash)
+        } else {
+            None
+        };
+
+        let execute_ret = match replayed {
+            Some(ret) => Ok(ret),
+            None => Self::execute_transaction(
+                ctx,
+                source,
+                transaction.input.clone(),
+                transaction.value,
+                transaction.gas_limit,
+                Some(transaction.gas_price),
+                Some(transaction.nonce),
+                transaction.action,
+            ),
+        };
 
         if let Err(e) = execute_ret {
             let mut to = Default::default();
@@ -191,7 +223,7 @@ impl<C: Config> App<C> {
                     logs: info.logs.clone(),
                     logs_bloom: {
                         let mut bloom: Bloom = Bloom::default();
-                        Self::logs_bloom(info.logs, &mut bloom);
+                        Self::logs_bloom(&info.logs, &mut bloom);
                         bloom
                     },
                 },
@@ -209,7 +241,7 @@ impl<C: Config> App<C> {
                     logs: info.logs.clone(),
                     logs_bloom: {
                         let mut bloom: Bloom = Bloom::default();
-                        Self::logs_bloom(info.logs, &mut bloom);
+                        Self::logs_bloom(&info.logs, &mut bloom);
                         bloom
                     },
                 },
@@ -268,8 +300,7 @@ impl<C: Config> App<C> {
             logs: status.logs.clone(),
         };
 
-        pending_txs.push((transaction, status, receipt));
-        PendingTransactions::put(ctx.db.write().borrow_mut(), &pending_txs)?;
+        Self::push_pending_transaction(ctx, transaction, status, receipt)?;
 
         TransactionIndex::insert(
             ctx.db.write().borrow_mut(),
@@ -298,6 +329,30 @@ impl<C: Config> App<C> {
         })
     }
 
+    /// Append a delivered transaction to the current building block,
+    /// its gas used and logs bloom are accumulated into the block right now.
+    pub fn push_pending_transaction(
+        ctx: &Context,
+        transaction: Transaction,
+        status: TransactionStatus,
+        receipt: Receipt,
+    ) -> Result<()> {
+        let mut db = ctx.db.write();
+        let mut pending = CurrentPendingBlock::get(&*db).unwrap_or_default();
+        let index = pending.transactions;
+
+        pending.transactions += 1;
+        pending.gas_used = pending.gas_used.saturating_add(receipt.used_gas);
+        Self::logs_bloom(&receipt.logs, &mut pending.logs_bloom);
+
+        PendingTransactions::insert(
+            db.borrow_mut(),
+            &index,
+            &(transaction, status, receipt),
+        )?;
+        CurrentPendingBlock::put(db.borrow_mut(), &pending)
+    }
+
     #[allow(clippy::too_many_arguments)]
     /// Execute an Ethereum transaction.
     pub fn execute_transaction(
@@ -404,15 +459,101 @@ impl<C: Config> App<C> {
         TransactionIndex::get(ctx.db.read().borrow(), &HA256::new(hash))
     }
 
-    fn logs_bloom(logs: Vec<ethereum::Log>, bloom: &mut Bloom) {
+    fn logs_bloom(logs: &[ethereum::Log], bloom: &mut Bloom) {
         for log in logs {
             bloom.accrue(BloomInput::Raw(&log.address[..]));
-            for topic in log.topics {
+            for topic in log.topics.iter() {
                 bloom.accrue(BloomInput::Raw(&topic[..]));
             }
         }
     }
 
+    /// Add the block to `LogIndex` by the addresses and the first topics of its logs.
+    fn index_logs(ctx: &Context, block_number: u64, receipts: &[Receipt]) -> Result<()> {
+        if LogIndexFirstBlock::get(ctx.db.read().borrow()).is_none() {
+            LogIndexFirstBlock::put(ctx.db.write().borrow_mut(), &block_number)?;
+        }
+
+        let bucket = block_number / LOG_INDEX_BUCKET_SIZE;
+        let mut keys = BTreeSet::new();
+        for log in receipts.iter().flat_map(|r| r.logs.iter()) {
+            keys.insert(log_index_key(Some(&log.address), None, bucket));
+            if let Some(topic0) = log.topics.first() {
+                keys.insert(log_index_key(None, Some(topic0), bucket));
+                keys.insert(log_index_key(Some(&log.address), Some(topic0), bucket));
+            }
+        }
+
+        // one small entry per key and block, the earlier blocks are not rewritten
+        for key in keys.iter() {
+            LogIndex::insert(ctx.db.write().borrow_mut(), key, &block_number, &())?;
+        }
+
+        Ok(())
+    }
+
+    /// Get the numbers of the blocks within `[from, to]` that may contain logs
+    /// of any of the `addresses` and any of the `topics0`, in descending order,
+    /// an empty list means no restriction.
+    ///
+    /// Return `None` if the filter or the range is not covered by `LogIndex`.
+    pub fn indexed_log_blocks(
+        ctx: &Context,
+        addresses: &[H160],
+        topics0: &[H256],
+        from: u64,
+        to: u64,
+    ) -> Option<Vec<u64>> {
+        let first = LogIndexFirstBlock::get(ctx.db.read().borrow())?;
+        if from < first {
+            return None;
+        }
+
+        let filters = match (addresses.is_empty(), topics0.is_empty()) {
+            (true, true) => return None,
+            (false, true) => addresses
+                .iter()
+                .map(|a| (Some(a), None))
+                .collect::<Vec<_>>(),
+            (true, false) => topics0.iter().map(|t| (None, Some(t))).collect(),
+            (false, false) => addresses
+                .iter()
+                .flat_map(|a| topics0.iter().map(move |t| (Some(a), Some(t))))
+                .collect(),
+        };
+
+        let mut blocks = BTreeSet::new();
+        for bucket in (from / LOG_INDEX_BUCKET_SIZE)..=(to / LOG_INDEX_BUCKET_SIZE) {
+            for (address, topic0) in filters.iter() {
+                let key = log_index_key(*address, *topic0, bucket);
+                blocks.extend(
+                    LogIndex::iter_prefix(ctx.db.read().borrow(), &key)
+                        .map(|(n, _)| n)
+                        .filter(|n| from <= *n && *n <= to),
+                );
+            }
+        }
+
+        Some(blocks.into_iter().rev().collect())
+    }
+
+    /// Get the block with given number,
+    /// and its transaction statuses if `pred` accepts the block.
+    pub fn block_with_statuses<F: Fn(&Block) -> bool>(
+        ctx: &Context,
+        number: U256,
+        pred: F,
+    ) -> Option<(Block, Option<Vec<TransactionStatus>>)> {
+        let hash = HA256::new(Self::get_hash(ctx, number)?);
+        let block = CurrentBlock::get(ctx.db.read().borrow(), &hash)?;
+        let statuses = if pred(&block) {
+            CurrentTransactionStatuses::get(ctx.db.read().borrow(), &hash)
+        } else {
+            None
+        };
+        Some((block, statuses))
+    }
+
     fn get_hash(ctx: &Context, number: U256) -> Option<H256> {
         if let Some(hash) = BlockHash::get(ctx.db.read().borrow(), &number) {
             return Some(hash.h256());
@@ -3,9 +3,11 @@
 
 mod basic;
 mod impls;
+pub mod sender_cache;
+pub mod speculation;
 
 use abci::{RequestEndBlock, ResponseEndBlock};
-use ethereum_types::{H160, H256, U256};
+use ethereum_types::{Bloom, H160, H256, U256};
 use evm::Config as EvmConfig;
 use fp_core::{
     context::Context,
@@ -22,6 +24,7 @@ use fp_traits::{
 };
 use fp_types::{actions::ethereum::Action, crypto::Address};
 use ruc::*;
+use serde::{Deserialize, Serialize};
 use std::marker::PhantomData;
 
 pub const MODULE_NAME: &str = "ethereum";
@@ -51,7 +54,18 @@ pub trait Config {
     }
 }
 
+/// Values of the current building block,
+/// accumulated as its transactions are delivered.
+#[derive(Clone, Debug, Default, Serialize, Deserialize)]
+pub struct PendingBlock {
+    /// Number of the delivered transactions.
+    pub transactions: u32,
+    pub gas_used: U256,
+    pub logs_bloom: Bloom,
+}
+
 pub mod storage {
+    use crate::PendingBlock;
     use ethereum::{BlockV0 as Block, Receipt, TransactionV0 as Transaction};
     use ethereum_types::U256;
     use fp_evm::TransactionStatus;
@@ -62,8 +76,10 @@ pub mod storage {
     generate_storage!(Ethereum, TransactionIndex => Map<HA256, (U256, u32)>);
 
     // The following data is stored in stateless rocksdb
-    // Current building block's transactions and receipts.
-    generate_storage!(Ethereum, PendingTransactions => Value<Vec<(Transaction, TransactionStatus, Receipt)>>);
+    // Current building block's transactions and receipts, by the transaction index.
+    generate_storage!(Ethereum, PendingTransactions => Map<u32, (Transaction, TransactionStatus, Receipt)>);
+    // Gas used, logs bloom and number of the transactions of the current building block.
+    generate_storage!(Ethereum, CurrentPendingBlock => Value<PendingBlock>);
     // The current Ethereum block number.
     generate_storage!(Ethereum, CurrentBlockNumber => Value<U256>);
     // Mapping for block number and hashes.
@@ -74,6 +90,10 @@ pub mod storage {
     generate_storage!(Ethereum, CurrentReceipts => Map<HA256, Vec<Receipt>>);
     // The ethereum history transaction statuses with block number.
     generate_storage!(Ethereum, CurrentTransactionStatuses => Map<HA256, Vec<TransactionStatus>>);
+    // Index of logs, <hash of (address, topic0, bucket id)> => <block number> => ().
+    generate_storage!(Ethereum, LogIndex => DoubleMap<HA256, u64, ()>);
+    // The first block number covered by `LogIndex`.
+    generate_storage!(Ethereum, LogIndexFirstBlock => Value<u64>);
 }
 
 #[derive(Event)]
@@ -0,0 +1,133 @@
+//!
+//! # Cache of the recovered senders
+//!
+//! Recovering the sender of an EVM transaction costs tens of microseconds,
+//! and the same transaction is recovered at check, recheck and deliver,
+//! and again when the RPC builds it. The results are kept by the hash of
+//! the transaction, which covers the signature.
+//!
+//! There are two generations, the older one is dropped when the newer one
+//! is full, a hit in the older one moves the entry into the newer one.
+//!
+
+use ethereum::{LegacyTransactionMessage, TransactionV0 as Transaction};
+use ethereum_types::{H160, H256};
+use fp_types::crypto::secp256k1_ecdsa_recover;
+use lazy_static::lazy_static;
+use parking_lot::Mutex;
+use sha3::{Digest, Keccak256};
+use std::{collections::HashMap, mem, thread};
+
+/// Max number of the entries in a generation.
+const GENERATION_CAP: usize = 16384;
+
+/// Below this, recovering on the calling thread is cheaper than spawning.
+const PARALLEL_THRESHOLD: usize = 16;
+
+lazy_static! {
+    static ref CACHE: Mutex<Cache> = Mutex::new(Cache::default());
+}
+
+/// The recovered sender of a transaction.
+#[derive(Clone, Copy)]
+pub struct Sender {
+    pub address: H160,
+    pub public: [u8; 64],
+}
+
+#[derive(Default)]
+struct Cache {
+    current: HashMap<H256, Sender>,
+    previous: HashMap<H256, Sender>,
+}
+
+impl Cache {
+    fn get(&mut self, hash: &H256) -> Option<Sender> {
+        if let Some(sender) = self.current.get(hash) {
+            return Some(*sender);
+        }
+        let sender = self.previous.remove(hash)?;
+        self.insert(*hash, sender);
+        Some(sender)
+    }
+
+    fn insert(&mut self, hash: H256, sender: Sender) {
+        if self.current.len() >= GENERATION_CAP {
+            self.previous = mem::take(&mut self.current);
+        }
+        self.current.insert(hash, sender);
+    }
+}
+
+/// Recover the sender of `tx` through the cache, `hash` is its transaction hash.
+pub fn recover(tx: &Transaction, hash: &H256) -> Option<Sender> {
+    if let Some(sender) = CACHE.lock().get(hash) {
+        return Some(sender);
+    }
+    let sender = recover_uncached(tx)?;
+    CACHE.lock().insert(*hash, sender);
+    Some(sender)
+}
+
+/// Whether the sender of the transaction with `hash` is in the cache.
+pub fn contains(hash: &H256) -> bool {
+    let cache = CACHE.lock();
+    cache.current.contains_key(hash) || cache.previous.contains_key(hash)
+}
+
+/// Recover the senders missing in the cache on multiple threads,
+/// the transactions are given with their hashes.
+pub fn warm<'a>(txs: impl IntoIterator<Item = (&'a H256, &'a Transaction)>) {
+    let missing = {
+        let mut cache = CACHE.lock();
+        txs.into_iter()
+            .filter(|(hash, _)| cache.get(hash).is_none())
+            .collect::<Vec<_>>()
+    };
+    if missing.is_empty() {
+        return;
+    }
+
+    let n = if missing.len() < PARALLEL_THRESHOLD {
+        1
+    } else {
+        thread::available_parallelism().map_or(1, |n| n.get())
+    };
+    let chunk = missing.len().div_ceil(n);
+    let recovered = thread::scope(|s| {
+        missing
+            .chunks(chunk)
+            .map(|part| {
+                s.spawn(move || {
+                    part.iter()
+                        .filter_map(|(hash, tx)| {
+                            recover_uncached(tx).map(|sender| (**hash, sender))
+                        })
+                        .collect::<Vec<_>>()
+                })
+            })
+            .collect::<Vec<_>>()
+            .into_iter()
+            .flat_map(|h| h.join().unwrap_or_default())
+            .collect::<Vec<_>>()
+    });
+
+    let mut cache = CACHE.lock();
+    for (hash, sender) in recovered {
+        cache.insert(hash, sender);
+    }
+}
+
+/// Recover the sender from the signature, without the cache.
+pub fn recover_uncached(tx: &Transaction) -> Option<Sender> {
+    let mut sig = [0u8; 65];
+    let mut msg = [0u8; 32];
+    sig[0..32].copy_from_slice(&tx.signature.r()[..]);
+    sig[32..64].copy_from_slice(&tx.signature.s()[..]);
+    sig[64] = tx.signature.standard_v();
+    msg.copy_from_slice(&LegacyTransactionMessage::from(tx.clone()).hash()[..]);
+
+    let public = secp256k1_ecdsa_recover(&sig, &msg).ok()?;
+    let address = H160::from(H256::from_slice(Keccak256::digest(&public).as_slice()));
+    Some(Sender { address, public })
+}
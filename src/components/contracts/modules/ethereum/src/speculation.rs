@@ -0,0 +1,148 @@
+//!
+//! # Speculative execution
+//!
+//! The EVM transactions of a block can be executed on other threads against
+//! the state at the beginning of the block, before they are delivered.
+//!
+//! When a speculated transaction is delivered, the result is replayed if
+//! none of the keys it has accessed were written since the block began,
+//! otherwise it is executed again in order. A replayed transaction writes
+//! exactly the same values as the serial execution would do.
+//!
+
+use ethereum_types::{H160, H256};
+use fp_core::context::Context;
+use fp_evm::CallOrCreateInfo;
+use fp_storage::access::{self, StoreAccess};
+use fp_storage::{BorrowMut, WriteBatch};
+use lazy_static::lazy_static;
+use parking_lot::{Condvar, Mutex};
+use ruc::*;
+use std::collections::HashMap;
+
+/// Result of `App::execute_transaction`.
+pub type ExecuteResult = (Option<H160>, Option<H160>, CallOrCreateInfo);
+
+/// A speculative execution of a transaction.
+pub struct Speculated {
+    pub result: ExecuteResult,
+    pub state: StoreAccess,
+    pub db: StoreAccess,
+    // final values of the written keys
+    pub state_changes: WriteBatch,
+    pub db_changes: WriteBatch,
+}
+
+enum Entry {
+    Queued,
+    Running,
+    Done(Box<Speculated>),
+}
+
+#[derive(Default)]
+struct Speculations {
+    height: i64,
+    entries: HashMap<H256, Entry>,
+}
+
+lazy_static! {
+    static ref SPECULATIONS: Mutex<Speculations> = Mutex::new(Speculations::default());
+    static ref FINISHED: Condvar = Condvar::new();
+}
+
+/// Queue the transactions of a new block, the old speculations are dropped.
+pub fn begin_block<I: IntoIterator<Item = H256>>(height: i64, hashes: I) {
+    let mut s = SPECULATIONS.lock();
+    s.height = height;
+    s.entries = hashes.into_iter().map(|h| (h, Entry::Queued)).collect();
+    FINISHED.notify_all();
+}
+
+/// Drop all speculations.
+pub fn clear() {
+    begin_block(0, None);
+}
+
+/// Called before a queued speculation runs,
+/// returns `false` if it's not needed anymore.
+pub fn start(height: i64, hash: &H256) -> bool {
+    let mut s = SPECULATIONS.lock();
+    if s.height != height {
+        return false;
+    }
+    match s.entries.get_mut(hash) {
+        Some(entry @ Entry::Queued) => {
+            *entry = Entry::Running;
+            true
+        }
+        _ => false,
+    }
+}
+
+/// Report the result of a running speculation, `None` if it can not be used.
+pub fn finish(height: i64, hash: &H256, speculated: Option<Speculated>) {
+    let mut s = SPECULATIONS.lock();
+    if s.height != height || !matches!(s.entries.get(hash), Some(Entry::Running)) {
+        return;
+    }
+    match speculated {
+        Some(v) => s.entries.insert(*hash, Entry::Done(Box::new(v))),
+        None => s.entries.remove(hash),
+    };
+    FINISHED.notify_all();
+}
+
+// Take the result of a speculation, wait for it if it's running,
+// since it has started earlier than a new execution could.
+fn take(height: i64, hash: &H256) -> Option<Box<Speculated>> {
+    let mut s = SPECULATIONS.lock();
+    loop {
+        if s.height != height {
+            return None;
+        }
+        match s.entries.remove(hash) {
+            Some(Entry::Done(v)) => return Some(v),
+            Some(Entry::Running) => {
+                s.entries.insert(*hash, Entry::Running);
+                FINISHED.wait(&mut s);
+            }
+            // a queued one will be skipped
+            Some(Entry::Queued) | None => return None,
+        }
+    }
+}
+
+/// Replay the speculation of a transaction being delivered, if it's still valid.
+pub fn replay(ctx: &Context, hash: &H256) -> Option<ExecuteResult> {
+    let speculated = take(ctx.header.height, hash)?;
+
+    let state_id = access::store_id(&*ctx.state.read());
+    let db_id = access::store_id(&*ctx.db.read());
+    if access::conflicts(state_id, &speculated.state)
+        || access::conflicts(db_id, &speculated.db)
+    {
+        return None;
+    }
+
+    let Speculated {
+        result,
+        state,
+        db,
+        mut state_changes,
+        mut db_changes,
+    } = *speculated;
+
+    // a counter overflows on top of the current values,
+    // execute it again to get the same error
+    if !pnk!(state.apply_counters(&*ctx.state.read(), &mut state_changes))
+        || !pnk!(db.apply_counters(&*ctx.db.read(), &mut db_changes))
+    {
+        return None;
+    }
+
+    // can not fall back once the writes have started
+    pnk!(state_changes.apply(ctx.state.write().borrow_mut()));
+    pnk!(db_changes.apply(ctx.db.write().borrow_mut()));
+
+    Some(result)
+}
@@ -3,7 +3,7 @@ use ethereum::{TransactionAction, TransactionSignature, TransactionV0};
 use fp_core::context::Context;
 use fp_storage::{Borrow, BorrowMut, RwLock};
 use fp_types::crypto::HA256;
-use fp_types::{H256, U256};
+use fp_types::{H160, H256, U256};
 use module_ethereum::storage::TransactionIndex;
 use sha3::{Digest, Keccak256};
 use std::env::temp_dir;
@@ -80,3 +80,79 @@ fn test_eth_db_migrate_txn_index() {
         assert_eq!(value.unwrap(), txn.1);
     }
 }
+
+#[test]
+fn test_eth_db_log_index() {
+    let mut ctx = setup();
+    let mut app = module_ethereum::App::<BaseApp>::default();
+    let (addr_a, addr_b) = (H160::from_low_u64_be(1), H160::from_low_u64_be(2));
+    let (topic_x, topic_y) = (H256::from_low_u64_be(3), H256::from_low_u64_be(4));
+
+    // block n has a log of `(addr_a, topic_x)` when n is even,
+    // and a log of `(addr_b, topic_y)` when n is a multiple of 3
+    for n in 1..=12_u64 {
+        let mut logs = vec![];
+        if 0 == n % 2 {
+            logs.push((addr_a, topic_x));
+        }
+        if 0 == n % 3 {
+            logs.push((addr_b, topic_y));
+        }
+
+        for (i, (address, topic)) in logs.into_iter().enumerate() {
+            let log = ethereum::Log {
+                address,
+                topics: vec![topic],
+                data: vec![],
+            };
+            let txn = TransactionV0 {
+                nonce: U256::from(i),
+                gas_price: Default::default(),
+                gas_limit: Default::default(),
+                action: TransactionAction::Create,
+                value: Default::default(),
+                input: vec![],
+                signature: TransactionSignature::new(27, H256::random(), H256::random())
+                    .unwrap(),
+            };
+            let status = fp_evm::TransactionStatus {
+                transaction_hash: H256::random(),
+                transaction_index: i as u32,
+                from: address,
+                to: None,
+                contract_address: None,
+                logs: vec![log.clone()],
+                logs_bloom: Default::default(),
+            };
+            let receipt = ethereum::Receipt {
+                state_root: H256::from_low_u64_be(1),
+                used_gas: U256::zero(),
+                logs_bloom: Default::default(),
+                logs: vec![log],
+            };
+            module_ethereum::App::<BaseApp>::push_pending_transaction(
+                &ctx, txn, status, receipt,
+            )
+            .unwrap();
+        }
+        app.store_block(&mut ctx, U256::from(n)).unwrap();
+    }
+
+    let query = |addresses: &[H160], topics0: &[H256], from, to| {
+        module_ethereum::App::<BaseApp>::indexed_log_blocks(
+            &ctx, addresses, topics0, from, to,
+        )
+    };
+
+    assert_eq!(Some(vec![12, 10, 8, 6, 4]), query(&[addr_a], &[], 3, 12));
+    assert_eq!(Some(vec![9, 6, 3]), query(&[], &[topic_y], 1, 10));
+    assert_eq!(
+        Some(vec![12, 10, 9, 8, 6, 4, 3, 2]),
+        query(&[addr_a, addr_b], &[topic_x, topic_y], 1, 12)
+    );
+    assert_eq!(Some(vec![]), query(&[addr_a], &[topic_y], 1, 12));
+
+    // not covered by the index
+    assert_eq!(None, query(&[], &[], 1, 12));
+    assert_eq!(None, query(&[addr_a], &[], 0, 12));
+}
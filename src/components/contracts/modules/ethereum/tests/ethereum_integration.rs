@@ -153,3 +153,32 @@ fn test_abci_query() {
         10.into()
     );
 }
+
+#[test]
+fn test_sender_cache() {
+    let txs = (0..32u64)
+        .map(|nonce| {
+            let tx = UnsignedTransaction {
+                nonce: nonce.into(),
+                gas_price: U256::one(),
+                gas_limit: U256::from(21000),
+                action: ethereum::TransactionAction::Call(BOB_ECDSA.address),
+                value: U256::one(),
+                input: Vec::new(),
+            }
+            .sign(&ALICE_ECDSA.private_key, ChainId::get());
+            (module_ethereum::App::<BaseApp>::transaction_hash(&tx), tx)
+        })
+        .collect::<Vec<_>>();
+
+    module_ethereum::sender_cache::warm(txs.iter().map(|(hash, tx)| (hash, tx)));
+    for (hash, tx) in txs.iter() {
+        assert!(module_ethereum::sender_cache::contains(hash));
+        let sender = module_ethereum::sender_cache::recover(tx, hash).unwrap();
+        assert_eq!(ALICE_ECDSA.address, sender.address);
+        assert_eq!(
+            Some(ALICE_ECDSA.address),
+            module_ethereum::App::<BaseApp>::recover_signer(tx)
+        );
+    }
+}
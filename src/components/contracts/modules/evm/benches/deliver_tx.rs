@@ -0,0 +1,147 @@
+//!
+//! # Throughput of `BaseApp::deliver_tx`
+//!
+//! Blocks of native transfers and ERC20 transfers are delivered to
+//! the mocked `BaseApp`, the transactions are signed out of the timing.
+//!
+//! Run with `cargo bench -p module-evm`.
+//!
+
+#![allow(clippy::field_reassign_with_default)]
+
+#[allow(dead_code)]
+#[path = "../tests/utils/mod.rs"]
+mod utils;
+
+use {
+    abci::*,
+    baseapp::{BaseApp, ChainId},
+    criterion::{criterion_group, criterion_main, Criterion, Throughput},
+    ethereum::TransactionAction,
+    ethereum_types::U256,
+    fp_evm::CallOrCreateInfo,
+    fp_mocks::*,
+    fp_traits::evm::FeeCalculator,
+    fp_types::actions::ethereum::Action as EthereumAction,
+    fp_utils::tx::EvmRawTxWrapper,
+    std::{
+        sync::atomic::{AtomicI64, AtomicU64, Ordering},
+        time::{Duration, Instant},
+    },
+    utils::*,
+};
+
+// transactions in a block
+const TXS: u64 = 100;
+
+// next nonce of ALICE, and height of the next block
+static NONCE: AtomicU64 = AtomicU64::new(0);
+static HEIGHT: AtomicI64 = AtomicI64::new(2);
+
+fn wrap(tx: UnsignedTransaction) -> Vec<u8> {
+    let raw_tx = tx.sign(&ALICE_ECDSA.private_key, ChainId::get());
+    let function = Action::Ethereum(EthereumAction::Transact(raw_tx));
+    EvmRawTxWrapper::wrap(
+        &serde_json::to_vec(&UncheckedTransaction::<()>::new_unsigned(function))
+            .unwrap(),
+    )
+}
+
+fn next_nonce() -> U256 {
+    NONCE.fetch_add(1, Ordering::Relaxed).into()
+}
+
+// Deliver a block, returns the time spent in `deliver_tx`.
+fn deliver_block(txs: Vec<Vec<u8>>) -> (Duration, Vec<ResponseDeliverTx>) {
+    let mut app = BASE_APP.lock().unwrap();
+
+    let mut req = RequestBeginBlock::default();
+    let mut header = Header::default();
+    header.height = HEIGHT.fetch_add(1, Ordering::Relaxed);
+    req.set_header(header);
+    let _ = app.begin_block(&req);
+
+    let start = Instant::now();
+    let resps = txs
+        .into_iter()
+        .map(|tx| {
+            let mut req = RequestDeliverTx::default();
+            req.tx = tx;
+            app.deliver_tx(&req)
+        })
+        .collect::<Vec<_>>();
+    let elapsed = start.elapsed();
+
+    for resp in resps.iter() {
+        assert_eq!(0, resp.code, "deliver tx failed: {}", resp.log);
+    }
+
+    let _ = app.end_block(&RequestEndBlock::default());
+    let _ = app.commit(&RequestCommit::new());
+    (elapsed, resps)
+}
+
+// Deploy an ERC20 contract, all tokens are minted to ALICE.
+fn deploy_erc20() -> ERC20 {
+    let constructor = ERC20Constructor::load();
+    let (_, resps) =
+        deliver_block(vec![wrap(constructor.deploy("erc20", "FRA", next_nonce()))]);
+    let address = match serde_json::from_slice::<CallOrCreateInfo>(&resps[0].data)
+        .unwrap()
+    {
+        CallOrCreateInfo::Create(info) if info.exit_reason.is_succeed() => info.value,
+        info => panic!("erc20 deploy failed: {:?}", info),
+    };
+
+    let erc20 = ERC20(DeployedContract {
+        abi: constructor.0.abi,
+        address,
+    });
+    deliver_block(vec![wrap(erc20.mint(
+        ALICE_ECDSA.address,
+        U256::MAX,
+        next_nonce(),
+    ))]);
+    erc20
+}
+
+fn bench_blocks(
+    c: &mut Criterion,
+    name: &str,
+    build: impl Fn(U256) -> UnsignedTransaction,
+) {
+    let mut group = c.benchmark_group("deliver_tx");
+    group.sample_size(10).throughput(Throughput::Elements(TXS));
+    group.bench_function(name, |b| {
+        b.iter_custom(|iters| {
+            (0..iters)
+                .map(|_| {
+                    let txs = (0..TXS).map(|_| wrap(build(next_nonce()))).collect();
+                    deliver_block(txs).0
+                })
+                .sum()
+        })
+    });
+    group.finish();
+}
+
+fn deliver_tx(c: &mut Criterion) {
+    test_mint_balance(&ALICE_ECDSA.account_id, U256::MAX >> 1, 1);
+
+    bench_blocks(c, "native_transfer", |nonce| UnsignedTransaction {
+        nonce,
+        gas_price: <BaseApp as module_evm::Config>::FeeCalculator::min_gas_price(),
+        gas_limit: U256::from(DEFAULT_GAS_LIMIT),
+        action: TransactionAction::Call(BOB_ECDSA.address),
+        value: 1.into(),
+        input: Vec::new(),
+    });
+
+    let erc20 = deploy_erc20();
+    bench_blocks(c, "erc20_transfer", |nonce| {
+        erc20.transfer(BOB_ECDSA.address, 1.into(), nonce, U256::zero())
+    });
+}
+
+criterion_group!(benches, deliver_tx);
+criterion_main!(benches);
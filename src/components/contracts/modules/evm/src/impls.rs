@@ -1,7 +1,8 @@
+use crate::runtime::code_cache;
 use crate::storage::*;
 use crate::{App, Config};
 use ethereum_types::{H160, H256, U256};
-use fp_core::context::Context;
+use fp_core::context::{Context, RunTxMode};
 use fp_evm::Account;
 use fp_storage::{Borrow, BorrowMut};
 use fp_traits::{
@@ -24,6 +25,7 @@ impl<C: Config> App<C> {
 
     /// Remove an account.
     pub fn remove_account(ctx: &Context, address: &HA160) {
+        code_cache::on_code_changed(address.0);
         AccountCodes::remove(ctx.state.write().borrow_mut(), address);
         AccountStorages::remove_prefix(ctx.state.write().borrow_mut(), address);
     }
@@ -33,6 +35,7 @@ impl<C: Config> App<C> {
         if code.is_empty() {
             return Ok(());
         }
+        code_cache::on_code_changed(address.0);
         AccountCodes::insert_bytes(ctx.state.write().borrow_mut(), &address, code)
     }
 
@@ -48,7 +51,21 @@ impl<C: Config> App<C> {
 
         let version = height.unwrap_or(0);
         if version == 0 {
-            AccountCodes::get_bytes(ctx.state.read().borrow(), address)
+            // the cached code may be newer than the version of a pinned context
+            if let Some(code) = code_cache::get(&address.0, ctx.pinned_version()) {
+                // still a read of the state for the speculative executions
+                AccountCodes::mark_read(ctx.state.read().borrow(), address);
+                return Some(code.to_vec());
+            }
+
+            let code = AccountCodes::get_bytes(ctx.state.read().borrow(), address);
+            if RunTxMode::Deliver == ctx.run_mode {
+                if let Some(code) = code.as_ref() {
+                    let committed = ctx.header.height.max(1) as u64 - 1;
+                    code_cache::insert(address.0, code.clone(), committed);
+                }
+            }
+            code
         } else {
             AccountCodes::get_ver_bytes(ctx.state.read().borrow(), address, version)
         }
@@ -58,7 +58,10 @@ impl PrecompileSet for Tuple {
     ) -> Option<core::result::Result<PrecompileOutput, ExitError>> {
         for_tuples!( #(
             if address == H160::from_low_u64_be(Tuple::contract_id()) {
-                return Some(Tuple::execute(input, target_gas, context, state.ctx))
+                let ret = Tuple::execute(input, target_gas, context, state.ctx);
+                // balances may be changed by the precompile
+                state.invalidate_accounts();
+                return Some(ret)
             }
         )* );
 
@@ -0,0 +1,184 @@
+//!
+//! # Process-wide cache of contract code
+//!
+//! Contract code is read by all the contexts, eg. `deliver_state`,
+//! `check_state` and the query contexts, the decoded code is cached
+//! here by code hash, so the clones of a contract share one copy.
+//!
+//! Only the code read in the `Deliver` mode can be cached, it's always
+//! the committed one unless the code has been changed in this block.
+//! Addresses whose code is created or removed in any uncommitted state
+//! are always read from the state, until the next commit.
+//!
+//! The code is cached with the committed height it was read at,
+//! a context pinned to an older version reads it from the state,
+//! the address may have had no code at that version.
+//!
+
+use ethereum_types::{H160, H256};
+use lazy_static::lazy_static;
+use lru::LruCache;
+use parking_lot::Mutex;
+use sha3::{Digest, Keccak256};
+use std::{
+    collections::{HashMap, HashSet},
+    sync::Arc,
+};
+
+/// Max total bytes of the cached code.
+const CODE_CACHE_SIZE: usize = 64 * 1024 * 1024;
+
+lazy_static! {
+    static ref CODE_CACHE: Mutex<CodeCache> =
+        Mutex::new(CodeCache::new(CODE_CACHE_SIZE));
+}
+
+struct CodeCache {
+    // <address> => (<code hash>, <committed height of the read>), in the LRU order
+    addresses: LruCache<H160, (H256, u64)>,
+    // <code hash> => (<code>, <number of addresses>)
+    codes: HashMap<H256, (Arc<Vec<u8>>, usize)>,
+    // addresses whose code has been changed since the last commit
+    changed: HashSet<H160>,
+    size: usize,
+    size_limit: usize,
+}
+
+impl CodeCache {
+    fn new(size_limit: usize) -> Self {
+        CodeCache {
+            addresses: LruCache::unbounded(),
+            codes: HashMap::new(),
+            changed: HashSet::new(),
+            size: 0,
+            size_limit,
+        }
+    }
+
+    fn get(&mut self, address: &H160, version: Option<u64>) -> Option<Arc<Vec<u8>>> {
+        if self.changed.contains(address) {
+            return None;
+        }
+
+        let (hash, height) = self.addresses.get(address)?;
+        if version.map_or(false, |v| v < *height) {
+            return None;
+        }
+        self.codes.get(hash).map(|(code, _)| Arc::clone(code))
+    }
+
+    fn insert(&mut self, address: H160, code: Vec<u8>, height: u64) {
+        if code.is_empty()
+            || code.len() > self.size_limit
+            || self.changed.contains(&address)
+            || self.addresses.contains(&address)
+        {
+            return;
+        }
+
+        let hash = H256::from_slice(Keccak256::digest(&code).as_slice());
+        let size = &mut self.size;
+        self.codes
+            .entry(hash)
+            .or_insert_with(|| {
+                *size += code.len();
+                (Arc::new(code), 0)
+            })
+            .1 += 1;
+        self.addresses.put(address, (hash, height));
+
+        while self.size > self.size_limit {
+            match self.addresses.peek_lru().map(|(address, _)| *address) {
+                Some(address) => self.remove(&address),
+                None => break,
+            }
+        }
+    }
+
+    fn remove(&mut self, address: &H160) {
+        if let Some((hash, _)) = self.addresses.pop(address) {
+            if let Some((code, cnt)) = self.codes.get_mut(&hash) {
+                *cnt -= 1;
+                if 0 == *cnt {
+                    self.size -= code.len();
+                    self.codes.remove(&hash);
+                }
+            }
+        }
+    }
+
+    fn change(&mut self, address: H160) {
+        self.remove(&address);
+        self.changed.insert(address);
+    }
+}
+
+/// Get the cached code of an address,
+/// `version` is the version the reading context is pinned to, if any.
+#[inline(always)]
+pub fn get(address: &H160, version: Option<u64>) -> Option<Arc<Vec<u8>>> {
+    CODE_CACHE.lock().get(address, version)
+}
+
+/// Cache the code read from a `Deliver` context,
+/// `height` is the committed height the block is built on.
+#[inline(always)]
+pub fn insert(address: H160, code: Vec<u8>, height: u64) {
+    CODE_CACHE.lock().insert(address, code, height)
+}
+
+/// Must be called when a contract is created or removed in any context,
+/// the address will not be cached until the next commit.
+#[inline(always)]
+pub fn on_code_changed(address: H160) {
+    CODE_CACHE.lock().change(address)
+}
+
+/// Called after a block is committed,
+/// all changes since the last commit become a part of the chain state.
+#[inline(always)]
+pub fn on_commit() {
+    CODE_CACHE.lock().changed.clear()
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn code_cache() {
+        let mut cache = CodeCache::new(10);
+        let (a, b, c) = (
+            H160::from_low_u64_be(1),
+            H160::from_low_u64_be(2),
+            H160::from_low_u64_be(3),
+        );
+
+        // the same code is shared by addresses
+        cache.insert(a, vec![1; 4], 1);
+        cache.insert(b, vec![1; 4], 1);
+        assert_eq!(4, cache.size);
+        assert_eq!(Some(vec![1; 4]), cache.get(&b, None).map(|c| c.to_vec()));
+
+        // the least recently used one is evicted
+        cache.insert(c, vec![2; 8], 1);
+        assert_eq!(8, cache.size);
+        assert!(cache.get(&a, None).is_none());
+        assert!(cache.get(&b, None).is_none());
+        assert!(cache.get(&c, None).is_some());
+
+        // changed addresses are not cached until the next commit
+        cache.change(c);
+        assert_eq!(0, cache.size);
+        cache.insert(c, vec![3; 2], 1);
+        assert!(cache.get(&c, None).is_none());
+        cache.changed.clear();
+        cache.insert(c, vec![3; 2], 5);
+        assert_eq!(Some(vec![3; 2]), cache.get(&c, None).map(|c| c.to_vec()));
+
+        // not for the contexts pinned to the versions before the read
+        assert!(cache.get(&c, Some(4)).is_none());
+        assert!(cache.get(&c, Some(5)).is_some());
+        assert!(cache.get(&c, Some(6)).is_some());
+    }
+}
@@ -1,2 +1,3 @@
+pub mod code_cache;
 pub mod runner;
 pub mod stack;
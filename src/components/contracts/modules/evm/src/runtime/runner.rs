@@ -3,7 +3,7 @@ use crate::precompile::PrecompileSet;
 use crate::{App, Config};
 use ethereum_types::{H160, H256, U256};
 use evm::{
-    executor::{StackExecutor, StackSubstateMetadata},
+    executor::{StackExecutor, StackState, StackSubstateMetadata},
     ExitReason,
 };
 use fp_core::{context::Context, ensure};
@@ -87,6 +87,9 @@ impl<C: Config> ActionRunner<C> {
         let (reason, retv) = f(&mut executor);
 
         let used_gas = U256::from(executor.used_gas());
+        let refunded_gas =
+            U256::from(executor.state().metadata().gasometer().total_used_gas())
+                .saturating_sub(used_gas);
         let actual_fee = executor.fee(gas_price);
         log::debug!(
             target: "evm",
@@ -104,15 +107,21 @@ impl<C: Config> ActionRunner<C> {
             App::<C>::correct_and_deposit_fee(ctx, &source, actual_fee, total_fee)?;
         }
 
-        let state = executor.into_state();
+        let mut state = executor.into_state();
 
-        for address in state.substate.deletes {
-            log::debug!(
-                target: "evm",
-                "Deleting account at {:?}",
-                address
-            );
-            App::<C>::remove_account(ctx, &address.into())
+        // The context of an estimation is dropped after the execution,
+        // no need to write the changes back.
+        if !config.estimate {
+            state.flush();
+
+            for address in state.substate.deletes {
+                log::debug!(
+                    target: "evm",
+                    "Deleting account at {:?}",
+                    address
+                );
+                App::<C>::remove_account(ctx, &address.into())
+            }
         }
 
         for log in &state.substate.logs {
@@ -131,6 +140,7 @@ impl<C: Config> ActionRunner<C> {
             value: retv,
             exit_reason: reason,
             used_gas,
+            refunded_gas,
             logs: state.substate.logs,
         })
     }
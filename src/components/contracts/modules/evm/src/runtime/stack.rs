@@ -8,11 +8,16 @@ use evm::{
 };
 use fp_core::{context::Context, macros::Get};
 use fp_evm::{Log, Vicinity};
-use fp_storage::{BorrowMut, DerefMut};
+use fp_storage::{Borrow, BorrowMut, DerefMut, WriteBatch};
 use fp_traits::{account::AccountAsset, evm::BlockHashMapping};
 use fp_utils::timestamp_converter;
 use log::info;
-use std::{collections::btree_set::BTreeSet, marker::PhantomData, mem};
+use std::{
+    cell::RefCell,
+    collections::{BTreeMap, BTreeSet},
+    marker::PhantomData,
+    mem,
+};
 use storage::{db::FinDB, state::State};
 
 pub struct FindoraStackSubstate<'context, 'config> {
@@ -22,6 +27,11 @@ pub struct FindoraStackSubstate<'context, 'config> {
     pub logs: Vec<Log>,
     pub parent: Option<Box<FindoraStackSubstate<'context, 'config>>>,
     pub substate: State<FinDB>,
+    // storage writes of this substate, a zero value means removed
+    pub storages: BTreeMap<(H160, H256), H256>,
+    // accounts whose storage has been cleared in this substate
+    pub storage_resets: BTreeSet<H160>,
+    pub codes: BTreeMap<H160, Vec<u8>>,
 }
 
 impl<'context, 'config> FindoraStackSubstate<'context, 'config> {
@@ -43,6 +53,9 @@ impl<'context, 'config> FindoraStackSubstate<'context, 'config> {
             deletes: BTreeSet::new(),
             logs: Vec::new(),
             substate,
+            storages: BTreeMap::new(),
+            storage_resets: BTreeSet::new(),
+            codes: BTreeMap::new(),
         };
         mem::swap(&mut entering, self);
 
@@ -53,6 +66,7 @@ impl<'context, 'config> FindoraStackSubstate<'context, 'config> {
         let mut exited = *self.parent.take().expect("Cannot commit on root substate");
         mem::swap(&mut exited, self);
 
+        self.merge_writes(&mut exited);
         self.metadata.swallow_commit(exited.metadata)?;
         self.logs.append(&mut exited.logs);
         self.deletes.append(&mut exited.deletes);
@@ -63,6 +77,11 @@ impl<'context, 'config> FindoraStackSubstate<'context, 'config> {
     pub fn exit_revert(&mut self) -> Result<(), ExitError> {
         let mut exited = *self.parent.take().expect("Cannot discard on root substate");
         mem::swap(&mut exited, self);
+
+        // writes of the exited substate were kept in the state before this height
+        if self.ctx.header.height < CFG.checkpoint.evm_substate_height {
+            self.merge_writes(&mut exited);
+        }
         self.metadata.swallow_revert(exited.metadata)?;
 
         if self.ctx.header.height >= CFG.checkpoint.evm_substate_height {
@@ -77,6 +96,11 @@ impl<'context, 'config> FindoraStackSubstate<'context, 'config> {
     pub fn exit_discard(&mut self) -> Result<(), ExitError> {
         let mut exited = *self.parent.take().expect("Cannot discard on root substate");
         mem::swap(&mut exited, self);
+
+        // writes of the exited substate were kept in the state before this height
+        if self.ctx.header.height < CFG.checkpoint.evm_substate_height {
+            self.merge_writes(&mut exited);
+        }
         self.metadata.swallow_discard(exited.metadata)?;
 
         if self.ctx.header.height >= CFG.checkpoint.evm_substate_height {
@@ -88,6 +112,54 @@ impl<'context, 'config> FindoraStackSubstate<'context, 'config> {
         Ok(())
     }
 
+    fn merge_writes(&mut self, exited: &mut Self) {
+        for address in exited.storage_resets.iter() {
+            self.storages.retain(|(a, _), _| a != address);
+        }
+        self.storage_resets.append(&mut exited.storage_resets);
+        self.storages.append(&mut exited.storages);
+        self.codes.append(&mut exited.codes);
+    }
+
+    /// The value written by this substate or its parents, if any.
+    pub fn known_storage(&self, address: H160, index: H256) -> Option<H256> {
+        if let Some(value) = self.storages.get(&(address, index)) {
+            return Some(*value);
+        }
+
+        if self.storage_resets.contains(&address) {
+            return Some(H256::default());
+        }
+
+        self.parent
+            .as_ref()
+            .and_then(|parent| parent.known_storage(address, index))
+    }
+
+    /// The code set by this substate or its parents, if any.
+    pub fn known_code(&self, address: H160) -> Option<&Vec<u8>> {
+        if let Some(code) = self.codes.get(&address) {
+            return Some(code);
+        }
+
+        self.parent
+            .as_ref()
+            .and_then(|parent| parent.known_code(address))
+    }
+
+    pub fn set_storage(&mut self, address: H160, index: H256, value: H256) {
+        self.storages.insert((address, index), value);
+    }
+
+    pub fn reset_storage(&mut self, address: H160) {
+        self.storages.retain(|(a, _), _| *a != address);
+        self.storage_resets.insert(address);
+    }
+
+    pub fn set_code(&mut self, address: H160, code: Vec<u8>) {
+        self.codes.insert(address, code);
+    }
+
     pub fn deleted(&self, address: H160) -> bool {
         if self.deletes.contains(&address) {
             return true;
@@ -114,13 +186,34 @@ impl<'context, 'config> FindoraStackSubstate<'context, 'config> {
 }
 
 /// Findora backend for EVM.
+///
+/// Values read from `ctx.state` are cached during the whole execution,
+/// storage and code writes are kept in the substates,
+/// and are written back to `ctx.state` only once by `flush`.
 pub struct FindoraStackState<'context, 'vicinity, 'config, T> {
     pub ctx: &'context Context,
     pub vicinity: &'vicinity Vicinity,
     pub substate: FindoraStackSubstate<'context, 'config>,
+    // values in `ctx.state` when the execution starts
+    original_storages: RefCell<BTreeMap<(H160, H256), H256>>,
+    original_codes: RefCell<BTreeMap<H160, Vec<u8>>>,
+    // balances and nonces are changed by other modules,
+    // so the entries are dropped instead of updated on changes
+    accounts: RefCell<BTreeMap<H160, evm::backend::Basic>>,
     _marker: PhantomData<T>,
 }
 
+impl<'context, 'vicinity, 'config, T>
+    FindoraStackState<'context, 'vicinity, 'config, T>
+{
+    /// Drop all cached balances and nonces,
+    /// must be called after they may be changed outside of the EVM,
+    /// eg. by a precompile.
+    pub fn invalidate_accounts(&self) {
+        self.accounts.borrow_mut().clear();
+    }
+}
+
 impl<'context, 'vicinity, 'config, C: Config>
     FindoraStackState<'context, 'vicinity, 'config, C>
 {
@@ -141,10 +234,116 @@ impl<'context, 'vicinity, 'config, C: Config>
                 logs: Vec::new(),
                 parent: None,
                 substate,
+                storages: BTreeMap::new(),
+                storage_resets: BTreeSet::new(),
+                codes: BTreeMap::new(),
             },
+            original_storages: RefCell::new(BTreeMap::new()),
+            original_codes: RefCell::new(BTreeMap::new()),
+            accounts: RefCell::new(BTreeMap::new()),
             _marker: PhantomData,
         }
     }
+
+    fn original_value(&self, address: H160, index: H256) -> H256 {
+        *self
+            .original_storages
+            .borrow_mut()
+            .entry((address, index))
+            .or_insert_with(|| {
+                App::<C>::account_storages(
+                    self.ctx,
+                    &address.into(),
+                    &index.into(),
+                    None,
+                )
+                .unwrap_or_default()
+            })
+    }
+
+    /// Write all changes of storage and code back to `ctx.state`,
+    /// should be called once after the execution.
+    pub fn flush(&mut self) {
+        let substate = &mut self.substate;
+        assert!(substate.parent.is_none(), "Cannot flush a child substate");
+
+        // The reset and the following writes of a key are coalesced in the batch.
+        let mut batch = WriteBatch::new();
+
+        for address in mem::take(&mut substate.storage_resets).into_iter() {
+            AccountStorages::remove_prefix_batched(
+                self.ctx.state.read().borrow(),
+                &mut batch,
+                &address.into(),
+            );
+        }
+
+        for ((address, index), value) in mem::take(&mut substate.storages).into_iter() {
+            if value == H256::default() {
+                log::debug!(
+                    target: "evm",
+                    "Removing storage for {:?} [index: {:?}]",
+                    address,
+                    index,
+                );
+                AccountStorages::remove_batched(
+                    &mut batch,
+                    &address.into(),
+                    &index.into(),
+                );
+            } else {
+                log::debug!(
+                    target: "evm",
+                    "Updating storage for {:?} [index: {:?}, value: {:?}]",
+                    address,
+                    index,
+                    value,
+                );
+                if let Err(e) = AccountStorages::insert_batched(
+                    &mut batch,
+                    &address.into(),
+                    &index.into(),
+                    &value,
+                ) {
+                    log::error!(
+                        target: "evm",
+                        "Failed updating storage for {:?} [index: {:?}, value: {:?}], error: {:?}",
+                        address,
+                        index,
+                        value,
+                        e
+                    );
+                }
+            }
+        }
+
+        if let Err(e) = batch.apply(self.ctx.state.write().borrow_mut()) {
+            log::error!(target: "evm", "Failed writing storages, error: {:?}", e);
+        }
+
+        for (address, code) in mem::take(&mut substate.codes).into_iter() {
+            let code_len = code.len();
+            log::debug!(
+                target: "evm",
+                "Inserting code ({} bytes) at {:?}",
+                code_len,
+                address
+            );
+            if let Err(e) = App::<C>::create_account(self.ctx, address.into(), code) {
+                log::error!(
+                    target: "evm",
+                    "Failed inserting code ({} bytes) at {:?}, error: {:?}",
+                    code_len,
+                    address,
+                    e
+                );
+            }
+        }
+
+        self.original_storages.borrow_mut().clear();
+        self.original_codes.borrow_mut().clear();
+        self.invalidate_accounts();
+    }
 }
 
 impl<'context, 'vicinity, 'config, C: Config> Backend
@@ -192,25 +391,47 @@ impl<'context, 'vicinity, 'config, C: Config> Backend
     }
 
     fn basic(&self, address: H160) -> evm::backend::Basic {
-        let account = App::<C>::account_basic(self.ctx, &address);
-
-        evm::backend::Basic {
-            balance: account.balance,
-            nonce: account.nonce,
-        }
+        self.accounts
+            .borrow_mut()
+            .entry(address)
+            .or_insert_with(|| {
+                let account = App::<C>::account_basic(self.ctx, &address);
+                evm::backend::Basic {
+                    balance: account.balance,
+                    nonce: account.nonce,
+                }
+            })
+            .clone()
     }
 
     fn code(&self, address: H160) -> Vec<u8> {
-        App::<C>::account_codes(self.ctx, &address.into(), None).unwrap_or_default()
+        if let Some(code) = self.substate.known_code(address) {
+            return code.clone();
+        }
+
+        self.original_codes
+            .borrow_mut()
+            .entry(address)
+            .or_insert_with(|| {
+                App::<C>::account_codes(self.ctx, &address.into(), None)
+                    .unwrap_or_default()
+            })
+            .clone()
     }
 
     fn storage(&self, address: H160, index: H256) -> H256 {
-        App::<C>::account_storages(self.ctx, &address.into(), &index.into(), None)
-            .unwrap_or_default()
+        self.substate
+            .known_storage(address, index)
+            .unwrap_or_else(|| self.original_value(address, index))
     }
 
-    fn original_storage(&self, _address: H160, _index: H256) -> Option<H256> {
-        None
+    fn original_storage(&self, address: H160, index: H256) -> Option<H256> {
+        // the current values were used as the original ones before this height
+        if (self.ctx.header.height as u64) < CFG.checkpoint.evm_original_storage_height {
+            return None;
+        }
+
+        Some(self.original_value(address, index))
     }
 }
 
@@ -234,15 +455,27 @@ impl<'context, 'vicinity, 'config, C: Config> StackState<'config>
     }
 
     fn exit_revert(&mut self) -> Result<(), ExitError> {
+        // balances and nonces may be restored along with the state
+        self.invalidate_accounts();
         self.substate.exit_revert()
     }
 
     fn exit_discard(&mut self) -> Result<(), ExitError> {
+        self.invalidate_accounts();
         self.substate.exit_discard()
     }
 
     fn is_empty(&self, address: H160) -> bool {
-        App::<C>::is_account_empty(self.ctx, &address.into())
+        let account = self.basic(address);
+        let code_len = match self.substate.known_code(address) {
+            Some(code) => code.len(),
+            None => {
+                AccountCodes::decode_len(self.ctx.state.read().borrow(), &address.into())
+                    .unwrap_or(0)
+            }
+        };
+
+        account.nonce == U256::zero() && account.balance == U256::zero() && code_len == 0
     }
 
     fn deleted(&self, address: H160) -> bool {
@@ -250,54 +483,17 @@ impl<'context, 'vicinity, 'config, C: Config> StackState<'config>
     }
 
     fn inc_nonce(&mut self, address: H160) {
+        self.accounts.borrow_mut().remove(&address);
         let account_id = C::AddressMapping::convert_to_account_id(address);
         let _ = C::AccountAsset::inc_nonce(self.ctx, &account_id);
     }
 
     fn set_storage(&mut self, address: H160, index: H256, value: H256) {
-        if value == H256::default() {
-            log::debug!(
-                target: "evm",
-                "Removing storage for {:?} [index: {:?}]",
-                address,
-                index,
-            );
-            AccountStorages::remove(
-                self.ctx.state.write().borrow_mut(),
-                &address.into(),
-                &index.into(),
-            );
-        } else {
-            log::debug!(
-                target: "evm",
-                "Updating storage for {:?} [index: {:?}, value: {:?}]",
-                address,
-                index,
-                value,
-            );
-            if let Err(e) = AccountStorages::insert(
-                self.ctx.state.write().borrow_mut(),
-                &address.into(),
-                &index.into(),
-                &value,
-            ) {
-                log::error!(
-                    target: "evm",
-                    "Failed updating storage for {:?} [index: {:?}, value: {:?}], error: {:?}",
-                    address,
-                    index,
-                    value,
-                        e
-                );
-            }
-        }
+        self.substate.set_storage(address, index, value)
     }
 
     fn reset_storage(&mut self, address: H160) {
-        AccountStorages::remove_prefix(
-            self.ctx.state.write().borrow_mut(),
-            &address.into(),
-        );
+        self.substate.reset_storage(address)
     }
 
     fn log(&mut self, address: H160, topics: Vec<H256>, data: Vec<u8>) {
@@ -309,25 +505,18 @@ impl<'context, 'vicinity, 'config, C: Config> StackState<'config>
     }
 
     fn set_code(&mut self, address: H160, code: Vec<u8>) {
-        let code_len = code.len();
-        log::debug!(
-            target: "evm",
-            "Inserting code ({} bytes) at {:?}",
-           code_len,
-            address
-        );
-        if let Err(e) = App::<C>::create_account(self.ctx, address.into(), code) {
-            log::error!(
-                target: "evm",
-                "Failed inserting code ({} bytes) at {:?}, error: {:?}",
-                code_len,
-                address,
-                    e
-            );
+        // same as `App::create_account`
+        if !code.is_empty() {
+            self.substate.set_code(address, code)
         }
     }
 
     fn transfer(&mut self, transfer: Transfer) -> Result<(), ExitError> {
+        let mut accounts = self.accounts.borrow_mut();
+        accounts.remove(&transfer.source);
+        accounts.remove(&transfer.target);
+        drop(accounts);
+
         let source = C::AddressMapping::convert_to_account_id(transfer.source);
         let target = C::AddressMapping::convert_to_account_id(transfer.target);
 
@@ -1,12 +1,57 @@
 use abci::Header;
+use std::{
+    any::Any,
+    collections::{BTreeMap, BTreeSet},
+    sync::Weak,
+};
 use storage::{
-    db::{FinDB, RocksDB},
+    db::{FinDB, MerkleDB, RocksDB},
     state::{ChainState, State},
 };
 
 pub use parking_lot::RwLock;
 pub use std::sync::Arc;
 
+// <address of a state> => the version it's pinned to, see `Context::pin_version`
+static PINNED: RwLock<BTreeMap<usize, Pinned>> =
+    parking_lot::const_rwlock(BTreeMap::new());
+
+struct Pinned {
+    // the address of the state is not reused while this is kept
+    owner: Weak<dyn Any + Send + Sync>,
+    height: u64,
+    // read from the cache of the state, not from the version
+    written: BTreeSet<Vec<u8>>,
+}
+
+#[inline(always)]
+fn state_id<D: MerkleDB>(state: &State<D>) -> usize {
+    state as *const State<D> as usize
+}
+
+/// The version to read `key` of `state` at, if the state is pinned
+/// and the key has not been written in it.
+pub fn pinned_version<D: MerkleDB>(state: &State<D>, key: &[u8]) -> Option<u64> {
+    let pinned = PINNED.read();
+    if pinned.is_empty() {
+        return None;
+    }
+    pinned
+        .get(&state_id(state))
+        .filter(|p| 0 < p.owner.strong_count() && !p.written.contains(key))
+        .map(|p| p.height)
+}
+
+/// Record a write of `key` to `state`, it's read from the state from now on.
+pub fn on_pinned_write<D: MerkleDB>(state: &State<D>, key: &[u8]) {
+    if PINNED.read().is_empty() {
+        return;
+    }
+    if let Some(p) = PINNED.write().get_mut(&state_id(state)) {
+        p.written.insert(key.to_vec());
+    }
+}
+
 #[derive(Clone, PartialEq, Eq, Debug, Hash, Copy)]
 pub enum RunTxMode {
     None = 0,
@@ -44,13 +89,36 @@ impl Context {
     }
 
     pub fn copy_with_state(&self) -> Self {
-        Context {
+        let ctx = Context {
             state: Arc::new(RwLock::new(self.state.read().copy())),
             db: Arc::new(RwLock::new(self.db.read().copy())),
             run_mode: RunTxMode::None,
             header: self.header.clone(),
             header_hash: self.header_hash(),
+        };
+
+        // the copy is pinned to the same version, with the same written keys,
+        // the states are not locked under `PINNED`
+        let (from, to) = (state_id(&*self.state.read()), state_id(&*ctx.state.read()));
+        let mut pinned = PINNED.write();
+        let copied = pinned
+            .get(&from)
+            .filter(|p| 0 < p.owner.strong_count())
+            .map(|p| (p.height, p.written.clone()));
+        if let Some((height, written)) = copied {
+            let owner = Arc::downgrade(&ctx.state) as Weak<dyn Any + Send + Sync>;
+            pinned.insert(
+                to,
+                Pinned {
+                    owner,
+                    height,
+                    written,
+                },
+            );
         }
+        drop(pinned);
+
+        ctx
     }
 
     pub fn copy_with_new_state(&self) -> Self {
@@ -68,6 +136,42 @@ impl Context {
 }
 
 impl Context {
+    /// Pin the chain state to the committed version at `height`,
+    /// the keys not written in it are read through the versioned getters,
+    /// so it sees the same version while new blocks are committed.
+    ///
+    /// Iterations over the keys with a prefix are not versioned.
+    pub fn pin_version(&self, height: u64) {
+        let id = state_id(&*self.state.read());
+        let owner = Arc::downgrade(&self.state) as Weak<dyn Any + Send + Sync>;
+        let mut pinned = PINNED.write();
+        pinned.retain(|_, p| 0 < p.owner.strong_count());
+        pinned.insert(
+            id,
+            Pinned {
+                owner,
+                height,
+                written: BTreeSet::new(),
+            },
+        );
+    }
+
+    /// Read the latest version of the chain state from now on.
+    pub fn unpin_version(&self) {
+        let id = state_id(&*self.state.read());
+        PINNED.write().remove(&id);
+    }
+
+    /// The version the chain state is pinned to.
+    pub fn pinned_version(&self) -> Option<u64> {
+        let id = state_id(&*self.state.read());
+        PINNED
+            .read()
+            .get(&id)
+            .filter(|p| 0 < p.owner.strong_count())
+            .map(|p| p.height)
+    }
+
     pub fn run_mode(&self) -> RunTxMode {
         self.run_mode
     }
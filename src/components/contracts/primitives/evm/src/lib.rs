@@ -25,6 +25,9 @@ pub struct ExecutionInfo<T> {
     pub exit_reason: ExitReason,
     pub value: T,
     pub used_gas: U256,
+    /// Gas refunded at the end of the execution, not included in `used_gas`.
+    #[serde(default)]
+    pub refunded_gas: U256,
     pub logs: Vec<Log>,
 }
 
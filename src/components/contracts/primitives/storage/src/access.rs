@@ -0,0 +1,269 @@
+//!
+//! # Access tracking
+//!
+//! Speculative executions record the keys they read and write on their own
+//! thread, a speculation is only valid if none of these keys have been
+//! written to the deliver state since it started, which is watched here.
+//!
+//! Stores are identified by the address of their `State`,
+//! the states of a `Context` are kept in `Arc`s and never move.
+//!
+
+use crate::batch::WriteBatch;
+use fp_core::context::on_pinned_write;
+use lazy_static::lazy_static;
+use parking_lot::Mutex;
+use primitive_types::U256;
+use ruc::*;
+use std::cell::RefCell;
+use std::collections::{BTreeMap, BTreeSet};
+use std::sync::atomic::{AtomicBool, Ordering};
+use storage::db::MerkleDB;
+use storage::state::State;
+use storage::store::traits::StatelessStore;
+
+struct RawStore;
+
+impl StatelessStore for RawStore {}
+
+thread_local! {
+    static RECORDER: RefCell<Option<AccessSet>> = RefCell::new(None);
+}
+
+static WATCHING: AtomicBool = AtomicBool::new(false);
+
+lazy_static! {
+    // <store id> => <written keys>
+    static ref WATCHED: Mutex<BTreeMap<usize, BTreeSet<Vec<u8>>>> =
+        Mutex::new(BTreeMap::new());
+}
+
+/// An update of a `U256` counter, eg. the total issuance.
+///
+/// Counters are only read to be updated, so the updates of different
+/// transactions commute, and they are not taken as conflicts.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum CounterOp {
+    Add(U256),
+    Sub(U256),
+}
+
+impl CounterOp {
+    #[inline(always)]
+    pub fn apply(&self, value: U256) -> Option<U256> {
+        match self {
+            CounterOp::Add(delta) => value.checked_add(*delta),
+            CounterOp::Sub(delta) => value.checked_sub(*delta),
+        }
+    }
+}
+
+/// Keys accessed in one store.
+#[derive(Default, Debug)]
+pub struct StoreAccess {
+    pub reads: BTreeSet<Vec<u8>>,
+    // prefixes of the iterated ranges
+    pub prefixes: BTreeSet<Vec<u8>>,
+    pub writes: BTreeSet<Vec<u8>>,
+    pub counters: Vec<(Vec<u8>, CounterOp)>,
+}
+
+impl StoreAccess {
+    /// The final values of the written keys in `state`, which has been
+    /// copied from `base`.
+    ///
+    /// The keys whose final values are the same as in `base` are left out,
+    /// eg. the ones written by a reverted substate, the serial execution
+    /// drops them with the substate and never writes them.
+    pub fn changes<D: MerkleDB>(
+        &self,
+        state: &State<D>,
+        base: &State<D>,
+    ) -> Result<WriteBatch> {
+        let mut batch = WriteBatch::new();
+        for k in self.writes.iter() {
+            let value = RawStore::get::<D>(state, k).c(d!())?;
+            if value == RawStore::get::<D>(base, k).c(d!())? {
+                continue;
+            }
+            match value {
+                Some(v) => batch.set(k.clone(), v),
+                None => batch.delete(k.clone()),
+            }
+        }
+        Ok(batch)
+    }
+
+    /// Apply the counter updates on top of the current values in `state`
+    /// and put the results into `batch`, returns `false` if any of them overflows.
+    pub fn apply_counters<D: MerkleDB>(
+        &self,
+        state: &State<D>,
+        batch: &mut WriteBatch,
+    ) -> Result<bool> {
+        let mut values = BTreeMap::new();
+        for (k, op) in self.counters.iter() {
+            let value = match values.get(k) {
+                Some(v) => *v,
+                None => RawStore::get_obj::<U256, D>(state, k)
+                    .c(d!())?
+                    .unwrap_or_default(),
+            };
+            match op.apply(value) {
+                Some(v) => values.insert(k.clone(), v),
+                None => return Ok(false),
+            };
+        }
+
+        for (k, v) in values.into_iter() {
+            batch.set(k, serde_json::to_vec(&v).c(d!())?);
+        }
+        Ok(true)
+    }
+}
+
+/// Keys accessed in all stores, by store id.
+#[derive(Default, Debug)]
+pub struct AccessSet {
+    stores: BTreeMap<usize, StoreAccess>,
+}
+
+impl AccessSet {
+    /// Take the accesses to `state` out of the set.
+    pub fn take<D: MerkleDB>(&mut self, state: &State<D>) -> StoreAccess {
+        self.stores.remove(&store_id(state)).unwrap_or_default()
+    }
+
+    /// No accesses left in the set.
+    pub fn is_empty(&self) -> bool {
+        self.stores.is_empty()
+    }
+}
+
+// Stops the recording even if the recorded function panics.
+struct RecordGuard;
+
+impl Drop for RecordGuard {
+    fn drop(&mut self) {
+        RECORDER.with(|r| r.borrow_mut().take());
+    }
+}
+
+/// Run `f` and record all its accesses on this thread,
+/// recordings can not be nested.
+pub fn record<R, F: FnOnce() -> R>(f: F) -> (R, AccessSet) {
+    RECORDER.with(|r| *r.borrow_mut() = Some(AccessSet::default()));
+    let guard = RecordGuard;
+    let ret = f();
+    let set = RECORDER.with(|r| r.borrow_mut().take()).unwrap_or_default();
+    drop(guard);
+    (ret, set)
+}
+
+/// Start collecting the keys written to these stores, from all threads.
+pub fn watch(ids: &[usize]) {
+    let mut watched = WATCHED.lock();
+    watched.clear();
+    for id in ids {
+        watched.insert(*id, BTreeSet::new());
+    }
+    WATCHING.store(true, Ordering::Release);
+}
+
+/// Stop watching and drop the collected keys.
+pub fn unwatch() {
+    WATCHING.store(false, Ordering::Release);
+    WATCHED.lock().clear();
+}
+
+/// Whether any key accessed in `access` has been written to the watched store,
+/// the keys of counters are not included.
+pub fn conflicts(id: usize, access: &StoreAccess) -> bool {
+    let watched = WATCHED.lock();
+    let written = if let Some(written) = watched.get(&id) {
+        written
+    } else {
+        // not watched, nothing is known
+        return true;
+    };
+
+    access
+        .reads
+        .iter()
+        .chain(access.writes.iter())
+        .any(|k| written.contains(k))
+        || access.prefixes.iter().any(|prefix| {
+            written
+                .range(prefix.clone()..)
+                .next()
+                .map_or(false, |k| k.starts_with(prefix))
+        })
+}
+
+/// The id of a store.
+#[inline(always)]
+pub fn store_id<D: MerkleDB>(state: &State<D>) -> usize {
+    state as *const State<D> as usize
+}
+
+#[inline(always)]
+fn with_recorder<D: MerkleDB, F: FnOnce(&mut StoreAccess)>(state: &State<D>, f: F) {
+    RECORDER.with(|r| {
+        if let Some(set) = r.borrow_mut().as_mut() {
+            f(set.stores.entry(store_id(state)).or_default());
+        }
+    });
+}
+
+#[inline(always)]
+fn watch_write<D: MerkleDB>(state: &State<D>, key: &[u8]) {
+    if WATCHING.load(Ordering::Acquire) {
+        if let Some(written) = WATCHED.lock().get_mut(&store_id(state)) {
+            written.insert(key.to_vec());
+        }
+    }
+}
+
+/// Record a read of `key`, also for values served from caches.
+#[inline(always)]
+pub fn on_read<D: MerkleDB>(state: &State<D>, key: &[u8]) {
+    with_recorder(state, |s| {
+        s.reads.insert(key.to_vec());
+    });
+}
+
+/// Record an iteration over all keys with `prefix`.
+#[inline(always)]
+pub fn on_read_prefix<D: MerkleDB>(state: &State<D>, prefix: &[u8]) {
+    with_recorder(state, |s| {
+        s.prefixes.insert(prefix.to_vec());
+    });
+}
+
+/// Record a write or removal of `key`.
+#[inline(always)]
+pub fn on_write<D: MerkleDB>(state: &State<D>, key: &[u8]) {
+    with_recorder(state, |s| {
+        s.writes.insert(key.to_vec());
+    });
+    watch_write(state, key);
+    on_pinned_write(state, key);
+}
+
+/// Update the counter under `key`, a missing value is zero.
+pub fn update_counter<D: MerkleDB>(
+    state: &mut State<D>,
+    key: &[u8],
+    op: CounterOp,
+) -> Result<()> {
+    let value = crate::get_obj::<RawStore, U256, D>(state, key)
+        .c(d!())?
+        .unwrap_or_default();
+    let value = op.apply(value).c(d!("counter overflow"))?;
+    RawStore::set_obj::<U256, D>(state, key, &value).c(d!())?;
+
+    with_recorder(state, |s| s.counters.push((key.to_vec(), op)));
+    watch_write(state, key);
+    on_pinned_write(state, key);
+    Ok(())
+}
@@ -0,0 +1,80 @@
+//!
+//! # Batched writes
+//!
+//! Writes of a block, or of a transaction, can be collected in a `WriteBatch`
+//! before they hit the `State`, multiple writes to the same key are coalesced
+//! into the last one, and they are applied in the order of keys.
+//!
+
+use crate::access;
+use ruc::*;
+use std::collections::BTreeMap;
+use storage::db::MerkleDB;
+use storage::state::State;
+use storage::store::traits::StatelessStore;
+
+struct BatchStore;
+
+impl StatelessStore for BatchStore {}
+
+/// Pending writes of raw storage keys.
+#[derive(Default)]
+pub struct WriteBatch {
+    // <key> => <value>, `None` for a removal
+    ops: BTreeMap<Vec<u8>, Option<Vec<u8>>>,
+}
+
+impl WriteBatch {
+    #[inline(always)]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    #[inline(always)]
+    pub fn set(&mut self, key: Vec<u8>, value: Vec<u8>) {
+        self.ops.insert(key, Some(value));
+    }
+
+    #[inline(always)]
+    pub fn delete(&mut self, key: Vec<u8>) {
+        self.ops.insert(key, None);
+    }
+
+    /// Remove all pending keys with the prefix.
+    pub fn delete_prefix(&mut self, prefix: &[u8]) {
+        self.ops
+            .range_mut(prefix.to_vec()..)
+            .take_while(|(k, _)| k.starts_with(prefix))
+            .for_each(|(_, v)| *v = None);
+    }
+
+    /// Get the pending write of a key,
+    /// `Some(None)` means the key will be removed.
+    #[inline(always)]
+    pub fn get(&self, key: &[u8]) -> Option<Option<&[u8]>> {
+        self.ops.get(key).map(|v| v.as_deref())
+    }
+
+    /// Number of the pending keys.
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.ops.len()
+    }
+
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.ops.is_empty()
+    }
+
+    /// Write all pending changes into the state.
+    pub fn apply<D: MerkleDB>(self, state: &mut State<D>) -> Result<()> {
+        for (k, v) in self.ops.into_iter() {
+            access::on_write(state, &k);
+            match v {
+                Some(v) => BatchStore::set::<D>(state, &k, v).c(d!())?,
+                None => BatchStore::delete(state, &k).c(d!())?,
+            }
+        }
+        Ok(())
+    }
+}
@@ -0,0 +1,143 @@
+//!
+//! # Storage key builder
+//!
+//! The keys of maps are `<module prefix><storage prefix>_<key1>[_<key2>]`,
+//! they are built on the stack for each access, the known fixed-size keys
+//! are written into the buffer directly, without any temporary `String`.
+//!
+
+use crate::DB_SEPARATOR;
+use fp_types::crypto::{Address32, HA160, HA256};
+use primitive_types::U256;
+use std::fmt::{self, Write};
+
+/// Longer keys spill to the heap.
+const KEY_BUF_SIZE: usize = 192;
+
+const HEX_UPPER: &[u8; 16] = b"0123456789ABCDEF";
+
+/// A storage key being built.
+pub struct KeyBuf {
+    buf: [u8; KEY_BUF_SIZE],
+    len: usize,
+    spilled: Option<Vec<u8>>,
+}
+
+impl KeyBuf {
+    /// Start a key with the prefixes of a storage.
+    #[inline(always)]
+    pub fn new(module_prefix: &[u8], storage_prefix: &[u8]) -> Self {
+        let mut key = KeyBuf {
+            buf: [0; KEY_BUF_SIZE],
+            len: 0,
+            spilled: None,
+        };
+        key.push(module_prefix);
+        key.push(storage_prefix);
+        key
+    }
+
+    /// Append the separator and the string form of `k`.
+    #[inline(always)]
+    pub fn push_key<K: StorageKey + ?Sized>(&mut self, k: &K) -> &mut Self {
+        self.push(DB_SEPARATOR.as_bytes());
+        k.write_key(self);
+        self
+    }
+
+    /// Append raw bytes.
+    #[inline(always)]
+    pub fn push(&mut self, bytes: &[u8]) {
+        if let Some(v) = self.spilled.as_mut() {
+            v.extend_from_slice(bytes);
+        } else if self.len + bytes.len() <= KEY_BUF_SIZE {
+            self.buf[self.len..self.len + bytes.len()].copy_from_slice(bytes);
+            self.len += bytes.len();
+        } else {
+            let mut v = Vec::with_capacity(self.len + bytes.len());
+            v.extend_from_slice(&self.buf[..self.len]);
+            v.extend_from_slice(bytes);
+            self.spilled = Some(v);
+        }
+    }
+
+    /// Append the upper case hex of `bytes`.
+    #[inline(always)]
+    pub fn push_hex_upper(&mut self, bytes: &[u8]) {
+        for chunk in bytes.chunks(32) {
+            let mut hex = [0_u8; 64];
+            for (i, b) in chunk.iter().enumerate() {
+                hex[2 * i] = HEX_UPPER[(b >> 4) as usize];
+                hex[2 * i + 1] = HEX_UPPER[(b & 0xf) as usize];
+            }
+            self.push(&hex[..2 * chunk.len()]);
+        }
+    }
+
+    #[inline(always)]
+    pub fn as_slice(&self) -> &[u8] {
+        match self.spilled.as_ref() {
+            Some(v) => v.as_slice(),
+            None => &self.buf[..self.len],
+        }
+    }
+
+    #[inline(always)]
+    pub fn to_vec(&self) -> Vec<u8> {
+        self.as_slice().to_vec()
+    }
+}
+
+impl Write for KeyBuf {
+    #[inline(always)]
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        self.push(s.as_bytes());
+        Ok(())
+    }
+}
+
+/// A type which can be used as a key of maps,
+/// it must be written the same as its `ToString`.
+pub trait StorageKey: ToString {
+    #[inline(always)]
+    fn write_key(&self, buf: &mut KeyBuf) {
+        buf.push(self.to_string().as_bytes());
+    }
+}
+
+impl StorageKey for String {
+    #[inline(always)]
+    fn write_key(&self, buf: &mut KeyBuf) {
+        buf.push(self.as_bytes());
+    }
+}
+
+macro_rules! impl_display_key {
+    ($($t:ty),+) => {
+        $(impl StorageKey for $t {
+            #[inline(always)]
+            fn write_key(&self, buf: &mut KeyBuf) {
+                // never fails
+                let _ = write!(buf, "{}", self);
+            }
+        })+
+    };
+}
+
+impl_display_key!(u8, u16, u32, u64, u128, usize, U256);
+
+impl StorageKey for Address32 {}
+
+impl StorageKey for HA160 {
+    #[inline(always)]
+    fn write_key(&self, buf: &mut KeyBuf) {
+        buf.push_hex_upper(self.0.as_bytes());
+    }
+}
+
+impl StorageKey for HA256 {
+    #[inline(always)]
+    fn write_key(&self, buf: &mut KeyBuf) {
+        buf.push_hex_upper(self.h256().as_bytes());
+    }
+}
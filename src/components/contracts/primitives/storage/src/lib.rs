@@ -1,12 +1,17 @@
 #![deny(warnings)]
 #![allow(missing_docs)]
 
+pub mod access;
+pub mod batch;
 pub mod hash;
+pub mod key;
 pub mod types;
 
 #[cfg(test)]
 mod tests;
 
+pub use batch::WriteBatch;
+pub use key::{KeyBuf, StorageKey};
 pub use parking_lot::RwLock;
 pub use paste;
 pub use ruc::{d, Result, RucResult};
@@ -16,8 +21,43 @@ pub use std::ops::{Deref, DerefMut};
 pub use std::sync::Arc;
 pub use storage::store::traits::StatelessStore;
 
+use fp_core::context::pinned_version;
+use storage::{db::MerkleDB, state::State};
+
 const DB_SEPARATOR: &str = "_";
 
+// Point reads of the storage types are at the pinned version of the state,
+// if any, see `fp_core::context::Context::pin_version`.
+
+fn get_raw<I: StatelessStore, D: MerkleDB>(
+    state: &State<D>,
+    key: &[u8],
+) -> Result<Option<Vec<u8>>> {
+    match pinned_version(state, key) {
+        Some(height) => I::get_v::<D>(state, key, height).c(d!()),
+        None => I::get::<D>(state, key).c(d!()),
+    }
+}
+
+fn get_obj<I: StatelessStore, T: DeserializeOwned, D: MerkleDB>(
+    state: &State<D>,
+    key: &[u8],
+) -> Result<Option<T>> {
+    match pinned_version(state, key) {
+        Some(height) => I::get_obj_v::<T, D>(state, key, height).c(d!()),
+        None => I::get_obj::<T, D>(state, key).c(d!()),
+    }
+}
+
+fn exists<I: StatelessStore, D: MerkleDB>(state: &State<D>, key: &[u8]) -> Result<bool> {
+    match pinned_version(state, key) {
+        Some(height) => I::get_v::<D>(state, key, height)
+            .c(d!())
+            .map(|v| v.is_some()),
+        None => I::exists(state, key).c(d!()),
+    }
+}
+
 /// An instance of a storage in a module.
 pub trait StorageInstance {
     /// Prefix of a module to isolate it from other modules.
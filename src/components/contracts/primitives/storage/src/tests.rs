@@ -1,10 +1,13 @@
 use crate::hash::*;
 use crate::*;
+use fp_types::crypto::{HA160, HA256};
+use primitive_types::{H160, H256, U256};
 use sha2::Digest;
 use std::env::temp_dir;
 use std::time::SystemTime;
 use storage::db::TempFinDB;
 use storage::state::{ChainState, State};
+use storage::store::Prefix;
 
 fn setup_temp_db() -> Arc<RwLock<State<TempFinDB>>> {
     let time = SystemTime::now()
@@ -128,3 +131,197 @@ fn storage_double_map_test() {
     let kvs = Data::iterate_prefix(state.read().borrow(), &1);
     assert_eq!(kvs, vec![(3, 20)]);
 }
+
+#[test]
+fn storage_key_builder_test() {
+    generate_storage!(Findora, Names => Map<String, u32>);
+    generate_storage!(Findora, Data => DoubleMap<u32, u32, u32>);
+    generate_storage!(Findora, Storages => DoubleMap<HA160, HA256, u32>);
+
+    // the same keys as `Prefix`
+    let name = "abc".to_string();
+    assert_eq!(
+        Names::build_key_for(&name),
+        Prefix::new(b"FindoraNames").push(b"abc").as_ref().to_vec()
+    );
+    let long_name = "x".repeat(300);
+    assert_eq!(
+        Names::build_key_for(&long_name),
+        Prefix::new(b"FindoraNames")
+            .push(long_name.as_bytes())
+            .as_ref()
+            .to_vec()
+    );
+    assert_eq!(
+        Data::build_key_for(&1, &23),
+        Prefix::new(b"FindoraData")
+            .push_sub(b"1", b"23")
+            .as_ref()
+            .to_vec()
+    );
+
+    // the same strings as `ToString`
+    let address = HA160(H160::repeat_byte(0xab));
+    let index = HA256::new(H256::repeat_byte(0x1f));
+    assert_eq!(
+        Storages::build_key_for(&address, &index),
+        Prefix::new(b"FindoraStorages")
+            .push_sub(address.to_string().as_bytes(), index.to_string().as_bytes())
+            .as_ref()
+            .to_vec()
+    );
+}
+
+#[test]
+fn storage_batch_test() {
+    generate_storage!(Findora, Data => DoubleMap<u32, u32, u32>);
+
+    let state = setup_temp_db();
+    assert!(Data::insert(state.write().borrow_mut(), &1, &1, &10).is_ok());
+    assert!(Data::insert(state.write().borrow_mut(), &1, &2, &20).is_ok());
+    assert!(Data::insert(state.write().borrow_mut(), &2, &1, &30).is_ok());
+
+    let mut batch = WriteBatch::new();
+    assert!(Data::insert_batched(&mut batch, &1, &3, &40).is_ok());
+    Data::remove_prefix_batched(state.read().borrow(), &mut batch, &1);
+    assert!(Data::insert_batched(&mut batch, &1, &2, &50).is_ok());
+    assert!(Data::insert_batched(&mut batch, &2, &2, &60).is_ok());
+    Data::remove_batched(&mut batch, &2, &2);
+
+    // writes to the same key are coalesced
+    assert_eq!(batch.len(), 4);
+    assert_eq!(
+        Data::get_batched(state.read().borrow(), &batch, &1, &2),
+        Some(50)
+    );
+    assert_eq!(
+        Data::get_batched(state.read().borrow(), &batch, &1, &1),
+        None
+    );
+    assert_eq!(
+        Data::get_batched(state.read().borrow(), &batch, &2, &1),
+        Some(30)
+    );
+
+    // nothing is written before applying
+    assert_eq!(Data::get(state.read().borrow(), &1, &1), Some(10));
+    assert!(batch.apply(state.write().borrow_mut()).is_ok());
+    assert_eq!(
+        Data::iterate_prefix(state.read().borrow(), &1),
+        vec![(2, 50)]
+    );
+    assert_eq!(
+        Data::iterate_prefix(state.read().borrow(), &2),
+        vec![(1, 30)]
+    );
+
+    // lazy iteration
+    assert!(Data::insert(state.write().borrow_mut(), &2, &5, &70).is_ok());
+    assert_eq!(
+        Data::iter_prefix(state.read().borrow(), &2).next(),
+        Some((1, 30))
+    );
+}
+
+#[test]
+fn storage_access_test() {
+    generate_storage!(Findora, Names => Map<String, u32>);
+    generate_storage!(Findora, Data => DoubleMap<u32, u32, u32>);
+    generate_storage!(Findora, Issuance => Value<U256>);
+
+    let state = setup_temp_db();
+    assert!(Data::insert(state.write().borrow_mut(), &1, &1, &10).is_ok());
+    assert!(Data::insert(state.write().borrow_mut(), &2, &1, &20).is_ok());
+    assert!(Issuance::put(state.write().borrow_mut(), &100.into()).is_ok());
+
+    // a speculation on a copy of the state
+    let copied = Arc::new(RwLock::new(state.read().copy()));
+    let (_, mut accesses) = access::record(|| {
+        assert_eq!(Data::get(copied.read().borrow(), &1, &1), Some(10));
+        assert!(Data::insert(copied.write().borrow_mut(), &1, &2, &11).is_ok());
+        assert_eq!(Data::iterate_prefix(copied.read().borrow(), &2).len(), 1);
+        assert!(Issuance::checked_sub(copied.write().borrow_mut(), 10.into()).is_ok());
+    });
+    let recorded = accesses.take(&*copied.read());
+    assert!(accesses.is_empty());
+    assert_eq!(recorded.reads.len(), 1);
+    assert_eq!(recorded.prefixes.len(), 1);
+    assert_eq!(recorded.writes.len(), 1);
+    assert_eq!(recorded.counters.len(), 1);
+
+    // not recorded out of `record`
+    assert!(Names::get(copied.read().borrow(), &"a".to_string()).is_none());
+    assert!(accesses.take(&*copied.read()).reads.is_empty());
+
+    let id = access::store_id(&*state.read());
+    access::watch(&[id]);
+    assert!(!access::conflicts(id, &recorded));
+
+    // counters and other keys do not conflict
+    assert!(Names::insert(state.write().borrow_mut(), &"a".to_string(), &1).is_ok());
+    assert!(Issuance::checked_add(state.write().borrow_mut(), 5.into()).is_ok());
+    assert!(!access::conflicts(id, &recorded));
+
+    // the counter is updated on top of the current value
+    let mut changes = recorded.changes(&*copied.read(), &*state.read()).unwrap();
+    assert_eq!(changes.len(), 1);
+    assert!(recorded
+        .apply_counters(&*state.read(), &mut changes)
+        .unwrap());
+    assert!(changes.apply(state.write().borrow_mut()).is_ok());
+    assert_eq!(Data::get(state.read().borrow(), &1, &2), Some(11));
+    assert_eq!(Issuance::get(state.read().borrow()), Some(95.into()));
+
+    // a new key in the iterated range
+    assert!(Data::insert(state.write().borrow_mut(), &2, &5, &50).is_ok());
+    assert!(access::conflicts(id, &recorded));
+    access::unwatch();
+}
+
+#[test]
+fn storage_access_reverted_writes() {
+    generate_storage!(Findora, Balances => Map<String, u32>);
+    struct RawStore;
+    impl StatelessStore for RawStore {}
+
+    let state = setup_temp_db();
+    assert!(Balances::insert(state.write().borrow_mut(), &"a".to_string(), &10).is_ok());
+    let base = state.read().copy();
+
+    // a transfer from `a` to the fresh `b`, reverted as `exit_revert` does,
+    // after the fee has been charged from `a`
+    let transfer = |s: &Arc<RwLock<State<TempFinDB>>>| {
+        assert!(Balances::insert(s.write().borrow_mut(), &"a".to_string(), &9).is_ok());
+        let parent = s.read().substate();
+        assert!(Balances::insert(s.write().borrow_mut(), &"a".to_string(), &4).is_ok());
+        assert!(Balances::insert(s.write().borrow_mut(), &"b".to_string(), &5).is_ok());
+        let _ = std::mem::replace(&mut *s.write(), parent);
+    };
+
+    // serially
+    let serial = Arc::new(RwLock::new(base.copy()));
+    transfer(&serial);
+
+    // speculatively
+    let speculative = Arc::new(RwLock::new(base.copy()));
+    let (_, mut accesses) = access::record(|| transfer(&speculative));
+    let recorded = accesses.take(&*speculative.read());
+    assert_eq!(recorded.writes.len(), 2);
+    let changes = recorded.changes(&*speculative.read(), &base).unwrap();
+
+    // the same keys are changed, the reverted write to `b` is not in the batch
+    let written = recorded
+        .writes
+        .iter()
+        .filter(|k| {
+            RawStore::get::<TempFinDB>(&*serial.read(), k).unwrap()
+                != RawStore::get::<TempFinDB>(&base, k).unwrap()
+        })
+        .collect::<Vec<_>>();
+    assert_eq!(written.len(), 1);
+    assert_eq!(changes.len(), 1);
+    for k in written {
+        let v = RawStore::get::<TempFinDB>(&*serial.read(), k).unwrap();
+        assert_eq!(changes.get(k), Some(v.as_deref()));
+    }
+}
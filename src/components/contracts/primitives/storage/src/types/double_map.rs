@@ -1,4 +1,6 @@
+use crate::access;
 use crate::hash::StorageHasher;
+use crate::key::{KeyBuf, StorageKey};
 use crate::*;
 use ruc::*;
 use std::str::FromStr;
@@ -25,8 +27,8 @@ impl<Instance, Hasher, Key1, Key2, Value>
 where
     Instance: StorageInstance + StatelessStore,
     Hasher: StorageHasher<Output = [u8; 32]>,
-    Key1: ToString + FromStr,
-    Key2: ToString + FromStr,
+    Key1: StorageKey + FromStr,
+    Key2: StorageKey + FromStr,
     Value: Serialize + DeserializeOwned,
 {
     pub fn module_prefix() -> &'static [u8] {
@@ -39,16 +41,23 @@ where
 
     /// Get the storage key used to fetch a value corresponding to a specific key.
     pub fn build_key_for(k1: &Key1, k2: &Key2) -> Vec<u8> {
-        let prefix_key: Vec<u8> =
-            [Self::module_prefix(), Self::storage_prefix()].concat();
-        let data_key1 = k1.to_string();
-        let data_key2 = k2.to_string();
+        Self::key_buf(k1, k2).to_vec()
+    }
+
+    /// Build the storage key on the stack.
+    #[inline(always)]
+    pub fn key_buf(k1: &Key1, k2: &Key2) -> KeyBuf {
+        let mut buf = KeyBuf::new(Self::module_prefix(), Self::storage_prefix());
+        buf.push_key(k1).push_key(k2);
+        buf
+    }
 
-        let final_key = Prefix::new(prefix_key.as_slice());
-        final_key
-            .push_sub(data_key1.as_ref(), data_key2.as_ref())
-            .as_ref()
-            .to_vec()
+    // Prefix of all keys under `k1`.
+    #[inline(always)]
+    fn prefix_for(k1: &Key1) -> Prefix {
+        let mut buf = KeyBuf::new(Self::module_prefix(), Self::storage_prefix());
+        buf.push_key(k1);
+        Prefix::new(buf.as_slice())
     }
 
     pub fn parse_key_for(key_list: Vec<&str>) -> Result<Key2> {
@@ -61,13 +70,16 @@ where
 
     /// Does the value (explicitly) exist in storage?
     pub fn contains_key<D: MerkleDB>(state: &State<D>, k1: &Key1, k2: &Key2) -> bool {
-        Instance::exists(state, Self::build_key_for(k1, k2).as_slice()).unwrap()
+        let key = Self::key_buf(k1, k2);
+        access::on_read(state, key.as_slice());
+        crate::exists::<Instance, D>(state, key.as_slice()).unwrap()
     }
 
     /// Load the value associated with the given key from the map.
     pub fn get<D: MerkleDB>(state: &State<D>, k1: &Key1, k2: &Key2) -> Option<Value> {
-        Instance::get_obj::<Value, D>(state, Self::build_key_for(k1, k2).as_slice())
-            .unwrap()
+        let key = Self::key_buf(k1, k2);
+        access::on_read(state, key.as_slice());
+        crate::get_obj::<Instance, Value, D>(state, key.as_slice()).unwrap()
     }
 
     /// Load versioned value associated with the given key from the map.
@@ -77,12 +89,8 @@ where
         k2: &Key2,
         height: u64,
     ) -> Option<Value> {
-        Instance::get_obj_v::<Value, D>(
-            state,
-            Self::build_key_for(k1, k2).as_slice(),
-            height,
-        )
-        .unwrap()
+        Instance::get_obj_v::<Value, D>(state, Self::key_buf(k1, k2).as_slice(), height)
+            .unwrap()
     }
 
     /// Store a value to be associated with the given key from the map.
@@ -92,18 +100,84 @@ where
         k2: &Key2,
         val: &Value,
     ) -> Result<()> {
-        Instance::set_obj::<Value, D>(state, Self::build_key_for(k1, k2).as_slice(), val)
+        let key = Self::key_buf(k1, k2);
+        access::on_write(state, key.as_slice());
+        Instance::set_obj::<Value, D>(state, key.as_slice(), val)
     }
 
     /// Remove the value under a key.
     pub fn remove<D: MerkleDB>(state: &mut State<D>, k1: &Key1, k2: &Key2) {
-        Instance::delete(state, Self::build_key_for(k1, k2).as_slice()).unwrap();
+        let key = Self::key_buf(k1, k2);
+        access::on_write(state, key.as_slice());
+        Instance::delete(state, key.as_slice()).unwrap();
     }
 
     /// Remove all values under the first key.
     pub fn remove_prefix<D: MerkleDB>(state: &mut State<D>, k1: &Key1) {
-        for (k2, _) in Self::iterate_prefix(state, k1).iter() {
-            Self::remove(state, k1, k2);
+        let prefix = Self::prefix_for(k1);
+        access::on_read_prefix(state, prefix.as_ref());
+
+        // values are not decoded, only the keys are needed
+        let keys = Instance::iter_cur(state, prefix)
+            .into_iter()
+            .map(|(k, _)| k)
+            .collect::<Vec<_>>();
+        for k in keys.iter() {
+            access::on_write(state, k.as_slice());
+            Instance::delete(state, k.as_slice()).unwrap();
+        }
+    }
+
+    /// Store a value into a batch, instead of the state.
+    pub fn insert_batched(
+        batch: &mut WriteBatch,
+        k1: &Key1,
+        k2: &Key2,
+        val: &Value,
+    ) -> Result<()> {
+        let val = serde_json::to_vec(val).c(d!())?;
+        batch.set(Self::build_key_for(k1, k2), val);
+        Ok(())
+    }
+
+    /// Remove the value under a key in a batch, instead of the state.
+    pub fn remove_batched(batch: &mut WriteBatch, k1: &Key1, k2: &Key2) {
+        batch.delete(Self::build_key_for(k1, k2));
+    }
+
+    /// Load the value with the pending writes of the batch.
+    pub fn get_batched<D: MerkleDB>(
+        state: &State<D>,
+        batch: &WriteBatch,
+        k1: &Key1,
+        k2: &Key2,
+    ) -> Option<Value> {
+        let key = Self::key_buf(k1, k2);
+        match batch.get(key.as_slice()) {
+            Some(Some(v)) => serde_json::from_slice(v).ok(),
+            Some(None) => None,
+            None => {
+                access::on_read(state, key.as_slice());
+                crate::get_obj::<Instance, Value, D>(state, key.as_slice()).unwrap()
+            }
+        }
+    }
+
+    /// Remove all values under the first key in a batch, instead of the state.
+    pub fn remove_prefix_batched<D: MerkleDB>(
+        state: &State<D>,
+        batch: &mut WriteBatch,
+        k1: &Key1,
+    ) {
+        let mut prefix = KeyBuf::new(Self::module_prefix(), Self::storage_prefix());
+        prefix.push_key(k1);
+        prefix.push(DB_SEPARATOR.as_bytes());
+        batch.delete_prefix(prefix.as_slice());
+
+        let prefix = Self::prefix_for(k1);
+        access::on_read_prefix(state, prefix.as_ref());
+        for (k, _) in Instance::iter_cur(state, prefix).into_iter() {
+            batch.delete(k);
         }
     }
 
@@ -112,25 +186,26 @@ where
         state: &State<D>,
         k1: &Key1,
     ) -> Vec<(Key2, Value)> {
-        let prefix_key: Vec<u8> =
-            [Self::module_prefix(), Self::storage_prefix()].concat();
-        let data_key1 = k1.to_string();
-        let final_key = Prefix::new(prefix_key.as_slice()).push(data_key1.as_ref());
-
-        let kv_map = Instance::iter_cur(state, final_key);
-
-        let mut res = Vec::new();
-        for (k, v) in kv_map {
-            let key_str = String::from_utf8_lossy(k.as_slice()).to_string();
-            let key_list: Vec<_> = key_str.split(DB_SEPARATOR).collect();
-
-            let key = Self::parse_key_for(key_list);
-            let raw_value = serde_json::from_slice::<Value>(v.as_slice()).ok();
+        Self::iter_prefix(state, k1).collect()
+    }
 
-            if let (Ok(k), Some(v)) = (key, raw_value) {
-                res.push((k, v))
-            }
-        }
-        res
+    /// Iter over all value under the first key lazily,
+    /// entries are decoded only when they are reached.
+    pub fn iter_prefix<D: MerkleDB>(
+        state: &State<D>,
+        k1: &Key1,
+    ) -> impl Iterator<Item = (Key2, Value)> {
+        let prefix = Self::prefix_for(k1);
+        access::on_read_prefix(state, prefix.as_ref());
+
+        Instance::iter_cur(state, prefix)
+            .into_iter()
+            .filter_map(|(k, v)| {
+                let key_str = String::from_utf8_lossy(&k);
+                let key =
+                    Self::parse_key_for(key_str.split(DB_SEPARATOR).collect()).ok()?;
+                let value = serde_json::from_slice::<Value>(&v).ok()?;
+                Some((key, value))
+            })
     }
 }
@@ -1,4 +1,6 @@
+use crate::access;
 use crate::hash::StorageHasher;
+use crate::key::{KeyBuf, StorageKey};
 use crate::*;
 use ruc::*;
 use std::str::FromStr;
@@ -22,7 +24,7 @@ impl<Instance, Hasher, Key, Value> StorageMap<Instance, Hasher, Key, Value>
 where
     Instance: StorageInstance + StatelessStore,
     Hasher: StorageHasher<Output = [u8; 32]>,
-    Key: ToString + FromStr,
+    Key: StorageKey + FromStr,
     Value: Serialize + DeserializeOwned,
 {
     pub fn module_prefix() -> &'static [u8] {
@@ -35,12 +37,15 @@ where
 
     /// Get the storage key used to fetch a value corresponding to a specific key.
     pub fn build_key_for(key: &Key) -> Vec<u8> {
-        let prefix_key: Vec<u8> =
-            [Self::module_prefix(), Self::storage_prefix()].concat();
-        let data_key = key.to_string();
+        Self::key_buf(key).to_vec()
+    }
 
-        let final_key = Prefix::new(prefix_key.as_slice());
-        final_key.push(data_key.as_ref()).as_ref().to_vec()
+    /// Build the storage key on the stack.
+    #[inline(always)]
+    pub fn key_buf(key: &Key) -> KeyBuf {
+        let mut buf = KeyBuf::new(Self::module_prefix(), Self::storage_prefix());
+        buf.push_key(key);
+        buf
     }
 
     pub fn parse_key_for(key_list: Vec<&str>) -> Result<Key> {
@@ -53,26 +58,35 @@ where
 
     /// Does the value (explicitly) exist in storage?
     pub fn contains_key<D: MerkleDB>(state: &State<D>, key: &Key) -> bool {
-        Instance::exists(state, Self::build_key_for(key).as_slice()).unwrap()
+        let key = Self::key_buf(key);
+        access::on_read(state, key.as_slice());
+        crate::exists::<Instance, D>(state, key.as_slice()).unwrap()
     }
 
     /// Read the length of the storage value without decoding the entire value under the
     /// given `key`.
     pub fn decode_len<D: MerkleDB>(state: &State<D>, key: &Key) -> Option<usize> {
-        Instance::get::<D>(state, Self::build_key_for(key).as_slice())
-            .unwrap()
-            .map(|val| val.len())
+        Self::get_bytes(state, key).map(|val| val.len())
     }
 
     /// Load the value associated with the given key from the map.
     pub fn get<D: MerkleDB>(state: &State<D>, key: &Key) -> Option<Value> {
-        Instance::get_obj::<Value, D>(state, Self::build_key_for(key).as_slice())
-            .unwrap()
+        let key = Self::key_buf(key);
+        access::on_read(state, key.as_slice());
+        crate::get_obj::<Instance, Value, D>(state, key.as_slice()).unwrap()
     }
 
     /// Load the value associated with the given key from the map.
     pub fn get_bytes<D: MerkleDB>(state: &State<D>, key: &Key) -> Option<Vec<u8>> {
-        Instance::get::<D>(state, Self::build_key_for(key).as_slice()).unwrap()
+        let key = Self::key_buf(key);
+        access::on_read(state, key.as_slice());
+        crate::get_raw::<Instance, D>(state, key.as_slice()).unwrap()
+    }
+
+    /// Record a read of the key for the value served from a cache.
+    #[inline(always)]
+    pub fn mark_read<D: MerkleDB>(state: &State<D>, key: &Key) {
+        access::on_read(state, Self::key_buf(key).as_slice());
     }
 
     /// Load versioned value associated with the given key from the map.
@@ -81,12 +95,8 @@ where
         key: &Key,
         height: u64,
     ) -> Option<Value> {
-        Instance::get_obj_v::<Value, D>(
-            state,
-            Self::build_key_for(key).as_slice(),
-            height,
-        )
-        .unwrap()
+        Instance::get_obj_v::<Value, D>(state, Self::key_buf(key).as_slice(), height)
+            .unwrap()
     }
 
     /// Load versioned value associated with the given key from the map.
@@ -95,7 +105,7 @@ where
         key: &Key,
         height: u64,
     ) -> Option<Vec<u8>> {
-        Instance::get_v::<D>(state, Self::build_key_for(key).as_slice(), height).unwrap()
+        Instance::get_v::<D>(state, Self::key_buf(key).as_slice(), height).unwrap()
     }
 
     /// Load the unique key value pair with specified prefix.
@@ -103,21 +113,12 @@ where
         state: &State<D>,
         prefix: &Key,
     ) -> Option<(Key, Value)> {
-        let prefix = Prefix::new(Self::build_key_for(prefix).as_slice());
-
-        let kv_map = Instance::iter_cur(state, prefix);
-        for (k, v) in kv_map {
-            let key_str = String::from_utf8_lossy(k.as_slice()).to_string();
-            let key_list: Vec<_> = key_str.split(DB_SEPARATOR).collect();
+        let prefix = Prefix::new(Self::key_buf(prefix).as_slice());
+        access::on_read_prefix(state, prefix.as_ref());
 
-            let key = Self::parse_key_for(key_list);
-            let raw_value = serde_json::from_slice::<Value>(v.as_slice()).ok();
-
-            if let (Ok(k), Some(v)) = (key, raw_value) {
-                return Some((k, v));
-            }
-        }
-        None
+        Instance::iter_cur(state, prefix)
+            .into_iter()
+            .find_map(|(k, v)| Self::parse_entry(&k, &v))
     }
 
     /// Store a value to be associated with the given key from the map.
@@ -126,7 +127,9 @@ where
         key: &Key,
         val: &Value,
     ) -> Result<()> {
-        Instance::set_obj::<Value, D>(state, Self::build_key_for(key).as_slice(), val)
+        let key = Self::key_buf(key);
+        access::on_write(state, key.as_slice());
+        Instance::set_obj::<Value, D>(state, key.as_slice(), val)
     }
 
     /// Store a serialized value to be associated with the given key from the map.
@@ -135,34 +138,68 @@ where
         key: &Key,
         val: Vec<u8>,
     ) -> Result<()> {
-        Instance::set::<D>(state, Self::build_key_for(key).as_slice(), val)
+        let key = Self::key_buf(key);
+        access::on_write(state, key.as_slice());
+        Instance::set::<D>(state, key.as_slice(), val)
     }
 
     /// Remove the value under a key.
     pub fn remove<D: MerkleDB>(state: &mut State<D>, key: &Key) {
-        Instance::delete(state, Self::build_key_for(key).as_slice()).unwrap()
+        let key = Self::key_buf(key);
+        access::on_write(state, key.as_slice());
+        Instance::delete(state, key.as_slice()).unwrap()
+    }
+
+    /// Store a value into a batch, instead of the state.
+    pub fn insert_batched(batch: &mut WriteBatch, key: &Key, val: &Value) -> Result<()> {
+        let val = serde_json::to_vec(val).c(d!())?;
+        batch.set(Self::build_key_for(key), val);
+        Ok(())
+    }
+
+    /// Remove the value under a key in a batch, instead of the state.
+    pub fn remove_batched(batch: &mut WriteBatch, key: &Key) {
+        batch.delete(Self::build_key_for(key));
+    }
+
+    /// Load the value with the pending writes of the batch.
+    pub fn get_batched<D: MerkleDB>(
+        state: &State<D>,
+        batch: &WriteBatch,
+        key: &Key,
+    ) -> Option<Value> {
+        let key = Self::key_buf(key);
+        match batch.get(key.as_slice()) {
+            Some(Some(v)) => serde_json::from_slice(v).ok(),
+            Some(None) => None,
+            None => {
+                access::on_read(state, key.as_slice());
+                crate::get_obj::<Instance, Value, D>(state, key.as_slice()).unwrap()
+            }
+        }
     }
 
     /// Iter over all value of the storage.
     pub fn iterate<D: MerkleDB>(state: &State<D>) -> Vec<(Key, Value)> {
-        let prefix_key: Vec<u8> =
-            [Self::module_prefix(), Self::storage_prefix()].concat();
-        let prefix = Prefix::new(prefix_key.as_ref());
-
-        let kv_map = Instance::iter_cur(state, prefix);
+        Self::iter(state).collect()
+    }
 
-        let mut res = Vec::new();
-        for (k, v) in kv_map {
-            let key_str = String::from_utf8_lossy(k.as_slice()).to_string();
-            let key_list: Vec<_> = key_str.split(DB_SEPARATOR).collect();
+    /// Iter over all value of the storage lazily,
+    /// entries are decoded only when they are reached.
+    pub fn iter<D: MerkleDB>(state: &State<D>) -> impl Iterator<Item = (Key, Value)> {
+        let prefix = KeyBuf::new(Self::module_prefix(), Self::storage_prefix());
+        let prefix = Prefix::new(prefix.as_slice());
+        access::on_read_prefix(state, prefix.as_ref());
 
-            let key = Self::parse_key_for(key_list);
-            let raw_value = serde_json::from_slice::<Value>(v.as_slice()).ok();
+        Instance::iter_cur(state, prefix)
+            .into_iter()
+            .filter_map(|(k, v)| Self::parse_entry(&k, &v))
+    }
 
-            if let (Ok(k), Some(v)) = (key, raw_value) {
-                res.push((k, v))
-            }
-        }
-        res
+    fn parse_entry(k: &[u8], v: &[u8]) -> Option<(Key, Value)> {
+        let key_str = String::from_utf8_lossy(k);
+        let key = Self::parse_key_for(key_str.split(DB_SEPARATOR).collect()).ok()?;
+        let value = serde_json::from_slice::<Value>(v).ok()?;
+        Some((key, value))
     }
 }
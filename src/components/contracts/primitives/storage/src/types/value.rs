@@ -1,5 +1,7 @@
+use crate::access::{self, CounterOp};
 use crate::hash::*;
 use crate::*;
+use primitive_types::U256;
 use storage::db::MerkleDB;
 use storage::state::State;
 use storage::store::Prefix;
@@ -57,17 +59,16 @@ where
 
     /// Does the value (explicitly) exist in storage?
     pub fn exists<D: MerkleDB>(state: &State<D>) -> bool {
-        Instance::exists(state, <Self as StoragePrefixKey>::store_key().as_ref())
-            .unwrap()
+        let key = <Self as StoragePrefixKey>::store_key();
+        access::on_read(state, &key);
+        crate::exists::<Instance, D>(state, &key).unwrap()
     }
 
     /// Load the value from the provided storage instance.
     pub fn get<D: MerkleDB>(state: &State<D>) -> Option<Value> {
-        Instance::get_obj::<Value, D>(
-            state,
-            <Self as StoragePrefixKey>::store_key().as_ref(),
-        )
-        .unwrap()
+        let key = <Self as StoragePrefixKey>::store_key();
+        access::on_read(state, &key);
+        crate::get_obj::<Instance, Value, D>(state, &key).unwrap()
     }
 
     /// Load versioned value from the provided storage instance.
@@ -82,11 +83,9 @@ where
 
     /// Store a value under this hashed key into the provided storage instance.
     pub fn put<D: MerkleDB>(state: &mut State<D>, val: &Value) -> Result<()> {
-        Instance::set_obj::<Value, D>(
-            state,
-            <Self as StoragePrefixKey>::store_key().as_ref(),
-            val,
-        )
+        let key = <Self as StoragePrefixKey>::store_key();
+        access::on_write(state, &key);
+        Instance::set_obj::<Value, D>(state, &key, val)
     }
 
     /// Take the value from the provided storage instance.
@@ -98,7 +97,29 @@ where
 
     /// Take a value from storage, removing it afterwards.
     pub fn delete<D: MerkleDB>(state: &mut State<D>) {
-        Instance::delete(state, <Self as StoragePrefixKey>::store_key().as_ref())
-            .unwrap()
+        let key = <Self as StoragePrefixKey>::store_key();
+        access::on_write(state, &key);
+        Instance::delete(state, &key).unwrap()
+    }
+}
+
+impl<Instance, Hasher> StorageValue<Instance, Hasher, U256>
+where
+    Instance: StorageInstance + StatelessStore,
+    Hasher: StorageHasher<Output = [u8; 32]>,
+{
+    /// Add to the counter, a missing value is zero.
+    ///
+    /// The value is not read by the caller, so the updates
+    /// of parallel transactions are not taken as conflicts.
+    pub fn checked_add<D: MerkleDB>(state: &mut State<D>, delta: U256) -> Result<()> {
+        let key = <Self as StoragePrefixKey>::store_key();
+        access::update_counter(state, &key, CounterOp::Add(delta))
+    }
+
+    /// Subtract from the counter, a missing value is zero.
+    pub fn checked_sub<D: MerkleDB>(state: &mut State<D>, delta: U256) -> Result<()> {
+        let key = <Self as StoragePrefixKey>::store_key();
+        access::update_counter(state, &key, CounterOp::Sub(delta))
     }
 }
@@ -0,0 +1,221 @@
+use baseapp::QueryContextPool;
+use ethereum::{BlockV0 as EthereumBlock, Receipt};
+use ethereum_types::{H256, U256};
+use fp_evm::{BlockId, TransactionStatus};
+use parking_lot::RwLock;
+use std::{
+    collections::{hash_map::DefaultHasher, HashMap, VecDeque},
+    hash::{Hash, Hasher},
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc,
+    },
+};
+
+const SHARD_NUM: usize = 16;
+const HASHES_CACHE_SIZE: usize = 4096;
+
+struct Shard<K, V> {
+    // <key> => (<value>, <used since the last eviction round>)
+    map: HashMap<K, (V, AtomicBool)>,
+    // keys in the insertion order
+    queue: VecDeque<K>,
+}
+
+/// A bounded cache split into shards by the hash of keys.
+///
+/// Hits only take the read lock of one shard, and mark the entry as used
+/// atomically. Entries are evicted in the CLOCK order, used ones are given
+/// a second chance, so no reordering is needed on hits like an LRU.
+pub struct ShardedCache<K, V> {
+    shards: Vec<RwLock<Shard<K, V>>>,
+    shard_capacity: usize,
+}
+
+impl<K: Hash + Eq + Clone, V: Clone> ShardedCache<K, V> {
+    pub fn new(capacity: usize) -> Self {
+        Self {
+            shards: (0..SHARD_NUM)
+                .map(|_| {
+                    RwLock::new(Shard {
+                        map: HashMap::new(),
+                        queue: VecDeque::new(),
+                    })
+                })
+                .collect(),
+            shard_capacity: (capacity + SHARD_NUM - 1) / SHARD_NUM,
+        }
+    }
+
+    fn shard(&self, k: &K) -> &RwLock<Shard<K, V>> {
+        let mut hasher = DefaultHasher::new();
+        k.hash(&mut hasher);
+        &self.shards[hasher.finish() as usize % SHARD_NUM]
+    }
+
+    pub fn get(&self, k: &K) -> Option<V> {
+        self.shard(k).read().map.get(k).map(|(v, used)| {
+            used.store(true, Ordering::Relaxed);
+            v.clone()
+        })
+    }
+
+    pub fn insert(&self, k: K, v: V) {
+        if 0 == self.shard_capacity {
+            return;
+        }
+
+        let mut shard = self.shard(&k).write();
+        if let Some(entry) = shard.map.get_mut(&k) {
+            entry.0 = v;
+            return;
+        }
+
+        while shard.map.len() >= self.shard_capacity {
+            let oldest = if let Some(oldest) = shard.queue.pop_front() {
+                oldest
+            } else {
+                break;
+            };
+            let used = shard
+                .map
+                .get(&oldest)
+                .map(|(_, used)| used.swap(false, Ordering::Relaxed));
+            if let Some(true) = used {
+                shard.queue.push_back(oldest);
+            } else {
+                shard.map.remove(&oldest);
+            }
+        }
+
+        shard.queue.push_back(k.clone());
+        shard.map.insert(k, (v, AtomicBool::new(false)));
+    }
+}
+
+/// Caches block data and their transaction statuses and receipts.
+/// These are large and take a lot of time to fetch from the database.
+///
+/// Entries are immutable once the blocks are committed, they are shared
+/// by `Arc`, so a hit never copies the data.
+pub struct EthBlockDataCache {
+    query_pool: Arc<QueryContextPool>,
+    // <block number> => <block hash>
+    hashes: ShardedCache<U256, H256>,
+    blocks: ShardedCache<H256, Arc<EthereumBlock>>,
+    statuses: ShardedCache<H256, Arc<Vec<TransactionStatus>>>,
+    receipts: ShardedCache<H256, Arc<Vec<Receipt>>>,
+}
+
+impl EthBlockDataCache {
+    /// Create a new cache with provided cache sizes,
+    /// receipts are cached as many as the statuses.
+    pub fn new(
+        query_pool: Arc<QueryContextPool>,
+        blocks_cache_size: usize,
+        statuses_cache_size: usize,
+    ) -> Self {
+        Self {
+            query_pool,
+            hashes: ShardedCache::new(HASHES_CACHE_SIZE),
+            blocks: ShardedCache::new(blocks_cache_size),
+            statuses: ShardedCache::new(statuses_cache_size),
+            receipts: ShardedCache::new(statuses_cache_size),
+        }
+    }
+
+    /// Cache for `QueryContextPool::block_hash`, the latest one is not cached.
+    pub fn block_hash(&self, id: Option<BlockId>) -> Option<H256> {
+        match id {
+            Some(BlockId::Hash(hash)) => Some(hash),
+            Some(BlockId::Number(number)) => {
+                if let Some(hash) = self.hashes.get(&number) {
+                    return Some(hash);
+                }
+
+                let hash = self.query_pool.block_hash(Some(BlockId::Number(number)))?;
+                self.hashes.insert(number, hash);
+                Some(hash)
+            }
+            None => self.query_pool.block_hash(None),
+        }
+    }
+
+    /// Cache for `QueryContextPool::current_block`.
+    pub fn current_block(&self, id: Option<BlockId>) -> Option<Arc<EthereumBlock>> {
+        let hash = self.block_hash(id)?;
+        get_or_load(&self.blocks, hash, || {
+            self.query_pool.current_block(Some(BlockId::Hash(hash)))
+        })
+    }
+
+    /// Cache for `QueryContextPool::current_transaction_statuses`.
+    pub fn current_transaction_statuses(
+        &self,
+        id: Option<BlockId>,
+    ) -> Option<Arc<Vec<TransactionStatus>>> {
+        let hash = self.block_hash(id)?;
+        get_or_load(&self.statuses, hash, || {
+            self.query_pool
+                .current_transaction_statuses(Some(BlockId::Hash(hash)))
+        })
+    }
+
+    /// Cache for `QueryContextPool::current_receipts`.
+    pub fn current_receipts(&self, id: Option<BlockId>) -> Option<Arc<Vec<Receipt>>> {
+        let hash = self.block_hash(id)?;
+        get_or_load(&self.receipts, hash, || {
+            self.query_pool.current_receipts(Some(BlockId::Hash(hash)))
+        })
+    }
+
+    /// Load all data of a new block in advance.
+    pub fn warm_up(&self, number: U256) {
+        let id = Some(BlockId::Number(number));
+        self.current_block(id.clone());
+        self.current_transaction_statuses(id.clone());
+        self.current_receipts(id);
+    }
+}
+
+fn get_or_load<V, F: FnOnce() -> Option<V>>(
+    cache: &ShardedCache<H256, Arc<V>>,
+    hash: H256,
+    load: F,
+) -> Option<Arc<V>> {
+    if let Some(v) = cache.get(&hash) {
+        return Some(v);
+    }
+
+    let v = Arc::new(load()?);
+    cache.insert(hash, Arc::clone(&v));
+    Some(v)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn sharded_cache_eviction() {
+        let cache = ShardedCache::<u64, u64>::new(SHARD_NUM * 2);
+        let keys = (0..1000_u64)
+            .filter(|k| std::ptr::eq(cache.shard(k), cache.shard(&0)))
+            .take(4)
+            .collect::<Vec<_>>();
+
+        cache.insert(keys[0], 0);
+        cache.insert(keys[1], 1);
+        assert_eq!(Some(0), cache.get(&keys[0]));
+
+        // the used one gets a second chance
+        cache.insert(keys[2], 2);
+        assert_eq!(Some(0), cache.get(&keys[0]));
+        assert_eq!(None, cache.get(&keys[1]));
+        assert_eq!(Some(2), cache.get(&keys[2]));
+
+        cache.insert(keys[3], 3);
+        assert_eq!(2, cache.shard(&0).read().map.len());
+        assert_eq!(Some(3), cache.get(&keys[3]));
+    }
+}
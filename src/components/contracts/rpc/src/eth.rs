@@ -1,5 +1,5 @@
-use crate::{error_on_execution_failure, internal_err};
-use baseapp::{extensions::SignedExtra, BaseApp};
+use crate::{block_cache::EthBlockDataCache, error_on_execution_failure, internal_err};
+use baseapp::{extensions::SignedExtra, BaseApp, QueryContextPool};
 use ethereum::{
     BlockV0 as EthereumBlock, LegacyTransactionMessage as EthereumTransactionMessage,
     LegacyTransactionMessage, TransactionV0 as EthereumTransaction,
@@ -10,7 +10,7 @@ use fp_evm::{BlockId, Runner, TransactionStatus};
 use fp_rpc_core::types::{
     Block, BlockNumber, BlockTransactions, Bytes, CallRequest, Filter, FilteredParams,
     Index, Log, Receipt, Rich, RichBlock, SyncStatus, Transaction, TransactionRequest,
-    Work,
+    VariadicValue, Work,
 };
 use fp_rpc_core::EthApi;
 use fp_traits::{
@@ -27,6 +27,7 @@ use fp_utils::tx::EvmRawTxWrapper;
 use jsonrpc_core::{futures::future, BoxFuture, Result};
 use lazy_static::lazy_static;
 use log::{debug, warn};
+use module_ethereum::sender_cache;
 use parking_lot::RwLock;
 use ruc::eg;
 use sha3::{Digest, Keccak256};
@@ -34,6 +35,8 @@ use std::collections::BTreeMap;
 use std::convert::Into;
 use std::ops::Range;
 use std::sync::{mpsc, Arc};
+use std::thread;
+use std::time::{Duration, Instant};
 use tendermint::abci::Code;
 use tendermint_rpc::{Client, HttpClient};
 use tokio::runtime::Runtime;
@@ -41,10 +44,36 @@ use tokio::runtime::Runtime;
 lazy_static! {
     static ref RT: Runtime =
         Runtime::new().expect("Failed to create thread pool executor");
+    /// The relative tolerance of `eth_estimateGas` in basis points,
+    /// the search stops once the gap is within `highest * tolerance`.
+    static ref ESTIMATE_GAS_TOLERANCE: u64 = std::env::var("EVM_ESTIMATE_GAS_TOLERANCE")
+        .map(|t| parse_estimate_gas_tolerance(&t))
+        .unwrap_or(DEFAULT_ESTIMATE_GAS_TOLERANCE);
+}
+
+const DEFAULT_ESTIMATE_GAS_TOLERANCE: u64 = 100;
+
+// A fraction, eg. `0.01` for 100 basis points,
+// falls back to the default if it's not a finite non-negative number.
+fn parse_estimate_gas_tolerance(t: &str) -> u64 {
+    match t.trim().parse::<f64>() {
+        Ok(t) if t.is_finite() && 0.0 <= t => (t * 10000.0) as u64,
+        _ => {
+            warn!(
+                target: "eth_rpc",
+                "Invalid EVM_ESTIMATE_GAS_TOLERANCE: {:?}, use the default {} bp",
+                t,
+                DEFAULT_ESTIMATE_GAS_TOLERANCE
+            );
+            DEFAULT_ESTIMATE_GAS_TOLERANCE
+        }
+    }
 }
 
 pub struct EthApiImpl {
     account_base_app: Arc<RwLock<BaseApp>>,
+    query_pool: Arc<QueryContextPool>,
+    block_data_cache: Arc<EthBlockDataCache>,
     signers: Vec<SecpPair>,
     tm_client: Arc<HttpClient>,
     max_past_logs: u32,
@@ -56,9 +85,13 @@ impl EthApiImpl {
         account_base_app: Arc<RwLock<BaseApp>>,
         signers: Vec<SecpPair>,
         max_past_logs: u32,
+        block_data_cache: Arc<EthBlockDataCache>,
     ) -> Self {
+        let query_pool = account_base_app.read().query_pool.clone();
         Self {
             account_base_app,
+            query_pool,
+            block_data_cache,
             signers,
             tm_client: Arc::new(HttpClient::new(url.as_str()).unwrap()),
             max_past_logs,
@@ -80,8 +113,7 @@ impl EthApiImpl {
                 hash,
                 require_canonical: _,
             } => match self
-                .account_base_app
-                .read()
+                .block_data_cache
                 .current_block(Some(BlockId::Hash(hash)))
             {
                 Some(block) => Some(block.header.number.as_u64()),
@@ -112,9 +144,8 @@ impl EthApiImpl {
     /// get the range of queryable versioned data [lower, upper)
     pub fn version_range(&self) -> Result<Range<u64>> {
         let range = self
-            .account_base_app
-            .read()
-            .chain_state
+            .query_pool
+            .chain_state()
             .read()
             .get_ver_range()
             .map_err(internal_err)?;
@@ -272,7 +303,7 @@ impl EthApi for EthApiImpl {
             nonce,
         } = request;
 
-        let block = self.account_base_app.read().current_block(None);
+        let block = self.block_data_cache.current_block(None);
         // use given gas limit or query current block's limit
         let gas_limit = match gas {
             Some(amount) => amount,
@@ -359,7 +390,7 @@ impl EthApi for EthApiImpl {
     }
 
     fn author(&self) -> Result<H160> {
-        let block = self.account_base_app.read().current_block(None);
+        let block = self.block_data_cache.current_block(None);
         if let Some(block) = block {
             Ok(block.header.beneficiary)
         } else {
@@ -378,9 +409,8 @@ impl EthApi for EthApiImpl {
 
     fn block_number(&self) -> Result<U256> {
         let height = self
-            .account_base_app
-            .read()
-            .chain_state
+            .query_pool
+            .chain_state()
             .read()
             .height()
             .map_err(internal_err)?;
@@ -407,21 +437,16 @@ impl EthApi for EthApiImpl {
         debug!(target: "eth_rpc", "block_by_hash, hash:{:?}, full:{:?}", hash, full);
 
         let block = self
-            .account_base_app
-            .read()
+            .block_data_cache
             .current_block(Some(BlockId::Hash(hash)));
         let statuses = self
-            .account_base_app
-            .read()
+            .block_data_cache
             .current_transaction_statuses(Some(BlockId::Hash(hash)));
 
         match (block, statuses) {
-            (Some(block), Some(statuses)) => Ok(Some(rich_block_build(
-                block,
-                statuses.into_iter().map(Some).collect(),
-                Some(hash),
-                full,
-            ))),
+            (Some(block), Some(statuses)) => {
+                Ok(Some(rich_block_build(&block, &statuses, Some(hash), full)))
+            }
             _ => Ok(None),
         }
     }
@@ -434,22 +459,14 @@ impl EthApi for EthApiImpl {
         debug!(target: "eth_rpc", "block_by_number, number:{:?}, full:{:?}", number, full);
 
         let id = native_block_id(Some(number));
-        let block = self.account_base_app.read().current_block(id.clone());
-        let statuses = self
-            .account_base_app
-            .read()
-            .current_transaction_statuses(id);
+        let block = self.block_data_cache.current_block(id.clone());
+        let statuses = self.block_data_cache.current_transaction_statuses(id);
 
         match (block, statuses) {
             (Some(block), Some(statuses)) => {
                 let hash = block.header.hash();
 
-                Ok(Some(rich_block_build(
-                    block,
-                    statuses.into_iter().map(Some).collect(),
-                    Some(hash),
-                    full,
-                )))
+                Ok(Some(rich_block_build(&block, &statuses, Some(hash), full)))
             }
             _ => Ok(None),
         }
@@ -479,8 +496,7 @@ impl EthApi for EthApiImpl {
         debug!(target: "eth_rpc", "block_transaction_count_by_hash, hash:{:?}", hash);
 
         let block = self
-            .account_base_app
-            .read()
+            .block_data_cache
             .current_block(Some(BlockId::Hash(hash)));
         match block {
             Some(block) => Ok(Some(U256::from(block.transactions.len()))),
@@ -495,7 +511,7 @@ impl EthApi for EthApiImpl {
         debug!(target: "eth_rpc", "block_transaction_count_by_number, number:{:?}", number);
 
         let id = native_block_id(Some(number));
-        let block = self.account_base_app.read().current_block(id);
+        let block = self.block_data_cache.current_block(id);
         match block {
             Some(block) => Ok(Some(U256::from(block.transactions.len()))),
             None => Ok(None),
@@ -520,8 +536,7 @@ impl EthApi for EthApiImpl {
 
         let height = self.block_number_to_height(number)?;
         Ok(self
-            .account_base_app
-            .read()
+            .query_pool
             .account_code_at(address, height)
             .unwrap_or_default()
             .into())
@@ -599,8 +614,7 @@ impl EthApi for EthApiImpl {
                 require_canonical: _,
             } => {
                 if let Some(block) = self
-                    .account_base_app
-                    .read()
+                    .block_data_cache
                     .current_block(Some(BlockId::Hash(hash)))
                 {
                     (Some(BlockId::Number(block.header.number)), false)
@@ -616,8 +630,7 @@ impl EthApi for EthApiImpl {
 
         let mut highest = if let Some(gas) = request.gas {
             gas
-        } else if let Some(block) = self.account_base_app.read().current_block(block_id)
-        {
+        } else if let Some(block) = self.block_data_cache.current_block(block_id) {
             block.header.gas_limit
         } else {
             gas_limit
@@ -654,36 +667,39 @@ impl EthApi for EthApiImpl {
             data: Vec<u8>,
             exit_reason: ExitReason,
             used_gas: U256,
+            refunded_gas: U256,
         }
 
-        let execute_call_or_create = move |request: CallRequest,
-                                           gas_limit|
-              -> Result<ExecuteResult> {
-            let ctx = self
-                .account_base_app
+        // All probes run on copies of one snapshot, so they see the same state,
+        // each copy starts with the cache of the snapshot, not of other probes.
+        let snapshot = if pending {
+            self.account_base_app
                 .read()
-                .create_query_context(if pending { None } else { Some(0) }, false)
+                .create_query_context(None, false)
                 .map_err(|err| {
                     internal_err(format!("create query context error: {:?}", err))
-                })?;
+                })?
+        } else {
+            self.query_pool.get().copy_with_state()
+        };
+
+        let mut config = <BaseApp as module_ethereum::Config>::config().clone();
+        config.estimate = true;
+
+        let execute_call_or_create = |request: &CallRequest,
+                                      gas_limit|
+         -> Result<ExecuteResult> {
+            let ctx = snapshot.copy_with_state();
 
             let CallRequest {
                 from,
                 to,
                 gas_price,
-                gas,
+                gas: _,
                 value,
                 data,
                 nonce,
-            } = request;
-
-            let gas_limit = core::cmp::min(
-                gas.unwrap_or_else(|| U256::from(gas_limit)).low_u64(),
-                gas_limit,
-            );
-
-            let mut config = <BaseApp as module_ethereum::Config>::config().clone();
-            config.estimate = true;
+            } = request.clone();
 
             match to {
                 Some(to) => {
@@ -709,6 +725,7 @@ impl EthApi for EthApiImpl {
                         data: info.value,
                         exit_reason: info.exit_reason,
                         used_gas: info.used_gas,
+                        refunded_gas: info.refunded_gas,
                     })
                 }
                 None => {
@@ -733,46 +750,55 @@ impl EthApi for EthApiImpl {
                         data: vec![],
                         exit_reason: info.exit_reason,
                         used_gas: info.used_gas,
+                        refunded_gas: info.refunded_gas,
                     })
                 }
             }
         };
 
-        let result = execute_call_or_create(request.clone(), highest.low_u64())?;
+        let result = execute_call_or_create(&request, highest.low_u64())?;
 
         error_on_execution_failure(&result.exit_reason, &result.data)?;
 
+        // The refund is paid after the execution, so the gas limit must cover
+        // the gas used before refunding, it's enough for most transactions.
+        let mut mid = result.used_gas + result.refunded_gas;
+        if mid >= highest {
+            return Ok(highest);
+        }
+
+        // Known results: `highest` succeeds, `lowest` fails.
+        let mut lowest = mid.saturating_sub(U256::one());
+        let tolerance = *ESTIMATE_GAS_TOLERANCE;
+        let mut first_retry = true;
+
+        while (highest - lowest)
+            > std::cmp::max(U256::one(), highest / 10000 * tolerance)
         {
-            let mut lowest = U256::from(21_000);
-            let mut mid = std::cmp::min(result.used_gas * 3, (highest + lowest) / 2);
-            let mut previous_highest = highest;
-
-            while (highest - lowest) > U256::one() {
-                let ExecuteResult {
-                    data,
-                    exit_reason,
-                    used_gas: _,
-                } = execute_call_or_create(request.clone(), mid.low_u64())?;
-                match exit_reason {
-                    ExitReason::Succeed(_) => {
-                        highest = mid;
-                        if (previous_highest - highest) * 10 / previous_highest
-                            < U256::one()
-                        {
-                            return Ok(highest);
-                        }
-                        previous_highest = highest;
-                    }
-                    ExitReason::Revert(_) | ExitReason::Error(ExitError::OutOfGas) => {
-                        lowest = mid;
-                    }
-                    other => error_on_execution_failure(&other, &data)?,
+            let ExecuteResult {
+                data, exit_reason, ..
+            } = execute_call_or_create(&request, mid.low_u64())?;
+            match exit_reason {
+                ExitReason::Succeed(_) => {
+                    highest = mid;
+                }
+                ExitReason::Revert(_) | ExitReason::Error(ExitError::OutOfGas) => {
+                    lowest = mid;
                 }
-                mid = (highest + lowest) / 2;
+                other => error_on_execution_failure(&other, &data)?,
             }
+
+            mid = if first_retry && lowest == mid {
+                // Only 63/64 of the remaining gas is passed to sub calls,
+                // the gap is usually small, so try a close one first.
+                std::cmp::min(mid + mid / 63 + 1, (highest + lowest) / 2)
+            } else {
+                (highest + lowest) / 2
+            };
+            first_retry = false;
         }
 
-        Ok(result.used_gas)
+        Ok(highest)
     }
 
     fn transaction_by_hash(&self, hash: H256) -> Result<Option<Transaction>> {
@@ -780,16 +806,14 @@ impl EthApi for EthApiImpl {
 
         let mut id = None;
         let mut index = 0;
-        if let Some((number, idx)) = self.account_base_app.read().transaction_index(hash)
-        {
+        if let Some((number, idx)) = self.query_pool.transaction_index(hash) {
             id = Some(BlockId::Number(number));
             index = idx as usize
         }
 
-        let block = self.account_base_app.read().current_block(id.clone());
+        let block = self.block_data_cache.current_block(id.clone());
         let statuses = self
-            .account_base_app
-            .read()
+            .block_data_cache
             .current_transaction_statuses(id.clone());
 
         match (block, statuses) {
@@ -805,9 +829,9 @@ impl EthApi for EthApiImpl {
                 }
 
                 Ok(Some(transaction_build(
-                    block.transactions[index].clone(),
-                    Some(block),
-                    Some(statuses[index].clone()),
+                    &block.transactions[index],
+                    Some(&block),
+                    statuses.get(index),
                 )))
             }
             _ => Ok(None),
@@ -823,12 +847,10 @@ impl EthApi for EthApiImpl {
 
         let index = index.value();
         let block = self
-            .account_base_app
-            .read()
+            .block_data_cache
             .current_block(Some(BlockId::Hash(hash)));
         let statuses = self
-            .account_base_app
-            .read()
+            .block_data_cache
             .current_transaction_statuses(Some(BlockId::Hash(hash)));
 
         match (block, statuses) {
@@ -838,9 +860,9 @@ impl EthApi for EthApiImpl {
                 }
 
                 Ok(Some(transaction_build(
-                    block.transactions[index].clone(),
-                    Some(block),
-                    Some(statuses[index].clone()),
+                    &block.transactions[index],
+                    Some(&block),
+                    statuses.get(index),
                 )))
             }
             _ => Ok(None),
@@ -856,11 +878,8 @@ impl EthApi for EthApiImpl {
 
         let id = native_block_id(Some(number));
         let index = index.value();
-        let block = self.account_base_app.read().current_block(id.clone());
-        let statuses = self
-            .account_base_app
-            .read()
-            .current_transaction_statuses(id);
+        let block = self.block_data_cache.current_block(id.clone());
+        let statuses = self.block_data_cache.current_transaction_statuses(id);
 
         match (block, statuses) {
             (Some(block), Some(statuses)) => {
@@ -869,9 +888,9 @@ impl EthApi for EthApiImpl {
                 }
 
                 Ok(Some(transaction_build(
-                    block.transactions[index].clone(),
-                    Some(block),
-                    Some(statuses[index].clone()),
+                    &block.transactions[index],
+                    Some(&block),
+                    statuses.get(index),
                 )))
             }
             _ => Ok(None),
@@ -883,18 +902,16 @@ impl EthApi for EthApiImpl {
 
         let mut id = None;
         let mut index = 0;
-        if let Some((number, idx)) = self.account_base_app.read().transaction_index(hash)
-        {
+        if let Some((number, idx)) = self.query_pool.transaction_index(hash) {
             id = Some(BlockId::Number(number));
             index = idx as usize
         }
 
-        let block = self.account_base_app.read().current_block(id.clone());
+        let block = self.block_data_cache.current_block(id.clone());
         let statuses = self
-            .account_base_app
-            .read()
+            .block_data_cache
             .current_transaction_statuses(id.clone());
-        let receipts = self.account_base_app.read().current_receipts(id.clone());
+        let receipts = self.block_data_cache.current_receipts(id.clone());
 
         match (block, statuses, receipts) {
             (Some(block), Some(statuses), Some(receipts)) => {
@@ -912,10 +929,10 @@ impl EthApi for EthApiImpl {
                 let block_hash = H256::from_slice(
                     Keccak256::digest(&rlp::encode(&block.header)).as_slice(),
                 );
-                let receipt = receipts[index].clone();
-                let status = statuses[index].clone();
-                let mut cumulative_receipts = receipts;
-                cumulative_receipts.truncate((status.transaction_index + 1) as usize);
+                let receipt = &receipts[index];
+                let status = &statuses[index];
+                let cumulative_receipts = &receipts
+                    [..receipts.len().min((status.transaction_index + 1) as usize)];
 
                 return Ok(Some(Receipt {
                     transaction_hash: Some(status.transaction_hash),
@@ -935,10 +952,10 @@ impl EthApi for EthApiImpl {
                     contract_address: status.contract_address,
                     logs: {
                         let mut pre_receipts_log_index = None;
-                        if !cumulative_receipts.is_empty() {
-                            cumulative_receipts.truncate(cumulative_receipts.len() - 1);
+                        if let Some((_, pre_receipts)) = cumulative_receipts.split_last()
+                        {
                             pre_receipts_log_index = Some(
-                                cumulative_receipts
+                                pre_receipts
                                     .iter()
                                     .map(|r| r.logs.len() as u32)
                                     .sum::<u32>(),
@@ -995,23 +1012,18 @@ impl EthApi for EthApiImpl {
         let mut ret: Vec<Log> = Vec::new();
         if let Some(hash) = filter.block_hash {
             let block = self
-                .account_base_app
-                .read()
+                .block_data_cache
                 .current_block(Some(BlockId::Hash(hash)));
             let statuses = self
-                .account_base_app
-                .read()
+                .block_data_cache
                 .current_transaction_statuses(Some(BlockId::Hash(hash)));
 
             if let (Some(block), Some(statuses)) = (block, statuses) {
-                filter_block_logs(&mut ret, &filter, block, statuses);
+                filter_block_logs(&mut ret, &filter, &block, &statuses);
             }
         } else {
-            let current_number = self
-                .account_base_app
-                .read()
-                .current_block_number()
-                .unwrap_or_default();
+            let current_number =
+                self.query_pool.current_block_number().unwrap_or_default();
             let mut to_number = filter
                 .to_block
                 .clone()
@@ -1031,12 +1043,13 @@ impl EthApi for EthApiImpl {
                 .unwrap_or(current_number);
 
             filter_range_logs(
-                self.account_base_app.clone(),
+                &self.query_pool,
                 &mut ret,
                 self.max_past_logs,
                 &filter,
-                from_number,
-                to_number,
+                from_number.low_u64(),
+                to_number.low_u64(),
+                None,
             )?;
         }
         debug!(target: "eth_rpc", "logs, ret: {:?}", ret);
@@ -1092,8 +1105,8 @@ pub fn sign_transaction_message(
 }
 
 fn rich_block_build(
-    block: EthereumBlock,
-    statuses: Vec<Option<TransactionStatus>>,
+    block: &EthereumBlock,
+    statuses: &[TransactionStatus],
     hash: Option<H256>,
     full_transactions: bool,
 ) -> RichBlock {
@@ -1133,9 +1146,9 @@ fn rich_block_build(
                             .enumerate()
                             .map(|(index, transaction)| {
                                 transaction_build(
-                                    transaction.clone(),
-                                    Some(block.clone()),
-                                    Some(statuses[index].clone().unwrap_or_default()),
+                                    transaction,
+                                    Some(block),
+                                    statuses.get(index),
                                 )
                             })
                             .collect(),
@@ -1157,44 +1170,32 @@ fn rich_block_build(
                     )
                 }
             },
-            size: Some(U256::from(rlp::encode(&block).len() as u32)),
+            size: Some(U256::from(rlp::encode(block).len() as u32)),
         },
         extra_info: BTreeMap::new(),
     }
 }
 
 fn transaction_build(
-    transaction: EthereumTransaction,
-    block: Option<EthereumBlock>,
-    status: Option<TransactionStatus>,
+    transaction: &EthereumTransaction,
+    block: Option<&EthereumBlock>,
+    status: Option<&TransactionStatus>,
 ) -> Transaction {
-    let pubkey = match public_key(&transaction) {
-        Ok(p) => Some(p),
-        Err(_e) => None,
-    };
+    let hash = H256::from_slice(Keccak256::digest(&rlp::encode(transaction)).as_slice());
+    let sender = sender_cache::recover(transaction, &hash);
 
     Transaction {
-        hash: H256::from_slice(Keccak256::digest(&rlp::encode(&transaction)).as_slice()),
+        hash,
         nonce: transaction.nonce,
-        block_hash: block.as_ref().map(|block| {
+        block_hash: block.map(|block| {
             H256::from_slice(Keccak256::digest(&rlp::encode(&block.header)).as_slice())
         }),
-        block_number: block.as_ref().map(|block| block.header.number),
-        transaction_index: status
-            .as_ref()
-            .map(|status| U256::from(status.transaction_index)),
-        from: status.as_ref().map_or(
-            {
-                match pubkey {
-                    Some(pk) => {
-                        H160::from(H256::from_slice(Keccak256::digest(&pk).as_slice()))
-                    }
-                    _ => H160::default(),
-                }
-            },
-            |status| status.from,
-        ),
-        to: status.as_ref().map_or(
+        block_number: block.map(|block| block.header.number),
+        transaction_index: status.map(|status| U256::from(status.transaction_index)),
+        from: status.map_or(sender.map(|s| s.address).unwrap_or_default(), |status| {
+            status.from
+        }),
+        to: status.map_or(
             {
                 match transaction.action {
                     ethereum::TransactionAction::Call(to) => Some(to),
@@ -1206,10 +1207,10 @@ fn transaction_build(
         value: transaction.value,
         gas_price: transaction.gas_price,
         gas: transaction.gas_limit,
-        input: Bytes(transaction.clone().input),
-        creates: status.as_ref().and_then(|status| status.contract_address),
-        raw: Bytes(rlp::encode(&transaction).to_vec()),
-        public_key: pubkey.as_ref().map(H512::from),
+        input: Bytes(transaction.input.clone()),
+        creates: status.and_then(|status| status.contract_address),
+        raw: Bytes(rlp::encode(transaction).to_vec()),
+        public_key: sender.as_ref().map(|s| H512::from(&s.public)),
         chain_id: transaction.signature.chain_id().map(U64::from),
         standard_v: U256::from(transaction.signature.standard_v()),
         v: U256::from(transaction.signature.v()),
@@ -1219,81 +1220,180 @@ fn transaction_build(
 }
 
 pub fn public_key(transaction: &EthereumTransaction) -> ruc::Result<[u8; 64]> {
-    let mut sig = [0u8; 65];
-    let mut msg = [0u8; 32];
-    sig[0..32].copy_from_slice(&transaction.signature.r()[..]);
-    sig[32..64].copy_from_slice(&transaction.signature.s()[..]);
-    sig[64] = transaction.signature.standard_v();
-    msg.copy_from_slice(
-        &EthereumTransactionMessage::from(transaction.clone()).hash()[..],
-    );
-
-    fp_types::crypto::secp256k1_ecdsa_recover(&sig, &msg)
+    let hash = H256::from_slice(Keccak256::digest(&rlp::encode(transaction)).as_slice());
+    sender_cache::recover(transaction, &hash)
+        .map(|s| s.public)
+        .ok_or_else(|| eg!("invalid signature"))
 }
 
-fn filter_range_logs(
-    app: Arc<RwLock<BaseApp>>,
+/// Number of threads loading the blocks of a range log query.
+const LOG_FILTER_THREADS: usize = 4;
+/// Number of blocks loaded by each thread at a time.
+const LOG_FILTER_CHUNK_SIZE: usize = 16;
+
+/// Collect the logs within blocks `[from, to]` at the beginning of `ret`.
+///
+/// All blocks are read from one query context on the latest committed
+/// state, the lock of BaseApp is not needed. Candidate blocks
+/// come from the log index if it covers the filter, or all blocks of the
+/// range are checked by their blooms. They are loaded in parallel chunks.
+///
+/// Return `true` if stopped at a block with more than `max_past_logs` logs.
+pub fn filter_range_logs(
+    query_pool: &QueryContextPool,
     ret: &mut Vec<Log>,
     max_past_logs: u32,
     filter: &Filter,
-    from: U256,
-    to: U256,
-) -> Result<()> {
-    let mut current = to;
+    from: u64,
+    to: u64,
+    max_duration: Option<Duration>,
+) -> Result<bool> {
+    let begin_request = Instant::now();
+
+    let ctx = query_pool.get();
 
+    let filtered_params = FilteredParams::new(Some(filter.clone()));
     let topics_input = if filter.topics.is_some() {
-        let filtered_params = FilteredParams::new(Some(filter.clone()));
-        Some(filtered_params.flat_topics)
+        Some(filtered_params.flat_topics.clone())
     } else {
         None
     };
     let address_bloom_filter = FilteredParams::addresses_bloom_filter(&filter.address);
     let topics_bloom_filter = FilteredParams::topics_bloom_filter(&topics_input);
 
-    while current >= from {
-        let id = BlockId::Number(current);
-        let block = app.read().current_block(Some(id.clone()));
+    let indexed = filter_topics0(&filtered_params).and_then(|topics0| {
+        module_ethereum::App::<BaseApp>::indexed_log_blocks(
+            &ctx,
+            &filter_addresses(filter),
+            &topics0,
+            from,
+            to,
+        )
+    });
+    let mut candidates: Box<dyn Iterator<Item = u64>> = match indexed {
+        Some(blocks) => Box::new(blocks.into_iter()),
+        None => Box::new((from..=to).rev()),
+    };
 
-        if let Some(block) = block {
-            if FilteredParams::address_in_bloom(
-                block.header.logs_bloom,
-                &address_bloom_filter,
-            ) && FilteredParams::topics_in_bloom(
-                block.header.logs_bloom,
-                &topics_bloom_filter,
-            ) {
-                let mut logs: Vec<Log> = Vec::new();
-                let statuses = app.read().current_transaction_statuses(Some(id));
-                if let Some(statuses) = statuses {
-                    filter_block_logs(&mut logs, filter, block, statuses);
-                }
+    let load_logs = |number: u64| {
+        module_ethereum::App::<BaseApp>::block_with_statuses(
+            &ctx,
+            U256::from(number),
+            |block| {
+                FilteredParams::address_in_bloom(
+                    block.header.logs_bloom,
+                    &address_bloom_filter,
+                ) && FilteredParams::topics_in_bloom(
+                    block.header.logs_bloom,
+                    &topics_bloom_filter,
+                )
+            },
+        )
+        .map(|(block, statuses)| {
+            let mut logs = Vec::new();
+            if let Some(statuses) = statuses {
+                filter_block_logs(&mut logs, filter, &block, &statuses);
+            }
+            logs
+        })
+        .unwrap_or_default()
+    };
+    let load_logs = &load_logs;
+
+    // logs of each block, in descending order of blocks
+    let mut block_logs: Vec<Vec<Log>> = Vec::new();
+    let mut logs_cnt = 0;
+    let mut limited = false;
+
+    'outer: loop {
+        let chunk = candidates
+            .by_ref()
+            .take(LOG_FILTER_THREADS * LOG_FILTER_CHUNK_SIZE)
+            .collect::<Vec<_>>();
+        if chunk.is_empty() {
+            break;
+        }
 
-                // insert logs at the beginning of ret
-                if !logs.is_empty() {
-                    logs.append(ret);
-                    ret.append(&mut logs);
-                }
+        let loaded = thread::scope(|s| {
+            let handles = chunk
+                .chunks(LOG_FILTER_CHUNK_SIZE)
+                .map(|part| {
+                    s.spawn(move || {
+                        part.iter().map(|n| load_logs(*n)).collect::<Vec<_>>()
+                    })
+                })
+                .collect::<Vec<_>>();
+            handles
+                .into_iter()
+                .map(|h| h.join())
+                .collect::<std::result::Result<Vec<_>, _>>()
+        })
+        .map_err(|_| internal_err("failed to load blocks"))?;
+
+        for (number, logs) in chunk.iter().zip(loaded.into_iter().flatten()) {
+            logs_cnt += logs.len();
+            block_logs.push(logs);
+
+            // Check for restrictions
+            if logs_cnt as u32 > max_past_logs {
+                warn!(target: "eth_rpc", "max_past_logs reached at block {:?}", number);
+                limited = true;
+                break 'outer;
             }
         }
-        // Check for restrictions
-        if ret.len() as u32 > max_past_logs {
-            warn!(target: "eth_rpc", "max_past_logs reached at block {:?}", current);
-            break;
+
+        if let Some(max_duration) = max_duration {
+            if begin_request.elapsed() > max_duration {
+                return Err(internal_err(format!(
+                    "query timeout of {} seconds exceeded",
+                    max_duration.as_secs()
+                )));
+            }
         }
-        if current == U256::zero() {
-            break;
-        } else {
-            current = current.saturating_sub(U256::one());
+    }
+
+    // insert logs at the beginning of ret
+    let mut logs = block_logs.into_iter().rev().flatten().collect::<Vec<_>>();
+    logs.append(ret);
+    *ret = logs;
+
+    Ok(limited)
+}
+
+/// Addresses of the filter, an empty list means any address.
+fn filter_addresses(filter: &Filter) -> Vec<H160> {
+    match &filter.address {
+        Some(VariadicValue::Single(address)) => vec![*address],
+        Some(VariadicValue::Multiple(addresses)) => addresses.clone(),
+        _ => vec![],
+    }
+}
+
+/// Accepted values of the first topic, an empty list means any value.
+///
+/// Return `None` if the topics can not be handled by the log index.
+fn filter_topics0(params: &FilteredParams) -> Option<Vec<H256>> {
+    let mut topics0 = Vec::new();
+    for topic in params.flat_topics.iter() {
+        let topic0 = match topic {
+            VariadicValue::Single(t) => *t,
+            VariadicValue::Multiple(t) => t.first().copied().flatten(),
+            VariadicValue::Null => None,
+        };
+        // a wildcard matches any value
+        match topic0 {
+            Some(t) => topics0.push(t),
+            None => return Some(vec![]),
         }
     }
-    Ok(())
+    Some(topics0)
 }
 
 pub fn filter_block_logs<'a>(
     ret: &'a mut Vec<Log>,
     filter: &'a Filter,
-    block: EthereumBlock,
-    transaction_statuses: Vec<TransactionStatus>,
+    block: &EthereumBlock,
+    transaction_statuses: &[TransactionStatus],
 ) -> &'a Vec<Log> {
     let params = FilteredParams::new(Some(filter.clone()));
     let mut block_log_index: u32 = 0;
@@ -1358,3 +1458,20 @@ fn native_block_id(number: Option<BlockNumber>) -> Option<BlockId> {
         BlockNumber::Pending => None,
     }
 }
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn estimate_gas_tolerance() {
+        assert_eq!(50, parse_estimate_gas_tolerance("0.005"));
+        assert_eq!(0, parse_estimate_gas_tolerance(" 0 "));
+        for t in ["", "1%", "-0.01", "NaN", "inf"] {
+            assert_eq!(
+                DEFAULT_ESTIMATE_GAS_TOLERANCE,
+                parse_estimate_gas_tolerance(t)
+            );
+        }
+    }
+}
@@ -1,11 +1,10 @@
-use crate::{filter_block_logs, internal_err};
-use baseapp::BaseApp;
-use ethereum::BlockV0 as EthereumBlock;
+use crate::{block_cache::EthBlockDataCache, filter_range_logs, internal_err};
+use baseapp::{BaseApp, QueryContextPool};
 use ethereum_types::{H256, U256};
-use fp_evm::{BlockId, TransactionStatus};
+use fp_evm::BlockId;
 use fp_rpc_core::types::{
-    BlockNumber, Filter, FilterChanges, FilterPool, FilterPoolItem, FilterType,
-    FilteredParams, Index, Log,
+    BlockNumber, Filter, FilterChanges, FilterPool, FilterPoolItem, FilterType, Index,
+    Log,
 };
 use fp_rpc_core::EthFilterApi;
 use fp_traits::base::BaseProvider;
@@ -13,7 +12,6 @@ use jsonrpc_core::Result;
 
 use futures::{executor::ThreadPool, StreamExt};
 use lazy_static::lazy_static;
-use lru::LruCache;
 use parking_lot::RwLock;
 use std::{
     collections::BTreeMap,
@@ -27,8 +25,6 @@ lazy_static! {
 }
 
 const MAX_FILTER_SECS: u64 = 10;
-const BLOCK_CACHE_SIZE: usize = 50;
-const STATS_CACHE_SIZE: usize = 50;
 const FILTER_RETAIN_THRESHOLD: u64 = 100;
 
 pub struct EthFilterApiImpl {
@@ -36,6 +32,7 @@ pub struct EthFilterApiImpl {
     max_past_logs: u32,
     max_stored_filters: usize,
     block_data_cache: Arc<EthBlockDataCache>,
+    query_pool: Arc<QueryContextPool>,
     account_base_app: Arc<RwLock<BaseApp>>,
 }
 
@@ -44,16 +41,15 @@ impl EthFilterApiImpl {
         account_base_app: Arc<RwLock<BaseApp>>,
         max_past_logs: u32,
         max_stored_filters: usize,
+        block_data_cache: Arc<EthBlockDataCache>,
     ) -> Self {
         let pool = Arc::new(Mutex::new(BTreeMap::new()));
         let instance = Self {
             filter_pool: pool.clone(),
             max_past_logs,
             max_stored_filters,
-            block_data_cache: Arc::new(EthBlockDataCache::new(
-                BLOCK_CACHE_SIZE,
-                STATS_CACHE_SIZE,
-            )),
+            block_data_cache,
+            query_pool: account_base_app.read().query_pool.clone(),
             account_base_app: account_base_app.clone(),
         };
         POOL_FILTER.spawn_ok(Self::filter_pool_task(account_base_app, pool));
@@ -61,9 +57,8 @@ impl EthFilterApiImpl {
     }
 
     fn block_number(&self) -> Result<u64> {
-        self.account_base_app
-            .read()
-            .chain_state
+        self.query_pool
+            .chain_state()
             .read()
             .height()
             .map_err(internal_err)
@@ -111,60 +106,20 @@ impl EthFilterApiImpl {
     ) -> Result<()> {
         // Max request duration of 10 seconds.
         let max_duration = time::Duration::from_secs(MAX_FILTER_SECS);
-        let begin_request = time::Instant::now();
-
-        // Pre-calculate BloomInput for reuse.
-        let topics_input = if filter.topics.is_some() {
-            let filtered_params = FilteredParams::new(Some(filter.clone()));
-            Some(filtered_params.flat_topics)
-        } else {
-            None
-        };
-        let address_bloom_filter =
-            FilteredParams::addresses_bloom_filter(&filter.address);
-        let topics_bloom_filter = FilteredParams::topics_bloom_filter(&topics_input);
-
-        let mut current = to;
-        while current >= from {
-            let block = self
-                .block_data_cache
-                .current_block(&self.account_base_app, current.into());
 
-            if let Some(block) = block {
-                if FilteredParams::address_in_bloom(
-                    block.header.logs_bloom,
-                    &address_bloom_filter,
-                ) && FilteredParams::topics_in_bloom(
-                    block.header.logs_bloom,
-                    &topics_bloom_filter,
-                ) {
-                    let statuses = self.block_data_cache.current_transaction_statuses(
-                        &self.account_base_app,
-                        current.into(),
-                    );
-                    if let Some(statuses) = statuses {
-                        filter_block_logs(ret, filter, block, statuses);
-                    }
-                }
-            } else {
-                // stop when past the 1st ethereum block
-                break;
-            }
-
-            // Check for restrictions
-            if ret.len() as u32 > max_past_logs {
-                return Err(internal_err(format!(
-                    "query returned more than {} results",
-                    max_past_logs
-                )));
-            }
-            if begin_request.elapsed() > max_duration {
-                return Err(internal_err(format!(
-                    "query timeout of {} seconds exceeded",
-                    max_duration.as_secs()
-                )));
-            }
-            current = current.saturating_sub(1);
+        if filter_range_logs(
+            &self.query_pool,
+            ret,
+            max_past_logs,
+            filter,
+            from,
+            to,
+            Some(max_duration),
+        )? {
+            return Err(internal_err(format!(
+                "query returned more than {} results",
+                max_past_logs
+            )));
         }
         Ok(())
     }
@@ -239,7 +194,7 @@ impl EthFilterApi for EthFilterApiImpl {
                         for n in last..next {
                             let block = self
                                 .block_data_cache
-                                .current_block(&self.account_base_app, n.into());
+                                .current_block(Some(BlockId::Number(n.into())));
                             if let Some(block) = block {
                                 ethereum_hashes.push(block.header.hash())
                             }
@@ -375,71 +330,3 @@ impl EthFilterApi for EthFilterApiImpl {
         response
     }
 }
-
-/// Stores an LRU cache for block data and their transaction statuses.
-/// These are large and take a lot of time to fetch from the database.
-/// Storing them in an LRU cache will allow to reduce database accesses
-/// when many subsequent requests are related to the same blocks.
-pub struct EthBlockDataCache {
-    blocks: parking_lot::Mutex<LruCache<U256, EthereumBlock>>,
-    statuses: parking_lot::Mutex<LruCache<U256, Vec<TransactionStatus>>>,
-}
-
-impl EthBlockDataCache {
-    /// Create a new cache with provided cache sizes.
-    pub fn new(blocks_cache_size: usize, statuses_cache_size: usize) -> Self {
-        Self {
-            blocks: parking_lot::Mutex::new(LruCache::new(blocks_cache_size)),
-            statuses: parking_lot::Mutex::new(LruCache::new(statuses_cache_size)),
-        }
-    }
-
-    /// Cache for `handler.current_block`.
-    pub fn current_block(
-        &self,
-        handler: &Arc<RwLock<BaseApp>>,
-        id: U256,
-    ) -> Option<EthereumBlock> {
-        {
-            let mut cache = self.blocks.lock();
-            if let Some(block) = cache.get(&id).cloned() {
-                return Some(block);
-            }
-        }
-
-        if let Some(block) = handler.read().current_block(Some(BlockId::Number(id))) {
-            let mut cache = self.blocks.lock();
-            cache.put(id, block.clone());
-
-            return Some(block);
-        }
-
-        None
-    }
-
-    /// Cache for `handler.current_transaction_statuses`.
-    pub fn current_transaction_statuses(
-        &self,
-        handler: &Arc<RwLock<BaseApp>>,
-        id: U256,
-    ) -> Option<Vec<TransactionStatus>> {
-        {
-            let mut cache = self.statuses.lock();
-            if let Some(statuses) = cache.get(&id).cloned() {
-                return Some(statuses);
-            }
-        }
-
-        if let Some(statuses) = handler
-            .read()
-            .current_transaction_statuses(Some(BlockId::Number(id)))
-        {
-            let mut cache = self.statuses.lock();
-            cache.put(id, statuses.clone());
-
-            return Some(statuses);
-        }
-
-        None
-    }
-}
@@ -1,3 +1,5 @@
+use crate::block_cache::EthBlockDataCache;
+use crate::fanout::{Interest, OverflowPolicy, PubSubFanout};
 use baseapp::BaseApp;
 use ethereum::{BlockV0 as EthereumBlock, Receipt};
 use ethereum_types::{H256, U256};
@@ -9,7 +11,6 @@ use fp_rpc_core::{
     },
     EthPubSubApi::{self as EthPubSubApiT},
 };
-use fp_traits::base::BaseProvider;
 use futures::{
     executor::ThreadPool,
     task::{FutureObj, Spawn, SpawnError},
@@ -42,15 +43,43 @@ impl Spawn for SubscriptionTaskExecutor {
     }
 }
 
-pub struct EthPubSubApiImpl {
+/// Load the data of every new block into the cache once it's committed,
+/// most of the following requests are about the latest blocks.
+pub fn warm_up_block_cache(
+    account_base_app: Arc<RwLock<BaseApp>>,
+    block_data_cache: Arc<EthBlockDataCache>,
+) {
+    let stream = account_base_app.read().event_notify.notification_stream();
+    EXECUTOR.spawn_ok(stream.for_each(move |block_id| {
+        debug!(target: "eth_rpc", "warm up block cache: {}", block_id);
+        if let BlockId::Number(number) = block_id {
+            block_data_cache.warm_up(number);
+        }
+        futures::future::ready(())
+    }));
+}
+
+/// Start dispatching the new blocks to the subscriptions.
+pub fn start_fanout(
     account_base_app: Arc<RwLock<BaseApp>>,
+    block_data_cache: Arc<EthBlockDataCache>,
+    queue_size: usize,
+    policy: OverflowPolicy,
+) -> Arc<PubSubFanout> {
+    let fanout = Arc::new(PubSubFanout::new(queue_size, policy));
+    fanout.start(&EXECUTOR, account_base_app, block_data_cache);
+    fanout
+}
+
+pub struct EthPubSubApiImpl {
+    fanout: Arc<PubSubFanout>,
     subscriptions: SubscriptionManager,
 }
 
 impl EthPubSubApiImpl {
-    pub fn new(account_base_app: Arc<RwLock<BaseApp>>) -> Self {
+    pub fn new(fanout: Arc<PubSubFanout>) -> Self {
         Self {
-            account_base_app,
+            fanout,
             subscriptions: SubscriptionManager::new(Arc::new(SubscriptionTaskExecutor)),
         }
     }
@@ -67,105 +96,33 @@ impl EthPubSubApiT for EthPubSubApiImpl {
         params: Option<Params>,
     ) {
         debug!(target: "eth_rpc", "new subscribe: {:?}", kind);
-        let filtered_params = match params {
-            Some(Params::Logs(filter)) => FilteredParams::new(Some(filter)),
-            _ => FilteredParams::default(),
-        };
-
-        let app = self.account_base_app.clone();
-        match kind {
-            Kind::Logs => {
-                self.subscriptions.add(subscriber, |sink| {
-                    let stream = self.account_base_app
-                        .read()
-                        .event_notify
-                        .notification_stream()
-                        .filter_map(move |block_id| {
-                            debug!(target: "eth_rpc", "subscribe [Logs] received new block: {}", block_id);
-                            let latest_block = app.read().current_block_number().unwrap();
-                            let is_new_block = match block_id {
-                                BlockId::Hash(_) => false,
-                                BlockId::Number(number) => latest_block == number,
-                            };
-
-                            if is_new_block {
-                                let block = app
-                                    .read()
-                                    .current_block(Some(block_id.clone()));
-                                let receipts = app
-                                    .read()
-                                    .current_receipts(Some(block_id));
-
-                                match (receipts, block) {
-                                    (Some(receipts), Some(block)) => {
-                                        futures::future::ready(Some((block, receipts)))
-                                    }
-                                    _ => futures::future::ready(None),
-                                }
-                            } else {
-                                futures::future::ready(None)
-                            }
-                        })
-                        .flat_map(move |(block, receipts)| {
-                            futures::stream::iter(SubscriptionResult::new().logs(
-                                block,
-                                receipts,
-                                &filtered_params,
-                            ))
-                        })
-                        .map(|x| {
-                            Ok::<
-                                Result<PubSubResult, jsonrpc_core::types::error::Error>,
-                                (),
-                            >(Ok(
-                                PubSubResult::Log(Box::new(x)),
-                            ))
-                        });
-                    stream
-                        .forward(sink.sink_map_err(|e| {
-                            warn!(target: "eth_rpc", "Error sending notifications: {:?}", e)
-                        }))
-                        .map(|_| ())
-                });
-            }
-            Kind::NewHeads => {
-                self.subscriptions.add(subscriber, |sink| {
-                    let stream = self.account_base_app.read().event_notify
-                        .notification_stream()
-                        .filter_map(move |block_id| {
-                            debug!(target: "eth_rpc", "subscribe [NewHeads] received new block: {}", block_id);
-                            let latest_block = app.read().current_block_number().unwrap();
-                            let is_new_block = match block_id {
-                                BlockId::Hash(_) => false,
-                                BlockId::Number(number) => latest_block == number,
-                            };
-
-                            if is_new_block {
-                                let block = app
-                                    .read()
-                                    .current_block(Some(block_id));
-                                futures::future::ready(block)
-                            } else {
-                                futures::future::ready(None)
-                            }
-                        })
-                        .map(|block| {
-                            Ok::<_, ()>(Ok(SubscriptionResult::new().new_heads(block)))
-                        });
-                    stream
-                        .forward(
-                            sink.sink_map_err(|e| warn!(target: "eth_rpc", "Error sending notifications: {:?}", e)),
-                        )
-                        .map(|_| ())
-                });
-            }
+        let interest = match kind {
+            Kind::Logs => Interest::Logs(match params {
+                Some(Params::Logs(filter)) => FilteredParams::new(Some(filter)),
+                _ => FilteredParams::default(),
+            }),
+            Kind::NewHeads => Interest::NewHeads,
             Kind::NewPendingTransactions => {
                 warn!(target: "eth_rpc", "subscribe NewPendingTransactions unimplemented");
+                return;
             }
             Kind::Syncing => {
                 warn!(target: "eth_rpc", "subscribe Syncing unimplemented");
+                return;
             }
-        }
+        };
+
+        let fanout = self.fanout.clone();
+        self.subscriptions.add(subscriber, move |sink| {
+            // the notifications are shared with other subscriptions until sent
+            fanout
+                .subscribe(interest)
+                .map(|result| Ok::<_, ()>(Ok(result.as_ref().clone())))
+                .forward(sink.sink_map_err(
+                    |e| warn!(target: "eth_rpc", "Error sending notifications: {:?}", e),
+                ))
+                .map(|_| ())
+        });
     }
 
     fn unsubscribe(
@@ -178,13 +135,13 @@ impl EthPubSubApiT for EthPubSubApiImpl {
     }
 }
 
-struct SubscriptionResult {}
+pub struct SubscriptionResult {}
 
 impl SubscriptionResult {
     pub fn new() -> Self {
         SubscriptionResult {}
     }
-    pub fn new_heads(&self, block: EthereumBlock) -> PubSubResult {
+    pub fn new_heads(&self, block: &EthereumBlock) -> PubSubResult {
         PubSubResult::Header(Box::new(Rich {
             inner: Header {
                 hash: Some(H256::from_slice(
@@ -208,15 +165,15 @@ impl SubscriptionResult {
                     Bytes(block.header.mix_hash.as_bytes().to_vec()),
                     Bytes(block.header.nonce.as_bytes().to_vec()),
                 ],
-                size: Some(U256::from(rlp::encode(&block).len() as u32)),
+                size: Some(U256::from(rlp::encode(block).len() as u32)),
             },
             extra_info: BTreeMap::new(),
         }))
     }
     pub fn logs(
         &self,
-        block: EthereumBlock,
-        receipts: Vec<Receipt>,
+        block: &EthereumBlock,
+        receipts: &[Receipt],
         params: &FilteredParams,
     ) -> Vec<Log> {
         let block_hash = Some(H256::from_slice(
@@ -224,7 +181,7 @@ impl SubscriptionResult {
         ));
         let mut logs: Vec<Log> = vec![];
         let mut log_index: u32 = 0;
-        for (receipt_index, receipt) in receipts.into_iter().enumerate() {
+        for (receipt_index, receipt) in receipts.iter().enumerate() {
             let transaction_hash: Option<H256> = if !receipt.logs.is_empty() {
                 Some(H256::from_slice(
                     Keccak256::digest(&rlp::encode(
@@ -235,12 +192,12 @@ impl SubscriptionResult {
             } else {
                 None
             };
-            for (transaction_log_index, log) in receipt.logs.into_iter().enumerate() {
-                if self.add_log(block_hash.unwrap(), &log, &block, params) {
+            for (transaction_log_index, log) in receipt.logs.iter().enumerate() {
+                if self.add_log(block_hash.unwrap(), log, block, params) {
                     logs.push(Log {
                         address: log.address,
-                        topics: log.topics,
-                        data: Bytes(log.data),
+                        topics: log.topics.clone(),
+                        data: Bytes(log.data.clone()),
                         block_hash,
                         block_number: Some(block.header.number),
                         transaction_hash,
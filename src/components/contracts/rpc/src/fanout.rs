@@ -0,0 +1,427 @@
+//!
+//! # Subscription fan-out
+//!
+//! The heads and logs of a new block are built once and shared by `Arc`
+//! among all subscribers, the logs are indexed by their addresses and first
+//! topics, so a subscriber only checks the logs it may be interested in.
+//!
+//! Each subscription has a bounded queue, a slow client can not hold more
+//! notifications than `queue_size`, see `OverflowPolicy`.
+//!
+
+use crate::block_cache::EthBlockDataCache;
+use crate::eth_pubsub::SubscriptionResult;
+use baseapp::BaseApp;
+use ethereum_types::{H160, H256};
+use fp_evm::BlockId;
+use fp_rpc_core::types::{
+    pubsub::Result as PubSubResult, FilteredParams, Log, VariadicValue,
+};
+use fp_traits::base::BaseProvider;
+use futures::{
+    channel::mpsc::{channel, Receiver, Sender},
+    executor::ThreadPool,
+    StreamExt,
+};
+use log::{debug, warn};
+use parking_lot::RwLock;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+
+/// What to do with a subscription whose queue is full.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum OverflowPolicy {
+    /// Drop the new notifications until the client catches up.
+    DropNewest,
+    /// Close the subscription.
+    Disconnect,
+}
+
+/// What a subscription is interested in.
+pub enum Interest {
+    NewHeads,
+    Logs(FilteredParams),
+}
+
+// The keys of `BlockLogs` to look up for a logs filter.
+#[derive(Debug, PartialEq, Eq)]
+enum IndexKeys {
+    Addresses(Vec<H160>),
+    Topics0(Vec<H256>),
+    All,
+}
+
+impl IndexKeys {
+    fn new(params: &FilteredParams) -> Self {
+        let filter = match params.filter.as_ref() {
+            Some(filter) => filter,
+            None => return IndexKeys::All,
+        };
+
+        match filter.address.as_ref() {
+            Some(VariadicValue::Single(address)) => {
+                return IndexKeys::Addresses(vec![*address]);
+            }
+            Some(VariadicValue::Multiple(addresses)) => {
+                return IndexKeys::Addresses(addresses.clone());
+            }
+            _ => {}
+        }
+
+        // a log matches only if its first topic is the first one of a flat topic,
+        // unless any of them is a wildcard
+        let mut topics0 = Vec::with_capacity(params.flat_topics.len());
+        for topic in params.flat_topics.iter() {
+            match topic {
+                VariadicValue::Single(Some(topic0)) => topics0.push(*topic0),
+                VariadicValue::Multiple(topics) => match topics.first() {
+                    Some(Some(topic0)) => topics0.push(*topic0),
+                    _ => return IndexKeys::All,
+                },
+                _ => return IndexKeys::All,
+            }
+        }
+        if topics0.is_empty() {
+            IndexKeys::All
+        } else {
+            IndexKeys::Topics0(topics0)
+        }
+    }
+}
+
+/// All logs of a block, with an inverted index by address and first topic.
+struct BlockLogs {
+    logs: Vec<Arc<PubSubResult>>,
+    // <address> => <positions in `logs`>
+    by_address: HashMap<H160, Vec<usize>>,
+    // <first topic> => <positions in `logs`>
+    by_topic0: HashMap<H256, Vec<usize>>,
+}
+
+impl BlockLogs {
+    fn new(logs: Vec<Log>) -> Self {
+        let mut by_address: HashMap<H160, Vec<usize>> = HashMap::new();
+        let mut by_topic0: HashMap<H256, Vec<usize>> = HashMap::new();
+        for (i, log) in logs.iter().enumerate() {
+            by_address.entry(log.address).or_default().push(i);
+            if let Some(topic0) = log.topics.first() {
+                by_topic0.entry(*topic0).or_default().push(i);
+            }
+        }
+
+        BlockLogs {
+            logs: logs
+                .into_iter()
+                .map(|log| Arc::new(PubSubResult::Log(Box::new(log))))
+                .collect(),
+            by_address,
+            by_topic0,
+        }
+    }
+
+    // The positions of the candidate logs in the order of the block.
+    fn candidates(&self, keys: &IndexKeys) -> Vec<usize> {
+        let mut positions = match keys {
+            IndexKeys::All => return (0..self.logs.len()).collect(),
+            IndexKeys::Addresses(addresses) => addresses
+                .iter()
+                .filter_map(|address| self.by_address.get(address))
+                .flatten()
+                .copied()
+                .collect::<Vec<_>>(),
+            IndexKeys::Topics0(topics0) => topics0
+                .iter()
+                .filter_map(|topic0| self.by_topic0.get(topic0))
+                .flatten()
+                .copied()
+                .collect::<Vec<_>>(),
+        };
+        positions.sort_unstable();
+        positions.dedup();
+        positions
+    }
+
+    // The logs matching a filter, the block has been checked.
+    fn matching<'a>(
+        &'a self,
+        params: &'a FilteredParams,
+        keys: &IndexKeys,
+    ) -> impl Iterator<Item = &'a Arc<PubSubResult>> + 'a {
+        self.candidates(keys)
+            .into_iter()
+            .map(move |i| &self.logs[i])
+            .filter(move |result| match result.as_ref() {
+                PubSubResult::Log(log) => {
+                    params.filter.is_none()
+                        || (params.filter_address(log) && params.filter_topics(log))
+                }
+                _ => false,
+            })
+    }
+}
+
+struct Subscription {
+    interest: Interest,
+    keys: IndexKeys,
+    queue: Queue,
+}
+
+struct Queue {
+    sender: Sender<Arc<PubSubResult>>,
+    dropped: u64,
+}
+
+impl Queue {
+    // Returns `false` if the client has gone.
+    fn push(&mut self, result: &Arc<PubSubResult>) -> bool {
+        match self.sender.try_send(result.clone()) {
+            Ok(()) => true,
+            Err(e) if e.is_full() => {
+                if 0 == self.dropped % 1024 {
+                    warn!(target: "eth_rpc", "subscription queue is full, dropped {} notifications", self.dropped + 1);
+                }
+                self.dropped += 1;
+                true
+            }
+            Err(_) => false,
+        }
+    }
+
+    #[inline(always)]
+    fn has_overflowed(&self) -> bool {
+        0 < self.dropped
+    }
+}
+
+/// Builds the notifications of each new block once, and dispatches them
+/// to the queues of all subscriptions.
+pub struct PubSubFanout {
+    next_id: AtomicU64,
+    subscriptions: RwLock<HashMap<u64, Subscription>>,
+    queue_size: usize,
+    policy: OverflowPolicy,
+}
+
+impl PubSubFanout {
+    pub fn new(queue_size: usize, policy: OverflowPolicy) -> Self {
+        Self {
+            next_id: AtomicU64::new(0),
+            subscriptions: RwLock::new(HashMap::new()),
+            queue_size,
+            policy,
+        }
+    }
+
+    /// Dispatch the new blocks committed by the app on `executor`.
+    pub fn start(
+        self: &Arc<Self>,
+        executor: &ThreadPool,
+        account_base_app: Arc<RwLock<BaseApp>>,
+        block_data_cache: Arc<EthBlockDataCache>,
+    ) {
+        let fanout = self.clone();
+        let stream = account_base_app.read().event_notify.notification_stream();
+        executor.spawn_ok(stream.for_each(move |block_id| {
+            debug!(target: "eth_rpc", "fan out new block: {}", block_id);
+            let latest_block = account_base_app.read().current_block_number();
+            if let BlockId::Number(number) = block_id {
+                if Some(number) == latest_block {
+                    fanout.on_block(&block_data_cache, block_id);
+                }
+            }
+            futures::future::ready(())
+        }));
+    }
+
+    /// Add a subscription, it's removed once the returned queue is dropped.
+    pub fn subscribe(&self, interest: Interest) -> Receiver<Arc<PubSubResult>> {
+        let (sender, receiver) = channel(self.queue_size);
+        let keys = match &interest {
+            Interest::Logs(params) => IndexKeys::new(params),
+            Interest::NewHeads => IndexKeys::All,
+        };
+
+        let id = self.next_id.fetch_add(1, Ordering::Relaxed);
+        self.subscriptions.write().insert(
+            id,
+            Subscription {
+                interest,
+                keys,
+                queue: Queue { sender, dropped: 0 },
+            },
+        );
+        receiver
+    }
+
+    fn on_block(&self, cache: &EthBlockDataCache, block_id: BlockId) {
+        let (need_heads, need_logs) = {
+            let subscriptions = self.subscriptions.read();
+            let need_heads = subscriptions
+                .values()
+                .any(|s| matches!(s.interest, Interest::NewHeads));
+            (need_heads, need_heads as usize != subscriptions.len())
+        };
+        if !need_heads && !need_logs {
+            return;
+        }
+
+        // built once for all subscriptions
+        let block = match cache.current_block(Some(block_id.clone())) {
+            Some(block) => block,
+            None => return,
+        };
+        let heads = if need_heads {
+            Some(Arc::new(SubscriptionResult::new().new_heads(&block)))
+        } else {
+            None
+        };
+        let logs = if need_logs {
+            cache.current_receipts(Some(block_id)).map(|receipts| {
+                BlockLogs::new(SubscriptionResult::new().logs(
+                    &block,
+                    &receipts,
+                    &FilteredParams::default(),
+                ))
+            })
+        } else {
+            None
+        };
+
+        let block_number = block.header.number.as_u64();
+        let block_hash = block.header.hash();
+        let policy = self.policy;
+        self.subscriptions.write().retain(|id, s| {
+            let queue = &mut s.queue;
+            let open = match &s.interest {
+                Interest::NewHeads => heads.as_ref().map_or(true, |h| queue.push(h)),
+                Interest::Logs(params) => match logs.as_ref() {
+                    Some(_)
+                        if params.filter.is_some()
+                            && (!params.filter_block_range(block_number)
+                                || !params.filter_block_hash(block_hash)) =>
+                    {
+                        true
+                    }
+                    Some(logs) => {
+                        logs.matching(params, &s.keys).all(|log| queue.push(log))
+                    }
+                    None => true,
+                },
+            };
+
+            if !open {
+                debug!(target: "eth_rpc", "subscription {} closed", id);
+                false
+            } else if queue.has_overflowed() && OverflowPolicy::Disconnect == policy {
+                warn!(target: "eth_rpc", "subscription {} is too slow, closed", id);
+                false
+            } else {
+                true
+            }
+        });
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use fp_rpc_core::types::{Bytes, Filter};
+
+    fn log(address: u64, topics: &[u64]) -> Log {
+        Log {
+            address: H160::from_low_u64_be(address),
+            topics: topics.iter().map(|t| H256::from_low_u64_be(*t)).collect(),
+            data: Bytes(vec![]),
+            block_hash: None,
+            block_number: None,
+            transaction_hash: None,
+            transaction_index: None,
+            log_index: None,
+            transaction_log_index: None,
+            removed: false,
+        }
+    }
+
+    fn params(addresses: &[u64], topic0: Option<u64>) -> FilteredParams {
+        FilteredParams::new(Some(Filter {
+            from_block: None,
+            to_block: None,
+            block_hash: None,
+            address: if addresses.is_empty() {
+                None
+            } else {
+                Some(VariadicValue::Multiple(
+                    addresses
+                        .iter()
+                        .map(|a| H160::from_low_u64_be(*a))
+                        .collect(),
+                ))
+            },
+            topics: topic0.map(|t| {
+                VariadicValue::Multiple(vec![Some(VariadicValue::Single(Some(
+                    H256::from_low_u64_be(t),
+                )))])
+            }),
+        }))
+    }
+
+    fn matched(logs: &BlockLogs, params: &FilteredParams) -> Vec<H160> {
+        logs.matching(params, &IndexKeys::new(params))
+            .filter_map(|r| match r.as_ref() {
+                PubSubResult::Log(log) => Some(log.address),
+                _ => None,
+            })
+            .collect()
+    }
+
+    #[test]
+    fn block_logs_matching() {
+        let logs = BlockLogs::new(vec![
+            log(1, &[10]),
+            log(2, &[20]),
+            log(1, &[20, 10]),
+            log(3, &[]),
+        ]);
+        let addr = H160::from_low_u64_be;
+
+        assert_eq!(IndexKeys::All, IndexKeys::new(&FilteredParams::default()));
+        assert_eq!(4, matched(&logs, &FilteredParams::default()).len());
+
+        assert_eq!(vec![addr(1), addr(1)], matched(&logs, &params(&[1], None)));
+        assert_eq!(
+            vec![addr(1), addr(1), addr(3)],
+            matched(&logs, &params(&[3, 1], None))
+        );
+        assert_eq!(vec![addr(1)], matched(&logs, &params(&[1], Some(20))));
+
+        let by_topic = params(&[], Some(20));
+        assert_eq!(
+            IndexKeys::Topics0(vec![H256::from_low_u64_be(20)]),
+            IndexKeys::new(&by_topic)
+        );
+        assert_eq!(vec![addr(2), addr(1)], matched(&logs, &by_topic));
+        assert!(matched(&logs, &params(&[4], None)).is_empty());
+    }
+
+    #[test]
+    fn fanout_queue_overflow() {
+        let fanout = PubSubFanout::new(1, OverflowPolicy::Disconnect);
+        let mut receiver = fanout.subscribe(Interest::NewHeads);
+        assert_eq!(1, fanout.subscriptions.read().len());
+
+        let result = Arc::new(PubSubResult::TransactionHash(H256::zero()));
+        let mut subscriptions = fanout.subscriptions.write();
+        let queue = &mut subscriptions.values_mut().next().unwrap().queue;
+        // the capacity is `queue_size` plus one for the sender
+        assert!(queue.push(&result));
+        assert!(queue.push(&result));
+        assert!(!queue.has_overflowed());
+        assert!(queue.push(&result));
+        assert!(queue.has_overflowed());
+
+        assert!(receiver.try_next().unwrap().is_some());
+        drop(receiver);
+        assert!(!queue.push(&result));
+    }
+}
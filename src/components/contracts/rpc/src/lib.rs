@@ -1,14 +1,17 @@
 #![deny(warnings)]
 #![allow(missing_docs)]
 
+mod block_cache;
 mod eth;
 mod eth_filter;
 mod eth_pubsub;
+mod fanout;
 mod net;
 mod web3;
 
 use baseapp::BaseApp;
-use eth::filter_block_logs;
+use block_cache::EthBlockDataCache;
+use eth::filter_range_logs;
 use evm::{ExitError, ExitReason};
 use fp_rpc_core::types::pubsub::Metadata;
 use fp_rpc_core::{
@@ -25,6 +28,9 @@ use std::sync::Arc;
 
 const MAX_PAST_LOGS: u32 = 10000;
 const MAX_STORED_FILTERS: usize = 500;
+const BLOCK_CACHE_SIZE: usize = 256;
+const STATS_CACHE_SIZE: usize = 256;
+const SUBSCRIPTION_QUEUE_SIZE: usize = 512;
 
 pub fn start_web3_service(
     evm_http: String,
@@ -39,6 +45,25 @@ pub fn start_web3_service(
     let dev_signer = "zebra paddle unveil toilet weekend space gorilla lesson relief useless arrive picture";
     let signers = vec![SecpPair::from_phrase(dev_signer, None).unwrap().0];
 
+    // shared by all APIs
+    let block_data_cache = Arc::new(EthBlockDataCache::new(
+        app.read().query_pool.clone(),
+        BLOCK_CACHE_SIZE,
+        STATS_CACHE_SIZE,
+    ));
+    eth_pubsub::warm_up_block_cache(app2.clone(), block_data_cache.clone());
+    // slow subscribers lose the new notifications by default
+    let pubsub_fanout = eth_pubsub::start_fanout(
+        app2.clone(),
+        block_data_cache.clone(),
+        SUBSCRIPTION_QUEUE_SIZE,
+        if std::env::var("EVM_WS_DISCONNECT_SLOW_SUBSCRIBERS").is_ok() {
+            fanout::OverflowPolicy::Disconnect
+        } else {
+            fanout::OverflowPolicy::DropNewest
+        },
+    );
+
     let io = || -> RpcHandler<Metadata> {
         rpc_handler(
             (
@@ -47,17 +72,19 @@ pub fn start_web3_service(
                     app.clone(),
                     signers.clone(),
                     MAX_PAST_LOGS,
+                    block_data_cache.clone(),
                 )
                 .to_delegate(),
                 eth_filter::EthFilterApiImpl::new(
                     app2.clone(),
                     MAX_PAST_LOGS,
                     MAX_STORED_FILTERS,
+                    block_data_cache.clone(),
                 )
                 .to_delegate(),
                 net::NetApiImpl::new().to_delegate(),
                 web3::Web3ApiImpl::new().to_delegate(),
-                eth_pubsub::EthPubSubApiImpl::new(app2.clone()).to_delegate(),
+                eth_pubsub::EthPubSubApiImpl::new(pubsub_fanout.clone()).to_delegate(),
             ),
             RpcMiddleware::new(),
         )
@@ -0,0 +1,239 @@
+//!
+//! # Block processing of the ledger
+//!
+//! Blocks of transparent and confidential FRA transfers are built with
+//! `txn_builder`, then applied to fresh ledgers, which have the same UTXOs
+//! with the ledger the transactions were built against.
+//!
+//! Run with `make bench`, or `make bench_compare` to compare with
+//! the results saved by `make bench_baseline`.
+//!
+
+use {
+    criterion::{criterion_group, criterion_main, Criterion, Throughput},
+    finutils::txn_builder::{TransactionBuilder, TransferOperationBuilder},
+    ledger::{
+        data_model::{
+            Transaction, TransferType, TxnEffect, TxoRef, ASSET_TYPE_FRA,
+            BLACK_HOLE_PUBKEY, TX_FEE_MIN,
+        },
+        store::{utils::fra_gen_initial_tx, LedgerState},
+    },
+    rand_chacha::ChaChaRng,
+    rand_core::SeedableRng,
+    ruc::*,
+    std::time::{Duration, Instant},
+    zei::xfr::{
+        asset_record::{open_blind_asset_record, AssetRecordType},
+        sig::{XfrKeyPair, XfrPublicKey},
+        structs::{AssetRecordTemplate, XfrAmount},
+    },
+};
+
+// transactions in a block
+const TXS: usize = 100;
+
+// funds of each sender
+const AMOUNT: u64 = 100 * TX_FEE_MIN;
+
+/// Transactions of a block, and the ones to fund its senders.
+struct Prepared {
+    // applied before the block
+    setup: Vec<Transaction>,
+    txs: Vec<Transaction>,
+    effects: Vec<TxnEffect>,
+}
+
+impl Prepared {
+    fn new(confidential: bool) -> Self {
+        let mut prng = ChaChaRng::from_entropy();
+        let root = XfrKeyPair::generate(&mut prng);
+        let senders = (0..TXS)
+            .map(|_| XfrKeyPair::generate(&mut prng))
+            .collect::<Vec<_>>();
+
+        let mut ledger = LedgerState::tmp_ledger();
+        let init = fra_gen_initial_tx(&root);
+        pnk!(apply_block(
+            &mut ledger,
+            vec![pnk!(TxnEffect::compute_effect(init.clone()))]
+        ));
+
+        let targets = senders
+            .iter()
+            .map(|kp| (kp.get_pk(), AMOUNT))
+            .collect::<Vec<_>>();
+        let fund = pnk!(transfer(&ledger, &root, &targets, 1, false));
+        pnk!(apply_block(
+            &mut ledger,
+            vec![pnk!(TxnEffect::compute_effect(fund.clone()))]
+        ));
+
+        // every sender pays all of its funds to the next one
+        let seq_id = ledger.get_block_commit_count();
+        let txs = senders
+            .iter()
+            .enumerate()
+            .map(|(i, kp)| {
+                let to = senders[(i + 1) % TXS].get_pk();
+                pnk!(transfer(
+                    &ledger,
+                    kp,
+                    &[(to, AMOUNT - TX_FEE_MIN)],
+                    seq_id,
+                    confidential
+                ))
+            })
+            .collect::<Vec<_>>();
+        let effects = txs
+            .iter()
+            .map(|tx| pnk!(TxnEffect::compute_effect(tx.clone())))
+            .collect();
+
+        Prepared {
+            setup: vec![init, fund],
+            txs,
+            effects,
+        }
+    }
+
+    // Apply the block to a fresh ledger,
+    // returns the time of `apply_transaction`s and `finish_block`.
+    fn run(&self) -> (Duration, Duration) {
+        let mut ledger = LedgerState::tmp_ledger();
+        for tx in self.setup.iter() {
+            pnk!(apply_block(
+                &mut ledger,
+                vec![pnk!(TxnEffect::compute_effect(tx.clone()))]
+            ));
+        }
+        let effects = self.effects.clone();
+
+        let start = Instant::now();
+        let mut block = pnk!(ledger.start_block());
+        for effect in effects {
+            pnk!(ledger.apply_transaction(&mut block, effect));
+        }
+        let applied = start.elapsed();
+
+        let start = Instant::now();
+        pnk!(ledger.finish_block(block));
+        (applied, start.elapsed())
+    }
+}
+
+fn apply_block(ledger: &mut LedgerState, effects: Vec<TxnEffect>) -> Result<()> {
+    let mut block = ledger.start_block().c(d!())?;
+    for effect in effects {
+        ledger.apply_transaction(&mut block, effect).c(d!())?;
+    }
+    ledger.finish_block(block).c(d!()).map(|_| ())
+}
+
+// Pay `targets` with the non-confidential UTXOs of `owner`,
+// the change goes back to `owner`, along with a fee to the black hole.
+fn transfer(
+    ledger: &LedgerState,
+    owner: &XfrKeyPair,
+    targets: &[(XfrPublicKey, u64)],
+    seq_id: u64,
+    confidential: bool,
+) -> Result<Transaction> {
+    let mut trans_builder = TransferOperationBuilder::new();
+
+    let mut am = targets.iter().map(|(_, am)| *am).sum::<u64>() + TX_FEE_MIN;
+    for (sid, (utxo, owner_memo)) in
+        ledger.get_owned_utxos(owner.get_pk_ref()).c(d!())?
+    {
+        let n = match utxo.0.record.amount {
+            XfrAmount::NonConfidential(n) => n.min(am),
+            _ => continue,
+        };
+        am -= n;
+        let ob = open_blind_asset_record(&utxo.0.record, &owner_memo, owner).c(d!())?;
+        trans_builder
+            .add_input(TxoRef::Absolute(sid), ob, None, None, n)
+            .c(d!())?;
+        if 0 == am {
+            break;
+        }
+    }
+    if 0 != am {
+        return Err(eg!("insufficient balance"));
+    }
+
+    let record_type = if confidential {
+        AssetRecordType::ConfidentialAmount_ConfidentialAssetType
+    } else {
+        AssetRecordType::NonConfidentialAmount_NonConfidentialAssetType
+    };
+    for (pk, n) in targets.iter() {
+        let template = AssetRecordTemplate::with_no_asset_tracing(
+            *n,
+            ASSET_TYPE_FRA,
+            record_type,
+            *pk,
+        );
+        trans_builder
+            .add_output(&template, None, None, None)
+            .c(d!())?;
+    }
+    let fee = AssetRecordTemplate::with_no_asset_tracing(
+        TX_FEE_MIN,
+        ASSET_TYPE_FRA,
+        AssetRecordType::NonConfidentialAmount_NonConfidentialAssetType,
+        *BLACK_HOLE_PUBKEY,
+    );
+    trans_builder.add_output(&fee, None, None, None).c(d!())?;
+
+    let op = trans_builder
+        .balance(None)
+        .c(d!())?
+        .create(TransferType::Standard)
+        .c(d!())?
+        .sign(owner)
+        .c(d!())?
+        .transaction()
+        .c(d!())?;
+
+    let mut tx_builder = TransactionBuilder::from_seq_id(seq_id);
+    tx_builder.add_operation(op);
+    Ok(tx_builder.take_transaction())
+}
+
+fn bench_block(c: &mut Criterion, name: &str, confidential: bool) {
+    let prepared = Prepared::new(confidential);
+
+    let mut group = c.benchmark_group(name);
+    group
+        .sample_size(10)
+        .throughput(Throughput::Elements(TXS as u64));
+
+    group.bench_function("compute_effect", |b| {
+        b.iter(|| {
+            prepared.txs.iter().for_each(|tx| {
+                pnk!(TxnEffect::compute_effect(tx.clone()));
+            })
+        })
+    });
+    group.bench_function("apply_transaction", |b| {
+        b.iter_custom(|iters| (0..iters).map(|_| prepared.run().0).sum())
+    });
+    // including `apply_block_effects` and `checkpoint`
+    group.bench_function("finish_block", |b| {
+        b.iter_custom(|iters| (0..iters).map(|_| prepared.run().1).sum())
+    });
+
+    group.finish();
+}
+
+fn transparent_transfers(c: &mut Criterion) {
+    bench_block(c, "transparent_transfers", false);
+}
+
+fn confidential_transfers(c: &mut Criterion) {
+    bench_block(c, "confidential_transfers", true);
+}
+
+criterion_group!(benches, transparent_transfers, confidential_transfers);
+criterion_main!(benches);
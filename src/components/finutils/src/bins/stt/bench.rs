@@ -0,0 +1,536 @@
+//!
+//! # bench
+//!
+//! Load generator of a devnet, e.g. the one of `tools/devnet`.
+//!
+//! - fund a set of fresh senders from the root account,
+//!   split the funds of each sender into many UTXOs,
+//!   and convert a part of them into its EVM account
+//! - pre-sign all the transactions in parallel
+//! - submit them over a pool of keep-alive connections,
+//!   at a target rate (open loop) or as fast as `conns` workers can (closed loop)
+//! - follow the new blocks, report TPS and the latency from submission to inclusion
+//!
+//! NOTE:
+//! - `TxoSID`s are assigned at commit, so a transaction can not spend
+//!   an output of another pending one; every UTXO transaction spends
+//!   one of the pre-split UTXOs instead. The EVM transactions of a sender
+//!   are a real chain of consecutive nonces, they are submitted round by round,
+//!   so concurrent submissions of the same sender are `users` transactions apart.
+//! - all the UTXO transactions share one `seq_id`, they must be included
+//!   within `TRANSACTION_WINDOW_WIDTH` blocks after the pre-signing.
+//! - inclusion is observed by polling, with a resolution of `POLL_ITV`.
+//!
+
+use {
+    super::*,
+    finutils::{
+        common::utils::{gen_transfer_op, get_owned_utxos, get_seq_id},
+        txn_builder::{TransactionBuilder, TransferOperationBuilder},
+    },
+    fp_types::{
+        actions::{
+            xhub::{
+                Action as AccountAction, NonConfidentialOutput, NonConfidentialTransfer,
+            },
+            Action,
+        },
+        assemble::{CheckFee, CheckNonce},
+        crypto::{Address, MultiSignature, MultiSigner},
+        transaction::UncheckedTransaction,
+        U256,
+    },
+    fp_utils::{ecdsa::SecpPair, tx::EvmRawTxWrapper},
+    ledger::data_model::{
+        TransferType, TxoRef, TxoSID, Utxo, ASSET_TYPE_FRA, BLACK_HOLE_PUBKEY,
+        TX_FEE_MIN,
+    },
+    std::{
+        collections::{hash_map::DefaultHasher, HashMap},
+        hash::{Hash, Hasher},
+        sync::{
+            atomic::{AtomicBool, AtomicUsize, Ordering},
+            Arc, Mutex,
+        },
+        thread,
+        time::{Duration, Instant},
+    },
+    tendermint::{abci::Code, block::Height},
+    tendermint_rpc::{Client, HttpClient},
+    tokio::runtime::Runtime,
+    zei::xfr::{
+        asset_record::{open_blind_asset_record, AssetRecordType},
+        structs::{AssetRecordTemplate, OwnerMemo},
+    },
+};
+
+// value of every pre-split UTXO, a spend pays one fee
+const UTXO_AMOUNT: u64 = 2 * TX_FEE_MIN;
+
+// value moved by an EVM transaction, along with a fee
+const EVM_AMOUNT: u64 = TX_FEE_MIN;
+const EVM_COST: u64 = EVM_AMOUNT + TX_FEE_MIN;
+
+const POLL_ITV: Duration = Duration::from_millis(100);
+
+/// Shape of the load.
+pub struct Load {
+    /// number of the senders
+    pub users: usize,
+    /// UTXO transactions of each sender
+    pub txs: usize,
+    /// EVM transactions of each sender
+    pub evm_txs: usize,
+    /// transactions per second, `None` for a closed loop
+    pub rate: Option<f64>,
+    /// concurrent submissions of a closed loop
+    pub conns: usize,
+    /// seconds to wait for the inclusions after the last submission
+    pub timeout: u64,
+}
+
+struct Sender {
+    xfr: XfrKeyPair,
+    eth: SecpPair,
+}
+
+pub fn bench(load: Load) -> Result<()> {
+    if 0 == load.users || 0 == load.txs + load.evm_txs {
+        return Err(eg!("nothing to submit"));
+    }
+
+    let senders = (0..load.users)
+        .map(|_| Sender {
+            xfr: gen_random_keypair(),
+            eth: SecpPair::generate().0,
+        })
+        .collect::<Vec<_>>();
+
+    println!(">>> Fund {} senders ...", senders.len());
+    fund(&senders, &load).c(d!())?;
+
+    println!(">>> Pre-sign transactions ...");
+    let start = Instant::now();
+    let plan = presign(&senders, &load).c(d!())?;
+    println!(
+        ">>> {} transactions signed in {:.2?}",
+        plan.len(),
+        start.elapsed()
+    );
+
+    let url = format!("{}:26657", common::get_serv_addr().c(d!())?);
+    let client = Arc::new(HttpClient::new(url.as_str()).c(d!())?);
+    let rt = Arc::new(Runtime::new().c(d!())?);
+    let tracker = Arc::new(Tracker::default());
+
+    let from = rt
+        .block_on(client.status())
+        .c(d!())?
+        .sync_info
+        .latest_block_height
+        .value()
+        + 1;
+    let watcher = {
+        let (rt, client, tracker) = (rt.clone(), client.clone(), tracker.clone());
+        thread::spawn(move || watch(&rt, &client, &tracker, from, load.timeout))
+    };
+
+    println!(">>> Submit ...");
+    let start = Instant::now();
+    submit(&rt, &client, &tracker, plan, &load);
+    let submit_time = start.elapsed();
+    tracker.done.store(true, Ordering::Release);
+
+    let last_inclusion = watcher.join().map_err(|_| eg!("watcher panicked"))??;
+    report(&tracker, submit_time, last_inclusion.map(|t| t - start));
+
+    Ok(())
+}
+
+// Root -> one UTXO for each sender -> `txs` UTXOs and an EVM balance.
+fn fund(senders: &[Sender], load: &Load) -> Result<()> {
+    let evm_total = load.evm_txs as u64 * EVM_COST;
+    let am = load.txs as u64 * UTXO_AMOUNT + evm_total + TX_FEE_MIN;
+    let target_list = senders
+        .iter()
+        .map(|s| (s.xfr.get_pk_ref(), am))
+        .collect::<Vec<_>>();
+    common::utils::transfer_batch(&ROOT_KP, target_list, None, false, false).c(d!())?;
+    wait_utxos(senders, 1, load.timeout).c(d!())?;
+
+    println!(">>> Split the funds of the senders ...");
+    for s in senders.iter() {
+        let mut target_list = vec![(s.xfr.get_pk_ref(), UTXO_AMOUNT); load.txs];
+        if 0 < evm_total {
+            target_list.push((&*BLACK_HOLE_PUBKEY_STAKING, evm_total));
+        }
+
+        let mut builder = common::utils::new_tx_builder().c(d!())?;
+        let op = gen_transfer_op(
+            &s.xfr,
+            target_list,
+            None,
+            false,
+            false,
+            Some(AssetRecordType::NonConfidentialAmount_NonConfidentialAssetType),
+        )
+        .c(d!())?;
+        builder.add_operation(op);
+        if 0 < evm_total {
+            builder
+                .add_operation_convert_account(
+                    &s.xfr,
+                    MultiSigner::Ethereum(s.eth.address()),
+                    evm_total,
+                )
+                .c(d!())?
+                .sign(&s.xfr);
+        }
+        common::utils::send_tx(&builder.take_transaction()).c(d!())?;
+    }
+    sleep_n_block!(1.2);
+    wait_utxos(senders, load.txs, load.timeout).c(d!())
+}
+
+// Wait until every sender owns at least `n` UTXOs.
+fn wait_utxos(senders: &[Sender], n: usize, timeout: u64) -> Result<()> {
+    let deadline = Instant::now() + Duration::from_secs(timeout);
+    for s in senders.iter() {
+        while get_owned_utxos(s.xfr.get_pk_ref())
+            .map(|utxos| utxos.len() < n)
+            .unwrap_or(true)
+        {
+            if Instant::now() > deadline {
+                return Err(eg!("funding timeout"));
+            }
+            sleep_n_block!(0.2);
+        }
+    }
+    Ok(())
+}
+
+// All the transactions in the order of submission,
+// the `i`th transaction of every sender goes in the `i`th round.
+fn presign(senders: &[Sender], load: &Load) -> Result<Vec<Vec<u8>>> {
+    let seq_id = get_seq_id().c(d!())?;
+    let n = thread::available_parallelism().map_or(1, |n| n.get());
+    let chunk = senders.len().div_ceil(n);
+
+    let lanes = thread::scope(|s| {
+        senders
+            .chunks(chunk)
+            .enumerate()
+            .map(|(i, part)| {
+                s.spawn(move || {
+                    part.iter()
+                        .enumerate()
+                        .map(|(j, sender)| {
+                            // pay to the next sender
+                            let to = &senders[(i * chunk + j + 1) % senders.len()];
+                            presign_lane(sender, to, seq_id, load).c(d!())
+                        })
+                        .collect::<Result<Vec<_>>>()
+                })
+            })
+            .collect::<Vec<_>>()
+            .into_iter()
+            .map(|h| h.join().map_err(|_| eg!("signer panicked")).and_then(|r| r))
+            .collect::<Result<Vec<_>>>()
+    })
+    .c(d!())?
+    .into_iter()
+    .flatten()
+    .collect::<Vec<_>>();
+
+    let rounds = load.txs.max(load.evm_txs);
+    let mut plan = Vec::with_capacity(senders.len() * (load.txs + load.evm_txs));
+    for r in 0..rounds {
+        for (utxo_txs, evm_txs) in lanes.iter() {
+            plan.extend(utxo_txs.get(r).cloned());
+            plan.extend(evm_txs.get(r).cloned());
+        }
+    }
+    Ok(plan)
+}
+
+// The UTXO transactions and the EVM transactions of a sender.
+fn presign_lane(
+    sender: &Sender,
+    to: &Sender,
+    seq_id: u64,
+    load: &Load,
+) -> Result<(Vec<Vec<u8>>, Vec<Vec<u8>>)> {
+    let utxo_txs = get_owned_utxos(sender.xfr.get_pk_ref())
+        .c(d!())?
+        .iter()
+        .take(load.txs)
+        .map(|(sid, (utxo, owner_memo))| {
+            gen_spend_tx(sender, *sid, utxo, owner_memo, to, seq_id)
+                // the legacy JSON format, accepted at any height
+                .and_then(|tx| serde_json::to_vec(&tx).c(d!()))
+        })
+        .collect::<Result<Vec<_>>>()?;
+
+    // a fresh account starts from nonce 0
+    let evm_txs = (0..load.evm_txs)
+        .map(|nonce| gen_evm_tx(sender, to, U256::from(nonce as u64)))
+        .collect::<Result<Vec<_>>>()?;
+
+    Ok((utxo_txs, evm_txs))
+}
+
+// Pay a whole UTXO to `to`, except the fee.
+fn gen_spend_tx(
+    sender: &Sender,
+    sid: TxoSID,
+    utxo: &Utxo,
+    owner_memo: &Option<OwnerMemo>,
+    to: &Sender,
+    seq_id: u64,
+) -> Result<Transaction> {
+    let oar =
+        open_blind_asset_record(&utxo.0.record, owner_memo, &sender.xfr).c(d!())?;
+    if oar.asset_type != ASSET_TYPE_FRA || oar.amount <= TX_FEE_MIN {
+        return Err(eg!("unexpected UTXO"));
+    }
+
+    let record_type = AssetRecordType::NonConfidentialAmount_NonConfidentialAssetType;
+    let am = oar.amount;
+    let op = TransferOperationBuilder::new()
+        .add_input(TxoRef::Absolute(sid), oar, None, None, am)
+        .c(d!())?
+        .add_output(
+            &AssetRecordTemplate::with_no_asset_tracing(
+                am - TX_FEE_MIN,
+                ASSET_TYPE_FRA,
+                record_type,
+                to.xfr.get_pk(),
+            ),
+            None,
+            None,
+            None,
+        )
+        .c(d!())?
+        .add_output(
+            &AssetRecordTemplate::with_no_asset_tracing(
+                TX_FEE_MIN,
+                ASSET_TYPE_FRA,
+                record_type,
+                *BLACK_HOLE_PUBKEY,
+            ),
+            None,
+            None,
+            None,
+        )
+        .c(d!())?
+        .balance(None)
+        .c(d!())?
+        .create(TransferType::Standard)
+        .c(d!())?
+        .sign(&sender.xfr)
+        .c(d!())?
+        .transaction()
+        .c(d!())?;
+
+    let mut builder = TransactionBuilder::from_seq_id(seq_id);
+    builder.add_operation(op);
+    Ok(builder.take_transaction())
+}
+
+// Pay from the EVM account of `sender` to a UTXO of `to`.
+fn gen_evm_tx(sender: &Sender, to: &Sender, nonce: U256) -> Result<Vec<u8>> {
+    let action = Action::XHub(AccountAction::NonConfidentialTransfer(
+        NonConfidentialTransfer {
+            input_value: EVM_AMOUNT,
+            outputs: vec![NonConfidentialOutput {
+                target: to.xfr.get_pk(),
+                amount: EVM_AMOUNT,
+                asset: ASSET_TYPE_FRA,
+            }],
+        },
+    ));
+    let extra = (CheckNonce::new(nonce), CheckFee::new(None));
+    let msg = serde_json::to_vec(&(action.clone(), extra.clone())).c(d!())?;
+    let signature = MultiSignature::from(sender.eth.sign(&msg));
+    let signer = Address::from(sender.eth.address());
+
+    let tx = UncheckedTransaction::new_signed(action, signer, signature, extra);
+    serde_json::to_vec(&tx)
+        .c(d!())
+        .map(|tx| EvmRawTxWrapper::wrap(&tx))
+}
+
+#[derive(Default)]
+struct Tracker {
+    // key of the tx -> time of submission
+    pending: Mutex<HashMap<u64, Instant>>,
+    latencies: Mutex<Vec<Duration>>,
+    accepted: AtomicUsize,
+    rejected: AtomicUsize,
+    failed: AtomicUsize,
+    done: AtomicBool,
+}
+
+fn key_of(tx: &[u8]) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    tx.hash(&mut hasher);
+    hasher.finish()
+}
+
+async fn submit_one(client: Arc<HttpClient>, tracker: Arc<Tracker>, tx: Vec<u8>) {
+    // record before sending, the block may be observed before the reply
+    let key = key_of(&tx);
+    tracker.pending.lock().unwrap().insert(key, Instant::now());
+
+    match client.broadcast_tx_sync(tx.into()).await {
+        Ok(resp) if resp.code == Code::Ok => {
+            tracker.accepted.fetch_add(1, Ordering::Relaxed);
+        }
+        _ => {
+            tracker.pending.lock().unwrap().remove(&key);
+            tracker.rejected.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+fn submit(
+    rt: &Runtime,
+    client: &Arc<HttpClient>,
+    tracker: &Arc<Tracker>,
+    plan: Vec<Vec<u8>>,
+    load: &Load,
+) {
+    let handles = if let Some(rate) = load.rate {
+        // open loop, the schedule does not wait for the replies
+        let start = Instant::now();
+        plan.into_iter()
+            .enumerate()
+            .map(|(i, tx)| {
+                let at = start + Duration::from_secs_f64(i as f64 / rate);
+                if let Some(itv) = at.checked_duration_since(Instant::now()) {
+                    thread::sleep(itv);
+                }
+                rt.spawn(submit_one(client.clone(), tracker.clone(), tx))
+            })
+            .collect::<Vec<_>>()
+    } else {
+        // closed loop, every worker keeps one submission in flight
+        let plan = Arc::new(plan);
+        let next = Arc::new(AtomicUsize::new(0));
+        (0..load.conns.max(1))
+            .map(|_| {
+                let (client, tracker) = (client.clone(), tracker.clone());
+                let (plan, next) = (plan.clone(), next.clone());
+                rt.spawn(async move {
+                    while let Some(tx) = plan.get(next.fetch_add(1, Ordering::Relaxed)) {
+                        submit_one(client.clone(), tracker.clone(), tx.clone()).await;
+                    }
+                })
+            })
+            .collect::<Vec<_>>()
+    };
+
+    rt.block_on(async {
+        for h in handles {
+            let _ = h.await;
+        }
+    });
+}
+
+// Follow the blocks from height `from`,
+// returns the time of the last inclusion.
+fn watch(
+    rt: &Runtime,
+    client: &HttpClient,
+    tracker: &Tracker,
+    mut from: u64,
+    timeout: u64,
+) -> Result<Option<Instant>> {
+    let mut last_inclusion = None;
+    let mut deadline = None;
+
+    loop {
+        let tip = rt
+            .block_on(client.status())
+            .c(d!())?
+            .sync_info
+            .latest_block_height
+            .value();
+        for h in from..=tip {
+            let height = Height::from(h as u32);
+            let block = rt.block_on(client.block(height)).c(d!())?.block;
+            let results = rt
+                .block_on(client.block_results(height))
+                .c(d!())?
+                .txs_results
+                .unwrap_or_default();
+
+            let now = Instant::now();
+            let mut pending = tracker.pending.lock().unwrap();
+            let mut latencies = tracker.latencies.lock().unwrap();
+            for (i, tx) in block.data.iter().enumerate() {
+                if let Some(t) = pending.remove(&key_of(tx.as_bytes())) {
+                    latencies.push(now - t);
+                    last_inclusion = Some(now);
+                    if results.get(i).map_or(false, |r| r.code != Code::Ok) {
+                        tracker.failed.fetch_add(1, Ordering::Relaxed);
+                    }
+                }
+            }
+        }
+        from = from.max(tip + 1);
+
+        if tracker.done.load(Ordering::Acquire) {
+            if tracker.pending.lock().unwrap().is_empty() {
+                break;
+            }
+            let deadline = *deadline
+                .get_or_insert_with(|| Instant::now() + Duration::from_secs(timeout));
+            if Instant::now() > deadline {
+                break;
+            }
+        }
+        thread::sleep(POLL_ITV);
+    }
+
+    Ok(last_inclusion)
+}
+
+fn report(tracker: &Tracker, submit_time: Duration, include_time: Option<Duration>) {
+    let accepted = tracker.accepted.load(Ordering::Relaxed);
+    let rejected = tracker.rejected.load(Ordering::Relaxed);
+    let failed = tracker.failed.load(Ordering::Relaxed);
+    let lost = tracker.pending.lock().unwrap().len();
+    let mut latencies = tracker.latencies.lock().unwrap();
+    latencies.sort_unstable();
+
+    let tps = |n: usize, d: Duration| n as f64 / d.as_secs_f64().max(1e-6);
+    let pct = |p: usize| {
+        latencies
+            .get((latencies.len() * p / 100).min(latencies.len().saturating_sub(1)))
+            .copied()
+            .unwrap_or_default()
+    };
+
+    println!(
+        ">>> Submitted: {} accepted, {} rejected by check_tx, in {:.2?}, {:.1} TPS",
+        accepted,
+        rejected,
+        submit_time,
+        tps(accepted + rejected, submit_time)
+    );
+    println!(
+        ">>> Included: {} ({} failed in deliver_tx), {} lost, {:.1} TPS",
+        latencies.len(),
+        failed,
+        lost,
+        include_time.map_or(0.0, |d| tps(latencies.len(), d))
+    );
+    println!(
+        ">>> Latency: p50 {:.2?}, p90 {:.2?}, p99 {:.2?}, max {:.2?}",
+        pct(50),
+        pct(90),
+        pct(99),
+        latencies.last().copied().unwrap_or_default()
+    );
+}
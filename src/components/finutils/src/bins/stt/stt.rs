@@ -5,10 +5,12 @@
 //! - delegate --user=<cat1> --amount=<N> --validator=<dog1>
 //! - undelegate --user=<cat1>
 //! - claim --user=<cat1> --amount=<N>
+//! - bench --users=<N> --txs=<N> --evm-txs=<N> --rate=<TPS>
 //!
 
 #![deny(warnings)]
 
+mod bench;
 mod init;
 
 use {
@@ -80,6 +82,24 @@ fn run() -> Result<()> {
         .arg_from_usage("-f, --from-user=[User] 'transfer sender'")
         .arg_from_usage("-t, --to-user=[User] 'transfer receiver'")
         .arg_from_usage("-n, --amount=[Amount] 'how much FRA to transfer'");
+    let subcmd_bench = SubCommand::with_name("bench")
+        .about("generate load and report the latency of inclusion")
+        .arg_from_usage("-u, --users=[N] 'number of senders, default to 10'")
+        .arg_from_usage(
+            "-n, --txs=[N] 'UTXO transactions of each sender, default to 100'",
+        )
+        .arg_from_usage(
+            "-e, --evm-txs=[N] 'EVM transactions of each sender, default to 0'",
+        )
+        .arg_from_usage(
+            "-r, --rate=[TPS] 'submit at a fixed rate, instead of a closed loop'",
+        )
+        .arg_from_usage(
+            "-c, --conns=[N] 'concurrent submissions of a closed loop, default to 16'",
+        )
+        .arg_from_usage(
+            "-t, --timeout=[Secs] 'how long to wait for the inclusions, default to 60'",
+        );
     let subcmd_show = SubCommand::with_name("show")
         .arg_from_usage("-r, --root-mnemonic 'show the pre-defined root mnemonic'")
         .arg_from_usage("-U, --user-list 'show the pre-defined user list'")
@@ -98,6 +118,7 @@ fn run() -> Result<()> {
         .subcommand(subcmd_undelegate)
         .subcommand(subcmd_claim)
         .subcommand(subcmd_transfer)
+        .subcommand(subcmd_bench)
         .subcommand(subcmd_show)
         .get_matches();
 
@@ -180,6 +201,23 @@ fn run() -> Result<()> {
                 println!("{}", m.usage());
             }
         }
+    } else if let Some(m) = matches.subcommand_matches("bench") {
+        let arg = |name, default: &str| {
+            m.value_of(name).unwrap_or(default).parse::<usize>().c(d!())
+        };
+        let load = bench::Load {
+            users: arg("users", "10").c(d!())?,
+            txs: arg("txs", "100").c(d!())?,
+            evm_txs: arg("evm-txs", "0").c(d!())?,
+            rate: m
+                .value_of("rate")
+                .map(|r| r.parse::<f64>())
+                .transpose()
+                .c(d!())?,
+            conns: arg("conns", "16").c(d!())?,
+            timeout: arg("timeout", "60").c(d!())? as u64,
+        };
+        bench::bench(load).c(d!())?;
     } else if let Some(m) = matches.subcommand_matches("show") {
         let rm = m.is_present("root-mnemonic");
         let ul = m.is_present("user-list");
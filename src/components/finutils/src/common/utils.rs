@@ -426,7 +426,8 @@ pub fn get_asset_balance(kp: &XfrKeyPair, asset: Option<AssetTypeCode>) -> Resul
     Ok(balance)
 }
 
-fn get_owned_utxos(
+/// Retrieve the UTXOs of a findora account, along with their owner memos
+pub fn get_owned_utxos(
     addr: &XfrPublicKey,
 ) -> Result<HashMap<TxoSID, (Utxo, Option<OwnerMemo>)>> {
     let url = format!(
@@ -448,8 +449,9 @@ fn get_owned_utxos(
         })
 }
 
+/// Retrieve the current block commit count, with which new transactions are built
 #[inline(always)]
-fn get_seq_id() -> Result<u64> {
+pub fn get_seq_id() -> Result<u64> {
     type Resp = (
         HashOf<Option<StateCommitmentData>>,
         u64,
@@ -665,6 +665,13 @@ impl TransactionBuilder {
         j.as_bytes().to_vec()
     }
 
+    /// Serialize the transaction into the binary wire format of ABCI,
+    /// which is accepted by the nodes since the `tx_wire_v1_height` checkpoint
+    pub fn serialize_wire(&self) -> Vec<u8> {
+        // Unwrap is safe beacuse the underlying transaction is guaranteed to be serializable.
+        self.txn.to_wire_bytes().unwrap()
+    }
+
     #[allow(missing_docs)]
     pub fn serialize_str(&self) -> String {
         // Unwrap is safe because the underlying transaction is guaranteed to be serializable.
@@ -531,6 +531,13 @@ impl TransactionBuilder {
         self.get_builder().serialize_str()
     }
 
+    /// Extracts the transaction in the binary wire format,
+    /// which can be broadcasted to tendermint directly
+    /// once the network has passed the `tx_wire_v1_height` checkpoint.
+    pub fn transaction_bytes(&self) -> Vec<u8> {
+        self.get_builder().serialize_wire()
+    }
+
     /// Calculates transaction handle.
     pub fn transaction_handle(&self) -> String {
         self.get_builder().transaction().handle()
@@ -15,7 +15,7 @@ use {
             },
         },
     },
-    globutils::HashOf,
+    globutils::{metrics::Histogram, HashOf},
     lazy_static::lazy_static,
     parking_lot::Mutex,
     rand_chacha::{ChaCha20Rng, ChaChaRng},
@@ -23,6 +23,7 @@ use {
     ruc::*,
     serde::Serialize,
     std::{
+        cell::RefCell,
         collections::{HashMap, HashSet},
         sync::Arc,
     },
@@ -44,6 +45,29 @@ lazy_static! {
         Arc::new(Mutex::new(PublicParams::default()));
 }
 
+thread_local! {
+    // per-thread copies for `TxnEffect::verify_stateless`,
+    // so that verifications on different threads do not contend
+    static LOCAL_PRNG: RefCell<ChaCha20Rng> = RefCell::new(ChaChaRng::from_entropy());
+    static LOCAL_PARAMS: RefCell<PublicParams> = RefCell::new(PublicParams::default());
+}
+
+static COMPUTE_EFFECT: Histogram = Histogram::new(
+    "findora_ledger_seconds",
+    "op=\"compute_effect\"",
+    "Time spent in the ledger",
+);
+static COMPUTE_EFFECT_PREVERIFIED: Histogram = Histogram::new(
+    "findora_ledger_seconds",
+    "op=\"compute_effect_preverified\"",
+    "Time spent in the ledger",
+);
+static VERIFY_STATELESS: Histogram = Histogram::new(
+    "findora_ledger_seconds",
+    "op=\"verify_stateless\"",
+    "Time spent in the ledger",
+);
+
 /// Check operations in the context of a tx, partially.
 #[derive(Debug, Default, Clone, Eq, PartialEq)]
 pub struct TxnEffect {
@@ -115,7 +139,27 @@ impl TxnEffect {
     /// `input_txos` and that Transfer should be valid if all those TXO SIDs
     /// exist unspent in the ledger and correspond to the correct
     /// TxOutput).
+    #[inline(always)]
     pub fn compute_effect(txn: Transaction) -> Result<TxnEffect> {
+        Self::do_compute_effect(txn, false)
+    }
+
+    /// Same as `compute_effect`, but the signature and proof checks are skipped.
+    ///
+    /// NOTE: only for transactions which have passed `verify_stateless`,
+    /// the result is then identical to `compute_effect`.
+    #[inline(always)]
+    pub fn compute_effect_preverified(txn: Transaction) -> Result<TxnEffect> {
+        Self::do_compute_effect(txn, true)
+    }
+
+    fn do_compute_effect(txn: Transaction, preverified: bool) -> Result<TxnEffect> {
+        let _t = if preverified {
+            &COMPUTE_EFFECT_PREVERIFIED
+        } else {
+            &COMPUTE_EFFECT
+        }
+        .start_timer();
         let mut te = TxnEffect::default();
         let mut txo_count: usize = 0;
 
@@ -127,6 +171,13 @@ impl TxnEffect {
                     }
                 };
             }
+            macro_rules! verify {
+                ($i: expr) => {
+                    if !preverified {
+                        $i.verify().c(d!())?;
+                    }
+                };
+            }
 
             match op {
                 Operation::MintFra(i) => {
@@ -136,26 +187,27 @@ impl TxnEffect {
                     });
                 }
                 Operation::TransferAsset(trn) => {
-                    te.add_transfer_asset(trn, &mut txo_count).c(d!())?;
+                    te.add_transfer_asset(trn, &mut txo_count, preverified)
+                        .c(d!())?;
                 }
                 Operation::Claim(i) => {
                     check_nonce!(i);
-                    i.verify().c(d!())?;
+                    verify!(i);
                     te.claims.push(i.clone());
                 }
                 Operation::Delegation(i) => {
                     check_nonce!(i);
-                    i.verify().c(d!())?;
+                    verify!(i);
                     te.delegations.push(i.clone());
                 }
                 Operation::UnDelegation(i) => {
                     check_nonce!(i);
-                    i.verify().c(d!())?;
+                    verify!(i);
                     te.undelegations.push(i.as_ref().clone());
                 }
                 Operation::UpdateStaker(i) => {
                     check_nonce!(i);
-                    i.verify().c(d!())?;
+                    verify!(i);
                     te.update_stakers.push(i.clone());
                 }
                 Operation::UpdateValidator(i) => {
@@ -170,13 +222,14 @@ impl TxnEffect {
                     }
                 }
                 Operation::DefineAsset(def) => {
-                    te.add_define_asset(def).c(d!())?;
+                    te.add_define_asset(def, preverified).c(d!())?;
                 }
                 Operation::IssueAsset(iss) => {
-                    te.add_issue_asset(iss, &mut txo_count).c(d!())?;
+                    te.add_issue_asset(iss, &mut txo_count, preverified)
+                        .c(d!())?;
                 }
                 Operation::UpdateMemo(update_memo) => {
-                    te.add_update_memo(&txn, update_memo).c(d!())?;
+                    te.add_update_memo(&txn, update_memo, preverified).c(d!())?;
                 }
                 Operation::Governance(i) => {
                     check_nonce!(i);
@@ -196,14 +249,76 @@ impl TxnEffect {
         Ok(te)
     }
 
+    /// Run all the signature checks and zei proof verifications of `txn`,
+    /// they are the heavy part of `compute_effect`.
+    ///
+    /// The result depends on nothing but the content of the transaction,
+    /// so this can be done on any thread before the serial state-application
+    /// step. It is only a hint: on failure, `compute_effect` must be used
+    /// to get the deterministic error.
+    pub fn verify_stateless(txn: &Transaction) -> Result<()> {
+        let _t = VERIFY_STATELESS.start_timer();
+        for op in txn.body.operations.iter() {
+            match op {
+                Operation::Claim(i) => i.verify().c(d!())?,
+                Operation::Delegation(i) => i.verify().c(d!())?,
+                Operation::UnDelegation(i) => i.verify().c(d!())?,
+                Operation::UpdateStaker(i) => i.verify().c(d!())?,
+                Operation::DefineAsset(def) => {
+                    def.signature.verify(&def.pubkey.key, &def.body).c(d!())?;
+                }
+                Operation::IssueAsset(iss) => {
+                    iss.signature.verify(&iss.pubkey.key, &iss.body).c(d!())?;
+                }
+                Operation::UpdateMemo(update_memo) => {
+                    update_memo
+                        .signature
+                        .verify(&update_memo.pubkey, &update_memo.body)
+                        .c(d!())?;
+                }
+                Operation::TransferAsset(trn) => {
+                    if TransferType::Standard != trn.body.transfer_type {
+                        continue;
+                    }
+                    for sig in &trn.body_signatures {
+                        if !trn.body.verify_body_signature(sig) {
+                            return Err(eg!());
+                        }
+                    }
+                    LOCAL_PRNG
+                        .with(|prng| {
+                            LOCAL_PARAMS.with(|params| {
+                                verify_xfr_body(
+                                    &mut *prng.borrow_mut(),
+                                    &mut *params.borrow_mut(),
+                                    &trn.body.transfer,
+                                    &trn.body.policies.to_ref(),
+                                )
+                            })
+                        })
+                        .c(d!())?;
+                }
+                Operation::MintFra(_)
+                | Operation::UpdateValidator(_)
+                | Operation::Governance(_)
+                | Operation::FraDistribution(_)
+                | Operation::ConvertAccount(_) => {}
+            }
+        }
+
+        Ok(())
+    }
+
     // An asset creation is valid iff:
     //     1) The signature is valid.
     //         - Fully checked here
     //     2) The token id is available.
     //         - Partially checked here
-    fn add_define_asset(&mut self, def: &DefineAsset) -> Result<()> {
+    fn add_define_asset(&mut self, def: &DefineAsset, preverified: bool) -> Result<()> {
         // (1)
-        def.signature.verify(&def.pubkey.key, &def.body).c(d!())?;
+        if !preverified {
+            def.signature.verify(&def.pubkey.key, &def.body).c(d!())?;
+        }
 
         let code = def.body.asset.code;
         let token = AssetType {
@@ -241,6 +356,7 @@ impl TxnEffect {
         &mut self,
         iss: &IssueAsset,
         txo_count: &mut usize,
+        preverified: bool,
     ) -> Result<()> {
         if iss.body.num_outputs != iss.body.records.len() {
             return Err(eg!());
@@ -263,7 +379,9 @@ impl TxnEffect {
         iss_nums.push(seq_num);
 
         // (2)
-        iss.signature.verify(&iss.pubkey.key, &iss.body).c(d!())?;
+        if !preverified {
+            iss.signature.verify(&iss.pubkey.key, &iss.body).c(d!())?;
+        }
 
         // (3)
         if let Some(prior_key) = self.issuance_keys.get(&code) {
@@ -328,10 +446,8 @@ impl TxnEffect {
         &mut self,
         trn: &TransferAsset,
         txo_count: &mut usize,
+        preverified: bool,
     ) -> Result<()> {
-        let params = &mut *PARAMS.lock();
-        let prng = &mut *PRNG.lock();
-
         if trn.body.inputs.len() != trn.body.transfer.inputs.len() {
             return Err(eg!());
         }
@@ -393,7 +509,7 @@ impl TxnEffect {
                 let mut input_keys = HashSet::new();
                 // (1a) all body signatures are valid
                 for sig in &trn.body_signatures {
-                    if !trn.body.verify_body_signature(sig) {
+                    if !preverified && !trn.body.verify_body_signature(sig) {
                         return Err(eg!());
                     }
                     input_keys.insert(sig.address.key.zei_to_bytes());
@@ -406,13 +522,15 @@ impl TxnEffect {
                     }
                 }
 
-                verify_xfr_body(
-                    prng,
-                    params,
-                    &trn.body.transfer,
-                    &trn.body.policies.to_ref(),
-                )
-                .c(d!())?;
+                if !preverified {
+                    verify_xfr_body(
+                        &mut *PRNG.lock(),
+                        &mut *PARAMS.lock(),
+                        &trn.body.transfer,
+                        &trn.body.policies.to_ref(),
+                    )
+                    .c(d!())?;
+                }
             }
         }
         // (3)
@@ -508,16 +626,19 @@ impl TxnEffect {
         &mut self,
         txn: &Transaction,
         update_memo: &UpdateMemo,
+        preverified: bool,
     ) -> Result<()> {
         let pk = update_memo.pubkey;
         if txn.body.no_replay_token != update_memo.body.no_replay_token {
             return Err(eg!("replay token not match"));
         }
         // 1)
-        update_memo
-            .signature
-            .verify(&pk, &update_memo.body)
-            .c(d!())?;
+        if !preverified {
+            update_memo
+                .signature
+                .verify(&pk, &update_memo.body)
+                .c(d!())?;
+        }
         self.memo_updates.push((
             update_memo.body.asset_type,
             pk,
@@ -24,7 +24,7 @@ use {
     },
     __trash__::{Policy, PolicyGlobals, TxnPolicyData},
     bitmap::SparseMap,
-    cryptohash::{sha256::Digest as BitDigest, HashValue},
+    cryptohash::{sha256::Digest as BitDigest, HashValue, MultiProof},
     fbnc::NumKey,
     globutils::{HashOf, ProofOf, Serialized, SignatureOf},
     lazy_static::lazy_static,
@@ -1438,6 +1438,45 @@ impl AuthenticatedTransaction {
     }
 }
 
+/// A batch of transactions along with a shared multi-proof,
+/// much smaller than a list of `AuthenticatedTransaction`s.
+#[allow(missing_docs)]
+#[derive(Serialize, Deserialize, Clone)]
+pub struct AuthenticatedTransactions {
+    pub finalized_txns: Vec<FinalizedTransaction>,
+    pub txn_inclusion_proofs: MultiProof,
+    pub state_commitment_data: StateCommitmentData,
+    pub state_commitment: HashOf<Option<StateCommitmentData>>,
+}
+
+impl AuthenticatedTransactions {
+    /// Same as `AuthenticatedTransaction::is_valid`, for every transaction.
+    pub fn is_valid(
+        &self,
+        state_commitment: HashOf<Option<StateCommitmentData>>,
+    ) -> bool {
+        if self.state_commitment != state_commitment
+            || self.state_commitment != self.state_commitment_data.compute_commitment()
+        {
+            return false;
+        }
+
+        if self.state_commitment_data.transaction_merkle_commitment
+            != self.txn_inclusion_proofs.root_hash
+            || self.finalized_txns.len() != self.txn_inclusion_proofs.tx_ids.len()
+        {
+            return false;
+        }
+
+        self.finalized_txns.iter().enumerate().all(|(i, tx)| {
+            let mut leaf = HashValue::new();
+            leaf.hash.copy_from_slice(tx.hash().as_ref());
+            self.txn_inclusion_proofs.tx_ids[i] == tx.merkle_id
+                && self.txn_inclusion_proofs.is_valid_proof(i, leaf)
+        })
+    }
+}
+
 #[allow(missing_docs)]
 pub struct AuthenticatedBlock {
     pub block: FinalizedBlock,
@@ -1601,6 +1640,13 @@ lazy_static! {
     pub static ref BLACK_HOLE_PUBKEY_STAKING: XfrPublicKey = pnk!(XfrPublicKey::zei_from_bytes(&[1; ed25519_dalek::PUBLIC_KEY_LENGTH][..]));
 }
 
+/// Leading bytes of a `Transaction` in the binary wire format, "fra:"
+pub const FINDORA_TX_TAG: [u8; 4] = [0x66, 0x72, 0x61, 0x3a];
+
+/// Current version of the binary wire format,
+/// it follows `FINDORA_TX_TAG` in the raw bytes of a transaction
+pub const TX_CODEC_VERSION: u8 = 1;
+
 /// see [**mainnet-v0.1 defination**](https://www.notion.so/findora/Transaction-Fees-Analysis-d657247b70f44a699d50e1b01b8a2287)
 pub const TX_FEE_MIN: u64 = 1_0000;
 
@@ -1672,6 +1718,53 @@ impl Transaction {
         HashOf::new(&(id, self.clone()))
     }
 
+    /// Encode into the binary wire format:
+    /// `FINDORA_TX_TAG` + `TX_CODEC_VERSION` + MessagePack body.
+    ///
+    /// NOTE: the body can not be a plain bincode, because fields marked with
+    /// `skip_serializing_if` need a self-describing format to be decoded.
+    pub fn to_wire_bytes(&self) -> Result<Vec<u8>> {
+        let mut bytes = Vec::with_capacity(FINDORA_TX_TAG.len() + 1);
+        bytes.extend_from_slice(&FINDORA_TX_TAG);
+        bytes.push(TX_CODEC_VERSION);
+        rmp_serde::encode::write_named(&mut bytes, self).c(d!())?;
+        Ok(bytes)
+    }
+
+    /// Whether `bytes` are in the binary wire format rather than the legacy JSON.
+    #[inline(always)]
+    pub fn is_wire_bytes(bytes: &[u8]) -> bool {
+        let len = FINDORA_TX_TAG.len();
+        bytes.len() > len && FINDORA_TX_TAG.eq(&bytes[..len])
+    }
+
+    /// Decode from the binary wire format,
+    /// the legacy JSON format of old clients is also accepted.
+    ///
+    /// Bytes after the MessagePack body are rejected,
+    /// so one transaction has only one valid encoding.
+    pub fn from_wire_bytes(bytes: &[u8]) -> Result<Transaction> {
+        let len = FINDORA_TX_TAG.len();
+        if Self::is_wire_bytes(bytes) {
+            match bytes[len] {
+                TX_CODEC_VERSION => {
+                    let mut body = &bytes[len + 1..];
+                    let tx = rmp_serde::from_read(&mut body).c(d!())?;
+                    if !body.is_empty() {
+                        return Err(eg!(format!(
+                            "{} trailing bytes after the tx",
+                            body.len()
+                        )));
+                    }
+                    Ok(tx)
+                }
+                v => Err(eg!(format!("unsupported tx codec version: {}", v))),
+            }
+        } else {
+            serde_json::from_slice(bytes).c(d!())
+        }
+    }
+
     /// tendermint hash
     #[inline(always)]
     pub fn hash_tm(&self) -> HashOf<Transaction> {
@@ -258,6 +258,31 @@ fn test_add_operation() {
     gen_sample_tx();
 }
 
+#[test]
+fn test_tx_wire_format() {
+    let tx = gen_sample_tx();
+
+    let bytes = pnk!(tx.to_wire_bytes());
+    assert_eq!(&bytes[..FINDORA_TX_TAG.len()], &FINDORA_TX_TAG[..]);
+    assert_eq!(bytes[FINDORA_TX_TAG.len()], TX_CODEC_VERSION);
+    assert_eq!(pnk!(Transaction::from_wire_bytes(&bytes)), tx);
+
+    // the legacy JSON format is still accepted
+    let json = pnk!(serde_json::to_vec(&tx));
+    assert!(bytes.len() < json.len());
+    assert_eq!(pnk!(Transaction::from_wire_bytes(&json)), tx);
+
+    // trailing bytes are rejected
+    let mut padded = bytes.clone();
+    padded.push(0);
+    assert!(Transaction::from_wire_bytes(&padded).is_err());
+
+    // unknown versions are rejected
+    let mut bytes = bytes;
+    bytes[FINDORA_TX_TAG.len()] = TX_CODEC_VERSION + 1;
+    assert!(Transaction::from_wire_bytes(&bytes).is_err());
+}
+
 fn gen_fee_operation(
     amount: Option<u64>,
     asset_type: Option<ZeiAssetType>,
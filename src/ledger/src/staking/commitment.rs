@@ -0,0 +1,696 @@
+//!
+//! # Incremental commitment of staking data
+//!
+//! Hashing the whole `Staking` on every block costs too much
+//! when there are lots of delegations, so the large maps in it
+//! are wrapped by a `HashedMap`, which records the changed keys
+//! and only re-hashes the related entries when a new root is needed.
+//!
+//! The same layout is used by:
+//! - `HashedIndex`, whose entries are the `(key, element)` pairs of a map of sets
+//! - `SeqDigest`, whose entries are the items of a sequence, hashed with
+//!   their positions and bucketed by `position % BUCKET_NUM`,
+//!   it commits the delegators of every validator, see `CowIndexMap`
+//!
+//! Layout of a root:
+//! - `entry digest = sha256(bincode(key, value))`
+//! - every entry belongs to one of the `BUCKET_NUM` buckets,
+//!   decided by the first byte of `sha256(bincode(key))`
+//! - `bucket digest = sha256(<entry digests of the bucket, ordered by key>)`
+//! - `root = sha256(<all bucket digests, ordered by bucket id>)`
+//!
+
+use {
+    super::{Delegation, ValidatorData},
+    cryptohash::sha256::{self, Digest, DIGESTBYTES},
+    ruc::*,
+    serde::{Deserialize, Deserializer, Serialize, Serializer},
+    std::{
+        collections::{BTreeMap, BTreeSet},
+        fmt, mem,
+        ops::{Deref, RangeBounds},
+        result::Result as StdResult,
+    },
+};
+
+const BUCKET_NUM: usize = 256;
+
+#[cfg(test)]
+thread_local! {
+    // how many entries have been hashed, used to check the incremental paths
+    pub(crate) static HASHED_ENTRIES: std::cell::Cell<usize> = std::cell::Cell::new(0);
+}
+
+/// How an entry of a `HashedMap` is hashed.
+pub(crate) trait EntryDigest {
+    fn entry_digest<K: Serialize>(&self, k: &K) -> Result<Digest>;
+}
+
+impl EntryDigest for Delegation {
+    #[inline(always)]
+    fn entry_digest<K: Serialize>(&self, k: &K) -> Result<Digest> {
+        hash_of(&(k, self)).c(d!())
+    }
+}
+
+// The delegators of a validator are committed by their own digest,
+// which is shared by all the heights until they are changed,
+// so a re-inserted `ValidatorData` costs O(validators) instead of O(delegators).
+impl EntryDigest for ValidatorData {
+    fn entry_digest<K: Serialize>(&self, k: &K) -> Result<Digest> {
+        let mut data = bincode::serialize(&(
+            k,
+            self.height,
+            &self.cosig_rule,
+            &self.addr_td_to_app,
+        ))
+        .c(d!())?;
+        for v in self.body.values() {
+            let others = bincode::serialize(&(
+                &v.id,
+                &v.td_pubkey,
+                &v.td_addr,
+                v.td_power,
+                v.commission_rate,
+                &v.memo,
+                &v.kind,
+                v.signed_last_block,
+                v.signed_cnt,
+            ))
+            .c(d!())?;
+            data.extend_from_slice(&others);
+            data.extend_from_slice(v.delegators.digest().c(d!())?.as_ref());
+        }
+        Ok(hash_bytes(&data))
+    }
+}
+
+/// Digests of the entries of a keyed collection, in `BUCKET_NUM` buckets.
+#[derive(Clone)]
+struct Accumulator<K: Ord> {
+    // keys that have been changed since the last `root`
+    dirty: BTreeSet<K>,
+    // all entries need to be re-hashed, eg. after a deserialization
+    all_dirty: bool,
+    // <bucket id> => <key> => <digest of the entry>
+    buckets: Vec<BTreeMap<K, Digest>>,
+    bucket_digests: Vec<Digest>,
+}
+
+impl<K: Ord> Accumulator<K> {
+    #[inline(always)]
+    fn new() -> Self {
+        Accumulator {
+            dirty: BTreeSet::new(),
+            all_dirty: true,
+            buckets: vec![],
+            bucket_digests: vec![],
+        }
+    }
+}
+
+impl<K: Ord + Clone + Serialize> Accumulator<K> {
+    #[inline(always)]
+    fn mark(&mut self, k: K) {
+        if !self.all_dirty {
+            self.dirty.insert(k);
+        }
+    }
+
+    /// Update the digests of all changed entries, and return the new root.
+    ///
+    /// - `all`: all existing keys, only used after a full invalidation
+    /// - `digest_of`: the digest of an entry, `None` if it does not exist
+    fn root<I, F>(&mut self, all: I, digest_of: F) -> Result<Digest>
+    where
+        I: Iterator<Item = K>,
+        F: Fn(&K) -> Option<Result<Digest>>,
+    {
+        let mut changed_buckets = BTreeSet::new();
+
+        if self.all_dirty {
+            self.buckets = vec![BTreeMap::new(); BUCKET_NUM];
+            for k in all {
+                let b = bucket_of(&k).c(d!())?;
+                let digest = digest_of(&k).c(d!())?.c(d!())?;
+                self.buckets[b].insert(k, digest);
+            }
+            self.bucket_digests = vec![Digest([0; DIGESTBYTES]); BUCKET_NUM];
+            changed_buckets.extend(0..BUCKET_NUM);
+            self.dirty.clear();
+            self.all_dirty = false;
+        } else {
+            for k in mem::take(&mut self.dirty).into_iter() {
+                let b = bucket_of(&k).c(d!())?;
+                if let Some(digest) = digest_of(&k) {
+                    self.buckets[b].insert(k, digest.c(d!())?);
+                } else {
+                    self.buckets[b].remove(&k);
+                }
+                changed_buckets.insert(b);
+            }
+        }
+
+        for b in changed_buckets.into_iter() {
+            self.bucket_digests[b] = concat_digest(self.buckets[b].values());
+        }
+
+        Ok(concat_digest(self.bucket_digests.iter()))
+    }
+}
+
+/// A `BTreeMap` with an incrementally maintained root hash.
+///
+/// Read-only operations are available through `Deref`,
+/// all changes must go through the methods here,
+/// so every changed key will be re-hashed in the next `root`.
+#[derive(Clone)]
+pub(crate) struct HashedMap<K: Ord, V> {
+    map: BTreeMap<K, V>,
+    acc: Accumulator<K>,
+}
+
+impl<K, V> HashedMap<K, V>
+where
+    K: Ord + Clone + Serialize,
+{
+    #[inline(always)]
+    pub(crate) fn new() -> Self {
+        Self::from(BTreeMap::new())
+    }
+
+    #[inline(always)]
+    fn mark(&mut self, k: K) {
+        self.acc.mark(k);
+    }
+
+    #[inline(always)]
+    pub(crate) fn insert(&mut self, k: K, v: V) -> Option<V> {
+        self.mark(k.clone());
+        self.map.insert(k, v)
+    }
+
+    #[inline(always)]
+    pub(crate) fn remove(&mut self, k: &K) -> Option<V> {
+        let v = self.map.remove(k);
+        if v.is_some() {
+            self.mark(k.clone());
+        }
+        v
+    }
+
+    #[inline(always)]
+    pub(crate) fn get_mut(&mut self, k: &K) -> Option<&mut V> {
+        let v = self.map.get_mut(k);
+        if v.is_some() {
+            self.acc.mark(k.clone());
+        }
+        v
+    }
+
+    #[inline(always)]
+    pub(crate) fn get_or_insert_with<F: FnOnce() -> V>(&mut self, k: K, f: F) -> &mut V {
+        self.mark(k.clone());
+        self.map.entry(k).or_insert_with(f)
+    }
+
+    /// Get the last entry within the range, in the mutable mode.
+    #[inline(always)]
+    pub(crate) fn range_last_mut<R: RangeBounds<K>>(
+        &mut self,
+        range: R,
+    ) -> Option<&mut V> {
+        let acc = &mut self.acc;
+        self.map.range_mut(range).next_back().map(|(k, v)| {
+            acc.mark(k.clone());
+            v
+        })
+    }
+
+    /// Get all values that match the predicate, in the mutable mode.
+    pub(crate) fn filter_values_mut<F: Fn(&V) -> bool>(
+        &mut self,
+        pred: F,
+    ) -> Vec<&mut V> {
+        let acc = &mut self.acc;
+        self.map
+            .iter_mut()
+            .filter(|(_, v)| pred(v))
+            .map(|(k, v)| {
+                acc.mark(k.clone());
+                v
+            })
+            .collect()
+    }
+
+    /// Remove all entries whose keys are smaller than `k`.
+    pub(crate) fn clean_before(&mut self, k: &K) {
+        if self.map.keys().next().map_or(true, |first| first >= k) {
+            return;
+        }
+        let tail = self.map.split_off(k);
+        mem::replace(&mut self.map, tail)
+            .into_keys()
+            .for_each(|k| self.mark(k));
+    }
+
+    /// Update the digests of all changed entries, and return the new root.
+    pub(crate) fn root(&mut self) -> Result<Digest>
+    where
+        V: EntryDigest,
+    {
+        let map = &self.map;
+        self.acc.root(map.keys().cloned(), |k| {
+            map.get(k).map(|v| v.entry_digest(k))
+        })
+    }
+}
+
+/// A `BTreeMap` of sets with an incrementally maintained root hash,
+/// every `(key, element)` pair is hashed as an entry,
+/// so moving one element only touches two entries.
+///
+/// Empty sets are kept as they are, but they are not a part of the root.
+#[derive(Clone)]
+pub(crate) struct HashedIndex<K: Ord, E: Ord> {
+    map: BTreeMap<K, BTreeSet<E>>,
+    acc: Accumulator<(K, E)>,
+}
+
+impl<K, E> HashedIndex<K, E>
+where
+    K: Ord + Clone + Serialize,
+    E: Ord + Clone + Serialize,
+{
+    #[inline(always)]
+    pub(crate) fn new() -> Self {
+        Self::from(BTreeMap::new())
+    }
+
+    /// Add `e` to the set of `k`, the set will be created if it does not exist.
+    #[inline(always)]
+    pub(crate) fn insert(&mut self, k: K, e: E) -> bool {
+        let set = self.map.entry(k.clone()).or_insert_with(BTreeSet::new);
+        let newly = set.insert(e.clone());
+        if newly {
+            self.acc.mark((k, e));
+        }
+        newly
+    }
+
+    /// Remove `e` from the set of `k`, an empty set is kept.
+    #[inline(always)]
+    pub(crate) fn remove(&mut self, k: &K, e: &E) -> bool {
+        let removed = self.map.get_mut(k).map_or(false, |set| set.remove(e));
+        if removed {
+            self.acc.mark((k.clone(), e.clone()));
+        }
+        removed
+    }
+
+    /// Remove the whole set of `k`.
+    pub(crate) fn remove_key(&mut self, k: &K) -> Option<BTreeSet<E>> {
+        let set = self.map.remove(k);
+        if let Some(set) = set.as_ref() {
+            set.iter()
+                .for_each(|e| self.acc.mark((k.clone(), e.clone())));
+        }
+        set
+    }
+
+    /// Update the digests of all changed entries, and return the new root.
+    pub(crate) fn root(&mut self) -> Result<Digest> {
+        let map = &self.map;
+        self.acc.root(
+            map.iter()
+                .flat_map(|(k, set)| set.iter().map(move |e| (k.clone(), e.clone()))),
+            |(k, e)| {
+                map.get(k)
+                    .filter(|set| set.contains(e))
+                    .map(|_| hash_of(&(k, e)))
+            },
+        )
+    }
+}
+
+/// Digests of a sequence, by position.
+///
+/// An item is hashed together with its position,
+/// so the order is committed, and a swap only re-hashes two items.
+#[derive(Clone)]
+pub(crate) struct SeqDigest {
+    items: Vec<Digest>,
+    // positions that have been changed since the last `root`
+    dirty: BTreeSet<usize>,
+    all_dirty: bool,
+    bucket_digests: Vec<Digest>,
+    root: Option<Digest>,
+}
+
+impl SeqDigest {
+    #[inline(always)]
+    pub(crate) fn new() -> Self {
+        SeqDigest {
+            items: vec![],
+            dirty: BTreeSet::new(),
+            all_dirty: true,
+            bucket_digests: vec![],
+            root: None,
+        }
+    }
+
+    #[inline(always)]
+    pub(crate) fn mark(&mut self, i: usize) {
+        if !self.all_dirty {
+            self.dirty.insert(i);
+        }
+        self.root = None;
+    }
+
+    /// Update the digests of all changed positions, and return the new root.
+    ///
+    /// - `len`: current length of the sequence
+    /// - `item`: the item at a position
+    pub(crate) fn root<T, F>(&mut self, len: usize, item: F) -> Result<Digest>
+    where
+        T: Serialize,
+        F: Fn(usize) -> T,
+    {
+        if let Some(root) = self.root {
+            return Ok(root);
+        }
+
+        let pos_digest = |i: usize| hash_of(&(i as u64, item(i)));
+        let mut changed_buckets = BTreeSet::new();
+
+        if self.all_dirty {
+            self.items = (0..len).map(pos_digest).collect::<Result<_>>().c(d!())?;
+            self.bucket_digests = vec![Digest([0; DIGESTBYTES]); BUCKET_NUM];
+            changed_buckets.extend(0..BUCKET_NUM);
+            self.dirty.clear();
+            self.all_dirty = false;
+        } else {
+            // removed positions
+            (len..self.items.len()).for_each(|i| {
+                changed_buckets.insert(i % BUCKET_NUM);
+            });
+            self.items.resize(len, Digest([0; DIGESTBYTES]));
+            for i in mem::take(&mut self.dirty).into_iter().filter(|i| *i < len) {
+                self.items[i] = pos_digest(i).c(d!())?;
+                changed_buckets.insert(i % BUCKET_NUM);
+            }
+        }
+
+        for b in changed_buckets.into_iter() {
+            self.bucket_digests[b] =
+                concat_digest(self.items.iter().skip(b).step_by(BUCKET_NUM));
+        }
+
+        let mut data = (len as u64).to_le_bytes().to_vec();
+        self.bucket_digests
+            .iter()
+            .for_each(|d| data.extend_from_slice(d.as_ref()));
+        let root = sha256::hash(&data);
+        self.root = Some(root);
+
+        Ok(root)
+    }
+}
+
+#[inline(always)]
+fn bucket_of<K: Serialize>(k: &K) -> Result<usize> {
+    bincode::serialize(k)
+        .c(d!())
+        .map(|bytes| sha256::hash(&bytes).0[0] as usize % BUCKET_NUM)
+}
+
+/// `sha256(bincode(t))`, the digest of one entry.
+#[inline(always)]
+fn hash_of<T: Serialize>(t: &T) -> Result<Digest> {
+    bincode::serialize(t)
+        .c(d!())
+        .map(|bytes| hash_bytes(&bytes))
+}
+
+#[inline(always)]
+fn hash_bytes(bytes: &[u8]) -> Digest {
+    #[cfg(test)]
+    HASHED_ENTRIES.with(|n| n.set(n.get() + 1));
+    sha256::hash(bytes)
+}
+
+#[inline(always)]
+fn concat_digest<'a>(digests: impl Iterator<Item = &'a Digest>) -> Digest {
+    let bytes = digests
+        .flat_map(|d| d.0.iter().copied())
+        .collect::<Vec<_>>();
+    sha256::hash(&bytes)
+}
+
+impl<K: Ord, V> From<BTreeMap<K, V>> for HashedMap<K, V> {
+    #[inline(always)]
+    fn from(map: BTreeMap<K, V>) -> Self {
+        HashedMap {
+            map,
+            acc: Accumulator::new(),
+        }
+    }
+}
+
+impl<K: Ord, V> Default for HashedMap<K, V> {
+    #[inline(always)]
+    fn default() -> Self {
+        Self::from(BTreeMap::new())
+    }
+}
+
+impl<K: Ord, V> Deref for HashedMap<K, V> {
+    type Target = BTreeMap<K, V>;
+    #[inline(always)]
+    fn deref(&self) -> &Self::Target {
+        &self.map
+    }
+}
+
+// the cached digests are not a part of the data
+impl<K: Ord, V: PartialEq> PartialEq for HashedMap<K, V> {
+    #[inline(always)]
+    fn eq(&self, other: &Self) -> bool {
+        self.map == other.map
+    }
+}
+
+impl<K: Ord, V: Eq> Eq for HashedMap<K, V> {}
+
+impl<K: Ord + fmt::Debug, V: fmt::Debug> fmt::Debug for HashedMap<K, V> {
+    #[inline(always)]
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        self.map.fmt(f)
+    }
+}
+
+// keep the same format with a plain `BTreeMap`
+impl<K: Ord + Serialize, V: Serialize> Serialize for HashedMap<K, V> {
+    #[inline(always)]
+    fn serialize<S: Serializer>(&self, serializer: S) -> StdResult<S::Ok, S::Error> {
+        self.map.serialize(serializer)
+    }
+}
+
+impl<'de, K, V> Deserialize<'de> for HashedMap<K, V>
+where
+    K: Ord + Deserialize<'de>,
+    V: Deserialize<'de>,
+{
+    #[inline(always)]
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> StdResult<Self, D::Error> {
+        BTreeMap::deserialize(deserializer).map(Self::from)
+    }
+}
+
+impl<K: Ord, E: Ord> From<BTreeMap<K, BTreeSet<E>>> for HashedIndex<K, E> {
+    #[inline(always)]
+    fn from(map: BTreeMap<K, BTreeSet<E>>) -> Self {
+        HashedIndex {
+            map,
+            acc: Accumulator::new(),
+        }
+    }
+}
+
+impl<K: Ord, E: Ord> Default for HashedIndex<K, E> {
+    #[inline(always)]
+    fn default() -> Self {
+        Self::from(BTreeMap::new())
+    }
+}
+
+impl<K: Ord, E: Ord> Deref for HashedIndex<K, E> {
+    type Target = BTreeMap<K, BTreeSet<E>>;
+    #[inline(always)]
+    fn deref(&self) -> &Self::Target {
+        &self.map
+    }
+}
+
+impl<K: Ord, E: Ord> PartialEq for HashedIndex<K, E> {
+    #[inline(always)]
+    fn eq(&self, other: &Self) -> bool {
+        self.map == other.map
+    }
+}
+
+impl<K: Ord, E: Ord> Eq for HashedIndex<K, E> {}
+
+impl<K: Ord + fmt::Debug, E: Ord + fmt::Debug> fmt::Debug for HashedIndex<K, E> {
+    #[inline(always)]
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        self.map.fmt(f)
+    }
+}
+
+// keep the same format with a plain `BTreeMap`
+impl<K: Ord + Serialize, E: Ord + Serialize> Serialize for HashedIndex<K, E> {
+    #[inline(always)]
+    fn serialize<S: Serializer>(&self, serializer: S) -> StdResult<S::Ok, S::Error> {
+        self.map.serialize(serializer)
+    }
+}
+
+impl<'de, K, E> Deserialize<'de> for HashedIndex<K, E>
+where
+    K: Ord + Deserialize<'de>,
+    E: Ord + Deserialize<'de>,
+{
+    #[inline(always)]
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> StdResult<Self, D::Error> {
+        BTreeMap::deserialize(deserializer).map(Self::from)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    impl EntryDigest for u64 {
+        fn entry_digest<K: Serialize>(&self, k: &K) -> Result<Digest> {
+            hash_of(&(k, self))
+        }
+    }
+
+    #[test]
+    fn hashed_map_root() {
+        let mut m = HashedMap::<u64, u64>::new();
+        (0..1000).for_each(|i| {
+            m.insert(i, i * 2);
+        });
+        let r0 = pnk!(m.root());
+
+        // unchanged data, unchanged root
+        assert_eq!(pnk!(m.root()), r0);
+
+        *m.get_mut(&7).unwrap() = 0;
+        m.remove(&8);
+        *m.get_or_insert_with(2000, || 1) += 1;
+        *m.range_last_mut(..=500).unwrap() += 1;
+        m.filter_values_mut(|v| 0 == v % 3)
+            .into_iter()
+            .for_each(|v| *v += 1);
+        m.clean_before(&3);
+        assert!(m.get_mut(&9999).is_none());
+        let r1 = pnk!(m.root());
+        assert_ne!(r0, r1);
+
+        // incremental result == full result
+        let mut full = HashedMap::from(m.map.clone());
+        assert_eq!(pnk!(full.root()), r1);
+
+        // same format with `BTreeMap`
+        let json = pnk!(serde_json::to_string(&m));
+        assert_eq!(json, pnk!(serde_json::to_string(&m.map)));
+        let mut de: HashedMap<u64, u64> = pnk!(serde_json::from_str(&json));
+        assert_eq!(de, m);
+        assert_eq!(pnk!(de.root()), r1);
+    }
+
+    #[test]
+    fn hashed_index_root() {
+        let mut m = HashedIndex::<u64, u64>::new();
+        (0..1000).for_each(|i| {
+            m.insert(i % 10, i);
+        });
+        let r0 = pnk!(m.root());
+
+        // moving one element only hashes the new pair
+        HASHED_ENTRIES.with(|n| n.set(0));
+        assert!(m.remove(&3, &13));
+        assert!(m.insert(9999, 13));
+        assert!(!m.remove(&3, &13));
+        let r1 = pnk!(m.root());
+        assert_ne!(r0, r1);
+        assert_eq!(1, HASHED_ENTRIES.with(|n| n.get()));
+
+        m.remove_key(&5);
+        assert!(m.remove_key(&5).is_none());
+        let r2 = pnk!(m.root());
+
+        // incremental result == full result
+        let mut full = HashedIndex::from(m.map.clone());
+        assert_eq!(pnk!(full.root()), r2);
+
+        // empty sets are kept, but not committed
+        (0..100).for_each(|i| {
+            m.remove(&0, &(i * 10));
+        });
+        assert!(m.get(&0).unwrap().is_empty());
+        let r3 = pnk!(m.root());
+        let mut full = HashedIndex::from(
+            m.map
+                .iter()
+                .filter(|(_, set)| !set.is_empty())
+                .map(|(k, set)| (*k, set.clone()))
+                .collect::<BTreeMap<_, _>>(),
+        );
+        assert_eq!(pnk!(full.root()), r3);
+
+        // same format with `BTreeMap`
+        let json = pnk!(serde_json::to_string(&m));
+        assert_eq!(json, pnk!(serde_json::to_string(&m.map)));
+        let mut de: HashedIndex<u64, u64> = pnk!(serde_json::from_str(&json));
+        assert_eq!(de, m);
+        assert_eq!(pnk!(de.root()), r3);
+    }
+
+    #[test]
+    fn seq_digest_root() {
+        let full = |v: &[u64]| pnk!(SeqDigest::new().root(v.len(), |i| v[i]));
+
+        let mut v = (0..1000).collect::<Vec<u64>>();
+        let mut d = SeqDigest::new();
+        let r0 = pnk!(d.root(v.len(), |i| v[i]));
+        assert_eq!(r0, full(&v));
+
+        // a swap re-hashes two positions
+        HASHED_ENTRIES.with(|n| n.set(0));
+        v.swap(3, 700);
+        d.mark(3);
+        d.mark(700);
+        let r1 = pnk!(d.root(v.len(), |i| v[i]));
+        assert_eq!(2, HASHED_ENTRIES.with(|n| n.get()));
+        assert_ne!(r0, r1);
+        assert_eq!(r1, full(&v));
+
+        // unchanged data, cached root
+        HASHED_ENTRIES.with(|n| n.set(0));
+        assert_eq!(pnk!(d.root(v.len(), |i| v[i])), r1);
+        assert_eq!(0, HASHED_ENTRIES.with(|n| n.get()));
+
+        // removals and appends
+        v.swap_remove(10);
+        d.mark(10);
+        v.truncate(500);
+        v.push(9999);
+        d.mark(500);
+        assert_eq!(pnk!(d.root(v.len(), |i| v[i])), full(&v));
+    }
+}
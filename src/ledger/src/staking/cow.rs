@@ -0,0 +1,271 @@
+//!
+//! # Copy-on-write maps
+//!
+//! The validator set is copied to every new height, most of its size is in
+//! the delegators of each validator, which rarely change between two heights.
+//!
+//! A `CowIndexMap` shares its entries with all copies, until one of them is
+//! changed, so a new height only allocates the delegators that have changed.
+//!
+//! The digest of the entries is shared in the same way, and only the changed
+//! positions are re-hashed, so a new height costs nothing in the commitment.
+//!
+
+use {
+    super::commitment::SeqDigest,
+    cryptohash::sha256::Digest,
+    indexmap::IndexMap,
+    parking_lot::Mutex,
+    ruc::*,
+    serde::{Deserialize, Deserializer, Serialize, Serializer},
+    std::{
+        cmp::Ordering, fmt, hash::Hash, ops::Deref, result::Result as StdResult,
+        sync::Arc,
+    },
+};
+
+struct Inner<K, V> {
+    map: IndexMap<K, V>,
+    digest: Mutex<SeqDigest>,
+}
+
+impl<K: Clone, V: Clone> Clone for Inner<K, V> {
+    fn clone(&self) -> Self {
+        Inner {
+            map: self.map.clone(),
+            digest: Mutex::new(self.digest.lock().clone()),
+        }
+    }
+}
+
+/// An `IndexMap` shared by its clones.
+///
+/// Read-only operations are available through `Deref`,
+/// all changes must go through the methods here,
+/// the entries are copied on the first change of a shared map.
+pub struct CowIndexMap<K, V> {
+    inner: Arc<Inner<K, V>>,
+}
+
+impl<K: Hash + Eq, V> CowIndexMap<K, V> {
+    #[inline(always)]
+    #[allow(missing_docs)]
+    pub fn new() -> Self {
+        Self::from(IndexMap::new())
+    }
+
+    /// If the entries are shared with other copies.
+    #[inline(always)]
+    pub fn is_shared(&self) -> bool {
+        1 < Arc::strong_count(&self.inner)
+    }
+}
+
+impl<K: Hash + Eq + Clone, V: Clone> CowIndexMap<K, V> {
+    #[inline(always)]
+    fn inner_mut(&mut self) -> &mut Inner<K, V> {
+        Arc::make_mut(&mut self.inner)
+    }
+
+    /// Update the value of `k`, insert a default one at the end if it does not exist,
+    /// return the index of the entry.
+    pub fn upsert<F: FnOnce(&mut V)>(&mut self, k: K, f: F) -> usize
+    where
+        V: Default,
+    {
+        let inner = self.inner_mut();
+        let entry = inner.map.entry(k);
+        let i = entry.index();
+        f(entry.or_insert_with(V::default));
+        inner.digest.get_mut().mark(i);
+        i
+    }
+
+    /// Update the value of `k` if it exists, return its index.
+    pub fn update<F: FnOnce(&mut V)>(&mut self, k: &K, f: F) -> Option<usize> {
+        self.inner.map.get_index_of(k)?;
+        let inner = self.inner_mut();
+        let (i, _, v) = inner.map.get_full_mut(k)?;
+        f(v);
+        inner.digest.get_mut().mark(i);
+        Some(i)
+    }
+
+    /// Same as `IndexMap::swap_indices`.
+    pub fn swap_indices(&mut self, a: usize, b: usize) {
+        let inner = self.inner_mut();
+        inner.map.swap_indices(a, b);
+        let digest = inner.digest.get_mut();
+        digest.mark(a);
+        digest.mark(b);
+    }
+
+    /// Same as `IndexMap::swap_remove_full`.
+    pub fn swap_remove_full(&mut self, k: &K) -> Option<(usize, K, V)> {
+        self.inner.map.get_index_of(k)?;
+        let inner = self.inner_mut();
+        let res = inner.map.swap_remove_full(k);
+        if let Some((i, _, _)) = res.as_ref() {
+            // the last one has been moved to `i`
+            inner.digest.get_mut().mark(*i);
+        }
+        res
+    }
+
+    /// Same as `IndexMap::sort_by`, only the moved entries will be re-hashed.
+    pub fn sort_by<F>(&mut self, cmp: F)
+    where
+        F: FnMut(&K, &V, &K, &V) -> Ordering,
+    {
+        let inner = self.inner_mut();
+        let orig = inner.map.keys().cloned().collect::<Vec<_>>();
+        inner.map.sort_by(cmp);
+        let digest = inner.digest.get_mut();
+        orig.iter()
+            .zip(inner.map.keys())
+            .enumerate()
+            .filter(|(_, (a, b))| a != b)
+            .for_each(|(i, _)| digest.mark(i));
+    }
+}
+
+impl<K: Serialize, V: Serialize> CowIndexMap<K, V> {
+    /// Digest of all the entries in order, see `SeqDigest`.
+    #[inline(always)]
+    pub fn digest(&self) -> Result<Digest> {
+        let map = &self.inner.map;
+        self.inner
+            .digest
+            .lock()
+            .root(map.len(), |i| map.get_index(i).unwrap())
+            .c(d!())
+    }
+}
+
+impl<K: Hash + Eq, V> Default for CowIndexMap<K, V> {
+    #[inline(always)]
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<K, V> From<IndexMap<K, V>> for CowIndexMap<K, V> {
+    #[inline(always)]
+    fn from(map: IndexMap<K, V>) -> Self {
+        CowIndexMap {
+            inner: Arc::new(Inner {
+                map,
+                digest: Mutex::new(SeqDigest::new()),
+            }),
+        }
+    }
+}
+
+// never copies the entries
+impl<K, V> Clone for CowIndexMap<K, V> {
+    #[inline(always)]
+    fn clone(&self) -> Self {
+        CowIndexMap {
+            inner: Arc::clone(&self.inner),
+        }
+    }
+}
+
+impl<K, V> Deref for CowIndexMap<K, V> {
+    type Target = IndexMap<K, V>;
+    #[inline(always)]
+    fn deref(&self) -> &Self::Target {
+        &self.inner.map
+    }
+}
+
+impl<'a, K, V> IntoIterator for &'a CowIndexMap<K, V> {
+    type Item = (&'a K, &'a V);
+    type IntoIter = indexmap::map::Iter<'a, K, V>;
+    #[inline(always)]
+    fn into_iter(self) -> Self::IntoIter {
+        self.inner.map.iter()
+    }
+}
+
+impl<K: Hash + Eq, V: PartialEq> PartialEq for CowIndexMap<K, V> {
+    #[inline(always)]
+    fn eq(&self, other: &Self) -> bool {
+        Arc::ptr_eq(&self.inner, &other.inner) || self.inner.map == other.inner.map
+    }
+}
+
+impl<K: Hash + Eq, V: Eq> Eq for CowIndexMap<K, V> {}
+
+impl<K: fmt::Debug, V: fmt::Debug> fmt::Debug for CowIndexMap<K, V> {
+    #[inline(always)]
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        self.inner.map.fmt(f)
+    }
+}
+
+// keep the same format with a plain `IndexMap`
+impl<K: Hash + Eq + Serialize, V: Serialize> Serialize for CowIndexMap<K, V> {
+    #[inline(always)]
+    fn serialize<S: Serializer>(&self, serializer: S) -> StdResult<S::Ok, S::Error> {
+        self.inner.map.serialize(serializer)
+    }
+}
+
+impl<'de, K, V> Deserialize<'de> for CowIndexMap<K, V>
+where
+    K: Hash + Eq + Deserialize<'de>,
+    V: Deserialize<'de>,
+{
+    #[inline(always)]
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> StdResult<Self, D::Error> {
+        IndexMap::deserialize(deserializer).map(Self::from)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn cow_index_map() {
+        let mut m = CowIndexMap::<u64, u64>::new();
+        (0..100).for_each(|i| {
+            m.upsert(i, |v| *v = i);
+        });
+        assert!(!m.is_shared());
+
+        // a copy shares the entries until it's changed
+        let mut copied = m.clone();
+        assert!(m.is_shared() && copied.is_shared());
+        assert_eq!(copied, m);
+        assert_eq!(copied.get(&1), Some(&1));
+
+        let d0 = pnk!(m.digest());
+        assert_eq!(pnk!(copied.digest()), d0);
+
+        assert_eq!(copied.update(&1, |v| *v += 1), Some(1));
+        assert!(!m.is_shared() && !copied.is_shared());
+        assert_eq!(pnk!(m.digest()), d0);
+        assert_ne!(pnk!(copied.digest()), d0);
+        assert_eq!(m.get(&1), Some(&1));
+        assert_eq!(copied.get(&1), Some(&2));
+        assert_ne!(copied, m);
+        assert_eq!(100, (&copied).into_iter().count());
+
+        // incremental digest == full digest
+        assert_eq!(copied.upsert(1000, |v| *v += 7), 100);
+        copied.swap_indices(0, 100);
+        assert!(copied.swap_remove_full(&5).is_some());
+        assert!(copied.swap_remove_full(&5).is_none());
+        copied.sort_by(|_, v1, _, v2| v2.cmp(v1));
+        let full = CowIndexMap::from((*copied).clone());
+        assert_eq!(pnk!(copied.digest()), pnk!(full.digest()));
+
+        // same format with `IndexMap`
+        let json = pnk!(serde_json::to_string(&m));
+        assert_eq!(json, pnk!(serde_json::to_string(&*m)));
+        let de: CowIndexMap<u64, u64> = pnk!(serde_json::from_str(&json));
+        assert_eq!(de, m);
+    }
+}
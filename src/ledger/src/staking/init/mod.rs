@@ -4,10 +4,9 @@
 
 use {
     super::{
-        td_addr_to_bytes, BlockHeight, Power, Validator, ValidatorKind,
+        td_addr_to_bytes, BlockHeight, CowIndexMap, Power, Validator, ValidatorKind,
         STAKING_VALIDATOR_MIN_POWER,
     },
-    indexmap::IndexMap,
     ruc::*,
     serde::{Deserialize, Serialize},
     std::convert::TryFrom,
@@ -54,7 +53,7 @@ impl TryFrom<ValidatorStr> for Validator {
             kind: v.kind.unwrap_or(ValidatorKind::Initiator),
             signed_last_block: false,
             signed_cnt: 0,
-            delegators: IndexMap::new(),
+            delegators: CowIndexMap::new(),
         })
     }
 }
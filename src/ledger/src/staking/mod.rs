@@ -15,10 +15,14 @@
 #[cfg(not(target_arch = "wasm32"))]
 use {num_bigint::BigUint, std::convert::TryFrom};
 
+mod commitment;
 pub mod cosig;
+mod cow;
 pub mod init;
 pub mod ops;
 
+pub use cow::CowIndexMap;
+
 use {
     crate::{
         data_model::{
@@ -26,12 +30,12 @@ use {
         },
         SNAPSHOT_ENTRIES_DIR,
     },
+    commitment::{HashedIndex, HashedMap},
     config::abci::global_cfg::CFG,
     cosig::CoSigRule,
     cryptohash::sha256::{self, Digest},
     fbnc::{new_mapx, Mapx},
     globutils::wallet,
-    indexmap::IndexMap,
     lazy_static::lazy_static,
     ops::{
         fra_distribution::FraDistributionOps,
@@ -198,7 +202,7 @@ pub type TendermintAddrRef<'a> = &'a str;
 pub type TendermintAddrBytes = Vec<u8>;
 // type TendermintAddrBytesRef<'a> = &'a [u8];
 
-type ValidatorInfo = BTreeMap<BlockHeight, ValidatorData>;
+type ValidatorInfo = HashedMap<BlockHeight, ValidatorData>;
 
 /// Staking entry
 ///
@@ -240,6 +244,37 @@ impl Staking {
             && 0 != self.validator_info.keys().next().copied().unwrap()
     }
 
+    /// Commitment of the whole staking data,
+    /// only the changed entries of the large maps will be re-hashed,
+    /// other fields are small enough to be hashed directly.
+    ///
+    /// The delegators of each validator are committed by the cached digest
+    /// of its `CowIndexMap`, the expiry index by its `(height, delegator)` pairs,
+    /// so a block with one changed delegation re-hashes O(1) entries
+    /// (plus one record per validator of the changed heights).
+    pub fn commitment(&mut self) -> Result<Digest> {
+        let vi_root = self.validator_info.root().c(d!())?;
+        let di_root = self
+            .delegation_info
+            .global_delegation_records_map
+            .root()
+            .c(d!())?;
+        let eh_root = self.delegation_info.end_height_map.root().c(d!())?;
+        let others = bincode::serialize(&(
+            self.cur_height,
+            self.delegation_info.global_amount,
+            &self.coinbase,
+            &self.cr,
+        ))
+        .c(d!())?;
+
+        let mut data = others;
+        data.extend_from_slice(vi_root.as_ref());
+        data.extend_from_slice(di_root.as_ref());
+        data.extend_from_slice(eh_root.as_ref());
+        Ok(sha256::hash(&data))
+    }
+
     #[inline(always)]
     fn gen_consensus_tmp_pubkey(cr: &mut ConsensusRng) -> XfrPublicKey {
         XfrKeyPair::generate(cr).get_pk()
@@ -251,7 +286,7 @@ impl Staking {
         Staking {
             // use '0' instead of '1' to
             // avoid conflicts with initial operations
-            validator_info: map! {B 0 => ValidatorData::default()},
+            validator_info: map! {B 0 => ValidatorData::default()}.into(),
             delegation_info: DelegationInfo::new(),
             cur_height: 0,
             coinbase: CoinBase::gen(),
@@ -383,11 +418,7 @@ impl Staking {
         &mut self,
         h: BlockHeight,
     ) -> Option<&mut ValidatorData> {
-        self.validator_info
-            .range_mut(0..=h)
-            .rev()
-            .next()
-            .map(|(_, v)| v)
+        self.validator_info.range_last_mut(0..=h)
     }
 
     /// Get the validators exactly on a specified height.
@@ -407,6 +438,9 @@ impl Staking {
     }
 
     /// Make the validators at a specified height to be effective.
+    ///
+    /// The copy of the previous settings shares the delegators of each validator
+    /// with them, see `CowIndexMap`, only the changed ones will be copied.
     pub fn validator_apply_at_height(&mut self, h: BlockHeight) {
         if let Some(mut prev) = self.validator_get_effective_at_height(h - 1).cloned() {
             alt!(prev.body.is_empty(), return);
@@ -446,7 +480,7 @@ impl Staking {
     // Clean validator-info older than the specified height.
     #[inline(always)]
     fn validator_clean_before_height(&mut self, h: BlockHeight) {
-        self.validator_info = self.validator_info.split_off(&h);
+        self.validator_info.clean_before(&h);
     }
 
     // Clean validators with zero power
@@ -468,6 +502,15 @@ impl Staking {
                     .collect::<BTreeSet<_>>()
             })
         {
+            // do not touch the current validators if nothing can be cleaned,
+            // a changed entry must be re-hashed in the next commitment
+            let dirty = self
+                .validator_get_current()
+                .map_or(false, |vd| old.iter().any(|k| vd.body.contains_key(k)));
+            if !dirty {
+                return;
+            }
+
             if let Some(vd) = self.validator_get_current_mut() {
                 vd.body = mem::take(&mut vd.body)
                     .into_iter()
@@ -668,16 +711,15 @@ impl Staking {
         let d = self
             .delegation_info
             .global_delegation_records_map
-            .entry(owner)
-            .or_insert_with(new);
+            .get_or_insert_with(owner, new);
 
         if DelegationState::Paid == d.state {
             *d = new();
         }
 
-        if let Some(set) = self.delegation_info.end_height_map.get_mut(&d.end_height) {
-            set.remove(&owner);
-        }
+        self.delegation_info
+            .end_height_map
+            .remove(&d.end_height, &owner);
 
         d.end_height = end_height;
         d.state = DelegationState::Bond;
@@ -696,8 +738,8 @@ impl Staking {
         // update delegator entries for this validator
         if let Some(v) = self.validator_get_current_mut_one_by_id(&validator) {
             if owner != validator {
-                *v.delegators.entry(owner).or_insert(0) += am;
-                v.delegators.sort_by(|_, v1, _, v2| v2.cmp(&v1));
+                let i = v.delegators.upsert(owner, |x| *x += am);
+                delegators_reposition(&mut v.delegators, i);
                 if *KEEP_HIST {
                     CHAN_D_AMOUNT_HIST
                         .0
@@ -710,9 +752,7 @@ impl Staking {
 
         self.delegation_info
             .end_height_map
-            .entry(end_height)
-            .or_insert_with(BTreeSet::new)
-            .insert(owner);
+            .insert(end_height, owner);
 
         // There should be no failure here !!
         pnk!(self.validator_change_power(&validator, am, false));
@@ -798,15 +838,10 @@ impl Staking {
         }
 
         if let Some(orig_h) = orig_h {
+            self.delegation_info.end_height_map.remove(&orig_h, addr);
             self.delegation_info
                 .end_height_map
-                .get_mut(&orig_h)
-                .map(|set| set.remove(addr));
-            self.delegation_info
-                .end_height_map
-                .entry(h + CFG.checkpoint.unbond_block_cnt)
-                .or_insert_with(BTreeSet::new)
-                .insert(*addr);
+                .insert(h + CFG.checkpoint.unbond_block_cnt, *addr);
         }
 
         Ok(())
@@ -896,19 +931,16 @@ impl Staking {
             .insert(pu.new_delegator_id, new_tmp_delegator);
         self.delegation_info
             .end_height_map
-            .entry(h + CFG.checkpoint.unbond_block_cnt)
-            .or_insert_with(BTreeSet::new)
-            .insert(pu.new_delegator_id);
+            .insert(h + CFG.checkpoint.unbond_block_cnt, pu.new_delegator_id);
 
         // update delegator entries for pu target_validator
         if let Some(v) = self.validator_get_current_mut_one_by_id(&target_validator) {
             // add new_delegator_id to delegator list
-            *v.delegators.entry(pu.new_delegator_id).or_insert(0) += actual_am;
+            v.delegators
+                .upsert(pu.new_delegator_id, |am| *am += actual_am);
 
             // update delegation amount of current address
-            if let Some(am) = v.delegators.get_mut(addr) {
-                *am -= actual_am;
-            }
+            v.delegators.update(addr, |am| *am -= actual_am);
             v.delegators.sort_by(|_, v1, _, v2| v2.cmp(&v1));
         }
 
@@ -927,10 +959,7 @@ impl Staking {
             .remove(addr)
             .c(d!("not exists"))?;
         if d.state == DelegationState::Paid {
-            self.delegation_info
-                .end_height_map
-                .get_mut(h)
-                .map(|addrs| addrs.remove(addr));
+            self.delegation_info.end_height_map.remove(h, addr);
 
             // If this is a temporary delegation, remove it from original one
             if let Some(receiver) = d.receiver_pk {
@@ -972,16 +1001,10 @@ impl Staking {
         if end_height > d.end_height {
             let orig_h = d.end_height;
             d.end_height = end_height;
-            self.delegation_info
-                .end_height_map
-                .get_mut(&orig_h)
-                .c(d!())?
-                .remove(addr);
-            self.delegation_info
-                .end_height_map
-                .entry(end_height)
-                .or_insert_with(BTreeSet::new)
-                .insert(addr.to_owned());
+            let end_height_map = &mut self.delegation_info.end_height_map;
+            end_height_map.get(&orig_h).c(d!())?;
+            end_height_map.remove(&orig_h, addr);
+            end_height_map.insert(end_height, addr.to_owned());
             Ok(())
         } else {
             Err(eg!("new end_height must be bigger than the old one"))
@@ -1122,57 +1145,77 @@ impl Staking {
     }
 
     /// Clean delegation states along with each new block.
+    ///
+    /// Only the delegations ending after the last processed height are checked,
+    /// the earlier ones have been freed.
     #[inline(always)]
     pub fn delegation_process(&mut self) {
         let h = self.cur_height;
 
-        self.delegation_info
+        // unknown(after a restart) or unusual, check all of them
+        let last = self.delegation_info.expired_height;
+        let from = if 0 < last && last < h { last + 1 } else { 0 };
+
+        let expired = self
+            .delegation_info
             .end_height_map
-            .range(..=h)
-            .map(|(_, addr)| addr)
-            .flatten()
-            .copied()
-            .collect::<Vec<_>>()
-            .into_iter()
-            .for_each(|addr| {
-                let entries = if let Some(d) = self
-                    .delegation_info
+            .range(from..=h)
+            .flat_map(|(_, addrs)| addrs.iter().copied())
+            .filter(|addr| {
+                self.delegation_info
                     .global_delegation_records_map
-                    .get_mut(&addr)
-                {
-                    if DelegationState::Bond == d.state {
-                        d.state = DelegationState::Free;
-                        Some(d.delegations.clone())
-                    } else {
-                        None
+                    .get(addr)
+                    .map_or(false, |d| DelegationState::Bond == d.state)
+            })
+            .collect::<Vec<_>>();
+
+        // the validators whose delegators have changed
+        let mut changed_validators = BTreeSet::new();
+
+        for addr in expired.into_iter() {
+            // unwrap is safe, filtered above
+            let d = self
+                .delegation_info
+                .global_delegation_records_map
+                .get_mut(&addr)
+                .unwrap();
+            d.state = DelegationState::Free;
+            let entries = d
+                .delegations
+                .iter()
+                .map(|(vid, am)| (*vid, *am))
+                .collect::<Vec<_>>();
+
+            for (vid, am) in entries.into_iter() {
+                if let Some(v) = self.validator_get_current_mut_one_by_id(&vid) {
+                    if let Some((i, _, _)) = v.delegators.swap_remove_full(&addr) {
+                        delegators_reposition(&mut v.delegators, i);
                     }
-                } else {
-                    None
-                };
+                    changed_validators.insert(vid);
+                }
 
-                if let Some(e) = entries {
-                    e.into_iter().for_each(|(vid, am)| {
-                        if let Some(v) = self.validator_get_current_mut_one_by_id(&vid) {
-                            v.delegators.remove(&addr);
-                            v.delegators.sort_by(|_, v1, _, v2| v2.cmp(&v1));
-                            if *KEEP_HIST {
-                                CHAN_D_AMOUNT_HIST
-                                    .0
-                                    .lock()
-                                    .send((v.id, h, v.delegators.values().sum()))
-                                    .unwrap();
-                            }
-                        }
+                // reduce global amount of global delegations
+                self.delegation_info.global_amount -= am;
 
-                        // reduce global amount of global delegations
-                        self.delegation_info.global_amount -= am;
+                // reduce the power of the target validator
+                // NOTE: set this operation after cleaning delegators!
+                ruc::info_omit!(self.validator_change_power(&vid, am, true));
+            }
+        }
+        self.delegation_info.expired_height = h;
 
-                        // reduce the power of the target validator
-                        // NOTE: set this operation after cleaning delegators!
-                        ruc::info_omit!(self.validator_change_power(&vid, am, true));
-                    });
+        // only the final amounts of this height are kept
+        if *KEEP_HIST {
+            for vid in changed_validators.iter() {
+                if let Some(v) = self.validator_get_current_one_by_id(vid) {
+                    CHAN_D_AMOUNT_HIST
+                        .0
+                        .lock()
+                        .send((v.id, h, v.delegators.values().sum()))
+                        .unwrap();
                 }
-            });
+            }
+        }
 
         self.delegation_process_finished_before_height(h);
 
@@ -1185,27 +1228,34 @@ impl Staking {
     //
     // @param h: included
     fn delegation_process_finished_before_height(&mut self, h: BlockHeight) {
-        self.delegation_info
+        // the unpaid ones are kept, do not touch them
+        let paid = self
+            .delegation_info
             .end_height_map
             .range(0..=h)
-            .map(|(k, v)| (k.to_owned(), (*v).clone()))
-            .collect::<Vec<_>>()
-            .iter()
-            .for_each(|(h, addrs)| {
-                addrs.iter().for_each(|addr| {
-                    ruc::info_omit!(self.delegation_clean_paid(addr, h));
-                });
-                // this unwrap is safe
-                if self
-                    .delegation_info
-                    .end_height_map
-                    .get(&h)
-                    .unwrap()
-                    .is_empty()
-                {
-                    self.delegation_info.end_height_map.remove(&h);
-                }
-            });
+            .flat_map(|(h, addrs)| addrs.iter().map(move |addr| (*h, *addr)))
+            .filter(|(_, addr)| {
+                self.delegation_info
+                    .global_delegation_records_map
+                    .get(addr)
+                    .map_or(false, |d| DelegationState::Paid == d.state)
+            })
+            .collect::<Vec<_>>();
+
+        paid.iter().for_each(|(h, addr)| {
+            ruc::info_omit!(self.delegation_clean_paid(addr, h));
+        });
+
+        let empty = self
+            .delegation_info
+            .end_height_map
+            .range(0..=h)
+            .filter(|(_, addrs)| addrs.is_empty())
+            .map(|(h, _)| *h)
+            .collect::<Vec<_>>();
+        empty.iter().for_each(|h| {
+            self.delegation_info.end_height_map.remove_key(h);
+        });
     }
 
     /// Penalize the FRAs by a specified address.
@@ -1748,16 +1798,24 @@ pub(crate) struct DelegationInfo {
     // addr_map contains an entry for every delegation on the network .
     // Self Delegations and Regular Delegation
     #[serde(rename = "addr_map")]
-    pub(crate) global_delegation_records_map: BTreeMap<XfrPublicKey, Delegation>,
-    pub(crate) end_height_map: BTreeMap<BlockHeight, BTreeSet<XfrPublicKey>>,
+    pub(crate) global_delegation_records_map: HashedMap<XfrPublicKey, Delegation>,
+    pub(crate) end_height_map: HashedIndex<BlockHeight, XfrPublicKey>,
+    // the delegations ending before this height(included)
+    // have been processed by `delegation_process`
+    //
+    // NOTE: never serialized, it would change the legacy hash of `Staking`;
+    // after a restart, the first `delegation_process` rebuilds it with a full scan
+    #[serde(skip)]
+    pub(crate) expired_height: BlockHeight,
 }
 
 impl DelegationInfo {
     fn new() -> Self {
         DelegationInfo {
             global_amount: 0,
-            global_delegation_records_map: BTreeMap::new(),
-            end_height_map: BTreeMap::new(),
+            global_delegation_records_map: HashedMap::new(),
+            end_height_map: HashedIndex::new(),
+            expired_height: 0,
         }
     }
 }
@@ -1811,7 +1869,8 @@ pub struct Validator {
 
     /// delegator pubkey => amount
     ///   - delegator entries on current block height
-    pub delegators: IndexMap<XfrPublicKey, Amount>,
+    ///   - shared with the same validator on other heights until changed
+    pub delegators: CowIndexMap<XfrPublicKey, Amount>,
 }
 
 impl Validator {
@@ -1838,7 +1897,7 @@ impl Validator {
             kind,
             signed_last_block: false,
             signed_cnt: 0,
-            delegators: IndexMap::new(),
+            delegators: CowIndexMap::new(),
         })
     }
 
@@ -2069,6 +2128,38 @@ impl Delegation {
     }
 }
 
+// Move the delegator at `i` to the position where a stable sort by amounts,
+// in descending order, would put it, others must have been in that order.
+//
+// It gets the same order as `sort_by` after changing one entry,
+// without the full sort.
+fn delegators_reposition(
+    delegators: &mut CowIndexMap<XfrPublicKey, Amount>,
+    mut i: usize,
+) {
+    let am = if let Some((_, am)) = delegators.get_index(i) {
+        *am
+    } else {
+        return;
+    };
+
+    while 0 < i
+        && delegators
+            .get_index(i - 1)
+            .map_or(false, |(_, prev)| *prev < am)
+    {
+        delegators.swap_indices(i - 1, i);
+        i -= 1;
+    }
+    while delegators
+        .get_index(i + 1)
+        .map_or(false, |(_, next)| *next > am)
+    {
+        delegators.swap_indices(i, i + 1);
+        i += 1;
+    }
+}
+
 // Calculate the amount(in FRA units) that
 // should be paid to the owner of this delegation.
 #[cfg(not(target_arch = "wasm32"))]
@@ -2351,6 +2442,7 @@ pub fn deny_relative_inputs(x: &TransferAsset) -> Result<()> {
 #[allow(missing_docs)]
 mod test {
     use super::*;
+    use indexmap::IndexMap;
 
     // **NOTE**
     //
@@ -2393,4 +2485,121 @@ mod test {
 
         [lb, 100_0000]
     }
+
+    #[test]
+    fn staking_delegators_reposition() {
+        let mut cr = ConsensusRng::default();
+        let keys = (0..64)
+            .map(|_| XfrKeyPair::generate(&mut cr).get_pk())
+            .collect::<Vec<_>>();
+        let sort = |m: &mut IndexMap<XfrPublicKey, Amount>| {
+            m.sort_by(|_, v1, _, v2| v2.cmp(&v1));
+        };
+
+        // lots of equal amounts, so the order of them matters
+        let mut m = keys
+            .iter()
+            .enumerate()
+            .map(|(i, k)| (*k, (i % 7) as Amount))
+            .collect::<IndexMap<_, _>>();
+        sort(&mut m);
+
+        for (n, k) in keys.iter().enumerate() {
+            // removals
+            let mut expected = m.clone();
+            expected.remove(k);
+            sort(&mut expected);
+            let mut m1 = CowIndexMap::from(m.clone());
+            let (i, _, _) = m1.swap_remove_full(k).unwrap();
+            delegators_reposition(&mut m1, i);
+            assert!(m1.iter().eq(expected.iter()));
+
+            // increments
+            let mut expected = m.clone();
+            *expected.get_mut(k).unwrap() += n as Amount % 5;
+            sort(&mut expected);
+            let mut m2 = CowIndexMap::from(m.clone());
+            let i = m2.upsert(*k, |am| *am += n as Amount % 5);
+            delegators_reposition(&mut m2, i);
+            assert!(m2.iter().eq(expected.iter()));
+
+            m = (*m1).clone();
+        }
+        assert!(m.is_empty());
+    }
+
+    #[test]
+    fn staking_commitment_incremental() {
+        let mut cr = ConsensusRng::default();
+        let vid = XfrKeyPair::generate(&mut cr).get_pk();
+        let delegators = (0..2000)
+            .map(|_| XfrKeyPair::generate(&mut cr).get_pk())
+            .collect::<Vec<_>>();
+
+        let mut s = Staking::new();
+        let mut v = pnk!(Validator::new(
+            vec![1; 32],
+            1,
+            vid,
+            [1, 100],
+            StakerMemo::default(),
+            ValidatorKind::Initiator,
+        ));
+        delegators.iter().enumerate().for_each(|(n, pk)| {
+            let i = v.delegators.upsert(*pk, |am| *am += 10000 - n as Amount);
+            delegators_reposition(&mut v.delegators, i);
+            s.delegation_info.global_delegation_records_map.insert(
+                *pk,
+                Delegation {
+                    delegations: map! {B vid => 10000 - n as Amount},
+                    id: *pk,
+                    receiver_pk: None,
+                    tmp_delegators: map! {B},
+                    start_height: 1,
+                    end_height: BLOCK_HEIGHT_MAX,
+                    state: DelegationState::Bond,
+                    rwd_amount: 0,
+                    delegation_rwd_cnt: 0,
+                    proposer_rwd_cnt: 0,
+                },
+            );
+            s.delegation_info
+                .end_height_map
+                .insert(BLOCK_HEIGHT_MAX, *pk);
+        });
+        pnk!(s.validator_set_at_height(1, pnk!(ValidatorData::new(1, vec![v]))));
+        s.set_custom_block_height(1);
+        pnk!(s.commitment());
+
+        // a new block: the validators are copied to the new height,
+        // the signed count is updated, and one delegation is changed
+        let pk = delegators[0];
+        s.set_custom_block_height(2);
+        s.validator_apply_at_height(2);
+        let v = s.validator_get_current_mut_one_by_id(&vid).unwrap();
+        v.signed_cnt += 1;
+        let i = v.delegators.upsert(pk, |am| *am += 1);
+        delegators_reposition(&mut v.delegators, i);
+        s.delegation_info
+            .global_delegation_records_map
+            .get_mut(&pk)
+            .unwrap()
+            .end_height = 100;
+        s.delegation_info
+            .end_height_map
+            .remove(&BLOCK_HEIGHT_MAX, &pk);
+        s.delegation_info.end_height_map.insert(100, pk);
+
+        // the new `ValidatorData` + one position of its delegators
+        // + one delegation record + the new pair of the expiry index
+        commitment::HASHED_ENTRIES.with(|n| n.set(0));
+        let c = pnk!(s.commitment());
+        assert_eq!(4, commitment::HASHED_ENTRIES.with(|n| n.get()));
+
+        // incremental result == full result
+        let mut full: Staking =
+            pnk!(serde_json::from_str(&pnk!(serde_json::to_string(&s))));
+        assert_eq!(full, s);
+        assert_eq!(pnk!(full.commitment()), c);
+    }
 }
@@ -1,6 +1,11 @@
 //!
 //! # Cached data for APIs
 //!
+//! The cache is written by an indexer in background, which consumes
+//! the committed blocks from a bounded queue, so the commit path of
+//! ABCI only collects the data of the block. The number of blocks
+//! that have been indexed is recorded in `last_sid`, see `indexed_blocks`.
+//!
 
 use {
     crate::{
@@ -16,15 +21,30 @@ use {
         store::LedgerState,
     },
     fbnc::{new_mapx, new_mapxnk, Mapx, Mapxnk},
-    globutils::wallet,
+    globutils::{metrics::Histogram, wallet},
+    parking_lot::Mutex,
     ruc::*,
     serde::{Deserialize, Serialize},
-    std::collections::HashSet,
+    std::{
+        collections::{HashMap, HashSet},
+        sync::{
+            mpsc::{sync_channel, SyncSender},
+            Arc,
+        },
+        thread,
+    },
     zei::xfr::{sig::XfrPublicKey, structs::OwnerMemo},
 };
 
 type Issuances = Vec<(TxOutput, Option<OwnerMemo>)>;
 
+/// How many committed blocks can wait for the indexer,
+/// `commit` will be blocked if the indexer falls too far behind.
+const INDEX_QUEUE_SIZE: usize = 64;
+
+// the key of the indexing watermark in `last_sid`
+const INDEXED_BLOCKS: &str = "indexed_blocks";
+
 /// Used in APIs
 #[derive(Clone, Deserialize, Serialize)]
 pub struct ApiCache {
@@ -158,6 +178,143 @@ impl ApiCache {
         save_issuance!(token_issuances, token_code);
     }
 
+    /// Number of blocks that have been written into the cache,
+    /// `None` if the cache has never been written by the indexer.
+    #[inline(always)]
+    pub fn indexed_blocks(&self) -> Option<u64> {
+        self.last_sid.get(&INDEXED_BLOCKS.to_owned())
+    }
+
+    /// Write all data of a committed block, changes of the same key
+    /// are merged, so each sub-map is opened once per block.
+    pub(crate) fn index_block(&mut self, block: &IndexedBlock) {
+        let prefix = self.prefix.clone();
+
+        let mut related_txns: HashMap<XfrAddress, Vec<TxnSID>> = HashMap::new();
+        let mut related_xfrs: HashMap<AssetTypeCode, Vec<TxnSID>> = HashMap::new();
+        let mut claim_txns: HashMap<XfrAddress, Vec<TxnSID>> = HashMap::new();
+        let mut coinbase_opers: HashMap<XfrAddress, Vec<(BlockHeight, MintEntry)>> =
+            HashMap::new();
+
+        for tx in block.txns.iter() {
+            let txn_sid = tx.sid;
+
+            let classify_op = |op: &Operation| {
+                match op {
+                    Operation::Claim(i) => {
+                        let key = XfrAddress {
+                            key: i.get_claim_publickey(),
+                        };
+                        claim_txns.entry(key).or_default().push(txn_sid);
+                    }
+                    Operation::MintFra(i) => i.entries.iter().for_each(|me| {
+                        let key = XfrAddress {
+                            key: me.utxo.record.public_key,
+                        };
+                        coinbase_opers
+                            .entry(key)
+                            .or_default()
+                            .push((i.height, me.clone()));
+                    }),
+                    _ => { /* filter more operations before this line */ }
+                };
+            };
+
+            // Update related addresses
+            // Apply classify_op for each operation in the transaction
+            for address in get_related_addresses(&tx.txn, classify_op) {
+                related_txns.entry(address).or_default().push(txn_sid);
+            }
+
+            // Update transferred nonconfidential assets
+            for asset in get_transferred_nonconfidential_assets(&tx.txn) {
+                related_xfrs.entry(asset).or_default().push(txn_sid);
+            }
+
+            // Add created asset
+            for op in &tx.txn.body.operations {
+                match op {
+                    Operation::DefineAsset(define_asset) => {
+                        self.add_created_asset(&define_asset);
+                    }
+                    Operation::IssueAsset(issue_asset) => {
+                        self.cache_issuance(&issue_asset);
+                    }
+                    _ => {}
+                };
+            }
+
+            // Add new utxos (this handles both transfers and issuances)
+            let hash = tx.txn.hash_tm().hex().to_uppercase();
+            let owner_memos = tx.txn.get_owner_memos_ref();
+            for (txo_sid, (address, owner_memo)) in tx
+                .txo_sids
+                .iter()
+                .zip(tx.addresses.iter().zip(owner_memos.iter()))
+            {
+                self.utxos_to_map_index.insert(*txo_sid, *address);
+                self.txo_to_txnid.insert(*txo_sid, (txn_sid, hash.clone()));
+                if let Some(owner_memo) = owner_memo {
+                    self.owner_memos.insert(*txo_sid, (*owner_memo).clone());
+                }
+            }
+            self.txn_sid_to_hash.insert(txn_sid, hash.clone());
+            self.txn_hash_to_sid.insert(hash, txn_sid);
+        }
+
+        macro_rules! save_sids {
+            ($changes: expr, $maps: expr, $name: expr) => {
+                for (key, sids) in $changes.into_iter() {
+                    #[allow(unused_mut)]
+                    let mut sub_map = $maps.entry(key).or_insert_with(|| {
+                        new_mapxnk!(format!(
+                            "api_cache/{}{}/{}",
+                            prefix,
+                            $name,
+                            key.to_base64()
+                        ))
+                    });
+                    sids.into_iter().for_each(|sid| {
+                        sub_map.insert(sid, Default::default());
+                    });
+                }
+            };
+        }
+
+        save_sids!(
+            related_txns,
+            self.related_transactions,
+            "related_transactions"
+        );
+        save_sids!(related_xfrs, self.related_transfers, "related_transfers");
+        save_sids!(claim_txns, self.claim_hist_txns, "claim_hist_txns");
+
+        for (key, entries) in coinbase_opers.into_iter() {
+            #[allow(unused_mut)]
+            let mut hist = self.coinbase_oper_hist.entry(key).or_insert_with(|| {
+                new_mapxnk!(format!(
+                    "api_cache/{}coinbase_oper_hist/{}",
+                    prefix,
+                    key.to_base64()
+                ))
+            });
+            entries.into_iter().for_each(|(h, me)| {
+                hist.insert(h, me);
+            });
+        }
+
+        // move the watermarks after all data of the block have been written
+        if let Some(tx) = block.txns.last() {
+            self.last_sid
+                .insert("last_txn_sid".to_owned(), tx.sid.0 as u64);
+        }
+        if let Some(sid) = block.txns.iter().rev().find_map(|tx| tx.txo_sids.last()) {
+            self.last_sid.insert("last_txo_sid".to_owned(), sid.0);
+        }
+        self.last_sid
+            .insert(INDEXED_BLOCKS.to_owned(), block.block_idx as u64 + 1);
+    }
+
     /// Cache history style data
     pub fn cache_hist_data(&mut self) {
         CHAN_GLOB_RATE_HIST.1.lock().try_iter().for_each(|(h, r)| {
@@ -171,10 +328,12 @@ impl ApiCache {
             .for_each(|(pk, h, r)| {
                 self.staking_self_delegation_hist
                     .entry(pk)
-                    .or_insert(new_mapxnk!(format!(
-                        "staking_self_delegation_hist_subdata/{}",
-                        wallet::public_key_to_base64(&pk)
-                    )))
+                    .or_insert_with(|| {
+                        new_mapxnk!(format!(
+                            "staking_self_delegation_hist_subdata/{}",
+                            wallet::public_key_to_base64(&pk)
+                        ))
+                    })
                     .insert(h, r);
             });
 
@@ -185,10 +344,12 @@ impl ApiCache {
             .for_each(|(pk, h, r)| {
                 self.staking_delegation_amount_hist
                     .entry(pk)
-                    .or_insert(new_mapxnk!(format!(
-                        "staking_delegation_amount_hist_subdata/{}",
-                        wallet::public_key_to_base64(&pk)
-                    )))
+                    .or_insert_with(|| {
+                        new_mapxnk!(format!(
+                            "staking_delegation_amount_hist_subdata/{}",
+                            wallet::public_key_to_base64(&pk)
+                        ))
+                    })
                     .insert(h, r);
             });
 
@@ -197,10 +358,12 @@ impl ApiCache {
             let mut dd =
                 self.staking_delegation_rwd_hist
                     .entry(pk)
-                    .or_insert(new_mapxnk!(format!(
-                        "staking_delegation_rwd_hist_subdata/{}",
-                        wallet::public_key_to_base64(&pk)
-                    )));
+                    .or_insert_with(|| {
+                        new_mapxnk!(format!(
+                            "staking_delegation_rwd_hist_subdata/{}",
+                            wallet::public_key_to_base64(&pk)
+                        ))
+                    });
             let mut dd = dd.entry(h).or_insert_with(DelegationRwdDetail::default);
 
             dd.block_height = r.block_height;
@@ -456,194 +619,131 @@ pub fn check_lost_data(ledger: &mut LedgerState) -> Result<()> {
     Ok(())
 }
 
-/// update the data of QueryServer when we create a new block in ABCI
-pub fn update_api_cache(ledger: &mut LedgerState) -> Result<()> {
-    if !*KEEP_HIST {
-        return Ok(());
-    }
+/// A transaction of a committed block, with the owners of its outputs.
+pub(crate) struct IndexedTxn {
+    sid: TxnSID,
+    txn: Transaction,
+    txo_sids: Vec<TxoSID>,
+    addresses: Vec<XfrAddress>,
+}
 
-    check_lost_data(ledger)?;
+/// The data of a committed block used by the indexer.
+pub(crate) struct IndexedBlock {
+    // index of the block in `LedgerState::blocks`
+    block_idx: usize,
+    txns: Vec<IndexedTxn>,
+}
 
-    ledger.api_cache.as_mut().unwrap().cache_hist_data();
+impl IndexedBlock {
+    // Collect the data of a block, this is the only part done in the commit path.
+    fn new(ledger: &LedgerState, block_idx: usize) -> Result<Self> {
+        let block = ledger.blocks.get(block_idx).c(d!())?;
+
+        let txns = block
+            .txns
+            .into_iter()
+            .map(|ftx| {
+                let addresses = ftx
+                    .txo_ids
+                    .iter()
+                    .map(|sid| {
+                        ledger
+                            .status
+                            .get_utxo(*sid)
+                            .or_else(|| ledger.status.get_spent_utxo(*sid))
+                            .map(|utxo| XfrAddress {
+                                key: utxo.0.record.public_key,
+                            })
+                            .c(d!())
+                    })
+                    .collect::<Result<Vec<_>>>()?;
+
+                Ok(IndexedTxn {
+                    sid: ftx.tx_id,
+                    txn: ftx.txn,
+                    txo_sids: ftx.txo_ids,
+                    addresses,
+                })
+            })
+            .collect::<Result<Vec<_>>>()?;
 
-    let block = if let Some(b) = ledger.blocks.last() {
-        b
-    } else {
-        return Ok(());
-    };
+        Ok(IndexedBlock { block_idx, txns })
+    }
+}
 
-    let prefix = ledger.api_cache.as_mut().unwrap().prefix.clone();
+/// The handle of the background indexer of `ApiCache`,
+/// a `None` in the queue only drains the history data of staking.
+pub(crate) struct ApiIndexer {
+    sender: SyncSender<Option<IndexedBlock>>,
+    // the next block to send to the indexer
+    next_block: usize,
+}
 
-    // Update ownership status
-    for (txn_sid, txo_sids) in block.txns.iter().map(|v| (v.tx_id, v.txo_ids.as_slice()))
-    {
-        let curr_txn = ledger.get_transaction_light(txn_sid).c(d!())?.txn;
-        // get the transaction, ownership addresses, and memos associated with each transaction
-        let (addresses, owner_memos) = {
-            let addresses: Vec<XfrAddress> = txo_sids
-                .iter()
-                .map(|sid| XfrAddress {
-                    key: ((ledger
-                        .get_utxo_light(*sid)
-                        .or_else(|| ledger.get_spent_utxo_light(*sid))
-                        .unwrap()
-                        .utxo)
-                        .0)
-                        .record
-                        .public_key,
-                })
-                .collect();
+impl ApiIndexer {
+    // Start the indexer, and resume from the watermark of the cache.
+    fn start(ledger: &mut LedgerState) -> Result<Self> {
+        // repair the hashes and memos lost by old versions
+        check_lost_data(ledger).c(d!())?;
 
-            let owner_memos = curr_txn.get_owner_memos_ref();
+        let mut cache = ledger.api_cache.clone().c(d!())?;
 
-            (addresses, owner_memos)
-        };
+        // old versions index every block before the commit returns,
+        // so only the latest block has not been indexed in that case
+        let next_block = cache
+            .indexed_blocks()
+            .map(|n| n as usize)
+            .unwrap_or_else(|| ledger.blocks.len().saturating_sub(1));
 
-        let classify_op = |op: &Operation| {
-            match op {
-                Operation::Claim(i) => {
-                    let key = XfrAddress {
-                        key: i.get_claim_publickey(),
-                    };
-                    ledger
-                        .api_cache
-                        .as_mut()
-                        .unwrap()
-                        .claim_hist_txns
-                        .entry(key)
-                        .or_insert_with(|| {
-                            new_mapxnk!(format!(
-                                "api_cache/{}claim_hist_txns/{}",
-                                prefix,
-                                key.to_base64()
-                            ))
-                        })
-                        .set_value(txn_sid, Default::default());
+        let (sender, receiver) = sync_channel::<Option<IndexedBlock>>(INDEX_QUEUE_SIZE);
+
+        thread::spawn(move || {
+            while let Ok(block) = receiver.recv() {
+                cache.cache_hist_data();
+                if let Some(block) = block {
+                    cache.index_block(&block);
                 }
-                Operation::MintFra(i) => i.entries.iter().for_each(|me| {
-                    let key = XfrAddress {
-                        key: me.utxo.record.public_key,
-                    };
-                    #[allow(unused_mut)]
-                    let mut hist = ledger
-                        .api_cache
-                        .as_mut()
-                        .unwrap()
-                        .coinbase_oper_hist
-                        .entry(key)
-                        .or_insert_with(|| {
-                            new_mapxnk!(format!(
-                                "api_cache/{}coinbase_oper_hist/{}",
-                                prefix,
-                                key.to_base64()
-                            ))
-                        });
-                    hist.insert(i.height, me.clone());
-                }),
-                _ => { /* filter more operations before this line */ }
-            };
-        };
+            }
+        });
 
-        // Update related addresses
-        // Apply classify_op for each operation in curr_txn
-        let related_addresses = get_related_addresses(&curr_txn, classify_op);
-        for address in &related_addresses {
-            ledger
-                .api_cache
-                .as_mut()
-                .unwrap()
-                .related_transactions
-                .entry(*address)
-                .or_insert_with(|| {
-                    new_mapxnk!(format!(
-                        "api_cache/{}related_transactions/{}",
-                        prefix,
-                        address.to_base64()
-                    ))
-                })
-                .insert(txn_sid, Default::default());
-        }
+        Ok(ApiIndexer { sender, next_block })
+    }
 
-        // Update transferred nonconfidential assets
-        let transferred_assets = get_transferred_nonconfidential_assets(&curr_txn);
-        for asset in &transferred_assets {
-            ledger
-                .api_cache
-                .as_mut()
-                .unwrap()
-                .related_transfers
-                .entry(*asset)
-                .or_insert_with(|| {
-                    new_mapxnk!(format!(
-                        "api_cache/{}related_transfers/{}",
-                        &prefix,
-                        asset.to_base64()
-                    ))
-                })
-                .insert(txn_sid, Default::default());
+    // Send all blocks that have not been sent,
+    // it blocks when the queue of the indexer is full.
+    fn send_new_blocks(&mut self, ledger: &LedgerState) -> Result<()> {
+        if self.next_block >= ledger.blocks.len() {
+            return self.sender.send(None).c(d!());
         }
 
-        // Add created asset
-        for op in &curr_txn.body.operations {
-            match op {
-                Operation::DefineAsset(define_asset) => {
-                    ledger
-                        .api_cache
-                        .as_mut()
-                        .unwrap()
-                        .add_created_asset(&define_asset);
-                }
-                Operation::IssueAsset(issue_asset) => {
-                    ledger
-                        .api_cache
-                        .as_mut()
-                        .unwrap()
-                        .cache_issuance(&issue_asset);
-                }
-                _ => {}
-            };
+        for idx in self.next_block..ledger.blocks.len() {
+            let block = IndexedBlock::new(ledger, idx).c(d!())?;
+            self.sender.send(Some(block)).c(d!())?;
+            self.next_block = idx + 1;
         }
+        Ok(())
+    }
+}
 
-        // Add new utxos (this handles both transfers and issuances)
-        for (txo_sid, (address, owner_memo)) in txo_sids
-            .iter()
-            .zip(addresses.iter().zip(owner_memos.iter()))
-        {
-            ledger
-                .api_cache
-                .as_mut()
-                .unwrap()
-                .utxos_to_map_index
-                .insert(*txo_sid, *address);
-            let hash = curr_txn.hash_tm().hex().to_uppercase();
-            ledger
-                .api_cache
-                .as_mut()
-                .unwrap()
-                .txo_to_txnid
-                .insert(*txo_sid, (txn_sid, hash.clone()));
-            ledger
-                .api_cache
-                .as_mut()
-                .unwrap()
-                .txn_sid_to_hash
-                .insert(txn_sid, hash.clone());
-            ledger
-                .api_cache
-                .as_mut()
-                .unwrap()
-                .txn_hash_to_sid
-                .insert(hash.clone(), txn_sid);
-            if let Some(owner_memo) = owner_memo {
-                ledger
-                    .api_cache
-                    .as_mut()
-                    .unwrap()
-                    .owner_memos
-                    .insert(*txo_sid, (*owner_memo).clone());
-            }
-        }
+static UPDATE_API_CACHE: Histogram = Histogram::new(
+    "findora_ledger_seconds",
+    "op=\"update_api_cache\"",
+    "Time spent in the ledger",
+);
+
+/// Hand the new blocks to the indexer of QueryServer when we create a new block in ABCI,
+/// the indexer will be started on the first call.
+pub fn update_api_cache(ledger: &mut LedgerState) -> Result<()> {
+    let _t = UPDATE_API_CACHE.start_timer();
+    if !*KEEP_HIST {
+        return Ok(());
     }
 
-    Ok(())
+    if ledger.api_indexer.is_none() {
+        let indexer = ApiIndexer::start(ledger).c(d!())?;
+        ledger.api_indexer = Some(Arc::new(Mutex::new(indexer)));
+    }
+
+    let indexer = ledger.api_indexer.clone().c(d!())?;
+    let mut indexer = indexer.lock();
+    indexer.send_new_blocks(ledger).c(d!())
 }
@@ -6,6 +6,7 @@ pub mod api_cache;
 pub mod helpers;
 mod test;
 pub mod utils;
+mod wal;
 
 pub use fbnc;
 
@@ -13,11 +14,11 @@ use {
     crate::{
         data_model::{
             AssetType, AssetTypeCode, AuthenticatedBlock, AuthenticatedTransaction,
-            AuthenticatedUtxo, AuthenticatedUtxoStatus, BlockEffect, BlockSID,
-            FinalizedBlock, FinalizedTransaction, IssuerKeyPair, IssuerPublicKey,
-            OutputPosition, StateCommitmentData, Transaction, TransferType, TxnEffect,
-            TxnSID, TxnTempSID, TxoSID, UnAuthenticatedUtxo, Utxo, UtxoStatus,
-            BLACK_HOLE_PUBKEY,
+            AuthenticatedTransactions, AuthenticatedUtxo, AuthenticatedUtxoStatus,
+            BlockEffect, BlockSID, FinalizedBlock, FinalizedTransaction, IssuerKeyPair,
+            IssuerPublicKey, OutputPosition, StateCommitmentData, Transaction,
+            TransferType, TxnEffect, TxnSID, TxnTempSID, TxoSID, UnAuthenticatedUtxo,
+            Utxo, UtxoStatus, BLACK_HOLE_PUBKEY,
         },
         staking::{
             Amount, Power, Staking, TendermintAddrRef, FF_PK_EXTRA_120_0000, FF_PK_LIST,
@@ -25,14 +26,14 @@ use {
         },
         LSSED_VAR, SNAPSHOT_ENTRIES_DIR,
     },
-    api_cache::ApiCache,
+    api_cache::{ApiCache, ApiIndexer},
     bitmap::{BitMap, SparseMap},
     config::abci::global_cfg::CFG,
-    cryptohash::sha256::Digest as BitDigest,
+    cryptohash::{sha256::Digest as BitDigest, MultiProof},
     fbnc::{new_mapx, new_mapxnk, new_vecx, Mapx, Mapxnk, Vecx},
-    globutils::{HashOf, ProofOf},
-    merkle_tree::AppendOnlyMerkle,
-    parking_lot::RwLock,
+    globutils::{metrics::Histogram, HashOf, ProofOf},
+    merkle_tree::{AppendOnlyMerkle, MerkleSnapshot},
+    parking_lot::{Mutex, RwLock},
     rand_chacha::ChaChaRng,
     rand_core::SeedableRng,
     ruc::*,
@@ -41,12 +42,16 @@ use {
     std::{
         collections::{BTreeMap, HashMap, HashSet},
         env,
-        fs::{self, OpenOptions},
+        fs::{self, File, OpenOptions},
         io::ErrorKind,
         mem,
         ops::{Deref, DerefMut},
-        sync::Arc,
+        path::Path,
+        sync::{mpsc::Sender, Arc},
+        thread,
+        time::Instant,
     },
+    wal::{CheckpointWal, WalRecord},
     zei::xfr::{
         lib::XfrNotePolicies,
         sig::XfrPublicKey,
@@ -54,7 +59,24 @@ use {
     },
 };
 
-const TRANSACTION_WINDOW_WIDTH: u64 = 128;
+/// A transaction is only valid within this number of blocks after the `seq_id`
+/// of its no-replay token.
+pub const TRANSACTION_WINDOW_WIDTH: u64 = 128;
+
+// Bumped when the derivation of the indexes in `LedgerStatus` changes,
+// all of them are rebuilt at the next startup.
+const DERIVED_INDEXES_VERSION: u64 = 1;
+
+static APPLY_BLOCK_EFFECTS: Histogram = Histogram::new(
+    "findora_ledger_seconds",
+    "op=\"apply_block_effects\"",
+    "Time spent in the ledger",
+);
+static CHECKPOINT: Histogram = Histogram::new(
+    "findora_ledger_seconds",
+    "op=\"checkpoint\"",
+    "Time spent in the ledger",
+);
 
 type TmpSidMap = HashMap<TxnTempSID, (TxnSID, Vec<TxoSID>)>;
 
@@ -71,6 +93,8 @@ pub struct LedgerState {
     pub tx_to_block_location: Mapxnk<TxnSID, [usize; 2]>,
     /// cache used in APIs
     pub api_cache: Option<ApiCache>,
+    // the background writer of `api_cache`
+    api_indexer: Option<Arc<Mutex<ApiIndexer>>>,
 
     // current block effect (middle cache)
     block_ctx: Option<BlockEffect>,
@@ -81,8 +105,18 @@ pub struct LedgerState {
     // Merkle tree tracing the sequence of all transaction hashes
     // Each appended hash is the hash of a transaction
     txn_merkle: Arc<RwLock<AppendOnlyMerkle>>,
+    // Read-only views of the two merkle trees, refreshed on every checkpoint,
+    // proofs are generated from them without locking the trees
+    block_merkle_snapshot: Arc<RwLock<MerkleSnapshot>>,
+    txn_merkle_snapshot: Arc<RwLock<MerkleSnapshot>>,
     // Bitmap tracing all the live TXOs
     utxo_map: Arc<RwLock<BitMap>>,
+    // Write-ahead log of checkpoints, and the background syncer of
+    // the on-disk structures, see the `wal` module
+    wal: Arc<Mutex<CheckpointWal>>,
+    wal_syncer: Arc<Mutex<Sender<(u64, Vec<File>)>>>,
+    // Changes of the current block, recorded in the WAL at checkpoint
+    wal_record: WalRecord,
 }
 
 impl LedgerState {
@@ -179,6 +213,11 @@ impl LedgerState {
             }
         }
 
+        self.wal_record.utxo_base = base_sid;
+        self.wal_record.utxo_new_bits = (base_sid..max_sid)
+            .map(|ix| utxo_map.query(ix as usize).c(d!()))
+            .collect::<Result<_>>()?;
+
         Ok(())
     }
 
@@ -188,15 +227,16 @@ impl LedgerState {
         // Update the transaction Merkle tree
         // Store the location of each utxo so we can create authenticated utxo proofs
         let mut txn_merkle = self.txn_merkle.write();
+        self.wal_record.txn_merkle_base = txn_merkle.state();
         for (tmp_sid, txn) in block.temp_sids.iter().zip(block.txns.iter()) {
             let txn = txn.clone();
             let txo_sid_map = tsm.get(&tmp_sid).c(d!())?;
             let txn_sid = txo_sid_map.0;
             let txo_sids = &txo_sid_map.1;
 
-            let merkle_id = txn_merkle
-                .append_hash(&txn.hash(txn_sid).0.hash.into())
-                .c(d!())?;
+            let hash = txn.hash(txn_sid).0.hash.into();
+            let merkle_id = txn_merkle.append_hash(&hash).c(d!())?;
+            self.wal_record.txn_hashes.push(hash);
 
             tx_block.push(FinalizedTransaction {
                 txn: txn.clone(),
@@ -251,8 +291,11 @@ impl LedgerState {
                 utxo_map.clear(inp_sid.0 as usize).c(d!())?;
             }
         }
+        self.wal_record.utxo_cleared =
+            block.input_txos.keys().map(|sid| sid.0).collect();
 
-        let (tsm, base_sid, max_sid) = self.status.apply_block_effects(&mut block);
+        let (tsm, base_sid, max_sid) =
+            APPLY_BLOCK_EFFECTS.time(|| self.status.apply_block_effects(&mut block));
 
         self.update_utxo_map(base_sid, max_sid, &block.temp_sids, &tsm)
             .c(d!())
@@ -314,16 +357,31 @@ impl LedgerState {
 
         // 2. Append txns_in_block_hash to block_merkle
         //  2.1 Update the block Merkle tree
-        let ret = self
-            .block_merkle
-            .write()
-            .append_hash(&txns_in_block_hash.0.hash.into())
-            .unwrap();
+        let hash = txns_in_block_hash.0.hash.into();
+        let mut block_merkle = self.block_merkle.write();
+        self.wal_record.block_merkle_base = block_merkle.state();
+        self.wal_record.block_hashes = vec![hash];
 
-        ret
+        block_merkle.append_hash(&hash).unwrap()
+    }
+
+    // The commitment of the staking data in the state commitment,
+    // `None` before it has been inited.
+    fn staking_commitment(&mut self) -> Result<Option<HashOf<Staking>>> {
+        let staking = self.get_staking_mut();
+        let commitment = if !staking.has_been_inited() {
+            None
+        } else if staking.cur_height() < CFG.checkpoint.staking_commitment_v2_height {
+            Some(HashOf::new(staking))
+        } else {
+            Some(HashOf::from_digest(staking.commitment().c(d!())?))
+        };
+        Ok(commitment)
     }
 
     fn compute_and_save_state_commitment_data(&mut self, pulse_count: u64) {
+        let staking = pnk!(self.staking_commitment());
+
         let state_commitment_data = StateCommitmentData {
             bitmap: self.utxo_map.write().compute_checksum(),
             block_merkle: self.block_merkle.read().get_root_hash(),
@@ -338,11 +396,7 @@ impl LedgerState {
             air_commitment: BitDigest::from_slice(&[0; 32][..]).unwrap(),
             txo_count: self.get_next_txo().0,
             pulse_count,
-            staking: alt!(
-                self.get_staking().has_been_inited(),
-                Some(HashOf::new(self.get_staking())),
-                None
-            ),
+            staking,
         };
 
         self.status
@@ -350,15 +404,25 @@ impl LedgerState {
             .push(state_commitment_data.compute_commitment());
         self.status.state_commitment_data = Some(state_commitment_data);
         self.status.incr_block_commit_count();
+        self.status.index_stamp = Some(self.status.current_index_stamp());
     }
 
     // Initialize a logged Merkle tree for the ledger.
-    // We might be creating a new tree or opening an existing one.
+    // We might be creating a new tree or opening an existing one,
+    // if the upper levels are broken, rebuild them from the leaves.
     #[inline(always)]
     fn init_merkle_log(path: &str) -> Result<AppendOnlyMerkle> {
-        AppendOnlyMerkle::open(path)
-            .c(d!())
-            .or_else(|e| AppendOnlyMerkle::create(path).c(d!(e)))
+        if !Path::new(path).exists() {
+            return AppendOnlyMerkle::create(path).c(d!());
+        }
+
+        AppendOnlyMerkle::open(path).c(d!()).or_else(|e| {
+            let tree = AppendOnlyMerkle::rebuild(path).c(d!(e))?;
+            omit!(fs::remove_file(
+                path.to_owned() + &AppendOnlyMerkle::rebuild_ext()
+            ));
+            Ok(tree)
+        })
     }
 
     // Initialize a bitmap to track the unspent utxos.
@@ -384,6 +448,7 @@ impl LedgerState {
         let block_merkle_path = format!("{}/{}block_merkle", basedir, &prefix);
         let txn_merkle_path = format!("{}/{}txn_merkle", basedir, &prefix);
         let utxo_map_path = format!("{}/{}utxo_map", basedir, &prefix);
+        let wal_path = format!("{}/{}checkpoint_wal", basedir, &prefix);
 
         // These iterms will be set under ${BNC_DATA_DIR}
         fs::create_dir_all(&basedir).c(d!())?;
@@ -395,21 +460,41 @@ impl LedgerState {
         let blocks_path = prefix.clone() + "blocks";
         let tx_to_block_location_path = prefix.clone() + "tx_to_block_location";
 
+        let mut block_merkle =
+            LedgerState::init_merkle_log(&block_merkle_path).c(d!())?;
+        let mut txn_merkle = LedgerState::init_merkle_log(&txn_merkle_path).c(d!())?;
+        let mut utxo_map = LedgerState::init_utxo_map(&utxo_map_path).c(d!())?;
+
+        // Recover the checkpoints that have not been persisted
+        // by the on-disk structures before the last exit.
+        let (mut wal, records) = CheckpointWal::open(&wal_path).c(d!())?;
+        if !records.is_empty() {
+            wal::replay(&records, &mut utxo_map, &mut txn_merkle, &mut block_merkle)
+                .c(d!())?;
+            utxo_map.write().c(d!())?;
+            txn_merkle.write().c(d!())?;
+            block_merkle.write().c(d!())?;
+            wal.reset().c(d!())?;
+        }
+        let wal = Arc::new(Mutex::new(wal));
+
         let mut ledger = LedgerState {
             status: LedgerStatus::new(&basedir, &snapshot_file).c(d!())?,
-            block_merkle: Arc::new(RwLock::new(
-                LedgerState::init_merkle_log(&block_merkle_path).c(d!())?,
-            )),
-            txn_merkle: Arc::new(RwLock::new(
-                LedgerState::init_merkle_log(&txn_merkle_path).c(d!())?,
+            block_merkle_snapshot: Arc::new(RwLock::new(
+                block_merkle.snapshot().c(d!())?,
             )),
+            txn_merkle_snapshot: Arc::new(RwLock::new(txn_merkle.snapshot().c(d!())?)),
+            block_merkle: Arc::new(RwLock::new(block_merkle)),
+            txn_merkle: Arc::new(RwLock::new(txn_merkle)),
             blocks: new_vecx!(&blocks_path),
             tx_to_block_location: new_mapxnk!(&tx_to_block_location_path),
-            utxo_map: Arc::new(RwLock::new(
-                LedgerState::init_utxo_map(&utxo_map_path).c(d!())?,
-            )),
+            utxo_map: Arc::new(RwLock::new(utxo_map)),
+            wal_syncer: Arc::new(Mutex::new(wal::start_syncer(Arc::clone(&wal)))),
+            wal,
+            wal_record: WalRecord::default(),
             block_ctx: Some(BlockEffect::default()),
             api_cache: alt!(*KEEP_HIST, Some(ApiCache::new(&prefix)), None),
+            api_indexer: None,
         };
 
         ledger.status.refresh_data();
@@ -424,7 +509,17 @@ impl LedgerState {
 
         let h = ledger.get_tendermint_height();
         ledger.get_staking_mut().set_custom_block_height(h);
-        omit!(ledger.utxo_map.write().compute_checksum());
+
+        // the block checksums are validated when the bitmap is opened,
+        // only their chain is computed here
+        let checksum = ledger.utxo_map.write().compute_checksum();
+        if let Some(data) = ledger.status.state_commitment_data.as_ref() {
+            if data.bitmap != checksum {
+                return Err(eg!(
+                    "The utxo map does not match the last state commitment"
+                ));
+            }
+        }
         ledger.fast_invariant_check().c(d!())?;
 
         flush_data();
@@ -434,17 +529,81 @@ impl LedgerState {
         Ok(ledger)
     }
 
+    /// Check the structures against the last state commitment,
+    /// eg. the ones restored from a state-sync snapshot.
+    ///
+    /// Every field that can be derived from the structures, including the
+    /// staking commitment, is recomputed, the returned state commitment is
+    /// the hash of the checked data rather than the saved one.
+    pub fn verify_state_commitment(
+        &mut self,
+    ) -> Result<HashOf<Option<StateCommitmentData>>> {
+        self.fast_invariant_check().c(d!())?;
+
+        let data = if let Some(data) = self.status.state_commitment_data.clone() {
+            data
+        } else {
+            return Ok(HashOf::new(&None));
+        };
+
+        if self.utxo_map.write().compute_checksum() != data.bitmap {
+            return Err(eg!("The utxo map does not match the state commitment"));
+        }
+        if self.block_merkle.read().get_root_hash() != data.block_merkle {
+            return Err(eg!("The block merkle does not match the state commitment"));
+        }
+        if self.txn_merkle.read().get_root_hash() != data.transaction_merkle_commitment {
+            return Err(eg!("The txn merkle does not match the state commitment"));
+        }
+        if self.get_next_txo().0 != data.txo_count {
+            return Err(eg!("The txo count does not match the state commitment"));
+        }
+        if self.staking_commitment().c(d!())? != data.staking {
+            return Err(eg!("The staking does not match the state commitment"));
+        }
+
+        let versions = &self.status.state_commitment_versions;
+        let previous = versions
+            .len()
+            .checked_sub(2)
+            .and_then(|i| versions.get(i))
+            .unwrap_or_else(|| HashOf::new(&None));
+        if previous != data.previous_state_commitment {
+            return Err(eg!(
+                "The previous state does not match the state commitment"
+            ));
+        }
+
+        Ok(data.compute_commitment())
+    }
+
     /// Perform checkpoint of current ledger state
     pub fn checkpoint(&mut self, block: &BlockEffect) -> Result<u64> {
+        let _t = CHECKPOINT.start_timer();
         let merkle_id = self.compute_and_append_txns_hash(&block);
         let pulse_count = block
             .staking_simulator
             .cur_height()
             .saturating_sub(self.get_block_commit_count() + 1);
         self.compute_and_save_state_commitment_data(pulse_count);
-        self.utxo_map.write().write().c(d!())?;
-        self.txn_merkle.write().write().c(d!())?;
-        self.block_merkle.write().write().c(d!())?;
+
+        // Only the WAL is synced before the block is committed,
+        // the structures are synced by the background syncer.
+        let record = mem::take(&mut self.wal_record);
+        let seq = self.wal.lock().append(&record).c(d!())?;
+
+        self.utxo_map.write().write_nosync().c(d!())?;
+        self.txn_merkle.write().write_nosync().c(d!())?;
+        self.block_merkle.write().write_nosync().c(d!())?;
+
+        let mut files = vec![self.utxo_map.read().try_clone_file().c(d!())?];
+        files.extend(self.txn_merkle.read().try_clone_files().c(d!())?);
+        files.extend(self.block_merkle.read().try_clone_files().c(d!())?);
+        omit!(self.wal_syncer.lock().send((seq, files)));
+
+        *self.txn_merkle_snapshot.write() = self.txn_merkle.read().snapshot().c(d!())?;
+        *self.block_merkle_snapshot.write() =
+            self.block_merkle.read().snapshot().c(d!())?;
 
         Ok(merkle_id)
     }
@@ -504,8 +663,8 @@ impl LedgerState {
             .get_staking_mut()
             .delegation_info
             .global_delegation_records_map
-            .values_mut()
-            .filter(|d| d.validator_entry_exists(&pk))
+            .filter_values_mut(|d| d.validator_entry_exists(&pk))
+            .into_iter()
             .map(|d| {
                 d.set_delegation_rewards(
                     &pk,
@@ -870,13 +1029,27 @@ impl LedgerState {
         &self.status.staking
     }
 
+    /// A read-only view of the transaction merkle tree at the last checkpoint,
+    /// it can be held across blocks without blocking the ledger.
+    #[inline(always)]
+    pub fn txn_merkle_reader(&self) -> MerkleSnapshot {
+        self.txn_merkle_snapshot.read().clone()
+    }
+
+    /// A read-only view of the block merkle tree at the last checkpoint,
+    /// it can be held across blocks without blocking the ledger.
+    #[inline(always)]
+    pub fn block_merkle_reader(&self) -> MerkleSnapshot {
+        self.block_merkle_snapshot.read().clone()
+    }
+
     /// Query the transaction by a TxnSID along with its proof data
     pub fn get_transaction(&self, id: TxnSID) -> Result<AuthenticatedTransaction> {
         self.get_transaction_light(id).c(d!()).and_then(|tx| {
             let state_commitment_data =
                 self.status.state_commitment_data.as_ref().c(d!())?.clone();
-            let merkle = &self.txn_merkle;
-            let proof = ProofOf::new(merkle.read().get_proof(tx.merkle_id, 0).c(d!())?);
+            let merkle = self.txn_merkle_reader();
+            let proof = ProofOf::new(merkle.get_proof(tx.merkle_id, 0).c(d!())?);
 
             Ok(AuthenticatedTransaction {
                 finalized_txn: tx,
@@ -887,6 +1060,47 @@ impl LedgerState {
         })
     }
 
+    /// Query the inclusion proof of a transaction at an older version of the
+    /// transaction merkle tree, which is the number of transactions in the tree
+    /// at that state, zero for the last checkpoint.
+    pub fn get_transaction_proof(
+        &self,
+        id: TxnSID,
+        version: u64,
+    ) -> Result<ProofOf<(TxnSID, Transaction)>> {
+        let tx = self.get_transaction_light(id).c(d!())?;
+        self.txn_merkle_reader()
+            .get_proof(tx.merkle_id, version)
+            .c(d!())
+            .map(ProofOf::new)
+    }
+
+    /// Query a batch of transactions by TxnSIDs along with a shared multi-proof
+    pub fn get_transactions(&self, ids: &[TxnSID]) -> Result<AuthenticatedTransactions> {
+        let finalized_txns = ids
+            .iter()
+            .map(|id| self.get_transaction_light(*id).c(d!()))
+            .collect::<Result<Vec<_>>>()?;
+        let state_commitment_data =
+            self.status.state_commitment_data.as_ref().c(d!())?.clone();
+
+        let merkle_ids = finalized_txns
+            .iter()
+            .map(|tx| tx.merkle_id)
+            .collect::<Vec<_>>();
+        let proofs = self
+            .txn_merkle_reader()
+            .get_proofs(&merkle_ids, 0)
+            .c(d!())?;
+
+        Ok(AuthenticatedTransactions {
+            finalized_txns,
+            txn_inclusion_proofs: MultiProof::new(proofs).c(d!())?,
+            state_commitment: state_commitment_data.compute_commitment(),
+            state_commitment_data,
+        })
+    }
+
     /// Query the transaction by a TxnSID without its proof data to reduce latency
     pub fn get_transaction_light(&self, id: TxnSID) -> Result<FinalizedTransaction> {
         self.tx_to_block_location
@@ -906,8 +1120,7 @@ impl LedgerState {
             None => None,
             Some(finalized_block) => {
                 let block_inclusion_proof = ProofOf::new(
-                    self.block_merkle
-                        .read()
+                    self.block_merkle_reader()
                         .get_proof(finalized_block.merkle_id, 0)
                         .unwrap(),
                 );
@@ -947,6 +1160,15 @@ impl LedgerState {
     }
 }
 
+/// Stamp of the derived indexes of a `LedgerStatus`, saved at checkpoint
+/// with the snapshot, the indexes are trusted at startup if it matches.
+#[derive(Deserialize, Serialize, Clone, Copy, PartialEq, Eq, Debug)]
+struct IndexStamp {
+    version: u64,
+    block_commit_count: u64,
+    next_txo: u64,
+}
+
 /// The main LedgerStatus of findora ledger
 #[derive(Deserialize, Serialize, Clone, PartialEq, Debug)]
 pub struct LedgerStatus {
@@ -985,6 +1207,9 @@ pub struct LedgerStatus {
     staking: Staking,
     // tendermint commit height
     td_commit_height: u64,
+    // stamp of `nonconfidential_balances`, missing in the snapshots of old versions
+    #[serde(default)]
+    index_stamp: Option<IndexStamp>,
 
     // An obsolete feature, ignore it!
     tracing_policies: HashMap<AssetTypeCode, TracingPolicy>,
@@ -1095,6 +1320,7 @@ impl LedgerStatus {
             block_commit_count: 0,
             staking: Staking::new(),
             td_commit_height: 0,
+            index_stamp: None,
         };
 
         Ok(ledger)
@@ -1418,22 +1644,84 @@ impl LedgerStatus {
         self.utxos.contains_key(&addr)
     }
 
+    #[inline(always)]
+    fn current_index_stamp(&self) -> IndexStamp {
+        IndexStamp {
+            version: DERIVED_INDEXES_VERSION,
+            block_commit_count: self.block_commit_count,
+            next_txo: self.next_txo.0,
+        }
+    }
+
+    // Rebuild the derived indexes if their stamp does not match,
+    // the ones of old versions are only rebuilt when they are empty, as before.
     fn refresh_data(&mut self) {
-        if self.nonconfidential_balances.is_empty() {
-            self.utxos
+        let stamp = self.current_index_stamp();
+        let stale = match self.index_stamp {
+            Some(s) => s != stamp,
+            None => self.nonconfidential_balances.is_empty(),
+        };
+
+        if stale {
+            let started = Instant::now();
+            let utxos = self.utxos.iter().map(|(_, txo)| txo).collect::<Vec<_>>();
+            let balances = nonconfidential_balances_of(&utxos);
+
+            // the owners of no utxos are kept with zero, same as the spent ones
+            let emptied = self
+                .nonconfidential_balances
                 .iter()
-                .collect::<Vec<_>>()
-                .into_iter()
-                .for_each(|(_, txo)| {
-                    *self
-                        .nonconfidential_balances
-                        .entry(txo.0.record.public_key)
-                        .or_insert(0) += txo.get_nonconfidential_balance();
-                });
+                .filter(|(pk, balance)| 0 != *balance && !balances.contains_key(pk))
+                .map(|(pk, _)| pk)
+                .collect::<Vec<_>>();
+            for pk in emptied {
+                self.nonconfidential_balances.insert(pk, 0);
+            }
+            for (pk, balance) in balances {
+                self.nonconfidential_balances.insert(pk, balance);
+            }
+
+            pd!(format!(
+                "Rebuilt the balances of {} utxos in {:?}",
+                utxos.len(),
+                started.elapsed()
+            ));
         }
+
+        self.index_stamp = Some(stamp);
     }
 }
 
+// Sum up the nonconfidential balances of the utxos on all cores.
+fn nonconfidential_balances_of(utxos: &[Utxo]) -> HashMap<XfrPublicKey, u64> {
+    let threads = thread::available_parallelism().map_or(1, |n| n.get());
+    let chunk = 1 + utxos.len() / threads;
+
+    thread::scope(|s| {
+        let workers = utxos
+            .chunks(chunk)
+            .map(|part| {
+                s.spawn(move || {
+                    let mut balances = HashMap::new();
+                    for txo in part {
+                        *balances.entry(txo.0.record.public_key).or_insert(0) +=
+                            txo.get_nonconfidential_balance();
+                    }
+                    balances
+                })
+            })
+            .collect::<Vec<_>>();
+
+        let mut balances = HashMap::new();
+        for w in workers {
+            for (pk, balance) in pnk!(w.join().ok().c(d!())) {
+                *balances.entry(pk).or_insert(0) += balance;
+            }
+        }
+        balances
+    })
+}
+
 #[allow(missing_docs)]
 #[derive(Clone, Debug, Serialize, Deserialize, PartialEq)]
 pub struct LoggedBlock {
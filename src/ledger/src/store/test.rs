@@ -8,6 +8,7 @@ use {
         Transaction, TransferAsset, TransferAssetBody, TxOutput, TxnEffect, TxoRef,
         TxoSID, ASSET_TYPE_FRA, BLACK_HOLE_PUBKEY, TX_FEE_MIN,
     },
+    crate::staking::{StakerMemo, Validator, ValidatorData, ValidatorKind},
     rand_core::SeedableRng,
     zei::{
         setup::PublicParams,
@@ -450,6 +451,10 @@ fn asset_issued() {
         }
     }
 
+    let authenticated_txns = ledger.get_transactions(&[txn_id]).unwrap();
+    assert!(authenticated_txns.is_valid(state_commitment_and_version.0.clone()));
+    assert!(transaction.finalized_txn == authenticated_txns.finalized_txns[0]);
+
     // We don't actually have anything to commmit yet,
     // but this will save the empty checksum, which is
     // enough for a bit of a test.
@@ -787,3 +792,42 @@ fn test_check_fee_with_ledger() {
     let mut block = ledger.start_block().unwrap();
     assert!(ledger.apply_transaction(&mut block, effect).is_err());
 }
+
+#[test]
+fn test_verify_state_commitment() {
+    let mut ledger = LedgerState::tmp_ledger();
+    let id = XfrKeyPair::generate(&mut ChaChaRng::from_entropy()).get_pk();
+    let v = pnk!(Validator::new(
+        vec![1; 32],
+        1,
+        id,
+        [1, 100],
+        StakerMemo::default(),
+        ValidatorKind::Initiator,
+    ));
+    let staking = ledger.get_staking_mut();
+    pnk!(staking.validator_set_at_height(1, pnk!(ValidatorData::new(1, vec![v]))));
+    staking.set_custom_block_height(1);
+
+    let block = pnk!(ledger.start_block());
+    pnk!(ledger.finish_block(block));
+    assert!(ledger
+        .status
+        .state_commitment_data
+        .as_ref()
+        .unwrap()
+        .staking
+        .is_some());
+    assert_eq!(
+        pnk!(ledger.verify_state_commitment()),
+        ledger.get_state_commitment().0
+    );
+
+    // the staking is recomputed, not trusted
+    let v = ledger
+        .get_staking_mut()
+        .validator_get_current_mut()
+        .unwrap();
+    v.body.get_mut(&id).unwrap().td_power += 1;
+    assert!(ledger.verify_state_commitment().is_err());
+}
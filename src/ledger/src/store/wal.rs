@@ -0,0 +1,295 @@
+//!
+//! # Write-ahead log of checkpoints
+//!
+//! Every checkpoint records the changes of the utxo bitmap and
+//! the two merkle trees of the block into one log entry, and only
+//! this log is fsync-ed before the block is committed.
+//!
+//! The on-disk structures are written without waiting for the disk,
+//! their fsyncs are grouped and done in background, the log will be
+//! cleared after all of them have been persisted.
+//!
+//! On startup, entries that are missing from the structures
+//! will be replayed, entries that have been applied are skipped.
+//!
+
+use {
+    bitmap::BitMap,
+    cryptohash::{sha256, HashValue, HASH_SIZE},
+    merkle_tree::AppendOnlyMerkle,
+    parking_lot::Mutex,
+    ruc::*,
+    serde::{Deserialize, Serialize},
+    std::{
+        fs::{File, OpenOptions},
+        io::{ErrorKind, Read, Seek, SeekFrom, Write},
+        sync::{
+            mpsc::{channel, Sender},
+            Arc,
+        },
+        thread,
+    },
+};
+
+/// Changes of the on-disk structures in one block.
+#[derive(Clone, Debug, Default, Serialize, Deserialize)]
+pub(crate) struct WalRecord {
+    // spent utxos of this block
+    pub(crate) utxo_cleared: Vec<u64>,
+    // new bits start from `utxo_base`
+    pub(crate) utxo_base: u64,
+    pub(crate) utxo_new_bits: Vec<bool>,
+    // new leaves start from `txn_merkle_base`
+    pub(crate) txn_merkle_base: u64,
+    pub(crate) txn_hashes: Vec<HashValue>,
+    pub(crate) block_merkle_base: u64,
+    pub(crate) block_hashes: Vec<HashValue>,
+}
+
+/// An append-only log file,
+/// format of each entry: `[ body len(u32, LE) | sha256(body) | body ]`.
+pub(crate) struct CheckpointWal {
+    file: File,
+    // total number of appended entries since the log is opened
+    seq: u64,
+}
+
+impl CheckpointWal {
+    /// Open or create the log, and read all intact entries in it,
+    /// a broken tail, if any, will be truncated.
+    pub(crate) fn open(path: &str) -> Result<(Self, Vec<WalRecord>)> {
+        let mut file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .open(path)
+            .c(d!())?;
+
+        let mut records = vec![];
+        let mut valid_len = 0;
+
+        loop {
+            match Self::read_entry(&mut file) {
+                Ok(Some((r, len))) => {
+                    records.push(r);
+                    valid_len += len;
+                }
+                Ok(None) => break,
+                Err(e) => {
+                    e.print(None);
+                    break;
+                }
+            }
+        }
+
+        file.set_len(valid_len).c(d!())?;
+        file.seek(SeekFrom::Start(valid_len)).c(d!())?;
+
+        Ok((CheckpointWal { file, seq: 0 }, records))
+    }
+
+    // Return `None` at the end of the log.
+    fn read_entry(file: &mut File) -> Result<Option<(WalRecord, u64)>> {
+        let mut len = [0_u8; 4];
+        match file.read_exact(&mut len) {
+            Ok(_) => {}
+            Err(e) if e.kind() == ErrorKind::UnexpectedEof => return Ok(None),
+            Err(e) => return Err(eg!(e)),
+        }
+        let len = u32::from_le_bytes(len) as usize;
+
+        let mut digest = [0_u8; HASH_SIZE];
+        file.read_exact(&mut digest).c(d!())?;
+
+        let mut body = vec![0_u8; len];
+        file.read_exact(&mut body).c(d!())?;
+
+        if sha256::hash(&body).0 != digest {
+            return Err(eg!("broken WAL entry"));
+        }
+
+        bincode::deserialize(&body)
+            .c(d!())
+            .map(|r| Some((r, (4 + HASH_SIZE + len) as u64)))
+    }
+
+    /// Append an entry and wait for the disk,
+    /// return the sequence number of this entry.
+    pub(crate) fn append(&mut self, record: &WalRecord) -> Result<u64> {
+        let body = bincode::serialize(record).c(d!())?;
+
+        let mut entry = Vec::with_capacity(4 + HASH_SIZE + body.len());
+        entry.extend_from_slice(&(body.len() as u32).to_le_bytes());
+        entry.extend_from_slice(&sha256::hash(&body).0);
+        entry.extend_from_slice(&body);
+
+        self.file.write_all(&entry).c(d!())?;
+        self.file.sync_data().c(d!())?;
+
+        self.seq += 1;
+        Ok(self.seq)
+    }
+
+    /// Drop all entries, they must have been persisted in the structures.
+    pub(crate) fn reset(&mut self) -> Result<()> {
+        self.file.set_len(0).c(d!())?;
+        self.file.seek(SeekFrom::Start(0)).c(d!())?;
+        self.file.sync_data().c(d!())
+    }
+}
+
+/// Start the background thread which syncs the on-disk structures,
+/// it receives `(<seq of the latest WAL entry>, <files to sync>)`.
+///
+/// Pending requests are merged into one, and the log is cleared
+/// only if there were no new entries during the syncing.
+pub(crate) fn start_syncer(wal: Arc<Mutex<CheckpointWal>>) -> Sender<(u64, Vec<File>)> {
+    let (sender, receiver) = channel::<(u64, Vec<File>)>();
+
+    thread::spawn(move || {
+        while let Ok(mut job) = receiver.recv() {
+            // group commit, the files of the latest job cover all previous ones
+            while let Ok(j) = receiver.try_recv() {
+                job = j;
+            }
+
+            let (seq, files) = job;
+            if let Err(e) = files.iter().try_for_each(|f| f.sync_all()) {
+                eg!(e).print(None);
+                continue;
+            }
+
+            let mut wal = wal.lock();
+            if wal.seq == seq {
+                info_omit!(wal.reset());
+            }
+        }
+    });
+
+    sender
+}
+
+/// Apply the log entries that are missing from the structures.
+pub(crate) fn replay(
+    records: &[WalRecord],
+    utxo_map: &mut BitMap,
+    txn_merkle: &mut AppendOnlyMerkle,
+    block_merkle: &mut AppendOnlyMerkle,
+) -> Result<()> {
+    for r in records.iter() {
+        for bit in r.utxo_cleared.iter() {
+            if (*bit as usize) < utxo_map.size() {
+                utxo_map.clear(*bit as usize).c(d!())?;
+            }
+        }
+        for (i, unspent) in r.utxo_new_bits.iter().enumerate() {
+            let bit = (r.utxo_base as usize) + i;
+            utxo_map.set(bit).c(d!())?;
+            if !unspent {
+                utxo_map.clear(bit).c(d!())?;
+            }
+        }
+
+        replay_merkle(txn_merkle, r.txn_merkle_base, &r.txn_hashes).c(d!())?;
+        replay_merkle(block_merkle, r.block_merkle_base, &r.block_hashes).c(d!())?;
+    }
+
+    Ok(())
+}
+
+fn replay_merkle(
+    tree: &mut AppendOnlyMerkle,
+    base: u64,
+    hashes: &[HashValue],
+) -> Result<()> {
+    let state = tree.state();
+
+    if state < base {
+        return Err(eg!(format!(
+            "merkle tree {} is too old: {} < {}",
+            tree.path(),
+            state,
+            base
+        )));
+    }
+
+    let applied = (state - base) as usize;
+    for h in hashes.iter().skip(applied) {
+        tree.append_hash(h).c(d!())?;
+    }
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod test {
+    use {super::*, std::io::Write};
+
+    #[test]
+    fn wal_replay() {
+        let dir = globutils::fresh_tmp_dir().to_string_lossy().into_owned();
+        let wal_path = format!("{}/wal", dir);
+        let utxo_path = format!("{}/utxo_map", dir);
+
+        let records = (0..3_u64)
+            .map(|i| WalRecord {
+                utxo_cleared: alt!(0 == i, vec![], vec![2 * i - 2]),
+                utxo_base: 2 * i,
+                utxo_new_bits: vec![true, false],
+                txn_merkle_base: 2 * i,
+                txn_hashes: vec![
+                    HashValue {
+                        hash: [i as u8 + 1; 32]
+                    };
+                    2
+                ],
+                block_merkle_base: i,
+                block_hashes: vec![HashValue {
+                    hash: [i as u8 + 9; 32],
+                }],
+            })
+            .collect::<Vec<_>>();
+
+        {
+            let (mut wal, old) = pnk!(CheckpointWal::open(&wal_path));
+            assert!(old.is_empty());
+            records.iter().for_each(|r| {
+                pnk!(wal.append(r));
+            });
+        }
+
+        // a broken tail should be dropped
+        let mut f = pnk!(OpenOptions::new().append(true).open(&wal_path));
+        pnk!(f.write_all(&[9, 0, 0, 0, 1, 2, 3]));
+
+        let (_, reloaded) = pnk!(CheckpointWal::open(&wal_path));
+        assert_eq!(reloaded.len(), records.len());
+
+        let mut utxo_map = pnk!(BitMap::create(pnk!(File::create(&utxo_path))));
+        let mut txn_merkle =
+            pnk!(AppendOnlyMerkle::create(&format!("{}/txn_merkle", dir)));
+        let mut block_merkle =
+            pnk!(AppendOnlyMerkle::create(&format!("{}/block_merkle", dir)));
+
+        // apply the first entry in advance, it should be skipped
+        pnk!(replay(
+            &reloaded[..1],
+            &mut utxo_map,
+            &mut txn_merkle,
+            &mut block_merkle
+        ));
+        pnk!(replay(
+            &reloaded,
+            &mut utxo_map,
+            &mut txn_merkle,
+            &mut block_merkle
+        ));
+
+        assert_eq!(6, utxo_map.size());
+        assert_eq!(6, txn_merkle.state());
+        assert_eq!(3, block_merkle.state());
+        (0..6).for_each(|i| {
+            assert_eq!(4 == i, pnk!(utxo_map.query(i)));
+        });
+    }
+}
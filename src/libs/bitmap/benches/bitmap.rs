@@ -0,0 +1,104 @@
+//!
+//! # Setting bits and checksumming in `BitMap`
+//!
+//! The UTXO map of the ledger appends the new outputs of a block, clears
+//! the spent ones, then computes the checksum for the state commitment.
+//!
+//! Run with `cargo bench -p bitmap`.
+//!
+
+use {
+    bitmap::BitMap,
+    criterion::{criterion_group, criterion_main, Criterion, Throughput},
+    rand::{thread_rng, Rng},
+    ruc::*,
+    std::{fs::OpenOptions, time::Instant},
+};
+
+const BITS: usize = 100_0000;
+const BATCH: usize = 1000;
+
+// a bitmap with `n` bits set
+fn bitmap(n: usize) -> BitMap {
+    let path = globutils::fresh_tmp_dir().join("bitmap");
+    let file = pnk!(OpenOptions::new()
+        .read(true)
+        .write(true)
+        .create_new(true)
+        .open(&path));
+    let mut bitmap = pnk!(BitMap::create(file));
+    for i in 0..n {
+        pnk!(bitmap.set(i));
+    }
+    bitmap.compute_checksum();
+    bitmap
+}
+
+// spent outputs of a block
+fn bits() -> Vec<usize> {
+    (0..BATCH)
+        .map(|_| thread_rng().gen_range(0, BITS))
+        .collect()
+}
+
+fn set(c: &mut Criterion) {
+    let mut bitmap = bitmap(BITS);
+    let mut next = BITS;
+
+    let mut group = c.benchmark_group("bitmap");
+    group.throughput(Throughput::Elements(BATCH as u64));
+    group.bench_function("append", |b| {
+        b.iter(|| {
+            for i in next..next + BATCH {
+                pnk!(bitmap.set(i));
+            }
+            next += BATCH;
+        })
+    });
+    group.bench_function("clear", |b| {
+        b.iter_custom(|iters| {
+            (0..iters)
+                .map(|_| {
+                    let bits = bits();
+                    let start = Instant::now();
+                    for i in bits.iter() {
+                        pnk!(bitmap.clear(*i));
+                    }
+                    let elapsed = start.elapsed();
+                    // restore them for the next round
+                    for i in bits {
+                        pnk!(bitmap.set(i));
+                    }
+                    elapsed
+                })
+                .sum()
+        })
+    });
+    group.finish();
+}
+
+fn checksum(c: &mut Criterion) {
+    let mut bitmap = bitmap(BITS);
+
+    let mut group = c.benchmark_group("bitmap");
+    // only the blocks changed since the last checksum are hashed again
+    group.bench_function("compute_checksum", |b| {
+        b.iter_custom(|iters| {
+            (0..iters)
+                .map(|_| {
+                    for i in bits() {
+                        pnk!(bitmap.clear(i));
+                        pnk!(bitmap.set(i));
+                    }
+                    let start = Instant::now();
+                    bitmap.compute_checksum();
+                    start.elapsed()
+                })
+                .sum()
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, set, checksum);
+criterion_main!(benches);
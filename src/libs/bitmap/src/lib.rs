@@ -21,6 +21,12 @@
 //! network. This Vec can be converted to a SparseMap structure.
 //! The SparseMap structure allows various queries on the contents
 //! of the map.
+//!
+//! In memory, full blocks that are mostly set or mostly clear,
+//! e.g. blocks of TXOs that have been spent, are kept as a short
+//! list of the bits that differ from the rest of the block. The
+//! checksums always are computed over the disk form of a block,
+//! so they don't depend on the in-memory form.
 
 #![deny(warnings)]
 #![deny(missing_docs)]
@@ -37,7 +43,7 @@ use {
         collections::{HashMap, HashSet},
         fs::File,
         io::{Read, Seek, SeekFrom, Write},
-        mem, slice,
+        iter, mem, slice,
     },
 };
 
@@ -149,7 +155,7 @@ pub struct SparseMap {
     version: u64,
     checksum: Digest,
     headers: Vec<BlockInfo>,
-    map: HashMap<u64, BlockBits>,
+    map: HashMap<u64, Bits>,
 }
 
 impl SparseMap {
@@ -188,9 +194,6 @@ impl SparseMap {
     pub fn query(&self, id: u64) -> Result<bool> {
         let block = (id / BLOCK_BITS as u64) as usize;
         let block_index = (id % BLOCK_BITS as u64) as usize;
-        let index = block_index / 8;
-        let shift = block_index % 8;
-        let mask = 1 << shift;
 
         if block >= self.headers.len() {
             return Err(eg!(format!(
@@ -211,7 +214,7 @@ impl SparseMap {
         }
 
         if let Some(bits) = self.map.get(&(block as u64)) {
-            return Ok(bits[index] & mask != 0);
+            return Ok(bits.get(block_index));
         }
 
         Err(eg!(format!(
@@ -241,7 +244,7 @@ impl SparseMap {
                 // Recreate the block as it should have been on disk...
                 let mut block = BitBlock::new(BIT_ARRAY, i as u64).unwrap();
                 block.header.count = info.count;
-                block.bits.clone_from_slice(&bits[0..]);
+                bits.copy_to(&mut block.bits);
 
                 let checksum = block.compute_checksum();
 
@@ -275,7 +278,7 @@ impl SparseMap {
 // The size of this structure must match the HEADER_SIZE
 // constant.
 #[repr(C)]
-#[derive(Debug)]
+#[derive(Clone, Debug)]
 struct BlockHeader {
     checksum: CheckBlock, // must be first
     magic: u32,           // must be second
@@ -475,6 +478,192 @@ impl BitBlock {
     }
 }
 
+// Define the limits for the sparse form of a block. An id in
+// the sparse form costs 4 bytes, so a block is compressed when
+// the list fits in an eighth of the dense form, and it is
+// expanded again when the list grows past a quarter of it.
+const SPARSE_LOWER: usize = BITS_SIZE / 4 / 8;
+const SPARSE_UPPER: usize = BITS_SIZE / 4 / 4;
+
+// Define the in-memory form of the bits of a block. The bits
+// are kept either in the disk layout, or as a sorted list of
+// the ids of the bits whose values differ from "fill".
+enum Bits {
+    Dense(Box<BlockBits>),
+    Sparse { fill: bool, ids: Vec<u32> },
+}
+
+impl Bits {
+    // Create the bits of an empty block.
+    #[inline(always)]
+    fn new() -> Bits {
+        Bits::Dense(Box::new([0_u8; BITS_SIZE]))
+    }
+
+    // Query the value of the given bit.
+    #[inline(always)]
+    fn get(&self, id: usize) -> bool {
+        match self {
+            Bits::Dense(bits) => bit_set(&bits[..], id),
+            Bits::Sparse { fill, ids } => {
+                *fill != ids.binary_search(&(id as u32)).is_ok()
+            }
+        }
+    }
+
+    // Change the value of the given bit. A sparse list that
+    // gets too long is converted back to the dense form.
+    fn put(&mut self, id: usize, value: bool) {
+        match self {
+            Bits::Dense(bits) => mutate_bit(&mut bits[..], id, value),
+            Bits::Sparse { fill, ids } => {
+                match ids.binary_search(&(id as u32)) {
+                    Ok(i) if value == *fill => {
+                        ids.remove(i);
+                    }
+                    Err(i) if value != *fill => {
+                        ids.insert(i, id as u32);
+                    }
+                    _ => {}
+                }
+
+                if ids.len() > SPARSE_UPPER {
+                    self.expand();
+                }
+            }
+        }
+    }
+
+    // Count the set bits.
+    fn count(&self) -> u32 {
+        match self {
+            Bits::Dense(bits) => count_bits(&bits[..]),
+            Bits::Sparse { fill, ids } => {
+                if *fill {
+                    (BLOCK_BITS - ids.len()) as u32
+                } else {
+                    ids.len() as u32
+                }
+            }
+        }
+    }
+
+    // Call "f" with the id of each bit in [0, limit) that
+    // has the given value, in ascending order.
+    fn for_each_bit<F: FnMut(usize)>(&self, value: bool, limit: usize, mut f: F) {
+        match self {
+            Bits::Dense(bits) => scan_bits(&bits[..], value, limit).for_each(f),
+            Bits::Sparse { fill, ids } if value != *fill => ids
+                .iter()
+                .map(|id| *id as usize)
+                .take_while(|id| *id < limit)
+                .for_each(f),
+            Bits::Sparse { ids, .. } => {
+                let mut others = ids.iter().map(|id| *id as usize).peekable();
+
+                for id in 0..limit {
+                    if others.peek() == Some(&id) {
+                        others.next();
+                    } else {
+                        f(id);
+                    }
+                }
+            }
+        }
+    }
+
+    // Write the bits in the disk layout.
+    fn copy_to(&self, out: &mut BlockBits) {
+        match self {
+            Bits::Dense(bits) => out.copy_from_slice(&bits[..]),
+            Bits::Sparse { fill, ids } => {
+                out.fill(if *fill { 0xff } else { 0 });
+
+                for id in ids.iter() {
+                    mutate_bit(out, *id as usize, !*fill);
+                }
+            }
+        }
+    }
+
+    #[cfg(test)]
+    fn is_sparse(&self) -> bool {
+        matches!(self, Bits::Sparse { .. })
+    }
+
+    // Convert the bits to the dense form.
+    fn expand(&mut self) {
+        if let Bits::Sparse { .. } = self {
+            let mut bits = Box::new([0_u8; BITS_SIZE]);
+            self.copy_to(&mut bits);
+            *self = Bits::Dense(bits);
+        }
+    }
+
+    // Convert the bits of a full block to the sparse form, if
+    // that form is small enough.
+    fn compress(&mut self, set_bits: u32) {
+        let set_bits = set_bits as usize;
+
+        let fill = if set_bits <= SPARSE_LOWER {
+            false
+        } else if BLOCK_BITS - set_bits <= SPARSE_LOWER {
+            true
+        } else {
+            return;
+        };
+
+        if let Bits::Dense(bits) = self {
+            let mut ids = Vec::new();
+            ids.reserve(SPARSE_LOWER);
+            ids.extend(scan_bits(&bits[..], !fill, BLOCK_BITS).map(|id| id as u32));
+            *self = Bits::Sparse { fill, ids };
+        }
+    }
+}
+
+// Define the in-memory structure of a block. The header is
+// the same as the one on disk, while the bits are kept in
+// either form of Bits.
+struct MemBlock {
+    header: BlockHeader,
+    bits: Bits,
+}
+
+impl MemBlock {
+    // Create a new block.
+    #[inline(always)]
+    fn new(block_contents: u16, block_id: u64) -> Result<MemBlock> {
+        let result = MemBlock {
+            header: BlockHeader::new(block_contents, block_id).c(d!())?,
+            bits: Bits::new(),
+        };
+
+        Ok(result)
+    }
+
+    // Rebuild the disk form of the block.
+    fn image(&self) -> Box<BitBlock> {
+        let mut result = Box::new(BitBlock {
+            header: self.header.clone(),
+            bits: [0_u8; BITS_SIZE],
+        });
+
+        self.bits.copy_to(&mut result.bits);
+        result
+    }
+
+    // Set the block check bits with the current checksum of
+    // the disk form, and return that form.
+    #[inline(always)]
+    fn set_checksum(&mut self) -> Box<BitBlock> {
+        let mut image = self.image();
+        image.set_checksum();
+        self.header.checksum = image.header.checksum;
+        image
+    }
+}
+
 // Define a type for the checksum operation.
 
 type ChecksumData = [u8; CHECK_SIZE + DIGESTBYTES];
@@ -490,12 +679,11 @@ const EMPTY_CHECKSUM: ChecksumData = [0_u8; CHECK_SIZE + DIGESTBYTES];
 ///   first_invalid   the index to the first invalidated checksum term
 ///                     See the BitMap compute_checksum method for
 ///                     details.
-///   map             a map from a byte value to the set bit count
-///                     for that value, i.e., 0 maps to zero, 1 and 2
-///                     map to 1, ...
 ///
 /// Data kept per block:
-///   blocks          the vector of data blocks in the map
+///   blocks          the vector of data blocks in the map, a
+///                     full block might be kept in a compressed
+///                     form, see the Bits enum for details.
 ///   checksum_data   the work area for computing the bitmap checksum
 ///   checksum_valid  a bool indicating whether the checksum_data field
 ///                     a valid block checksum present
@@ -508,10 +696,9 @@ pub struct BitMap {
     size: usize,
     checksum: Digest,
     first_invalid: usize,
-    map: [u8; 256],
 
     // Data kept per block
-    blocks: Vec<BitBlock>,
+    blocks: Vec<MemBlock>,
     checksum_data: Vec<ChecksumData>,
     checksum_valid: Vec<bool>,
     dirty: Vec<i64>,
@@ -533,23 +720,58 @@ fn time() -> i64 {
     time::now().to_timespec().sec
 }
 
-// Count the number of set bits in a given array using
-// an existing map. See create_map() for details on
-// the map.
+// Load the given 8 bytes as a little-endian word, so that
+// bit i of the word is bit i of the bytes.
 #[inline(always)]
-fn count_bits(bits: &[u8], map: [u8; 256]) -> u32 {
-    let mut result: u32 = 0;
+fn load_word(bytes: &[u8]) -> u64 {
+    let mut word = [0_u8; 8];
+    word.copy_from_slice(bytes);
+    u64::from_le_bytes(word)
+}
 
-    for bit in bits.iter() {
-        result += u32::from(map[*bit as usize]);
-    }
+// Count the number of set bits in a given array. The array
+// is processed a word at a time, so that the compiler can use
+// the popcount instructions.
+#[inline(always)]
+fn count_bits(bits: &[u8]) -> u32 {
+    let words = bits.chunks_exact(8);
+    let tail: u32 = words.remainder().iter().map(|b| b.count_ones()).sum();
 
-    result
+    words.map(|w| load_word(w).count_ones()).sum::<u32>() + tail
 }
 
-// Create a map of byte values to their corresponding
-// population count (count of set bits)
+// Iterate over the ids of the bits in [0, limit) of an array
+// that have the given value. Words that contain no such bits
+// are skipped as a whole. The array length must be a multiple
+// of 8, as BITS_SIZE is.
 #[inline(always)]
+fn scan_bits(
+    bits: &[u8],
+    value: bool,
+    limit: usize,
+) -> impl Iterator<Item = usize> + '_ {
+    bits.chunks_exact(8)
+        .enumerate()
+        .flat_map(move |(i, w)| {
+            let mut word = if value { load_word(w) } else { !load_word(w) };
+
+            iter::from_fn(move || {
+                if word == 0 {
+                    return None;
+                }
+
+                let id = i * 64 + word.trailing_zeros() as usize;
+                word &= word - 1;
+                Some(id)
+            })
+        })
+        .take_while(move |id| *id < limit)
+}
+
+// Create a map of byte values to their corresponding
+// population count (count of set bits). This is the
+// reference for the tests of count_bits().
+#[cfg(test)]
 fn create_map() -> [u8; 256] {
     let mut result = [0_u8; 256];
 
@@ -561,7 +783,7 @@ fn create_map() -> [u8; 256] {
 }
 
 // Get the population count for a byte value.
-#[inline(always)]
+#[cfg(test)]
 fn count_byte(mask: usize) -> u8 {
     let mut result = 0;
 
@@ -582,6 +804,21 @@ fn bit_set(bits: &[u8], bit_index: usize) -> bool {
     bits[index] & mask != 0
 }
 
+// Given a bit index into an array, change that bit's
+// value to what's given.
+#[inline(always)]
+fn mutate_bit(bytes: &mut [u8], id: usize, bit_set: bool) {
+    let index = id / 8;
+    let shift = id % 8;
+    let mask = 1 << shift;
+
+    if bit_set {
+        bytes[index] |= mask
+    } else {
+        bytes[index] &= !mask;
+    }
+}
+
 // Convert a count into its serialized form. Currently,
 // that is little-endian, using INDEX_SIZE bytes.
 #[inline(always)]
@@ -598,7 +835,7 @@ fn encode(mut value: usize) -> [u8; INDEX_SIZE] {
 
 // Clippy requires this declaration, otherwise the type is
 // "too complicated".
-type StoredState = (usize, Vec<BitBlock>, Vec<i64>, Vec<bool>, Vec<u32>);
+type StoredState = (usize, Vec<MemBlock>, Vec<i64>, Vec<bool>, Vec<u32>);
 
 impl BitMap {
     /// Create a new bit map. The caller should pass a File
@@ -621,7 +858,6 @@ impl BitMap {
             dirty: Vec::new(),
             checksum_valid: Vec::new(),
             set_bits: Vec::new(),
-            map: create_map(),
             first_invalid: 0,
         };
 
@@ -645,16 +881,18 @@ impl BitMap {
             dirty: state_vector,
             checksum_valid: checksum_vector,
             set_bits: set_vector,
-            map: create_map(),
             first_invalid: 0,
         };
 
         result.checksum_data.reserve(result.blocks.len());
 
-        // Reserve space for the checksum operation cache.
-        result
-            .checksum_data
-            .extend(vec![EMPTY_CHECKSUM; result.blocks.len()]);
+        // Fill the checksum operation cache with the block checksums,
+        // read_file has validated them against the contents.
+        for block in result.blocks.iter() {
+            let mut data = EMPTY_CHECKSUM;
+            data[0..CHECK_SIZE].clone_from_slice(&block.header.checksum.bytes);
+            result.checksum_data.push(data);
+        }
 
         Ok(result)
     }
@@ -668,9 +906,6 @@ impl BitMap {
         let mut set = Vec::new();
         let mut count = 0;
 
-        // Get a map to convert a byte value to a set bit count.
-        let map = create_map();
-
         // Compute the number of blocks in the file.
         let file_size = file.seek(SeekFrom::End(0)).c(d!())?;
 
@@ -704,11 +939,22 @@ impl BitMap {
                         )));
                     }
 
-                    let set_count = count_bits(&block.bits, map);
+                    let set_count = count_bits(&block.bits);
                     count += block.header.count as usize;
-                    blocks.push(block);
+
+                    // Full blocks might be kept in the sparse form.
+                    let mut bits = Bits::Dense(Box::new(block.bits));
+
+                    if block.header.count == BLOCK_BITS as u32 {
+                        bits.compress(set_count);
+                    }
+
+                    blocks.push(MemBlock {
+                        header: block.header,
+                        bits,
+                    });
                     dirty.push(0_i64);
-                    checksum_valid.push(false);
+                    checksum_valid.push(true);
                     set.push(set_count);
                 }
                 Err(e) => {
@@ -723,7 +969,7 @@ impl BitMap {
     // Check that the population count of bits for a given block
     // in the file matches the contents of the bit map itself.
     fn validate_count(&self, index: usize) -> bool {
-        count_bits(&self.blocks[index].bits, self.map) == self.set_bits[index]
+        self.blocks[index].bits.count() == self.set_bits[index]
     }
 
     /// Validate the bitmap. This currently is intended for use
@@ -740,7 +986,7 @@ impl BitMap {
             let header = &block.header;
 
             if validate_checksums {
-                if let Err(e) = block.validate(BIT_ARRAY, i as u64) {
+                if let Err(e) = block.image().validate(BIT_ARRAY, i as u64) {
                     println!("Block {} failed validation:  {}", i, e);
                     pass = false;
                 }
@@ -772,11 +1018,8 @@ impl BitMap {
 
         let block = bit / BLOCK_BITS;
         let bit_id = bit % BLOCK_BITS;
-        let index = bit_id / 8;
-        let mask = 1 << (bit_id % 8);
 
-        let value = self.blocks[block].bits[index] & mask;
-        Ok(value != 0)
+        Ok(self.blocks[block].bits.get(bit_id))
     }
 
     /// Append a set bit, and return the index on success.
@@ -831,9 +1074,6 @@ impl BitMap {
         // Compute the various indices.
         let block = bit / BLOCK_BITS;
         let bit_id = bit % BLOCK_BITS;
-        let index = bit_id / 8;
-        let mask_shift = bit_id % 8;
-        let mask = 1 << mask_shift;
 
         // Check whether the bit map state actually is going to
         // be changed. We can skip the store if not. Also, we
@@ -842,7 +1082,7 @@ impl BitMap {
         let mutate = if bit >= self.size {
             true
         } else {
-            self.blocks[block].bits[index] & mask != value << mask_shift
+            self.blocks[block].bits.get(bit_id) != (value != 0)
         };
 
         if !mutate {
@@ -853,7 +1093,7 @@ impl BitMap {
         // push the new block and all the metadata entries.
         if block >= self.blocks.len() {
             self.blocks
-                .push(BitBlock::new(BIT_ARRAY, block as u64).c(d!())?);
+                .push(MemBlock::new(BIT_ARRAY, block as u64).c(d!())?);
             self.checksum_data.push(EMPTY_CHECKSUM);
             self.dirty.push(time());
             self.checksum_valid.push(false);
@@ -868,11 +1108,11 @@ impl BitMap {
 
         // Change the actual value in the block. Also,
         // update the population count.
+        self.blocks[block].bits.put(bit_id, value != 0);
+
         if value == 0 {
-            self.blocks[block].bits[index] &= !mask;
             self.set_bits[block] -= 1;
         } else {
-            self.blocks[block].bits[index] |= mask;
             self.set_bits[block] += 1;
         }
 
@@ -1097,7 +1337,14 @@ impl BitMap {
         // Append the header to the serialization.
         self.append_header(index, BIT_ARRAY, 0, result);
 
-        result.extend_from_slice(&self.blocks[index].bits[0..BITS_SIZE]);
+        match &self.blocks[index].bits {
+            Bits::Dense(bits) => result.extend_from_slice(&bits[0..BITS_SIZE]),
+            sparse => {
+                let mut bits = [0_u8; BITS_SIZE];
+                sparse.copy_to(&mut bits);
+                result.extend_from_slice(&bits[0..BITS_SIZE]);
+            }
+        }
     }
 
     // Append a list of the set bits to the serialization
@@ -1109,12 +1356,12 @@ impl BitMap {
         self.append_header(index, BIT_DESC_SET, set_bits, result);
 
         // Get the bit map.
-        let bits = &self.blocks[index].bits;
-        for i in 0..self.blocks[index].header.count as usize {
-            if bit_set(bits, i) {
-                result.extend_from_slice(&encode(i));
-            }
-        }
+        let block = &self.blocks[index];
+        block
+            .bits
+            .for_each_bit(true, block.header.count as usize, |i| {
+                result.extend_from_slice(&encode(i))
+            });
     }
 
     // Append a list of the clear bits to the serialization
@@ -1124,19 +1371,16 @@ impl BitMap {
 
         self.append_header(index, BIT_DESC_CLEAR, clear_bits, result);
 
-        let bits = &self.blocks[index].bits;
-        for i in 0..BLOCK_BITS {
-            if !bit_set(bits, i) {
-                result.extend_from_slice(&encode(i));
-            }
-        }
+        self.blocks[index]
+            .bits
+            .for_each_bit(false, BLOCK_BITS, |i| result.extend_from_slice(&encode(i)));
     }
 
     // Convert a serialized bitmap back into structured data.
     #[allow(clippy::type_complexity)]
     fn deserialize(
         bytes: &[u8],
-    ) -> Result<(u64, Digest, Vec<BlockInfo>, HashMap<u64, BlockBits>)> {
+    ) -> Result<(u64, Digest, Vec<BlockInfo>, HashMap<u64, Bits>)> {
         let mut info_vec = Vec::new();
         let mut bits_map = HashMap::new();
         let mut index = 0;
@@ -1164,40 +1408,32 @@ impl BitMap {
             info.validate().c(d!())?;
 
             let block = info.bit_id / BLOCK_BITS as u64;
-            let mut bits: BlockBits;
 
             // Now retrieve the block contents, if present, and
             // restore them to bitmaps.
             match info.contents {
                 BIT_HEADER => {}
                 BIT_ARRAY => {
-                    bits = [0_u8; BITS_SIZE];
+                    if bytes.len() - index < BITS_SIZE {
+                        return Err(eg!("The input was too short.".to_string()));
+                    }
+
+                    let mut bits = Box::new([0_u8; BITS_SIZE]);
                     bits.clone_from_slice(&bytes[index..index + BITS_SIZE]);
                     index += BITS_SIZE;
-                    bits_map.insert(block, bits);
+                    bits_map.insert(block, Bits::Dense(bits));
                 }
                 BIT_DESC_SET => {
+                    // Keep the list as it is, rather than expanding it.
                     let (next, ids) =
                         BitMap::decode(info.list_size, bytes, index).c(d!())?;
-                    bits = [0_u8; BITS_SIZE];
-
-                    for id in ids.iter() {
-                        BitMap::mutate_bit(&mut bits, *id, true);
-                    }
-
-                    bits_map.insert(block, bits);
+                    bits_map.insert(block, Bits::Sparse { fill: false, ids });
                     index = next;
                 }
                 BIT_DESC_CLEAR => {
                     let (next, ids) =
                         BitMap::decode(info.list_size, bytes, index).c(d!())?;
-                    bits = [0xff_u8; BITS_SIZE];
-
-                    for id in ids.iter() {
-                        BitMap::mutate_bit(&mut bits, *id, false);
-                    }
-
-                    bits_map.insert(block, bits);
+                    bits_map.insert(block, Bits::Sparse { fill: true, ids });
                     index = next;
                 }
                 _ => {
@@ -1251,12 +1487,9 @@ impl BitMap {
     }
 
     // Decode a list of bit indices. We get the number of entries
-    // as an input, since it's kept in the BitInfo structure.
-    fn decode(
-        list_size: u32,
-        bytes: &[u8],
-        start: usize,
-    ) -> Result<(usize, Vec<usize>)> {
+    // as an input, since it's kept in the BitInfo structure. The
+    // result is sorted, so it can be used as a sparse block.
+    fn decode(list_size: u32, bytes: &[u8], start: usize) -> Result<(usize, Vec<u32>)> {
         let mut index = start;
         let mut ids = Vec::new();
         let bytes_consumed = list_size as usize * INDEX_SIZE;
@@ -1273,27 +1506,18 @@ impl BitMap {
                 index += 1;
             }
 
-            ids.push(id);
+            if id >= BLOCK_BITS {
+                return Err(eg!(format!("An index was out of range:  {}", id)));
+            }
+
+            ids.push(id as u32);
         }
 
+        ids.sort_unstable();
+        ids.dedup();
         Ok((index, ids))
     }
 
-    // Given a bit index into an array, change that bit's
-    // value to what's given. This procedure is used when
-    // creating a downloaded block.
-    fn mutate_bit(bytes: &mut BlockBits, id: usize, bit_set: bool) {
-        let index = id / 8;
-        let shift = id % 8;
-        let mask = 1 << shift;
-
-        if bit_set {
-            bytes[index] |= mask
-        } else {
-            bytes[index] &= !mask;
-        }
-    }
-
     /// Return the number of bits in the map.
     pub fn size(&self) -> usize {
         self.size
@@ -1301,16 +1525,29 @@ impl BitMap {
 
     /// Write the bitmap to disk.
     pub fn write(&mut self) -> Result<()> {
+        self.write_nosync().c(d!())?;
+        self.file.sync_all().c(d!())?;
+        Ok(())
+    }
+
+    /// Write the bitmap to the operating system without waiting for
+    /// the storage, the caller should sync the file from `try_clone_file`.
+    pub fn write_nosync(&mut self) -> Result<()> {
         for i in 0..self.blocks.len() {
             if self.dirty[i] != 0 {
                 self.write_block(i).c(d!())?;
             }
         }
 
-        self.file.sync_all().c(d!())?;
         Ok(())
     }
 
+    /// Duplicate the handle of the underlying file.
+    #[inline(always)]
+    pub fn try_clone_file(&self) -> Result<File> {
+        self.file.try_clone().c(d!())
+    }
+
     /// Flush buffers that haven't been modified in "age" seconds
     /// to the operating system. The write() method must be invoked
     /// if the caller wants a guarantee that the data has been moved
@@ -1332,12 +1569,20 @@ impl BitMap {
     // although compute_checksum() actually might have fixed
     // it. TODO:  use first_invalid to avoid an unnecessary
     // update of the checksum?
+    //
+    // A full block is compressed here if possible, since it
+    // is not going to be extended any more.
     fn write_block(&mut self, index: usize) -> Result<()> {
-        self.blocks[index].set_checksum();
+        let image = self.blocks[index].set_checksum();
         let offset = index as u64 * BLOCK_SIZE as u64;
         self.file.seek(SeekFrom::Start(offset)).c(d!())?;
-        self.file.write_all(self.blocks[index].as_ref()).c(d!())?;
+        self.file.write_all(image.as_ref()).c(d!())?;
         self.dirty[index] = 0;
+
+        if self.blocks[index].header.count == BLOCK_BITS as u32 {
+            self.blocks[index].bits.compress(self.set_bits[index]);
+        }
+
         Ok(())
     }
 }
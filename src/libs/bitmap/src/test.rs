@@ -410,3 +410,131 @@ fn test_counting() {
         assert!(map[value] == 2);
     }
 }
+
+#[test]
+fn test_word_kernels() {
+    let map = create_map();
+    let mut rng = rand::thread_rng();
+    let mut bits = [0_u8; BITS_SIZE];
+
+    for byte in bits.iter_mut() {
+        *byte = rng.gen();
+    }
+
+    let expected: u32 = bits.iter().map(|b| map[*b as usize] as u32).sum();
+    assert!(count_bits(&bits) == expected);
+    assert!(count_bits(&bits[1..]) == expected - map[bits[0] as usize] as u32);
+
+    let limit = BLOCK_BITS - 5;
+    let set: Vec<usize> = scan_bits(&bits, true, limit).collect();
+    let clear: Vec<usize> = scan_bits(&bits, false, limit).collect();
+    let expected_set: Vec<usize> = (0..limit).filter(|i| bit_set(&bits, *i)).collect();
+    let expected_clear: Vec<usize> =
+        (0..limit).filter(|i| !bit_set(&bits, *i)).collect();
+    assert!(set == expected_set);
+    assert!(clear == expected_clear);
+}
+
+// Check that the compressed blocks give the same results and
+// checksums as the dense ones.
+#[test]
+fn test_sparse_blocks() {
+    let path = "sparse_bitmap";
+    let _ = fs::remove_file(&path);
+
+    let file = OpenOptions::new()
+        .read(true)
+        .write(true)
+        .create_new(true)
+        .open(&path)
+        .unwrap();
+
+    let mut bitmap = BitMap::create(file).unwrap();
+
+    for _ in 0..3 * BLOCK_BITS + 7 {
+        bitmap.append().unwrap();
+    }
+
+    // Spend all but a few bits of block 0, and a few bits of
+    // block 1, while leaving the others mostly dense.
+    for i in 0..BLOCK_BITS {
+        if i % 1000 != 0 {
+            bitmap.clear(i).unwrap();
+        }
+    }
+
+    for i in (BLOCK_BITS..2 * BLOCK_BITS).step_by(997) {
+        bitmap.clear(i).unwrap();
+    }
+
+    for i in (2 * BLOCK_BITS..3 * BLOCK_BITS).step_by(2) {
+        bitmap.clear(i).unwrap();
+    }
+
+    let expected: Vec<bool> = (0..bitmap.size())
+        .map(|i| bitmap.query(i).unwrap())
+        .collect();
+    let checksum = bitmap.compute_checksum();
+    let dense = bitmap.serialize(1);
+
+    bitmap.write().unwrap();
+    assert!(bitmap.blocks[0].bits.is_sparse());
+    assert!(bitmap.blocks[1].bits.is_sparse());
+    assert!(!bitmap.blocks[2].bits.is_sparse());
+    assert!(!bitmap.blocks[3].bits.is_sparse());
+    assert!(bitmap.validate(true));
+
+    bitmap.clear_checksum_cache();
+    assert!(bitmap.compute_checksum() == checksum);
+    assert!(bitmap.serialize(1) == dense);
+
+    for (i, value) in expected.iter().enumerate() {
+        assert!(bitmap.query(i).unwrap() == *value);
+    }
+
+    // Mutate the sparse blocks, and compare against a dense copy.
+    bitmap.set(5).unwrap();
+    bitmap.clear(1000).unwrap();
+    bitmap.set(BLOCK_BITS + 997).unwrap();
+    bitmap.clear(BLOCK_BITS + 1).unwrap();
+    assert!(bitmap.validate(false));
+    validate_checksum(&mut bitmap, "sparse".to_owned());
+
+    let checksum = bitmap.compute_checksum();
+    bitmap.write().unwrap();
+    drop(bitmap);
+
+    let file = OpenOptions::new()
+        .read(true)
+        .write(true)
+        .open(&path)
+        .unwrap();
+
+    let mut bitmap = BitMap::open(file).unwrap();
+    assert!(bitmap.blocks[0].bits.is_sparse());
+    assert!(bitmap.query(5).unwrap());
+    assert!(!bitmap.query(1000).unwrap());
+    assert!(bitmap.query(BLOCK_BITS + 997).unwrap());
+    assert!(!bitmap.query(BLOCK_BITS + 1).unwrap());
+    assert!(bitmap.compute_checksum() == checksum);
+
+    // The downloaded form keeps the lists as they are.
+    let sparse_map = SparseMap::new(&bitmap.serialize(2)).unwrap();
+    assert!(sparse_map.validate_checksum());
+
+    for i in 0..bitmap.size() {
+        assert!(sparse_map.query(i as u64).unwrap() == bitmap.query(i).unwrap());
+    }
+
+    // A sparse block that grows too much goes back to the dense form.
+    for i in 0..BLOCK_BITS / 2 {
+        bitmap.set(i).unwrap();
+    }
+
+    assert!(!bitmap.blocks[0].bits.is_sparse());
+    assert!(bitmap.validate(false));
+    validate_checksum(&mut bitmap, "expanded".to_owned());
+
+    drop(bitmap);
+    let _ = fs::remove_file(&path);
+}
@@ -6,7 +6,10 @@
 #![deny(warnings)]
 #![deny(missing_docs)]
 
-use serde::{Deserialize, Serialize};
+use {
+    serde::{Deserialize, Serialize},
+    std::collections::HashMap,
+};
 
 /// HashValue size in byte
 pub const HASH_SIZE: usize = 32;
@@ -181,6 +184,102 @@ impl Proof {
     }
 }
 
+///
+/// A compact form of a set of proofs for the same state of a tree.
+/// Proofs of nearby transactions share most of their upper hashes,
+/// so every distinct hash is stored only once in `nodes`, and each
+/// proof is described by the indexes of its hashes.
+///
+
+#[allow(missing_docs)]
+#[derive(Debug, Clone, Deserialize, Serialize)]
+pub struct MultiProof {
+    pub version: u64,
+    pub ledger: String,
+    pub state: u64,
+    pub time: i64,
+    pub root_hash: HashValue,
+    pub tx_ids: Vec<u64>,
+    pub nodes: Vec<HashValue>,
+    pub paths: Vec<Vec<u32>>,
+}
+
+impl MultiProof {
+    /// Merge some proofs into a multi-proof, `None` will be returned
+    /// if the proofs are empty or not generated from the same state.
+    pub fn new(proofs: Vec<Proof>) -> Option<MultiProof> {
+        let first = proofs.first()?;
+
+        let mut mp = MultiProof {
+            version: first.version,
+            ledger: first.ledger.clone(),
+            state: first.state,
+            time: first.time,
+            root_hash: first.root_hash,
+            tx_ids: Vec::with_capacity(proofs.len()),
+            nodes: vec![],
+            paths: Vec::with_capacity(proofs.len()),
+        };
+
+        let mut indexes = HashMap::new();
+
+        for proof in proofs.into_iter() {
+            if proof.version != mp.version
+                || proof.ledger != mp.ledger
+                || proof.state != mp.state
+                || proof.root_hash != mp.root_hash
+            {
+                return None;
+            }
+
+            let path = proof
+                .hash_array
+                .iter()
+                .map(|h| {
+                    *indexes.entry(h.hash).or_insert_with(|| {
+                        mp.nodes.push(*h);
+                        mp.nodes.len() as u32 - 1
+                    })
+                })
+                .collect();
+
+            mp.tx_ids.push(proof.tx_id);
+            mp.paths.push(path);
+        }
+
+        Some(mp)
+    }
+
+    /// Expand the proof at the given position.
+    pub fn proof(&self, idx: usize) -> Option<Proof> {
+        let tx_id = *self.tx_ids.get(idx)?;
+        let hash_array = self
+            .paths
+            .get(idx)?
+            .iter()
+            .map(|i| self.nodes.get(*i as usize).copied())
+            .collect::<Option<Vec<_>>>()?;
+
+        Some(Proof {
+            version: self.version,
+            ledger: self.ledger.clone(),
+            state: self.state,
+            time: self.time,
+            tx_id,
+            root_hash: self.root_hash,
+            hash_array,
+        })
+    }
+
+    /// Check if the leaf is proved by the proof at the given position.
+    #[inline(always)]
+    pub fn is_valid_proof(&self, idx: usize, leaf: HashValue) -> bool {
+        self.proof(idx)
+            .map(|p| p.is_valid_proof(leaf))
+            .unwrap_or(false)
+    }
+}
+
 /// Compute the hash of two hashes. This Merkle tree is a binary
 /// representation, so this is a common operation.
 pub fn hash_pair(left: &HashValue, right: &HashValue) -> HashValue {
@@ -6,6 +6,7 @@
 #![deny(missing_docs)]
 
 pub mod logging;
+pub mod metrics;
 pub mod wallet;
 
 use {
@@ -158,6 +159,15 @@ where
         Self(HashOfBytes::new(&Serialized::new(to_hash)))
     }
 
+    /// Wrap a digest that has been computed in another way, eg. incrementally
+    #[inline(always)]
+    pub fn from_digest(hash: Digest) -> Self {
+        Self(HashOfBytes {
+            hash,
+            phantom: PhantomData,
+        })
+    }
+
     #[inline(always)]
     #[allow(missing_docs)]
     pub fn hex(&self) -> String {
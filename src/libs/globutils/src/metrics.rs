@@ -0,0 +1,369 @@
+//!
+//! # Metrics
+//!
+//! Counters, gauges and histograms for the hot paths of the node,
+//! rendered in the text format of Prometheus.
+//!
+//! All metrics are `static`s built by `const fn`s, an observation is
+//! a few relaxed atomic additions, no lock and no allocation.
+//! A metric joins the output on its first observation.
+//!
+
+use std::{
+    fmt::Write,
+    ptr,
+    sync::atomic::{AtomicBool, AtomicI64, AtomicPtr, AtomicU64, Ordering},
+    time::Instant,
+};
+
+// upper bounds of the buckets, in microseconds
+const BOUNDS: [u64; 19] = [
+    10, 25, 50, 100, 250, 500, 1_000, 2_500, 5_000, 10_000, 25_000, 50_000, 100_000,
+    250_000, 500_000, 1_000_000, 2_500_000, 5_000_000, 10_000_000,
+];
+
+// the last one is `+Inf`
+const BUCKETS: usize = BOUNDS.len() + 1;
+
+static HISTOGRAMS: AtomicPtr<Histogram> = AtomicPtr::new(ptr::null_mut());
+static COUNTERS: AtomicPtr<Counter> = AtomicPtr::new(ptr::null_mut());
+static GAUGES: AtomicPtr<Gauge> = AtomicPtr::new(ptr::null_mut());
+
+// push a metric into an intrusive list, exactly once
+macro_rules! register {
+    ($list: expr, $me: expr) => {
+        if !$me.registered.load(Ordering::Relaxed)
+            && !$me.registered.swap(true, Ordering::AcqRel)
+        {
+            let me = $me as *const _ as *mut _;
+            let mut head = $list.load(Ordering::Acquire);
+            loop {
+                $me.next.store(head, Ordering::Relaxed);
+                match $list.compare_exchange_weak(
+                    head,
+                    me,
+                    Ordering::AcqRel,
+                    Ordering::Acquire,
+                ) {
+                    Ok(_) => break,
+                    Err(h) => head = h,
+                }
+            }
+        }
+    };
+}
+
+// iterate an intrusive list
+fn walk<T: 'static>(
+    head: &AtomicPtr<T>,
+    next: fn(&T) -> *mut T,
+) -> impl Iterator<Item = &'static T> {
+    let mut p = head.load(Ordering::Acquire);
+    std::iter::from_fn(move || {
+        // only `'static` metrics are pushed
+        let m: &'static T = unsafe { p.as_ref() }?;
+        p = next(m);
+        Some(m)
+    })
+}
+
+/// A histogram of durations, in seconds.
+pub struct Histogram {
+    name: &'static str,
+    labels: &'static str,
+    help: &'static str,
+    buckets: [AtomicU64; BUCKETS],
+    sum_us: AtomicU64,
+    registered: AtomicBool,
+    next: AtomicPtr<Histogram>,
+}
+
+impl Histogram {
+    /// `labels` is in the form of `k1="v1",k2="v2"`, may be empty,
+    /// histograms with the same name are rendered together.
+    pub const fn new(
+        name: &'static str,
+        labels: &'static str,
+        help: &'static str,
+    ) -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        Histogram {
+            name,
+            labels,
+            help,
+            buckets: [ZERO; BUCKETS],
+            sum_us: AtomicU64::new(0),
+            registered: AtomicBool::new(false),
+            next: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    /// Record a duration in microseconds.
+    #[inline(always)]
+    pub fn observe_us(&'static self, us: u64) {
+        register!(HISTOGRAMS, self);
+        let idx = BOUNDS.iter().position(|b| us <= *b).unwrap_or(BOUNDS.len());
+        self.buckets[idx].fetch_add(1, Ordering::Relaxed);
+        self.sum_us.fetch_add(us, Ordering::Relaxed);
+    }
+
+    /// Record the time elapsed since `start`.
+    #[inline(always)]
+    pub fn observe_since(&'static self, start: Instant) {
+        self.observe_us(start.elapsed().as_micros() as u64);
+    }
+
+    /// Start a timer, which records its duration when dropped.
+    #[inline(always)]
+    pub fn start_timer(&'static self) -> Timer {
+        Timer {
+            histogram: self,
+            start: Instant::now(),
+        }
+    }
+
+    /// Measure the time spent in `f`.
+    #[inline(always)]
+    pub fn time<T>(&'static self, f: impl FnOnce() -> T) -> T {
+        let _t = self.start_timer();
+        f()
+    }
+
+    /// Number of the observations.
+    pub fn count(&self) -> u64 {
+        self.buckets.iter().map(|b| b.load(Ordering::Relaxed)).sum()
+    }
+
+    fn render(&self, out: &mut String) {
+        let sep = if self.labels.is_empty() { "" } else { "," };
+        let mut cumulative = 0;
+        for (idx, b) in self.buckets.iter().enumerate() {
+            cumulative += b.load(Ordering::Relaxed);
+            let le = BOUNDS
+                .get(idx)
+                .map_or_else(|| "+Inf".to_owned(), |us| (*us as f64 / 1e6).to_string());
+            let _ = writeln!(
+                out,
+                "{}_bucket{{{}{}le=\"{}\"}} {}",
+                self.name, self.labels, sep, le, cumulative
+            );
+        }
+        let labels = if self.labels.is_empty() {
+            String::new()
+        } else {
+            format!("{{{}}}", self.labels)
+        };
+        let sum = self.sum_us.load(Ordering::Relaxed) as f64 / 1e6;
+        let _ = writeln!(out, "{}_sum{} {}", self.name, labels, sum);
+        let _ = writeln!(out, "{}_count{} {}", self.name, labels, cumulative);
+    }
+}
+
+/// Records the duration of a `Histogram::start_timer` when dropped.
+pub struct Timer {
+    histogram: &'static Histogram,
+    start: Instant,
+}
+
+impl Drop for Timer {
+    #[inline(always)]
+    fn drop(&mut self) {
+        self.histogram.observe_since(self.start);
+    }
+}
+
+/// A monotonic counter.
+pub struct Counter {
+    name: &'static str,
+    labels: &'static str,
+    help: &'static str,
+    value: AtomicU64,
+    registered: AtomicBool,
+    next: AtomicPtr<Counter>,
+}
+
+impl Counter {
+    /// Same naming as `Histogram::new`.
+    pub const fn new(
+        name: &'static str,
+        labels: &'static str,
+        help: &'static str,
+    ) -> Self {
+        Counter {
+            name,
+            labels,
+            help,
+            value: AtomicU64::new(0),
+            registered: AtomicBool::new(false),
+            next: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    /// Add `n` to the counter.
+    #[inline(always)]
+    pub fn inc_by(&'static self, n: u64) {
+        register!(COUNTERS, self);
+        self.value.fetch_add(n, Ordering::Relaxed);
+    }
+
+    /// Add one to the counter.
+    #[inline(always)]
+    pub fn inc(&'static self) {
+        self.inc_by(1);
+    }
+
+    /// Current value.
+    pub fn get(&self) -> u64 {
+        self.value.load(Ordering::Relaxed)
+    }
+
+    fn render(&self, out: &mut String) {
+        if self.labels.is_empty() {
+            let _ = writeln!(out, "{} {}", self.name, self.get());
+        } else {
+            let _ = writeln!(out, "{}{{{}}} {}", self.name, self.labels, self.get());
+        }
+    }
+}
+
+/// A value that goes up and down, e.g. the depth of a queue.
+pub struct Gauge {
+    name: &'static str,
+    labels: &'static str,
+    help: &'static str,
+    value: AtomicI64,
+    registered: AtomicBool,
+    next: AtomicPtr<Gauge>,
+}
+
+impl Gauge {
+    /// Same naming as `Histogram::new`.
+    pub const fn new(
+        name: &'static str,
+        labels: &'static str,
+        help: &'static str,
+    ) -> Self {
+        Gauge {
+            name,
+            labels,
+            help,
+            value: AtomicI64::new(0),
+            registered: AtomicBool::new(false),
+            next: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    /// Add `n` to the gauge, `n` may be negative.
+    #[inline(always)]
+    pub fn add(&'static self, n: i64) {
+        register!(GAUGES, self);
+        self.value.fetch_add(n, Ordering::Relaxed);
+    }
+
+    /// Set the gauge to `n`.
+    #[inline(always)]
+    pub fn set(&'static self, n: i64) {
+        register!(GAUGES, self);
+        self.value.store(n, Ordering::Relaxed);
+    }
+
+    /// Current value.
+    pub fn get(&self) -> i64 {
+        self.value.load(Ordering::Relaxed)
+    }
+
+    fn render(&self, out: &mut String) {
+        if self.labels.is_empty() {
+            let _ = writeln!(out, "{} {}", self.name, self.get());
+        } else {
+            let _ = writeln!(out, "{}{{{}}} {}", self.name, self.labels, self.get());
+        }
+    }
+}
+
+// emit `HELP` and `TYPE` once for each name
+fn render_group<T>(
+    out: &mut String,
+    mut metrics: Vec<&'static T>,
+    kind: &str,
+    name: fn(&T) -> &'static str,
+    help: fn(&T) -> &'static str,
+    render: fn(&T, &mut String),
+) {
+    metrics.sort_by_key(|m| name(m));
+    let mut last = "";
+    for m in metrics {
+        if name(m) != last {
+            last = name(m);
+            let _ = writeln!(out, "# HELP {} {}", last, help(m));
+            let _ = writeln!(out, "# TYPE {} {}", last, kind);
+        }
+        render(m, out);
+    }
+}
+
+/// All observed metrics in the text format of Prometheus.
+pub fn render() -> String {
+    let mut out = String::new();
+    render_group(
+        &mut out,
+        walk(&COUNTERS, |c| c.next.load(Ordering::Acquire)).collect(),
+        "counter",
+        |c| c.name,
+        |c| c.help,
+        Counter::render,
+    );
+    render_group(
+        &mut out,
+        walk(&GAUGES, |g| g.next.load(Ordering::Acquire)).collect(),
+        "gauge",
+        |g| g.name,
+        |g| g.help,
+        Gauge::render,
+    );
+    render_group(
+        &mut out,
+        walk(&HISTOGRAMS, |h| h.next.load(Ordering::Acquire)).collect(),
+        "histogram",
+        |h| h.name,
+        |h| h.help,
+        Histogram::render,
+    );
+    out
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    static H_A: Histogram = Histogram::new("test_seconds", "op=\"a\"", "test op");
+    static H_B: Histogram = Histogram::new("test_seconds", "op=\"b\"", "test op");
+    static C: Counter = Counter::new("test_total", "", "test counter");
+    static G: Gauge = Gauge::new("test_depth", "q=\"a\"", "test gauge");
+
+    #[test]
+    fn prometheus_text() {
+        H_A.observe_us(5);
+        H_A.observe_us(300);
+        H_B.time(|| {});
+        (0..3).for_each(|_| C.inc());
+        G.add(5);
+        G.add(-7);
+
+        assert_eq!(2, H_A.count());
+        assert_eq!(1, H_B.count());
+        assert_eq!(3, C.get());
+        assert_eq!(-2, G.get());
+
+        let text = render();
+        assert_eq!(1, text.matches("# TYPE test_seconds histogram").count());
+        assert!(text.contains("test_seconds_bucket{op=\"a\",le=\"0.00001\"} 1"));
+        assert!(text.contains("test_seconds_bucket{op=\"a\",le=\"0.0005\"} 2"));
+        assert!(text.contains("test_seconds_bucket{op=\"a\",le=\"+Inf\"} 2"));
+        assert!(text.contains("test_seconds_count{op=\"a\"} 2"));
+        assert!(text.contains("test_seconds_count{op=\"b\"} 1"));
+        assert!(text.contains("# TYPE test_total counter\ntest_total 3\n"));
+        assert!(text.contains("# TYPE test_depth gauge\ntest_depth{q=\"a\"} -2\n"));
+    }
+}
@@ -0,0 +1,73 @@
+//!
+//! # Appending and proving in `AppendOnlyMerkle`
+//!
+//! The ledger appends a hash per transaction and per block,
+//! and proves the transactions on queries.
+//!
+//! Run with `cargo bench -p merkle_tree`.
+//!
+
+use {
+    criterion::{criterion_group, criterion_main, Criterion, Throughput},
+    cryptohash::{sha256, HashValue},
+    merkle_tree::AppendOnlyMerkle,
+    rand::{thread_rng, Rng},
+    ruc::*,
+};
+
+const LEAVES: u64 = 10_0000;
+const BATCH: u64 = 1000;
+
+fn leaf(i: u64) -> HashValue {
+    HashValue::from(sha256::hash(&i.to_be_bytes()))
+}
+
+// a tree with `n` leaves
+fn tree(n: u64) -> AppendOnlyMerkle {
+    let path = globutils::fresh_tmp_dir().join("merkle");
+    let mut tree = pnk!(AppendOnlyMerkle::create(&path.to_string_lossy()));
+    for i in 0..n {
+        pnk!(tree.append_hash(&leaf(i)));
+    }
+    tree
+}
+
+fn append_hash(c: &mut Criterion) {
+    // appended to a large tree, as the ledger does
+    let mut tree = tree(LEAVES);
+    let mut next = LEAVES;
+
+    let mut group = c.benchmark_group("merkle");
+    group.throughput(Throughput::Elements(BATCH));
+    group.bench_function("append_hash", |b| {
+        b.iter(|| {
+            for i in next..next + BATCH {
+                pnk!(tree.append_hash(&leaf(i)));
+            }
+            next += BATCH;
+        })
+    });
+    group.finish();
+}
+
+fn get_proof(c: &mut Criterion) {
+    let tree = tree(LEAVES);
+    let ids = (0..BATCH)
+        .map(|_| thread_rng().gen_range(0, LEAVES))
+        .collect::<Vec<_>>();
+
+    let mut group = c.benchmark_group("merkle");
+    group.throughput(Throughput::Elements(BATCH));
+    group.bench_function("get_proof", |b| {
+        b.iter(|| {
+            ids.iter().for_each(|id| {
+                pnk!(tree.get_proof(*id, 0));
+            })
+        })
+    });
+    group.bench_function("get_proofs", |b| b.iter(|| pnk!(tree.get_proofs(&ids, 0))));
+    group.finish();
+}
+
+criterion_group!(benches, append_hash, get_proof);
+criterion_main!(benches);
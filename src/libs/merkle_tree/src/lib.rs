@@ -17,6 +17,7 @@ use {
     chrono::Utc,
     cryptohash::{hash_pair, hash_partial, sha256, HashValue, Proof, HASH_SIZE},
     globutils::Commas,
+    memmap2::{Mmap, MmapOptions},
     ruc::*,
     serde::{Deserialize, Deserializer, Serialize, Serializer},
     std::{
@@ -29,6 +30,7 @@ use {
         ptr::copy_nonoverlapping,
         result::Result as StdResult,
         slice,
+        sync::Arc,
     },
 };
 
@@ -277,7 +279,7 @@ where
 // with each such interior node being the parent of two level zero
 // blocks.
 #[repr(C)]
-#[derive(Serialize, Deserialize)]
+#[derive(Clone, Serialize, Deserialize)]
 struct Block {
     header: BlockHeader,
 
@@ -692,8 +694,10 @@ impl AppendOnlyMerkle {
         Ok(tree)
     }
 
+    /// The suffix of the file which keeps the original leaves during
+    /// a rebuild, it should be removed by the caller after the rebuild.
     #[inline(always)]
-    fn rebuild_ext() -> String {
+    pub fn rebuild_ext() -> String {
         "-base".to_string()
     }
 
@@ -1337,65 +1341,13 @@ impl AppendOnlyMerkle {
 
     /// Generate a proof given an index into the tree.
     ///
-    /// This routine probably will end up taking a tree state id as
-    /// an input so that verifiers don't need to keep a complete
-    /// copy of the tree.
-    ///
     /// # Arguments
     ///
     /// * `transaction_id`  - the transaction id for which a proof is required
     /// * `tree_version`    - the version of the tree for which the proof is wanted
+    #[inline(always)]
     pub fn generate_proof(&self, transaction_id: u64, version: u64) -> Result<Proof> {
-        if transaction_id >= self.entry_count {
-            return Err(eg!(format!(
-                "That transaction id ({}) does not exist.",
-                transaction_id
-            )));
-        }
-
-        if version != self.entry_count {
-            return Err(eg!("Versioning is not yet supported."));
-        }
-
-        // Generate a dictionary of all the blocks that
-        // would change or be added to make a complete
-        // Merkle tree.
-        let dictionary = self.generate_tree_completion();
-
-        let mut level = 0;
-        let mut hashes = Vec::new();
-        let mut id = transaction_id as usize;
-        let mut root;
-
-        // Loop through each level of the tree building
-        // the list of hashes.
-        loop {
-            root = self.append_proof_hashes(&mut hashes, level, id, &dictionary);
-
-            if level == dictionary.max_level() {
-                break;
-            }
-
-            // Now append the hash of the partner (sibling) for this block,
-            // if one exists, or the empty hash.
-            let block_id = id / LEAVES_IN_BLOCK;
-            self.push_partner_hash(&mut hashes, level, block_id, &dictionary);
-
-            level += 1;
-            id /= LEAVES_IN_BLOCK * 2;
-        }
-
-        let result = Proof {
-            version: PROOF_VERSION,
-            ledger: self.path.clone(),
-            state: self.entry_count,
-            time: Utc::now().timestamp(),
-            tx_id: transaction_id,
-            root_hash: root,
-            hash_array: hashes,
-        };
-
-        Ok(result)
+        ProofView::generate_proof(self, transaction_id, version)
     }
 
     /// Get a proof for the given transaction id from the underlying
@@ -1406,228 +1358,69 @@ impl AppendOnlyMerkle {
     /// * `transaction` - the Merkle tree id for the transaction
     /// * `state` - the Merkle tree state for which the proof is wanted,
     ///              or zero, for the current state.
+    #[inline(always)]
     pub fn get_proof(&self, transaction: u64, state: u64) -> Result<Proof> {
-        let proof_state = if state != 0 { state } else { self.total_size() };
-
-        if transaction >= proof_state {
-            return Err(eg!(format!(
-                "That id ({}) is not valid for state {}.",
-                transaction.commas(),
-                state
-            )));
-        }
-
-        if !self.validate_transaction_id(transaction) {
-            return Err(eg!(format!(
-                "That id ({}) is not valid.",
-                transaction.commas()
-            )));
-        }
-
-        self.generate_proof(transaction, proof_state)
-    }
-
-    // Append the hash of the partner of the current block, or
-    // the empty hash, if this block has no sibling in the tree.
-    fn push_partner_hash(
-        &self,
-        hashes: &mut Vec<HashValue>,
-        level: usize,
-        block_id: usize,
-        dictionary: &Dictionary,
-    ) {
-        let partner_id = block_id ^ 1;
-        let block_hash = self.find_block_root(dictionary, level, block_id);
-        let partner_hash = self.find_block_root(dictionary, level, partner_id);
-
-        // Compute the hash of the parent of the block.
-        // This is useful for debugging.
-        if 0 == partner_id & 1 {
-            hash_partial(&partner_hash, &block_hash)
-        } else {
-            hash_partial(&block_hash, &partner_hash)
-        };
-
-        hashes.push(partner_hash);
+        ProofView::get_proof(self, transaction, state)
     }
 
-    // Find the hash at the root of the given block. The
-    // block might be in the dictionary, or not.
+    /// Get the proofs for a batch of transaction ids,
+    /// the shared parts of the proofs are computed only once.
     #[inline(always)]
-    fn find_block_root(
-        &self,
-        dictionary: &Dictionary,
-        level: usize,
-        block_id: usize,
-    ) -> HashValue {
-        let empty_hash = HashValue::new();
-
-        match dictionary.get(level, block_id) {
-            Some(entry) => entry.root(),
-            None => {
-                if level >= self.blocks.len() || block_id >= self.blocks[level].len() {
-                    empty_hash
-                } else {
-                    let block = &self.blocks[level][block_id];
-                    block.root()
-                }
-            }
-        }
+    pub fn get_proofs(&self, transactions: &[u64], state: u64) -> Result<Vec<Proof>> {
+        ProofView::get_proofs(self, transactions, state)
     }
 
-    // The basic tree code only computes the upper tree elements
-    // when a block becomes full. When we produce a proof, we need
-    // to work on a "complete" tree. In a complete tree, nodes with
-    // only one child contain a hash of that child's value. This
-    // change from the working form of a tree ripples up to the root.
-    //
-    // The implementation of this modification is represented by a
-    // dictionary that holds an entry for each block modified (or
-    // created) by this rippling.
-    //
-    fn generate_tree_completion(&self) -> Dictionary {
-        let empty_hash = HashValue::new();
-
-        let mut dictionary = Dictionary::new();
-        let mut level = 0;
-        let mut carried_hash = HashValue::new();
-        let mut carried = false;
-        let mut solitary_block = false;
-
-        // Iterate over each level of the tree that's present
-        // in the working copy.
-        while level < self.blocks.len() {
-            let length = self.blocks[level].len();
-            let last_id = length - 1;
-            let last_block = &self.blocks[level][last_id];
-            let count = last_block.valid_leaves() as usize;
-
-            //
-            // We have three important cases to consider:
-            //   1) The current block is only partially full. Create
-            //      a dictionary entry for it. Append the carried
-            //      hash from the lower level to it. If we are at
-            //      level zero, the carried hash will be the empty
-            //      hash.
-            //   2) The block is full, but we have a valid carried
-            //      hash. Create a new entry and add it to the
-            //      directory.
-            //   3) There's no carried hash, the block is full, and
-            //      the length of the block list at this level is
-            //      odd. The carried hash becomes the hash of the
-            //      root of the last block in this chain.
-            //
-            if count != LEAVES_IN_BLOCK {
-                let mut entry = Entry::new(level, last_id);
-
-                entry.hashes[0..count].clone_from_slice(&last_block.hashes[0..count]);
-                entry.hashes[count] = carried_hash;
-                entry.fill();
-                carried_hash = entry.root();
-                carried = true;
-                dictionary.insert(level, entry);
-                solitary_block = length == 1;
-
-                // Compute the hash to carry upward. That is the
-                // hash of the root of this block and the root of
-                // its sibling, if it has a sibling. Otherwise,
-                // the carried hash is the hash of the root of this
-                // block and the empty hash.
-                if last_id & 1 == 0 {
-                    carried_hash = hash_partial(&carried_hash, &empty_hash);
-                } else {
-                    let left = self.blocks[level][last_id - 1].root();
-                    carried_hash = hash_partial(&left, &carried_hash);
-                }
-            } else if carried_hash != empty_hash {
-                let mut entry = Entry::new(level, length);
-                let new_block_id = length;
-
-                entry.hashes[0] = carried_hash;
-                entry.fill();
-                carried_hash = entry.root();
-                carried = true;
-                dictionary.insert(level, entry);
-                solitary_block = level > self.blocks.len();
+    /// Take a read-only view of the current version of the tree.
+    ///
+    /// Full blocks that have been written to disk are mapped instead of
+    /// being copied, so this is cheap enough to be done on every block.
+    /// The view can be used to generate proofs without holding any lock
+    /// on the tree, and it stays valid after the tree has grown.
+    /// Proofs for older states of the tree can be served from it too.
+    ///
+    /// The mapped files are never shrunk or rewritten in place, see
+    /// `swap_in_empty_file`, so a view stays readable after `reset_disk`.
+    pub fn snapshot(&self) -> Result<MerkleSnapshot> {
+        let mut levels = Vec::with_capacity(self.blocks.len());
+
+        for (level, blocks) in self.blocks.iter().enumerate() {
+            let mut mapped = blocks
+                .iter()
+                .take(self.blocks_on_disk[level] as usize)
+                .take_while(|b| b.full())
+                .count();
+
+            let map = if 0 < mapped {
+                let map = unsafe {
+                    MmapOptions::new()
+                        .len(mapped * BLOCK_SIZE)
+                        .map(&self.files[level])
+                        .c(d!())?
+                };
 
-                // Similarly to the previous case, compute the
-                // carried hash.
-                if new_block_id & 1 == 0 {
-                    carried_hash = hash_partial(&carried_hash, &empty_hash);
-                } else {
-                    let left = self.blocks[level][new_block_id - 1].root();
-                    carried_hash = hash_partial(&left, &carried_hash);
+                // The last block on disk might have been written
+                // before it became full, keep it in memory then.
+                if !block_in_map(&map, mapped - 1).full() {
+                    mapped -= 1;
                 }
-            } else if !carried && length % 2 == 1 {
-                carried = true;
-                carried_hash = hash_partial(&last_block.root(), &empty_hash);
-                solitary_block = false;
-            } else if !carried {
-                solitary_block = length == 1;
-            }
-
-            level += 1;
-        }
-
-        //
-        // Okay, we are at the top of the tree. We have a
-        // couple of cases:
-        //   1) The top of the tree is a solitary block.
-        //      We have nothing to do.
-        //   2) We have a carried hash. In this case, add
-        //      a new dictionary entry to form the top of the
-        //      tree.
-        //
-        if solitary_block {
-            // The top of the tree is a single block. There's nothing
-            // to do. The hash of the root of this block is the
-            // hash of the completed tree.
-        } else if carried_hash != empty_hash {
-            let mut entry = Entry::new(level, 0);
-            entry.hashes[0] = carried_hash;
-            entry.fill();
-            dictionary.insert(level, entry);
-        }
-
-        dictionary
-    }
 
-    //
-    // Append the hashes for a given level in the block
-    // structure. This amounts to adding the hierarchy
-    // for one block, excluding the root of the block
-    // itself. We either use a complete block from the
-    // working tree, or we use a fake block from the tree
-    // completion we generated.
-    //
-    // We return the root hash of the block since it might
-    // be the root of the tree, and it's easy to get it.
-    //
-    fn append_proof_hashes(
-        &self,
-        hashes: &mut Vec<HashValue>,
-        level: usize,
-        id: usize,
-        dictionary: &Dictionary,
-    ) -> HashValue {
-        let block_id = id / LEAVES_IN_BLOCK;
-        let block_index = id % LEAVES_IN_BLOCK;
-        let last = HASHES_IN_BLOCK - 1;
-        let block_root_hash;
+                Some(map)
+            } else {
+                None
+            };
 
-        match dictionary.get(level, block_id) {
-            Some(entry) => {
-                entry.push(hashes, block_index, &[]);
-                block_root_hash = entry.hashes[last];
-            }
-            None => {
-                let block = &self.blocks[level][id / LEAVES_IN_BLOCK];
-                block.push(hashes, block_index, &[]);
-                block_root_hash = block.hashes[last];
-            }
+            levels.push(LevelView {
+                map,
+                mapped,
+                tail: blocks[mapped..].to_vec(),
+            });
         }
 
-        block_root_hash
+        Ok(MerkleSnapshot {
+            entry_count: self.entry_count,
+            path: self.path.clone(),
+            levels: Arc::new(levels),
+        })
     }
 
     /// Compute the root hash of the Merkle tree.
@@ -1649,6 +1442,7 @@ impl AppendOnlyMerkle {
     }
 
     // Return the number of transaction entries in the tree.
+    #[cfg(test)]
     #[inline(always)]
     fn total_size(&self) -> u64 {
         self.entry_count
@@ -1662,7 +1456,25 @@ impl AppendOnlyMerkle {
 
     /// Save the tree to disk.
     /// At some point, flushes for transactional semantics might be important.
+    #[inline(always)]
     pub fn write(&mut self) -> Result<()> {
+        self.write_levels(true).c(d!())
+    }
+
+    /// Save the tree to disk without waiting for the storage, the caller
+    /// should sync the files returned by `try_clone_files` later.
+    #[inline(always)]
+    pub fn write_nosync(&mut self) -> Result<()> {
+        self.write_levels(false).c(d!())
+    }
+
+    /// Duplicate the handles of the files of all levels,
+    /// they can be used to sync the tree in another thread.
+    pub fn try_clone_files(&self) -> Result<Vec<File>> {
+        self.files.iter().map(|f| f.try_clone().c(d!())).collect()
+    }
+
+    fn write_levels(&mut self, sync: bool) -> Result<()> {
         let mut entries_at_this_level = self.entry_count;
 
         // Write each block level of the tree to its file.
@@ -1742,14 +1554,17 @@ impl AppendOnlyMerkle {
 
             // Sync the file to detect any errors and give us a better shot
             // at decent semantics.
-            let result = self.files[level].sync_all();
+            if sync {
+                let result = self.files[level].sync_all();
 
-            // If there's an I/O error, truncate the file to try to get rid
-            // of any possible bad blocks.
-            if let Err(x) = result {
-                let _ = self.files[level].set_len(0);
-                self.blocks_on_disk[level] = 0;
-                return Err(eg!(x));
+                // If there's an I/O error, start over with an empty file to
+                // try to get rid of any possible bad blocks.
+                if let Err(x) = result {
+                    if self.swap_in_empty_file(level).is_err() {
+                        self.blocks_on_disk[level] = 0;
+                    }
+                    return Err(eg!(x));
+                }
             }
 
             // Save the number of blocks we have written to disk and
@@ -1902,181 +1717,844 @@ impl AppendOnlyMerkle {
                 }
             }
         }
-    }
+    }
+
+    /// Check the in-memory version of the Merkle tree for consistency.
+    pub fn check(&self) -> Result<()> {
+        let mut leaves_at_this_level = self.entry_count;
+        let mut last_blocks = 0;
+        let mut last_block_full = true;
+
+        // Check each level.
+        for level in 0..self.blocks.len() {
+            let blocks_at_this_level =
+                covered(leaves_at_this_level, LEAVES_IN_BLOCK as u64) as usize;
+            let list_length = self.blocks[level].len();
+
+            if list_length != blocks_at_this_level {
+                return Err(eg!(format!(
+                    "check:  The expected block count ({}) at level {} \
+                    should be {}, last {}, full {}, entries {}",
+                    blocks_at_this_level,
+                    level,
+                    list_length,
+                    last_blocks,
+                    last_block_full,
+                    self.entry_count
+                )));
+            }
+
+            let mut leaf_count = 0;
+            last_block_full = true;
+
+            // Now check each block at this level.
+            for block_id in 0..blocks_at_this_level {
+                let last = block_id == blocks_at_this_level - 1;
+                let block = &self.blocks[level][block_id];
+                last_block_full = block.full();
+
+                if !last && !last_block_full {
+                    return Err(eg!(format!(
+                        "check:  Block {} at level {} should be full.",
+                        block_id, level
+                    )));
+                }
+
+                block.check(level, block_id as u64, false).c(d!())?;
+
+                // If we are above level zero, check the hashes in the block
+                // against the values in the lower level.
+                if level > 0 {
+                    let lower_index = block_id * LEAVES_IN_BLOCK * 2;
+                    let lower_list = &self.blocks[level - 1];
+
+                    self.check_lower(block, lower_list, lower_index).c(d!())?;
+                }
+
+                leaf_count += block.valid_leaves() as u64;
+            }
+
+            if leaf_count != leaves_at_this_level {
+                return Err(eg!(format!(
+                    "check:  The entry counts ({}, {}) at level {} did not match",
+                    leaf_count, leaves_at_this_level, level
+                )));
+            }
+
+            // Advance to the next level of the  tree. Compute the number
+            // of entries that we expect to be there.
+            last_blocks = blocks_at_this_level;
+            leaves_at_this_level =
+                next_level_leaves(last_blocks as u64, last_block_full);
+
+            // Check that there's an entry in the vector for the next level.
+            // If not, return an error.
+            let last_level = level == self.blocks.len() - 1;
+
+            if last_level && leaves_at_this_level > 0 {
+                return Err(eg!(format!(
+                    "Level {} has {} blocks, with {} upper leaves, \
+                    but no levels remain.",
+                    level, last_blocks, leaves_at_this_level
+                )));
+            }
+        }
+
+        Ok(())
+    }
+
+    // Check that a block contains the correct hashes based on the lower-level
+    // blocks.
+    fn check_lower(
+        &self,
+        block: &Block,
+        lower: &[Block],
+        start_block: usize,
+    ) -> Result<()> {
+        let mut block_index = start_block;
+
+        for i in 0..block.valid_leaves() as usize {
+            if block_index + 1 >= lower.len() {
+                return Err(eg!(format!(
+                    "Block {} at level {} has too many hashes:  {} vs {}.",
+                    block.id(),
+                    block.level(),
+                    block.valid_leaves(),
+                    lower.len()
+                )));
+            }
+
+            let left = match lower[block_index].top_hash() {
+                None => {
+                    return Err(eg!(format!(
+                        "The left lower hash at {}, level {} is missing.",
+                        block_index,
+                        block.level()
+                    )));
+                }
+                Some(x) => x,
+            };
+
+            let right = match lower[block_index + 1].top_hash() {
+                None => {
+                    return Err(eg!(format!(
+                        "The right lower hash at {}, level {} is missing.",
+                        block_index + 1,
+                        block.level()
+                    )));
+                }
+                Some(x) => x,
+            };
+
+            let hash = hash_pair(left, right);
+
+            if hash != block.hashes[i] {
+                return Err(eg!(format!(
+                    "hash[{}] for block {} at level {} didn't match.",
+                    i,
+                    block.id(),
+                    block.level()
+                )));
+            }
+
+            block_index += 2;
+        }
+
+        Ok(())
+    }
+
+    /// Reset the disk image to null.
+    ///
+    /// This action will cause the entire tree to be written to disk on
+    /// the next write call, which can be useful in the presence of errors.
+    /// For this reason, the code attempts to recreate all the files.
+    #[inline(always)]
+    pub fn reset_disk(&mut self) -> Result<()> {
+        for i in 0..self.files.len() {
+            self.blocks_on_disk[i] = 0;
+            self.swap_in_empty_file(i).c(d!())?;
+        }
+
+        Ok(())
+    }
+
+    // Replace the file of a level with an empty one.
+    //
+    // Snapshots might still map the current file, and shrinking it in
+    // place would make their readers fault (SIGBUS) on the cut pages.
+    // So the new file is created aside and renamed over the old path,
+    // the old one lives until the last mapping of it has been dropped.
+    fn swap_in_empty_file(&mut self, level: usize) -> Result<()> {
+        let path = self.file_path(level);
+        let new_path = path.clone() + ".swap";
+        let _ = fs::remove_file(&new_path);
+
+        let file = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(true)
+            .open(&new_path)
+            .c(d!())?;
+        fs::rename(&new_path, &path).c(d!())?;
+
+        self.files[level] = file;
+        self.blocks_on_disk[level] = 0;
+        Ok(())
+    }
+
+    /// Return the path for the tree as given to open.
+    #[inline(always)]
+    pub fn path(&self) -> String {
+        self.path.clone()
+    }
+}
+
+// The part of a tree that is needed to generate proofs, it is shared
+// by the working copy of the tree and its read-only snapshots.
+trait ProofView {
+    // Return the number of transaction entries in the tree.
+    fn entries(&self) -> u64;
+
+    // Return the path of the tree, which is recorded in proofs.
+    fn ledger(&self) -> String;
+
+    // Return the number of levels of the tree.
+    fn levels(&self) -> usize;
+
+    // Return the number of blocks at the given level.
+    fn blocks_at(&self, level: usize) -> usize;
+
+    // Return the block with the given id at the given level.
+    fn block(&self, level: usize, id: usize) -> &Block;
+
+    /// Generate a proof given an index into the tree.
+    ///
+    /// The version is the number of entries in the tree at the wanted
+    /// state, an older version is served from a `VersionView`.
+    ///
+    /// # Arguments
+    ///
+    /// * `transaction_id`  - the transaction id for which a proof is required
+    /// * `tree_version`    - the version of the tree for which the proof is wanted
+    fn generate_proof(&self, transaction_id: u64, version: u64) -> Result<Proof>
+    where
+        Self: Sized,
+    {
+        if transaction_id >= self.entries() {
+            return Err(eg!(format!(
+                "That transaction id ({}) does not exist.",
+                transaction_id
+            )));
+        }
+
+        if version != self.entries() {
+            return VersionView::new(self, version)
+                .c(d!())?
+                .generate_proof(transaction_id, version);
+        }
+
+        // Generate a dictionary of all the blocks that
+        // would change or be added to make a complete
+        // Merkle tree.
+        let dictionary = self.generate_tree_completion();
+
+        let mut hashes = Vec::new();
+        let root = self.append_path_hashes(
+            &mut hashes,
+            0,
+            transaction_id as usize,
+            &dictionary,
+        );
+
+        let result = Proof {
+            version: PROOF_VERSION,
+            ledger: self.ledger(),
+            state: self.entries(),
+            time: Utc::now().timestamp(),
+            tx_id: transaction_id,
+            root_hash: root,
+            hash_array: hashes,
+        };
+
+        Ok(result)
+    }
+
+    /// Get a proof for the given transaction id from the underlying
+    /// AppendOnlyMerkle object.
+    ///
+    /// # Arguments
+    ///
+    /// * `transaction` - the Merkle tree id for the transaction
+    /// * `state` - the Merkle tree state for which the proof is wanted,
+    ///              or zero, for the current state.
+    fn get_proof(&self, transaction: u64, state: u64) -> Result<Proof>
+    where
+        Self: Sized,
+    {
+        let proof_state = self.check_proof_state(transaction, state).c(d!())?;
+        self.generate_proof(transaction, proof_state)
+    }
+
+    /// Get the proofs for a batch of transaction ids. The tree
+    /// completion is generated only once, and the hashes above the
+    /// lowest level are shared by the transactions under the same
+    /// level-one node, so this is much cheaper than calling
+    /// `get_proof` for each transaction.
+    fn get_proofs(&self, transactions: &[u64], state: u64) -> Result<Vec<Proof>>
+    where
+        Self: Sized,
+    {
+        for transaction in transactions.iter() {
+            self.check_proof_state(*transaction, state).c(d!())?;
+        }
+
+        if state != 0 && state != self.entries() {
+            return VersionView::new(self, state)
+                .c(d!())?
+                .get_proofs(transactions, state);
+        }
+
+        let dictionary = self.generate_tree_completion();
+        let time = Utc::now().timestamp();
+        let mut upper_paths: HashMap<usize, (Vec<HashValue>, HashValue)> =
+            HashMap::new();
+
+        let proofs = transactions
+            .iter()
+            .map(|transaction| {
+                let id = *transaction as usize;
+                let mut hashes = Vec::new();
+                let mut root = self.append_proof_hashes(&mut hashes, 0, id, &dictionary);
+
+                if dictionary.max_level() != 0 {
+                    self.push_partner_hash(
+                        &mut hashes,
+                        0,
+                        id / LEAVES_IN_BLOCK,
+                        &dictionary,
+                    );
+
+                    let upper_id = id / (LEAVES_IN_BLOCK * 2);
+                    let (upper_hashes, upper_root) =
+                        upper_paths.entry(upper_id).or_insert_with(|| {
+                            let mut upper_hashes = Vec::new();
+                            let upper_root = self.append_path_hashes(
+                                &mut upper_hashes,
+                                1,
+                                upper_id,
+                                &dictionary,
+                            );
+                            (upper_hashes, upper_root)
+                        });
+
+                    hashes.extend_from_slice(upper_hashes);
+                    root = *upper_root;
+                }
+
+                Proof {
+                    version: PROOF_VERSION,
+                    ledger: self.ledger(),
+                    state: self.entries(),
+                    time,
+                    tx_id: *transaction,
+                    root_hash: root,
+                    hash_array: hashes,
+                }
+            })
+            .collect();
+
+        Ok(proofs)
+    }
+
+    // Check a transaction id against the wanted state of the tree,
+    // and return the actual state for the proof.
+    fn check_proof_state(&self, transaction: u64, state: u64) -> Result<u64> {
+        let proof_state = if state != 0 { state } else { self.entries() };
+
+        if transaction >= proof_state {
+            return Err(eg!(format!(
+                "That id ({}) is not valid for state {}.",
+                transaction.commas(),
+                state
+            )));
+        }
+
+        if transaction >= self.entries() {
+            return Err(eg!(format!(
+                "That id ({}) is not valid.",
+                transaction.commas()
+            )));
+        }
+
+        Ok(proof_state)
+    }
+
+    // Loop through each level of the tree from the given one,
+    // building the list of hashes, and return the root hash.
+    fn append_path_hashes(
+        &self,
+        hashes: &mut Vec<HashValue>,
+        mut level: usize,
+        mut id: usize,
+        dictionary: &Dictionary,
+    ) -> HashValue {
+        loop {
+            let root = self.append_proof_hashes(hashes, level, id, dictionary);
+
+            if level == dictionary.max_level() {
+                return root;
+            }
+
+            // Now append the hash of the partner (sibling) for this block,
+            // if one exists, or the empty hash.
+            let block_id = id / LEAVES_IN_BLOCK;
+            self.push_partner_hash(hashes, level, block_id, dictionary);
+
+            level += 1;
+            id /= LEAVES_IN_BLOCK * 2;
+        }
+    }
+
+    // Append the hash of the partner of the current block, or
+    // the empty hash, if this block has no sibling in the tree.
+    fn push_partner_hash(
+        &self,
+        hashes: &mut Vec<HashValue>,
+        level: usize,
+        block_id: usize,
+        dictionary: &Dictionary,
+    ) {
+        let partner_id = block_id ^ 1;
+        let block_hash = self.find_block_root(dictionary, level, block_id);
+        let partner_hash = self.find_block_root(dictionary, level, partner_id);
+
+        // Compute the hash of the parent of the block.
+        // This is useful for debugging.
+        if 0 == partner_id & 1 {
+            hash_partial(&partner_hash, &block_hash)
+        } else {
+            hash_partial(&block_hash, &partner_hash)
+        };
+
+        hashes.push(partner_hash);
+    }
+
+    // Find the hash at the root of the given block. The
+    // block might be in the dictionary, or not.
+    #[inline(always)]
+    fn find_block_root(
+        &self,
+        dictionary: &Dictionary,
+        level: usize,
+        block_id: usize,
+    ) -> HashValue {
+        let empty_hash = HashValue::new();
+
+        match dictionary.get(level, block_id) {
+            Some(entry) => entry.root(),
+            None => {
+                if level >= self.levels() || block_id >= self.blocks_at(level) {
+                    empty_hash
+                } else {
+                    let block = self.block(level, block_id);
+                    block.root()
+                }
+            }
+        }
+    }
+
+    // The basic tree code only computes the upper tree elements
+    // when a block becomes full. When we produce a proof, we need
+    // to work on a "complete" tree. In a complete tree, nodes with
+    // only one child contain a hash of that child's value. This
+    // change from the working form of a tree ripples up to the root.
+    //
+    // The implementation of this modification is represented by a
+    // dictionary that holds an entry for each block modified (or
+    // created) by this rippling.
+    //
+    fn generate_tree_completion(&self) -> Dictionary {
+        let empty_hash = HashValue::new();
+
+        let mut dictionary = Dictionary::new();
+        let mut level = 0;
+        let mut carried_hash = HashValue::new();
+        let mut carried = false;
+        let mut solitary_block = false;
+
+        // Iterate over each level of the tree that's present
+        // in the working copy.
+        while level < self.levels() {
+            let length = self.blocks_at(level);
+            let last_id = length - 1;
+            let last_block = self.block(level, last_id);
+            let count = last_block.valid_leaves() as usize;
+
+            //
+            // We have three important cases to consider:
+            //   1) The current block is only partially full. Create
+            //      a dictionary entry for it. Append the carried
+            //      hash from the lower level to it. If we are at
+            //      level zero, the carried hash will be the empty
+            //      hash.
+            //   2) The block is full, but we have a valid carried
+            //      hash. Create a new entry and add it to the
+            //      directory.
+            //   3) There's no carried hash, the block is full, and
+            //      the length of the block list at this level is
+            //      odd. The carried hash becomes the hash of the
+            //      root of the last block in this chain.
+            //
+            if count != LEAVES_IN_BLOCK {
+                let mut entry = Entry::new(level, last_id);
+
+                entry.hashes[0..count].clone_from_slice(&last_block.hashes[0..count]);
+                entry.hashes[count] = carried_hash;
+                entry.fill();
+                carried_hash = entry.root();
+                carried = true;
+                dictionary.insert(level, entry);
+                solitary_block = length == 1;
+
+                // Compute the hash to carry upward. That is the
+                // hash of the root of this block and the root of
+                // its sibling, if it has a sibling. Otherwise,
+                // the carried hash is the hash of the root of this
+                // block and the empty hash.
+                if last_id & 1 == 0 {
+                    carried_hash = hash_partial(&carried_hash, &empty_hash);
+                } else {
+                    let left = self.block(level, last_id - 1).root();
+                    carried_hash = hash_partial(&left, &carried_hash);
+                }
+            } else if carried_hash != empty_hash {
+                let mut entry = Entry::new(level, length);
+                let new_block_id = length;
+
+                entry.hashes[0] = carried_hash;
+                entry.fill();
+                carried_hash = entry.root();
+                carried = true;
+                dictionary.insert(level, entry);
+                solitary_block = level > self.levels();
+
+                // Similarly to the previous case, compute the
+                // carried hash.
+                if new_block_id & 1 == 0 {
+                    carried_hash = hash_partial(&carried_hash, &empty_hash);
+                } else {
+                    let left = self.block(level, new_block_id - 1).root();
+                    carried_hash = hash_partial(&left, &carried_hash);
+                }
+            } else if !carried && length % 2 == 1 {
+                carried = true;
+                carried_hash = hash_partial(&last_block.root(), &empty_hash);
+                solitary_block = false;
+            } else if !carried {
+                solitary_block = length == 1;
+            }
+
+            level += 1;
+        }
+
+        //
+        // Okay, we are at the top of the tree. We have a
+        // couple of cases:
+        //   1) The top of the tree is a solitary block.
+        //      We have nothing to do.
+        //   2) We have a carried hash. In this case, add
+        //      a new dictionary entry to form the top of the
+        //      tree.
+        //
+        if solitary_block {
+            // The top of the tree is a single block. There's nothing
+            // to do. The hash of the root of this block is the
+            // hash of the completed tree.
+        } else if carried_hash != empty_hash {
+            let mut entry = Entry::new(level, 0);
+            entry.hashes[0] = carried_hash;
+            entry.fill();
+            dictionary.insert(level, entry);
+        }
+
+        dictionary
+    }
+
+    //
+    // Append the hashes for a given level in the block
+    // structure. This amounts to adding the hierarchy
+    // for one block, excluding the root of the block
+    // itself. We either use a complete block from the
+    // working tree, or we use a fake block from the tree
+    // completion we generated.
+    //
+    // We return the root hash of the block since it might
+    // be the root of the tree, and it's easy to get it.
+    //
+    fn append_proof_hashes(
+        &self,
+        hashes: &mut Vec<HashValue>,
+        level: usize,
+        id: usize,
+        dictionary: &Dictionary,
+    ) -> HashValue {
+        let block_id = id / LEAVES_IN_BLOCK;
+        let block_index = id % LEAVES_IN_BLOCK;
+        let last = HASHES_IN_BLOCK - 1;
+        let block_root_hash;
+
+        match dictionary.get(level, block_id) {
+            Some(entry) => {
+                entry.push(hashes, block_index, &[]);
+                block_root_hash = entry.hashes[last];
+            }
+            None => {
+                let block = &self.block(level, id / LEAVES_IN_BLOCK);
+                block.push(hashes, block_index, &[]);
+                block_root_hash = block.hashes[last];
+            }
+        }
+
+        block_root_hash
+    }
+}
+
+impl ProofView for AppendOnlyMerkle {
+    #[inline(always)]
+    fn entries(&self) -> u64 {
+        self.entry_count
+    }
+
+    #[inline(always)]
+    fn ledger(&self) -> String {
+        self.path.clone()
+    }
+
+    #[inline(always)]
+    fn levels(&self) -> usize {
+        self.blocks.len()
+    }
+
+    #[inline(always)]
+    fn blocks_at(&self, level: usize) -> usize {
+        self.blocks[level].len()
+    }
+
+    #[inline(always)]
+    fn block(&self, level: usize, id: usize) -> &Block {
+        &self.blocks[level][id]
+    }
+}
+
+// A tree at an older version, which is the number of entries at that state.
+//
+// The tree is append-only, so every level at an older version is a prefix
+// of the current one, and only the last block of a level might have had
+// fewer leaves, such a block is rebuilt from the leaves of the current one.
+// Nothing is re-hashed here, the completion of the tree at that version is
+// generated from these blocks as usual.
+struct VersionView<'a> {
+    tree: &'a dyn ProofView,
+    entries: u64,
+    // the number of blocks at each level
+    blocks: Vec<usize>,
+    // the rebuilt last block of each level, if it differs from the current one
+    tails: Vec<Option<Block>>,
+}
+
+impl<'a> VersionView<'a> {
+    fn new(tree: &'a dyn ProofView, version: u64) -> Result<Self> {
+        if version == 0 || version > tree.entries() {
+            return Err(eg!(format!(
+                "The version {} is not valid, the tree has {} entries.",
+                version.commas(),
+                tree.entries().commas()
+            )));
+        }
 
-    /// Check the in-memory version of the Merkle tree for consistency.
-    pub fn check(&self) -> Result<()> {
-        let mut leaves_at_this_level = self.entry_count;
-        let mut last_blocks = 0;
-        let mut last_block_full = true;
+        let mut blocks = Vec::new();
+        let mut tails = Vec::new();
+        let mut leaves = version;
 
-        // Check each level.
-        for level in 0..self.blocks.len() {
-            let blocks_at_this_level =
-                covered(leaves_at_this_level, LEAVES_IN_BLOCK as u64) as usize;
-            let list_length = self.blocks[level].len();
+        while leaves > 0 {
+            let level = blocks.len();
+            let count = covered(leaves, LEAVES_IN_BLOCK as u64) as usize;
 
-            if list_length != blocks_at_this_level {
+            if level >= tree.levels() || count > tree.blocks_at(level) {
                 return Err(eg!(format!(
-                    "check:  The expected block count ({}) at level {} \
-                    should be {}, last {}, full {}, entries {}",
-                    blocks_at_this_level,
+                    "Level {} does not cover {} leaves.",
                     level,
-                    list_length,
-                    last_blocks,
-                    last_block_full,
-                    self.entry_count
+                    leaves.commas()
                 )));
             }
 
-            let mut leaf_count = 0;
-            last_block_full = true;
-
-            // Now check each block at this level.
-            for block_id in 0..blocks_at_this_level {
-                let last = block_id == blocks_at_this_level - 1;
-                let block = &self.blocks[level][block_id];
-                last_block_full = block.full();
+            let valid = leaves - (count as u64 - 1) * LEAVES_IN_BLOCK as u64;
+            let last = tree.block(level, count - 1);
 
-                if !last && !last_block_full {
-                    return Err(eg!(format!(
-                        "check:  Block {} at level {} should be full.",
-                        block_id, level
-                    )));
+            let tail = if valid == last.valid_leaves() {
+                None
+            } else {
+                let mut block = Block::new(level as u32, count as u64 - 1);
+                for hash in last.hashes[0..valid as usize].iter() {
+                    block.set_hash(hash).c(d!())?;
                 }
+                Some(block)
+            };
 
-                block.check(level, block_id as u64, false).c(d!())?;
-
-                // If we are above level zero, check the hashes in the block
-                // against the values in the lower level.
-                if level > 0 {
-                    let lower_index = block_id * LEAVES_IN_BLOCK * 2;
-                    let lower_list = &self.blocks[level - 1];
+            blocks.push(count);
+            tails.push(tail);
+            leaves = next_level_leaves(count as u64, valid == LEAVES_IN_BLOCK as u64);
+        }
 
-                    self.check_lower(block, lower_list, lower_index).c(d!())?;
-                }
+        Ok(VersionView {
+            tree,
+            entries: version,
+            blocks,
+            tails,
+        })
+    }
+}
 
-                leaf_count += block.valid_leaves() as u64;
-            }
+impl<'a> ProofView for VersionView<'a> {
+    #[inline(always)]
+    fn entries(&self) -> u64 {
+        self.entries
+    }
 
-            if leaf_count != leaves_at_this_level {
-                return Err(eg!(format!(
-                    "check:  The entry counts ({}, {}) at level {} did not match",
-                    leaf_count, leaves_at_this_level, level
-                )));
-            }
+    #[inline(always)]
+    fn ledger(&self) -> String {
+        self.tree.ledger()
+    }
 
-            // Advance to the next level of the  tree. Compute the number
-            // of entries that we expect to be there.
-            last_blocks = blocks_at_this_level;
-            leaves_at_this_level =
-                next_level_leaves(last_blocks as u64, last_block_full);
+    #[inline(always)]
+    fn levels(&self) -> usize {
+        self.blocks.len()
+    }
 
-            // Check that there's an entry in the vector for the next level.
-            // If not, return an error.
-            let last_level = level == self.blocks.len() - 1;
+    #[inline(always)]
+    fn blocks_at(&self, level: usize) -> usize {
+        self.blocks[level]
+    }
 
-            if last_level && leaves_at_this_level > 0 {
-                return Err(eg!(format!(
-                    "Level {} has {} blocks, with {} upper leaves, \
-                    but no levels remain.",
-                    level, last_blocks, leaves_at_this_level
-                )));
-            }
+    #[inline(always)]
+    fn block(&self, level: usize, id: usize) -> &Block {
+        match self.tails[level].as_ref() {
+            Some(tail) if id + 1 == self.blocks[level] => tail,
+            _ => self.tree.block(level, id),
         }
-
-        Ok(())
     }
+}
 
-    // Check that a block contains the correct hashes based on the lower-level
-    // blocks.
-    fn check_lower(
-        &self,
-        block: &Block,
-        lower: &[Block],
-        start_block: usize,
-    ) -> Result<()> {
-        let mut block_index = start_block;
+// Interpret the block with the given id in a mapped file.
+#[inline(always)]
+fn block_in_map(map: &Mmap, id: usize) -> &Block {
+    assert!((id + 1) * BLOCK_SIZE <= map.len());
 
-        for i in 0..block.valid_leaves() as usize {
-            if block_index + 1 >= lower.len() {
-                return Err(eg!(format!(
-                    "Block {} at level {} has too many hashes:  {} vs {}.",
-                    block.id(),
-                    block.level(),
-                    block.valid_leaves(),
-                    lower.len()
-                )));
-            }
+    // The mapping is page-aligned, and blocks are written
+    // to disk in their in-memory layout by `as_bytes`.
+    unsafe { &*(map.as_ptr().add(id * BLOCK_SIZE) as *const Block) }
+}
 
-            let left = match lower[block_index].top_hash() {
-                None => {
-                    return Err(eg!(format!(
-                        "The left lower hash at {}, level {} is missing.",
-                        block_index,
-                        block.level()
-                    )));
-                }
-                Some(x) => x,
-            };
+// One level of a snapshot.
+struct LevelView {
+    // full blocks on disk, they never change
+    map: Option<Mmap>,
+    mapped: usize,
+    // the rest blocks, copied from the working tree
+    tail: Vec<Block>,
+}
 
-            let right = match lower[block_index + 1].top_hash() {
-                None => {
-                    return Err(eg!(format!(
-                        "The right lower hash at {}, level {} is missing.",
-                        block_index + 1,
-                        block.level()
-                    )));
-                }
-                Some(x) => x,
-            };
+impl LevelView {
+    #[inline(always)]
+    fn len(&self) -> usize {
+        self.mapped + self.tail.len()
+    }
 
-            let hash = hash_pair(left, right);
+    #[inline(always)]
+    fn block(&self, id: usize) -> &Block {
+        match self.map.as_ref() {
+            Some(map) if id < self.mapped => block_in_map(map, id),
+            _ => &self.tail[id - self.mapped],
+        }
+    }
+}
 
-            if hash != block.hashes[i] {
-                return Err(eg!(format!(
-                    "hash[{}] for block {} at level {} didn't match.",
-                    i,
-                    block.id(),
-                    block.level()
-                )));
-            }
+/// A read-only view of an `AppendOnlyMerkle` at a fixed state,
+/// created by `AppendOnlyMerkle::snapshot`.
+///
+/// It is cheap to clone, and can be held by readers across blocks.
+#[derive(Clone)]
+pub struct MerkleSnapshot {
+    entry_count: u64,
+    path: String,
+    levels: Arc<Vec<LevelView>>,
+}
 
-            block_index += 2;
-        }
+impl MerkleSnapshot {
+    /// Get a proof for the given transaction id, `state` is zero
+    /// for the state of this snapshot, or any older state of the tree.
+    #[inline(always)]
+    pub fn get_proof(&self, transaction: u64, state: u64) -> Result<Proof> {
+        ProofView::get_proof(self, transaction, state)
+    }
 
-        Ok(())
+    /// Get the proofs for a batch of transaction ids, `state` is zero
+    /// for the state of this snapshot, or any older state of the tree.
+    #[inline(always)]
+    pub fn get_proofs(&self, transactions: &[u64], state: u64) -> Result<Vec<Proof>> {
+        ProofView::get_proofs(self, transactions, state)
     }
 
-    /// Reset the disk image to null.
-    ///
-    /// This action will cause the entire tree to be written to disk on
-    /// the next write call, which can be useful in the presence of errors.
-    /// For this reason, the code attempts to recreate all the files.
+    /// Compute the root hash of the tree at the state of this snapshot.
     #[inline(always)]
-    pub fn reset_disk(&mut self) -> Result<()> {
-        for i in 0..self.files.len() {
-            self.blocks_on_disk[i] = 0;
+    pub fn get_root_hash(&self) -> HashValue {
+        if self.entry_count == 0 {
+            return HashValue::default();
+        }
 
-            let path = self.file_path(i);
-            let _ = fs::remove_file(&path);
+        let proof = ProofView::generate_proof(self, 0, self.entry_count).unwrap();
+        proof.root_hash
+    }
 
-            self.files[i] = OpenOptions::new()
-                .read(true)
-                .write(true)
-                .create(true)
-                .open(path)
-                .c(d!())?;
-        }
+    /// Check that a transaction id is present in this snapshot.
+    #[inline(always)]
+    pub fn validate_transaction_id(&self, transaction_id: u64) -> bool {
+        transaction_id < self.entry_count
+    }
 
-        Ok(())
+    #[inline(always)]
+    #[allow(missing_docs)]
+    pub fn state(&self) -> u64 {
+        self.entry_count
     }
+}
 
-    /// Return the path for the tree as given to open.
+impl ProofView for MerkleSnapshot {
     #[inline(always)]
-    pub fn path(&self) -> String {
+    fn entries(&self) -> u64 {
+        self.entry_count
+    }
+
+    #[inline(always)]
+    fn ledger(&self) -> String {
         self.path.clone()
     }
+
+    #[inline(always)]
+    fn levels(&self) -> usize {
+        self.levels.len()
+    }
+
+    #[inline(always)]
+    fn blocks_at(&self, level: usize) -> usize {
+        self.levels[level].len()
+    }
+
+    #[inline(always)]
+    fn block(&self, level: usize, id: usize) -> &Block {
+        self.levels[level].block(id)
+    }
 }
 
 #[cfg(test)]
@@ -2085,7 +2563,7 @@ mod tests {
     use {
         super::*,
         byteorder::{LittleEndian, WriteBytesExt},
-        cryptohash::sha256,
+        cryptohash::{sha256, MultiProof},
         rand::{prelude::thread_rng, Rng},
     };
 
@@ -2895,6 +3373,164 @@ mod tests {
         let _ = fs::remove_file(&path);
     }
 
+    #[test]
+    fn test_snapshot() {
+        let path = "snapshot_tree".to_string();
+        let _ = fs::remove_file(&path);
+
+        let mut tree = pnk!(AppendOnlyMerkle::create(&path));
+
+        // Put some full blocks on disk, and leave some entries in memory.
+        for i in 0..(3 * LEAVES_IN_BLOCK + 5) as u64 {
+            test_append(&mut tree, i, false);
+        }
+        pnk!(tree.write());
+
+        let base = tree.total_size();
+        for i in 0..7 {
+            test_append(&mut tree, base + i, false);
+        }
+
+        let snapshot = pnk!(tree.snapshot());
+        let root = tree.get_root_hash();
+        assert_eq!(snapshot.state(), tree.total_size());
+        assert_eq!(snapshot.get_root_hash(), root);
+
+        for i in 0..tree.total_size() {
+            let expected = pnk!(tree.get_proof(i, 0));
+            let actual = pnk!(snapshot.get_proof(i, 0));
+            assert_eq!(expected.ledger, actual.ledger);
+            assert_eq!(expected.state, actual.state);
+            assert_eq!(expected.root_hash, actual.root_hash);
+            assert_eq!(expected.hash_array, actual.hash_array);
+        }
+
+        // The snapshot should not see the new entries.
+        let base = tree.total_size();
+        for i in 0..(LEAVES_IN_BLOCK + 3) as u64 {
+            test_append(&mut tree, base + i, false);
+        }
+        pnk!(tree.write());
+
+        assert_ne!(tree.get_root_hash(), root);
+        assert_eq!(snapshot.get_root_hash(), root);
+        assert!(!snapshot.validate_transaction_id(tree.total_size() - 1));
+        assert!(snapshot.get_proof(tree.total_size() - 1, 0).is_err());
+
+        // The mapped files are swapped out instead of being truncated,
+        // so the snapshot can still be read after the disk is reset.
+        let expected = pnk!(snapshot.get_proof(1, 0));
+        pnk!(tree.reset_disk());
+        pnk!(tree.write());
+        pnk!(tree.check_disk(true));
+        let actual = pnk!(snapshot.get_proof(1, 0));
+        assert_eq!(expected.root_hash, actual.root_hash);
+        assert_eq!(expected.hash_array, actual.hash_array);
+        assert_eq!(pnk!(tree.snapshot()).get_root_hash(), tree.get_root_hash());
+
+        let _ = fs::remove_file(&path);
+        for i in 1..MAX_BLOCK_LEVELS {
+            let _ = fs::remove_file(format!("{}.{}", path, i));
+        }
+    }
+
+    #[test]
+    fn test_historical_proofs() {
+        let path = "historical_proof_tree".to_string();
+        let _ = fs::remove_file(&path);
+
+        let mut tree = pnk!(AppendOnlyMerkle::create(&path));
+        let mut history = Vec::new();
+
+        // Record some proofs at each state, including the block boundaries.
+        for i in 0..(20 * LEAVES_IN_BLOCK + 7) as u64 {
+            test_append(&mut tree, i, false);
+            let state = tree.total_size();
+
+            if state % 37 == 1 || state % LEAVES_IN_BLOCK as u64 <= 1 {
+                let ids = [0, state / 2, state - 1];
+                let proofs = pnk!(tree.get_proofs(&ids, 0));
+                history.push((state, ids, proofs));
+            }
+
+            if state == (7 * LEAVES_IN_BLOCK) as u64 {
+                pnk!(tree.write());
+            }
+        }
+
+        let snapshot = pnk!(tree.snapshot());
+
+        for (state, ids, expected) in history.iter() {
+            let batch = pnk!(snapshot.get_proofs(ids, *state));
+
+            for ((id, expected), in_batch) in ids.iter().zip(expected).zip(batch) {
+                for actual in [
+                    pnk!(tree.get_proof(*id, *state)),
+                    pnk!(snapshot.get_proof(*id, *state)),
+                    in_batch,
+                ] {
+                    assert_eq!(actual.state, *state);
+                    assert_eq!(actual.tx_id, *id);
+                    assert_eq!(actual.root_hash, expected.root_hash);
+                    assert_eq!(actual.hash_array, expected.hash_array);
+                    assert!(actual.is_valid_proof(create_test_hash(*id, false)));
+                }
+            }
+
+            // The entry did not exist at that state.
+            assert!(tree.get_proof(*state, *state).is_err());
+        }
+
+        // A version in the future is not valid.
+        assert!(snapshot.get_proof(0, snapshot.state() + 1).is_err());
+
+        let _ = fs::remove_file(&path);
+        for i in 1..MAX_BLOCK_LEVELS {
+            let _ = fs::remove_file(format!("{}.{}", path, i));
+        }
+    }
+
+    #[test]
+    fn test_batch_proofs() {
+        let path = "batch_proof_tree".to_string();
+        let _ = fs::remove_file(&path);
+
+        let mut tree = pnk!(AppendOnlyMerkle::create(&path));
+
+        for i in 0..(5 * LEAVES_IN_BLOCK + 17) as u64 {
+            test_append(&mut tree, i, false);
+        }
+
+        let ids = (0..tree.total_size()).step_by(7).collect::<Vec<_>>();
+        let proofs = pnk!(tree.get_proofs(&ids, 0));
+        assert_eq!(proofs.len(), ids.len());
+
+        for (id, proof) in ids.iter().zip(proofs.iter()) {
+            let expected = pnk!(tree.get_proof(*id, 0));
+            assert_eq!(expected.root_hash, proof.root_hash);
+            assert_eq!(expected.hash_array, proof.hash_array);
+            check_proof(&tree, proof, *id);
+        }
+
+        let mp = pnk!(MultiProof::new(proofs.clone()));
+        assert!(mp.nodes.len() < proofs.iter().map(|p| p.hash_array.len()).sum());
+
+        for (i, id) in ids.iter().enumerate() {
+            let proof = pnk!(mp.proof(i));
+            assert_eq!(proof.tx_id, *id);
+            assert_eq!(proof.hash_array, proofs[i].hash_array);
+            assert!(mp.is_valid_proof(i, create_test_hash(*id, false)));
+            assert!(!mp.is_valid_proof(i, create_test_hash(*id + 1, false)));
+        }
+
+        assert!(tree.get_proofs(&[tree.total_size()], 0).is_err());
+
+        let _ = fs::remove_file(&path);
+        for i in 1..MAX_BLOCK_LEVELS {
+            let _ = fs::remove_file(format!("{}.{}", path, i));
+        }
+    }
+
     fn check_all_proofs(tree: &AppendOnlyMerkle) {
         for i in 0..tree.total_size() {
             match tree.generate_proof(i, tree.total_size()) {
@@ -2969,19 +3605,14 @@ mod tests {
         }
 
         //
-        // Generating a proof for a version other than the
-        // current version should fail.
+        // Generating a proof for an older version should work,
+        // and a proof for a version in the future should fail.
         //
-        match tree.generate_proof(0, tree.total_size() - 1) {
-            Err(e) => {
-                if !e.msg_has_overloop(eg!("Versioning is not yet supported.").as_ref())
-                {
-                    panic!("The error for an invalid generation was not valid.");
-                }
-            }
-            Ok(_x) => {
-                panic!("An invalid tree version passed.");
-            }
+        let proof = pnk!(tree.generate_proof(0, tree.total_size() - 1));
+        assert_eq!(proof.state, tree.total_size() - 1);
+
+        if let Ok(_x) = tree.generate_proof(0, tree.total_size() + 1) {
+            panic!("An invalid tree version passed.");
         }
 
         assert!(!tree.validate_transaction_id(tree.total_size()));
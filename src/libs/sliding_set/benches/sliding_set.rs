@@ -0,0 +1,132 @@
+//!
+//! # Microbenchmark of `SlidingSet`
+//!
+//! Compare the hashed slots with the previous `Vec`-only slots,
+//! under the access pattern of the ledger: every block checks and
+//! then inserts all of its no-replay tokens into the window.
+//!
+//! Run with `cargo bench -p sliding_set`.
+//!
+
+use {
+    rand::{thread_rng, Rng},
+    sliding_set::SlidingSet,
+    std::time::{Duration, Instant},
+};
+
+// Same with `TRANSACTION_WINDOW_WIDTH` of the ledger.
+const WIDTH: usize = 128;
+const BLOCKS: usize = 256;
+
+// The previous implementation, where every lookup is a linear scan.
+struct VecSlidingSet {
+    current: usize,
+    width: usize,
+    map: Vec<Vec<[u8; 8]>>,
+}
+
+impl VecSlidingSet {
+    fn new(width: usize) -> Self {
+        VecSlidingSet {
+            current: 0,
+            width,
+            map: vec![Vec::new(); width],
+        }
+    }
+
+    fn incr_current(&mut self) {
+        self.current += 1;
+        let current_index = self.current % self.width;
+        self.map[current_index].clear();
+    }
+
+    fn has_key_at(&self, index: usize, key: [u8; 8]) -> bool {
+        if index > self.current || index + self.width <= self.current {
+            false
+        } else {
+            self.map[index % self.width].contains(&key)
+        }
+    }
+
+    fn insert(&mut self, key: [u8; 8], index: usize) -> bool {
+        if index <= self.current
+            && index + self.width > self.current
+            && !self.map[index % self.width].contains(&key)
+        {
+            self.map[index % self.width].push(key);
+            true
+        } else {
+            false
+        }
+    }
+}
+
+// Tokens of all blocks, each of them is `(rand, seq_id)`.
+fn gen_tokens(per_block: usize) -> Vec<Vec<([u8; 8], usize)>> {
+    let mut rng = thread_rng();
+    (0..BLOCKS)
+        .map(|height| {
+            (0..per_block)
+                .map(|_| {
+                    // most tokens are fresh, some of them lag behind a little
+                    let lag = rng.gen_range(0, 4).min(height);
+                    (rng.gen(), height - lag)
+                })
+                .collect()
+        })
+        .collect()
+}
+
+fn run_hashed(blocks: &[Vec<([u8; 8], usize)>]) -> (Duration, usize) {
+    let mut ss = SlidingSet::<[u8; 8]>::new(WIDTH);
+    let mut hits = 0;
+    let start = Instant::now();
+    for tokens in blocks.iter() {
+        for (rand, seq_id) in tokens.iter() {
+            hits += ss.has_key_at(*seq_id, *rand) as usize;
+        }
+        for (rand, seq_id) in tokens.iter() {
+            hits += ss.insert(*rand, *seq_id).is_err() as usize;
+        }
+        ss.incr_current();
+    }
+    (start.elapsed(), hits)
+}
+
+fn run_vec(blocks: &[Vec<([u8; 8], usize)>]) -> (Duration, usize) {
+    let mut ss = VecSlidingSet::new(WIDTH);
+    let mut hits = 0;
+    let start = Instant::now();
+    for tokens in blocks.iter() {
+        for (rand, seq_id) in tokens.iter() {
+            hits += ss.has_key_at(*seq_id, *rand) as usize;
+        }
+        for (rand, seq_id) in tokens.iter() {
+            hits += !ss.insert(*rand, *seq_id) as usize;
+        }
+        ss.incr_current();
+    }
+    (start.elapsed(), hits)
+}
+
+fn main() {
+    println!(
+        "{:>10} {:>14} {:>14} {:>8}",
+        "txs/block", "vec (ms)", "hashed (ms)", "speedup"
+    );
+
+    for per_block in [100, 1000, 5000, 10000] {
+        let blocks = gen_tokens(per_block);
+        let (vec_time, vec_hits) = run_vec(&blocks);
+        let (hashed_time, hashed_hits) = run_hashed(&blocks);
+        assert_eq!(vec_hits, hashed_hits);
+
+        println!(
+            "{:>10} {:>14.3} {:>14.3} {:>7.1}x",
+            per_block,
+            vec_time.as_secs_f64() * 1000.0,
+            hashed_time.as_secs_f64() * 1000.0,
+            vec_time.as_secs_f64() / hashed_time.as_secs_f64()
+        );
+    }
+}
@@ -10,15 +10,23 @@
 
 use {
     ruc::*,
-    serde::{Deserialize, Serialize},
+    serde::{Deserialize, Deserializer, Serialize, Serializer},
+    std::{collections::HashSet, fmt::Debug, hash::Hash},
 };
 
 /// Define a sliding window
-#[derive(Clone, Default, Debug, Serialize, Deserialize, Eq, PartialEq)]
+///
+/// Every slot keeps its keys twice: in a `Vec`, which preserves
+/// the insertion order and is the serialized form, and in a
+/// `HashSet`, which makes the lookups O(1). Both of them are
+/// cleared, not dropped, when the slot is reused, so their
+/// capacities are kept across blocks.
+#[derive(Clone, Default, Debug)]
 pub struct SlidingSet<T> {
     current: usize,
     width: usize,
     map: Vec<Vec<T>>,
+    index: Vec<HashSet<T>>,
 }
 
 impl<T> SlidingSet<T> {
@@ -26,14 +34,17 @@ impl<T> SlidingSet<T> {
     #[inline(always)]
     pub fn new(width: usize) -> Self {
         let mut map = Vec::with_capacity(width as usize);
+        let mut index = Vec::with_capacity(width as usize);
         for _ in 0..width {
             map.push(Vec::new());
+            index.push(HashSet::new());
         }
         let current = 0;
         SlidingSet {
             current,
             width,
             map,
+            index,
         }
     }
 
@@ -44,17 +55,18 @@ impl<T> SlidingSet<T> {
         self.current += 1;
         let current_index = self.current % self.width;
         self.map[current_index].clear();
+        self.index[current_index].clear();
     }
 }
 
-impl<T: Eq + Copy + std::fmt::Debug> SlidingSet<T> {
+impl<T: Eq + Hash + Copy + Debug> SlidingSet<T> {
     /// Check if a key with user-defined-type exists at specified index in current window
     #[inline(always)]
     pub fn has_key_at(&self, index: usize, key: T) -> bool {
         if index > self.current || index + self.width <= self.current {
             false
         } else {
-            self.map[index % self.width].contains(&key)
+            self.index[index % self.width].contains(&key)
         }
     }
 
@@ -63,14 +75,14 @@ impl<T: Eq + Copy + std::fmt::Debug> SlidingSet<T> {
     #[inline(always)]
     pub fn insert(&mut self, key: T, index: usize) -> Result<()> {
         if index <= self.current && index + self.width >= (self.current + 1) {
-            if self.map[index % self.width].contains(&key) {
+            if self.index[index % self.width].insert(key) {
+                self.map[index % self.width].push(key);
+                Ok(())
+            } else {
                 Err(eg!(format!(
                     "SlidingSet::insert: ({:?}, {}) already in set",
                     key, index
                 )))
-            } else {
-                self.map[index % self.width].push(key);
-                Ok(())
             }
         } else {
             Err(eg!(format!("({:?}, {}) is out of range", key, index)))
@@ -78,6 +90,72 @@ impl<T: Eq + Copy + std::fmt::Debug> SlidingSet<T> {
     }
 }
 
+// The hashed index is derived from `map`, so it is left out of
+// the comparison and the serialized form, which stays the same as
+// the one of the Vec-only version.
+
+impl<T: PartialEq> PartialEq for SlidingSet<T> {
+    #[inline(always)]
+    fn eq(&self, other: &Self) -> bool {
+        self.current == other.current
+            && self.width == other.width
+            && self.map == other.map
+    }
+}
+
+impl<T: Eq> Eq for SlidingSet<T> {}
+
+#[derive(Serialize)]
+struct WindowRef<'a, T> {
+    current: usize,
+    width: usize,
+    map: &'a Vec<Vec<T>>,
+}
+
+#[derive(Deserialize)]
+struct Window<T> {
+    current: usize,
+    width: usize,
+    map: Vec<Vec<T>>,
+}
+
+impl<T: Serialize> Serialize for SlidingSet<T> {
+    fn serialize<S: Serializer>(
+        &self,
+        serializer: S,
+    ) -> std::result::Result<S::Ok, S::Error> {
+        WindowRef {
+            current: self.current,
+            width: self.width,
+            map: &self.map,
+        }
+        .serialize(serializer)
+    }
+}
+
+impl<'de, T> Deserialize<'de> for SlidingSet<T>
+where
+    T: Deserialize<'de> + Eq + Hash + Copy,
+{
+    fn deserialize<D: Deserializer<'de>>(
+        deserializer: D,
+    ) -> std::result::Result<Self, D::Error> {
+        Window::deserialize(deserializer).map(|w| {
+            let index = w
+                .map
+                .iter()
+                .map(|keys| keys.iter().copied().collect())
+                .collect();
+            SlidingSet {
+                current: w.current,
+                width: w.width,
+                map: w.map,
+                index,
+            }
+        })
+    }
+}
+
 #[cfg(test)]
 #[allow(missing_docs)]
 mod tests {
@@ -117,4 +195,29 @@ mod tests {
             assert!(ss.has_key_at((i + 1) * width - 1, digests[(i + 1) * width - 1]));
         }
     }
+
+    #[test]
+    fn test_serde() {
+        let width: usize = 4;
+        let mut ss = SlidingSet::<[u8; 8]>::new(width);
+        for i in 0..10_u8 {
+            pnk!(ss.insert([i; 8], i as usize / 3));
+            if 2 == i % 3 {
+                ss.incr_current();
+            }
+        }
+        assert!(ss.insert([9; 8], 3).is_err());
+
+        // same format with the Vec-only version
+        let json = pnk!(serde_json::to_string(&ss));
+        let value: serde_json::Value = pnk!(serde_json::from_str(&json));
+        assert_eq!(value["map"].as_array().map(|m| m.len()), Some(width));
+
+        let de: SlidingSet<[u8; 8]> = pnk!(serde_json::from_str(&json));
+        assert_eq!(de, ss);
+        (0..10_u8).for_each(|i| {
+            assert!(de.has_key_at(i as usize / 3, [i; 8]));
+        });
+        assert!(!de.has_key_at(1, [0; 8]));
+    }
 }